@@ -0,0 +1,114 @@
+// HostCore.cpp - Arduino core stubs and the virtual clock for the native
+// (host) builds
+#include "HostFakes.h"
+
+#include <chrono>
+#include <thread>
+
+#include <SPIFFS.h>
+#include <WiFi.h>
+
+HardwareSerial Serial;
+WiFiClass WiFi;
+SPIFFSFS SPIFFS;
+
+namespace HostFakes
+{
+    static time_t bootEpoch = 0;
+    static unsigned long virtualMillis = 0;
+    static bool realTime = false;
+    static unsigned long realStart = 0;
+
+    static unsigned long realMillis() {
+      using namespace std::chrono;
+      return (unsigned long)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    void setClock(time_t epochSeconds) {
+      bootEpoch = epochSeconds - millis() / 1000;
+    }
+
+    void advanceMillis(unsigned long ms) {
+      virtualMillis += ms;
+    }
+
+    void followRealTime() {
+      virtualMillis = millis();
+      realStart = realMillis();
+      realTime = true;
+    }
+
+    time_t epoch() {
+      return bootEpoch + millis() / 1000;
+    }
+}
+
+// ============================================================================
+// ARDUINO CORE
+// ============================================================================
+unsigned long millis() {
+  if (HostFakes::realTime)
+    return HostFakes::realMillis() - HostFakes::realStart + HostFakes::virtualMillis;
+  return HostFakes::virtualMillis;
+}
+
+unsigned long micros() {
+  // Real time, used for measurements only
+  using namespace std::chrono;
+  return (unsigned long)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void delay(unsigned long ms) {
+  if (HostFakes::realTime)
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  else
+    HostFakes::advanceMillis(ms);
+}
+
+void yield() {}
+
+// Fixed seed, so host runs repeat
+static uint32_t randomState = 1;
+long random(long howbig) {
+  if (howbig <= 0)
+    return 0;
+  randomState = randomState * 1103515245u + 12345u;
+  return (randomState >> 8) % howbig;
+}
+
+long random(long howsmall, long howbig) {
+  return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+
+bool getLocalTime(struct tm *info, uint32_t ms) {
+  time_t now = HostFakes::epoch();
+  return localtime_r(&now, info) != nullptr;
+}
+
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char *server1,
+                const char *server2, const char *server3) {}
+
+int HardwareSerial::printf(const char *format, ...) {
+  if (!enabled)
+    return 0;
+  va_list args;
+  va_start(args, format);
+  int written = vprintf(format, args);
+  va_end(args);
+  return written;
+}
+
+void HardwareSerial::print(const char *s) {
+  if (enabled)
+    fputs(s, stdout);
+}
+
+void HardwareSerial::println(const char *s) {
+  if (enabled)
+    puts(s);
+}
+
+void HardwareSerial::write(uint8_t c) {
+  if (enabled)
+    putchar(c);
+}
@@ -0,0 +1,115 @@
+// HostFakes.cpp - fake devices and the globals main.cpp would normally
+// define, for the native (host) builds. The Arduino core is in HostCore.cpp.
+#include "HostFakes.h"
+
+#include "GlobalVars.h"
+#include "SmartRuleSystem.h"
+
+// ============================================================================
+// GLOBALS (normally in main.cpp)
+// ============================================================================
+TimingControl timing;
+Config config;
+EnvironmentSensors sensors;
+HomeP1Device *p1Meter = nullptr;
+HomeSocketDevice *sockets[NUM_SOCKETS] = {nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+unsigned long lastStateChangeTime[NUM_SOCKETS] = {0, 0, 0, 0, 0, 0, 0, 0};
+bool switchForceOff[NUM_SOCKETS] = {false, false, false, false, false, false, false, false};
+SmartRuleSystem ruleSystem;
+TimeSync timeSync;
+NetworkCheck *phoneCheck = nullptr;
+
+namespace HostFakes
+{
+    World world;
+
+    void createDevices(int socketCount) {
+      for (int i = 0; i < socketCount && i < NUM_SOCKETS; i++) {
+        char ip[16];
+        snprintf(ip, sizeof(ip), "10.0.0.%d", 10 + i);
+        world.socketOnline[i] = true;
+        sockets[i] = new HomeSocketDevice(ip, i + 1);
+      }
+      p1Meter = new HomeP1Device("10.0.0.2");
+      phoneCheck = new NetworkCheck();
+      phoneCheck->addDevice("10.0.0.3");
+    }
+}
+
+// ============================================================================
+// FAKE DEVICES
+// ============================================================================
+HomeSocketDevice::HomeSocketDevice(const char *ip, int socketNum)
+    : baseUrl("http://" + String(ip)), lastKnownState(false), lastReadSuccess(true),
+      reachId(Reachability::NONE), deviceIP(ip), socketNumber(socketNum), lastLogTime(0) {}
+
+unsigned long HomeSocketDevice::retryIn() const { return health.retryIn(); }
+
+bool HomeSocketDevice::getState() {
+  int idx = socketNumber - 1;
+  if (!HostFakes::world.socketOnline[idx]) {
+    health.record(DeviceHealth::Outcome::Connect, 0);
+    return false;
+  }
+  health.record(DeviceHealth::Outcome::Ok, 0);
+  lastKnownState = HostFakes::world.socketOn[idx];
+  return true;
+}
+
+uint32_t HomeSocketDevice::setState(bool state) {
+  int idx = socketNumber - 1;
+  HostFakes::world.setStateCalls++;
+  if (!HostFakes::world.socketOnline[idx])
+    return 0;
+  HostFakes::world.socketOn[idx] = state;
+  lastKnownState = state;
+  return HostFakes::world.setStateCalls; // Command id
+}
+
+HomeP1Device::HomeP1Device(const char *ip)
+    : baseUrl("http://" + String(ip)), lastReadTime(0) {}
+
+void HomeP1Device::update() {
+  latest.write({HostFakes::world.importPower, HostFakes::world.exportPower, 0, 0});
+}
+
+float HomeP1Device::getCurrentImport() const { return latest.read().importPower; }
+float HomeP1Device::getCurrentExport() const { return latest.read().exportPower; }
+float HomeP1Device::getTotalImport() const { return latest.read().totalImport; }
+float HomeP1Device::getTotalExport() const { return latest.read().totalExport; }
+float HomeP1Device::getNetPower() const { return getCurrentImport() - getCurrentExport(); }
+bool HomeP1Device::isConnected() const { return true; }
+void WebSocketClient::close() {} // The fake meter never streams
+
+bool EnvironmentSensors::begin() {
+  update();
+  return true;
+}
+
+void EnvironmentSensors::update() {
+  bmeFound = HostFakes::world.hasBME280;
+  lightMeterFound = true;
+  temperature = HostFakes::world.temperature;
+  humidity = HostFakes::world.humidity;
+  pressure = HostFakes::world.pressure;
+  lightLevel = HostFakes::world.light;
+}
+
+float EnvironmentSensors::getTemperature() const { return temperature; }
+float EnvironmentSensors::getHumidity() const { return humidity; }
+float EnvironmentSensors::getPressure() const { return pressure; }
+float EnvironmentSensors::getLightLevel() const { return lightLevel; }
+bool EnvironmentSensors::hasBME280() const { return bmeFound; }
+bool EnvironmentSensors::hasBH1750() const { return lightMeterFound; }
+
+NetworkCheck::NetworkCheck() {}
+NetworkCheck::~NetworkCheck() {}
+
+bool NetworkCheck::addDevice(const char *ip) {
+  if (deviceCount >= MAX_DEVICES)
+    return false;
+  devices[deviceCount++].ip = ip;
+  return true;
+}
+
+bool NetworkCheck::isDevicePresent() { return HostFakes::world.phonePresent; }
@@ -0,0 +1,72 @@
+// HostFakes.h - virtual clock, fake devices and stand-in devices for the
+// native (host) builds. The clock lives in HostCore.cpp, the fake devices in
+// HostFakes.cpp; the stand-ins, which the real device code talks to over
+// sockets, in HostStandIn.cpp.
+#ifndef HOST_FAKES_H
+#define HOST_FAKES_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <ctime>
+#include <functional>
+#include "Constants.h"
+
+namespace HostFakes
+{
+    // Virtual clock: millis() and getLocalTime() both follow it
+    void setClock(time_t epochSeconds);
+    void advanceMillis(unsigned long ms);
+    time_t epoch();
+    // From now on millis() runs with the steady clock and delay() sleeps,
+    // for programs that talk to real sockets
+    void followRealTime();
+
+    // Inputs the fake devices report, set by the host program
+    struct World
+    {
+        float light = 0;
+        float temperature = 20;
+        float humidity = 50;
+        float pressure = 1013;
+        bool hasBME280 = true;
+        float importPower = 0;
+        float exportPower = 0;
+        bool phonePresent = false;
+        bool socketOn[NUM_SOCKETS] = {};
+        bool socketOnline[NUM_SOCKETS] = {};
+        unsigned long setStateCalls = 0;
+    };
+    extern World world;
+
+    // Creates the fake sockets, P1 meter and phone check globals
+    void createDevices(int socketCount);
+
+    // Accepts on ip:port and hands each connection to serve on a thread of
+    // its own, which closes it; false when the address is taken
+    bool listenOn(const char *ip, int port, std::function<void(int fd)> serve);
+    // One request off the connection, body included; false when the client
+    // closed it or went quiet past the socket's receive timeout
+    bool readRequest(int fd, char *request, size_t size);
+
+    // A HomeWizard socket on 127.0.0.1 (or ip) answering /api/v1/state,
+    // PUT switching it, or with p1 a P1 meter answering /api/v1/data.
+    // Connections stay open while the client asks for keep-alive; the
+    // modes can change while it runs
+    struct StandIn
+    {
+        const char *ip = "127.0.0.1";
+        int port = 0;
+        bool p1 = false;
+        bool refused = false;  // Nothing listening: connects are refused
+        int idleSeconds = 0;   // Closes a connection this long without requests, 0 never
+        std::atomic<unsigned long> latencyMs{0}; // Before each answer
+        std::atomic<bool> silent{false};         // Takes requests, never answers
+        std::atomic<bool> on{false};
+        std::atomic<unsigned long> requests{0};
+        std::atomic<unsigned long> puts{0};
+        std::atomic<unsigned long> lastPutAt{0}; // millis() of the last PUT
+    };
+    bool listenOn(StandIn &device);
+}
+
+#endif
@@ -0,0 +1,122 @@
+// HostStandIn.cpp - stand-in devices on real sockets, for the native (host)
+// programs that run the real device code; see StandIn in HostFakes.h.
+#include "HostFakes.h"
+
+#include <chrono>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char *P1_DATA =
+    "{\"wifi_ssid\":\"home\",\"wifi_strength\":78,\"smr_version\":50,\"meter_model\":\"ISKRA 2M550T-101\","
+    "\"unique_id\":\"4530303433303036333832333136343139\",\"active_tariff\":2,"
+    "\"total_power_import_kwh\":13779.338,\"total_power_import_t1_kwh\":10830.511,"
+    "\"total_power_import_t2_kwh\":2948.827,\"total_power_export_kwh\":1751.623,"
+    "\"total_power_export_t1_kwh\":1283.045,\"total_power_export_t2_kwh\":468.578,"
+    "\"active_power_w\":-543.000,\"active_power_l1_w\":-543.000,\"active_voltage_l1_v\":231.100,"
+    "\"active_current_a\":2.350,\"active_current_l1_a\":-2.350,\"voltage_sag_l1_count\":2.000,"
+    "\"voltage_swell_l1_count\":0.000,\"any_power_fail_count\":4.000,\"long_power_fail_count\":2.000,"
+    "\"total_gas_m3\":2569.646,\"gas_timestamp\":210606140010,\"gas_unique_id\":\"4730303339303031363532303530323136\","
+    "\"external\":[{\"unique_id\":\"4730303339303031363532303530323136\",\"type\":\"gas_meter\","
+    "\"timestamp\":210606140010,\"value\":2569.646,\"unit\":\"m3\"}]}";
+
+namespace HostFakes
+{
+    bool listenOn(const char *ip, int port, std::function<void(int fd)> serve) {
+      int listener = socket(AF_INET, SOCK_STREAM, 0);
+      int reuse = 1;
+      setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+      sockaddr_in addr = {};
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(port);
+      inet_aton(ip, &addr.sin_addr);
+      if (bind(listener, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 16) < 0) {
+        fprintf(stderr, "cannot listen on %s:%d\n", ip, port);
+        close(listener);
+        return false;
+      }
+      std::thread([listener, serve]() {
+        while (true) {
+          int fd = accept(listener, nullptr, nullptr);
+          if (fd >= 0)
+            std::thread(serve, fd).detach();
+        }
+      }).detach();
+      return true;
+    }
+
+    bool readRequest(int fd, char *request, size_t size) {
+      size_t received = 0;
+      while (received < size - 1) {
+        ssize_t n = recv(fd, request + received, size - 1 - received, 0);
+        if (n <= 0)
+          return false;
+        received += n;
+        request[received] = '\0';
+        const char *headerEnd = strstr(request, "\r\n\r\n");
+        if (!headerEnd)
+          continue;
+        const char *length = strcasestr(request, "Content-Length:");
+        size_t bodyLength = length ? strtoul(length + 15, nullptr, 10) : 0;
+        if (received >= (size_t)(headerEnd + 4 - request) + bodyLength)
+          return true;
+      }
+      return false;
+    }
+
+    // Answers requests until the client closes, asks to close, or stays
+    // quiet for idleSeconds
+    static void serveStandIn(StandIn *device, int fd) {
+      if (device->idleSeconds > 0) {
+        timeval idle = {device->idleSeconds, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+      }
+
+      char request[1024];
+      while (readRequest(fd, request, sizeof(request))) {
+        device->requests++;
+        if (device->silent) {
+          // Hold the connection open until the client gives up
+          char sink[64];
+          while (recv(fd, sink, sizeof(sink), 0) > 0) {
+          }
+          break;
+        }
+        if (device->latencyMs > 0)
+          std::this_thread::sleep_for(std::chrono::milliseconds(device->latencyMs.load()));
+
+        char body[1536];
+        if (device->p1) {
+          snprintf(body, sizeof(body), "%s", P1_DATA);
+        } else {
+          if (strncmp(request, "PUT", 3) == 0) {
+            device->on = strstr(request, "\"power_on\":true") != nullptr;
+            device->puts++;
+            device->lastPutAt = millis();
+          }
+          snprintf(body, sizeof(body), "{\"power_on\":%s,\"switch_lock\":false,\"brightness\":255}",
+                   device->on ? "true" : "false");
+        }
+        bool keepAlive = strcasestr(request, "Connection: close") == nullptr;
+        char answer[2048];
+        int length = snprintf(answer, sizeof(answer),
+                              "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %u\r\n"
+                              "Connection: %s\r\n\r\n%s",
+                              (unsigned)strlen(body), keepAlive ? "keep-alive" : "close", body);
+        send(fd, answer, length, MSG_NOSIGNAL);
+        if (!keepAlive)
+          break;
+      }
+      close(fd);
+    }
+
+    bool listenOn(StandIn &device) {
+      if (device.refused)
+        return true;
+      StandIn *served = &device;
+      return listenOn(device.ip, device.port, [served](int fd) { serveStandIn(served, fd); });
+    }
+}
@@ -0,0 +1,239 @@
+// bench_json - parse time and memory of the P1 /api/v1/data and socket
+// /api/v1/state answers: the old getString() + StaticJsonDocument<1536>
+// path, ArduinoJson with a filter, and the JsonFields scanner the devices
+// use now.
+//
+//   pio run -e native_bench_json && .pio/build/native_bench_json/program
+//
+// The payloads are answers recorded from HomeWizard devices (a single and
+// a three phase P1 meter, older P1 firmware, an energy socket), plus a
+// pretty printed one with the wanted keys repeated inside nested objects.
+// Every parser must read the recorded values; heap is the peak of live
+// allocations during one parse, stack the size of the documents it needs.
+#include <chrono>
+#include <new>
+
+#include <ArduinoJson.h>
+
+#include "JsonFields.h"
+
+// ============================================================================
+// HEAP ACCOUNTING
+// ============================================================================
+static size_t heapLive = 0;
+static size_t heapPeak = 0;
+
+void *operator new(size_t size) {
+  size_t *block = (size_t *)malloc(size + sizeof(size_t));
+  if (!block)
+    throw std::bad_alloc();
+  *block = size;
+  heapLive += size;
+  if (heapLive > heapPeak)
+    heapPeak = heapLive;
+  return block + 1;
+}
+
+void operator delete(void *ptr) noexcept {
+  if (!ptr)
+    return;
+  size_t *block = (size_t *)ptr - 1;
+  heapLive -= *block;
+  free(block);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  operator delete(ptr);
+}
+
+// ============================================================================
+// PAYLOADS
+// ============================================================================
+struct Payload
+{
+  const char *name;
+  bool isSocket;
+  const char *json;
+  float power; // active_power_w, or power_on for the socket
+  float totalImport;
+  float totalExport;
+};
+
+static const Payload payloads[] = {
+    {"P1 1-phase + gas", false,
+     "{\"wifi_ssid\":\"home\",\"wifi_strength\":78,\"smr_version\":50,\"meter_model\":\"ISKRA 2M550T-101\","
+     "\"unique_id\":\"4530303433303036333832333136343139\",\"active_tariff\":2,"
+     "\"total_power_import_kwh\":13779.338,\"total_power_import_t1_kwh\":10830.511,"
+     "\"total_power_import_t2_kwh\":2948.827,\"total_power_export_kwh\":1751.623,"
+     "\"total_power_export_t1_kwh\":1283.045,\"total_power_export_t2_kwh\":468.578,"
+     "\"active_power_w\":-543.000,\"active_power_l1_w\":-543.000,\"active_voltage_l1_v\":231.100,"
+     "\"active_current_a\":2.350,\"active_current_l1_a\":-2.350,\"voltage_sag_l1_count\":2.000,"
+     "\"voltage_swell_l1_count\":0.000,\"any_power_fail_count\":4.000,\"long_power_fail_count\":2.000,"
+     "\"total_gas_m3\":2569.646,\"gas_timestamp\":210606140010,\"gas_unique_id\":\"4730303339303031363532303530323136\","
+     "\"external\":[{\"unique_id\":\"4730303339303031363532303530323136\",\"type\":\"gas_meter\","
+     "\"timestamp\":210606140010,\"value\":2569.646,\"unit\":\"m3\"}]}",
+     -543.0f, 13779.338f, 1751.623f},
+    {"P1 3-phase", false,
+     "{\"wifi_ssid\":\"home\",\"wifi_strength\":64,\"smr_version\":50,\"meter_model\":\"Landis + Gyr E360\","
+     "\"unique_id\":\"4c4745303030303031323334353637\",\"active_tariff\":1,"
+     "\"total_power_import_kwh\":25514.083,\"total_power_import_t1_kwh\":14012.448,"
+     "\"total_power_import_t2_kwh\":11501.635,\"total_power_export_kwh\":8123.004,"
+     "\"total_power_export_t1_kwh\":3988.120,\"total_power_export_t2_kwh\":4134.884,"
+     "\"active_power_w\":1874.000,\"active_power_l1_w\":912.000,\"active_power_l2_w\":423.000,"
+     "\"active_power_l3_w\":539.000,\"active_voltage_l1_v\":229.800,\"active_voltage_l2_v\":231.400,"
+     "\"active_voltage_l3_v\":230.600,\"active_current_a\":8.210,\"active_current_l1_a\":3.970,"
+     "\"active_current_l2_a\":1.830,\"active_current_l3_a\":2.410,\"active_frequency_hz\":50.010,"
+     "\"voltage_sag_l1_count\":3,\"voltage_sag_l2_count\":3,\"voltage_sag_l3_count\":4,"
+     "\"voltage_swell_l1_count\":0,\"voltage_swell_l2_count\":0,\"voltage_swell_l3_count\":0,"
+     "\"any_power_fail_count\":7,\"long_power_fail_count\":2,\"active_power_average_w\":1620.000,"
+     "\"monthly_power_peak_w\":6420.000,\"monthly_power_peak_timestamp\":250114180015,"
+     "\"total_gas_m3\":4102.337,\"gas_timestamp\":250121101500,\"gas_unique_id\":\"4730303339303031363532303530323136\","
+     "\"external\":[{\"unique_id\":\"4730303339303031363532303530323136\",\"type\":\"gas_meter\","
+     "\"timestamp\":250121101500,\"value\":4102.337,\"unit\":\"m3\"},"
+     "{\"unique_id\":\"3853414731323334353637383930\",\"type\":\"water_meter\","
+     "\"timestamp\":250121101000,\"value\":612.218,\"unit\":\"m3\"}]}",
+     1874.0f, 25514.083f, 8123.004f},
+    {"P1 old firmware", false,
+     "{\"smr_version\":42,\"meter_model\":\"Kaifa MA105\",\"wifi_ssid\":\"home\",\"wifi_strength\":100,"
+     "\"total_power_import_t1_kwh\":3218.412,\"total_power_import_t2_kwh\":2987.009,"
+     "\"total_power_export_t1_kwh\":0,\"total_power_export_t2_kwh\":0,"
+     "\"active_power_w\":312,\"active_power_l1_w\":312,\"total_gas_m3\":1840.221,\"gas_timestamp\":190823140000,"
+     "\"total_power_import_kwh\":6205.421,\"total_power_export_kwh\":0}",
+     312.0f, 6205.421f, 0.0f},
+    {"P1 pretty, decoys", false,
+     "{\n  \"meter_model\": \"test \\\"quoted\\\" {brace}\",\n"
+     "  \"external\": [ { \"active_power_w\": 99, \"total_power_import_kwh\": 99 } ],\n"
+     "  \"nested\": { \"total_power_export_kwh\": 99, \"deeper\": { \"a\": [1, 2, {\"b\": \"]\"}] } },\n"
+     "  \"active_power_w\" : -1.5e3 ,\n"
+     "  \"total_power_import_kwh\" : 100.25,\n"
+     "  \"total_power_export_kwh\" : 50.5\n}",
+     -1500.0f, 100.25f, 50.5f},
+    {"socket state", true, "{\"power_on\":true,\"switch_lock\":false,\"brightness\":255}", 1.0f, 0, 0},
+};
+
+// ============================================================================
+// PARSERS
+// ============================================================================
+struct Values
+{
+  float power = 0;
+  float totalImport = 0;
+  float totalExport = 0;
+};
+
+// What HomeP1Device/HomeSocketDevice did before: the answer copied into a
+// String by getString(), then a full document
+static bool parseString(const Payload &p, Values &v) {
+  String payload(p.json);
+  if (p.isSocket) {
+    StaticJsonDocument<256> doc;
+    if (deserializeJson(doc, payload))
+      return false;
+    v.power = (doc["power_on"] | false) ? 1 : 0;
+    return true;
+  }
+  StaticJsonDocument<1536> doc;
+  if (deserializeJson(doc, payload))
+    return false;
+  v.power = doc["active_power_w"].as<float>();
+  v.totalImport = doc["total_power_import_kwh"].as<float>();
+  v.totalExport = doc["total_power_export_kwh"].as<float>();
+  return true;
+}
+
+// ArduinoJson on the buffer, with a filter that keeps the three fields
+static bool parseFiltered(const Payload &p, Values &v) {
+  size_t length = strlen(p.json);
+  if (p.isSocket) {
+    StaticJsonDocument<JSON_OBJECT_SIZE(1)> filter;
+    filter["power_on"] = true;
+    StaticJsonDocument<JSON_OBJECT_SIZE(1) + 16> doc; // Key copied from the input
+    if (deserializeJson(doc, p.json, length, DeserializationOption::Filter(filter)))
+      return false;
+    v.power = (doc["power_on"] | false) ? 1 : 0;
+    return true;
+  }
+  StaticJsonDocument<JSON_OBJECT_SIZE(3)> filter;
+  filter["active_power_w"] = true;
+  filter["total_power_import_kwh"] = true;
+  filter["total_power_export_kwh"] = true;
+  StaticJsonDocument<JSON_OBJECT_SIZE(3) + 80> doc;
+  if (deserializeJson(doc, p.json, length, DeserializationOption::Filter(filter)))
+    return false;
+  v.power = doc["active_power_w"].as<float>();
+  v.totalImport = doc["total_power_import_kwh"].as<float>();
+  v.totalExport = doc["total_power_export_kwh"].as<float>();
+  return true;
+}
+
+static bool parseFields(const Payload &p, Values &v) {
+  JsonFields fields;
+  if (p.isSocket) {
+    bool on = false;
+    fields.flag("power_on", on);
+    if (!fields.read(p.json, strlen(p.json)))
+      return false;
+    v.power = on ? 1 : 0;
+    return true;
+  }
+  fields.number("active_power_w", v.power)
+      .number("total_power_import_kwh", v.totalImport)
+      .number("total_power_export_kwh", v.totalExport);
+  return fields.read(p.json, strlen(p.json));
+}
+
+struct Parser
+{
+  const char *name;
+  bool (*parse)(const Payload &, Values &);
+  size_t stackP1; // Documents on the stack
+  size_t stackSocket;
+  bool inUse; // The devices' parser, must read every payload right
+};
+
+static const Parser parsers[] = {
+    {"String + doc", parseString, sizeof(StaticJsonDocument<1536>), sizeof(StaticJsonDocument<256>), false},
+    {"filtered doc", parseFiltered, sizeof(StaticJsonDocument<JSON_OBJECT_SIZE(3)>) + sizeof(StaticJsonDocument<JSON_OBJECT_SIZE(3) + 80>),
+     sizeof(StaticJsonDocument<JSON_OBJECT_SIZE(1)>) + sizeof(StaticJsonDocument<JSON_OBJECT_SIZE(1) + 16>), false},
+    {"JsonFields", parseFields, sizeof(JsonFields), sizeof(JsonFields), true},
+};
+
+static bool near(float a, float b) {
+  return fabsf(a - b) <= 0.001f * (1 + fabsf(b));
+}
+
+int main() {
+  const int ROUNDS = 20000;
+  int failures = 0;
+
+  printf("%-18s %-13s %6s %9s %8s %8s\n", "payload", "parser", "bytes", "ns/parse", "heap", "stack");
+  for (const Payload &payload : payloads) {
+    for (const Parser &parser : parsers) {
+      Values values;
+      heapPeak = heapLive;
+      size_t heapBefore = heapLive;
+      bool ok = parser.parse(payload, values);
+      size_t heap = heapPeak - heapBefore;
+
+      bool correct = ok && near(values.power, payload.power) && near(values.totalImport, payload.totalImport) &&
+                     near(values.totalExport, payload.totalExport);
+      if (!correct && parser.inUse)
+        failures++;
+
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < ROUNDS; i++) {
+        Values v;
+        parser.parse(payload, v);
+        asm volatile("" : : "r"(&v) : "memory");
+      }
+      double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ROUNDS;
+
+      printf("%-18s %-13s %6zu %9.0f %8zu %8zu%s\n", payload.name, parser.name, strlen(payload.json), ns, heap,
+             payload.isSocket ? parser.stackSocket : parser.stackP1, correct ? "" : ok ? "  wrong values" : "  failed");
+    }
+  }
+  // The old 1536 byte document can run out of room on the three phase
+  // payload (ArduinoJson copies the keys of a String input): "failed"
+  printf("\n%s\n", failures ? "JsonFields read wrong values" : "JsonFields read every recorded value");
+  return failures ? 1 : 0;
+}
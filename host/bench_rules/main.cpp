@@ -0,0 +1,316 @@
+// bench_rules - per-tick evaluation time and heap use of the compiled rule
+// programs against the std::function closure tree they replaced.
+//
+//   pio run -e native_bench && .pio/build/native_bench/program
+//
+// Both rule sets are the setupRules() rules, replayed over one simulated
+// week with one tick per second (the rate main.cpp calls update()).
+// A second pass registers setupRules() six times (60 rules) to show how
+// many evaluations the dependency tracking skips on a larger ruleset.
+//
+// The compiled heap is what getRulesetBytes() reports, and it is larger
+// than the closure tree's. Most of it is the rules vector's capacity times
+// sizeof(Rule), and each Rule carries the RULES_PROFILE counters. The state
+// slot pool is inside SmartRuleSystem itself, so it is not counted.
+#include <chrono>
+#include <functional>
+#include <new>
+#include <vector>
+
+#include "GlobalVars.h"
+#include "HostFakes.h"
+#include "SmartRuleSystem.h"
+
+// ============================================================================
+// HEAP ACCOUNTING
+// ============================================================================
+static size_t heapLive = 0;
+static size_t heapAllocations = 0;
+
+void *operator new(size_t size) {
+  size_t *block = (size_t *)malloc(size + sizeof(size_t));
+  if (!block)
+    throw std::bad_alloc();
+  *block = size;
+  heapLive += size;
+  heapAllocations++;
+  return block + 1;
+}
+
+void operator delete(void *ptr) noexcept {
+  if (!ptr)
+    return;
+  size_t *block = (size_t *)ptr - 1;
+  heapLive -= *block;
+  free(block);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  operator delete(ptr);
+}
+
+// ============================================================================
+// CLOSURE TREE BASELINE (the builders as they were before compilation)
+// ============================================================================
+namespace Legacy
+{
+    using Cond = std::function<bool()>;
+    using Action = std::function<RuleDecision()>;
+
+    struct Rule
+    {
+        int socketNumber;
+        Action evaluate;
+        const char *name;
+    };
+
+    static int minutesNow() {
+      TimeSync::TimeData t = timeSync.getTime();
+      return t.hour * 60 + t.minute;
+    }
+
+    static Cond lightBelow(float threshold) {
+      return [=]() { return sensors.getLightLevel() < threshold; };
+    }
+    static Cond lightAbove(float threshold) {
+      return [=]() { return sensors.getLightLevel() > threshold; };
+    }
+    static Cond isWorkday() {
+      return []() { return timeSync.isWorkday(); };
+    }
+    static Cond isWeekend() {
+      return []() { return timeSync.isWeekend(); };
+    }
+    static Cond phonePresent() {
+      return []() { return phoneCheck && phoneCheck->isDevicePresent(); };
+    }
+    static Cond phoneNotPresent() {
+      return []() { return phoneCheck && !phoneCheck->isDevicePresent(); };
+    }
+    static Cond allOf(std::vector<Cond> conditions) {
+      return [=]() {
+        for (const auto &cond : conditions) {
+          if (!cond())
+            return false;
+        }
+        return true;
+      };
+    }
+    static Cond after(const char *timeStr, int durationMins = 0) {
+      return [timeStr, durationMins]() {
+        int h, m;
+        sscanf(timeStr, "%d:%d", &h, &m);
+        int target = h * 60 + m;
+        int cur = minutesNow();
+        int end = target + durationMins;
+        if (end >= 1440)
+          end -= 1440;
+        if (durationMins == 0)
+          return cur >= target;
+        if (target <= end)
+          return cur >= target && cur < end;
+        return cur >= target || cur < end;
+      };
+    }
+    static Action period(const char *startTime, const char *endTime, Cond condition) {
+      return [=]() {
+        int sh, sm, eh, em;
+        sscanf(startTime, "%d:%d", &sh, &sm);
+        sscanf(endTime, "%d:%d", &eh, &em);
+        int cur = minutesNow();
+        int start = sh * 60 + sm;
+        int end = eh * 60 + em;
+        bool inRange = end < start ? (cur >= start || cur <= end) : (cur >= start && cur <= end);
+        if (!inRange)
+          return RuleDecision::Skip;
+        if (cur >= end - 2 && cur <= end)
+          return RuleDecision::Off;
+        return condition() ? RuleDecision::On : RuleDecision::Skip;
+      };
+    }
+    static Action offAfter(const char *timeStr, int durationMins, Cond condition = []() { return true; }) {
+      return [=]() {
+        bool isAfter = after(timeStr, durationMins)();
+        bool conditionMet = condition();
+        if (isAfter)
+          return conditionMet ? RuleDecision::Off : RuleDecision::Skip;
+        return RuleDecision::Skip;
+      };
+    }
+    static Action onCondition(Cond condition) {
+      return [condition]() { return condition() ? RuleDecision::On : RuleDecision::Skip; };
+    }
+    static Action offConditionDelayed(Cond condition, int delaySeconds) {
+      struct DelayState
+      {
+        unsigned long startTime = 0;
+        bool timing = false;
+      };
+      auto state = std::make_shared<DelayState>();
+      return [condition, delaySeconds, state]() {
+        if (condition()) {
+          if (!state->timing) {
+            state->startTime = millis();
+            state->timing = true;
+          }
+          if (millis() - state->startTime >= delaySeconds * 1000UL) {
+            state->timing = false;
+            return RuleDecision::Off;
+          }
+        } else {
+          state->timing = false;
+        }
+        return RuleDecision::Skip;
+      };
+    }
+    static Action solarHeater(float exportThreshold, float importThreshold,
+                              unsigned long minOnTime, unsigned long minOffTime, Cond extraCondition) {
+      auto deviceIsOn = std::make_shared<bool>(false);
+      auto lastChange = std::make_shared<unsigned long>(0);
+      return [=]() {
+        if (!timeSync.isTimeBetween("07:00", "19:00"))
+          return RuleDecision::Off;
+        unsigned long now = millis();
+        bool conditionMet = extraCondition();
+        if (*deviceIsOn) {
+          if ((!conditionMet || p1Meter->getCurrentImport() > importThreshold) && now - *lastChange >= minOnTime) {
+            *deviceIsOn = false;
+            *lastChange = now;
+            return RuleDecision::Off;
+          }
+          return RuleDecision::On;
+        }
+        if (conditionMet && p1Meter->getCurrentExport() > exportThreshold && now - *lastChange >= minOffTime) {
+          *deviceIsOn = true;
+          *lastChange = now;
+          return RuleDecision::On;
+        }
+        return RuleDecision::Off;
+      };
+    }
+
+    static std::vector<Rule> rules;
+
+    static void setupRules() {
+      static char eveningEndTime[6] = "23:11";
+      static char weekendEndTime[6] = "23:27";
+      static char nightOffTime[6] = "23:57";
+
+      rules.push_back({1, period("07:10", "07:44", allOf({lightBelow(5), isWorkday()})), "Good morning"});
+      rules.push_back({1, offAfter("07:45", 2, isWorkday()), "Leave for car"});
+      rules.push_back({1, period("17:15", eveningEndTime, allOf({lightBelow(5), isWorkday()})), "Evening"});
+      rules.push_back({1, offAfter(eveningEndTime, 2, isWorkday()), "Good night"});
+      rules.push_back({1, period("19:00", weekendEndTime, allOf({lightBelow(5), phoneNotPresent(), isWeekend()})), "Weekend"});
+      rules.push_back({1, offAfter(weekendEndTime, 2, isWeekend()), "Weekend night"});
+      rules.push_back({1, offAfter(nightOffTime, 5), "Night off"});
+      rules.push_back({3, solarHeater(1020, 5, 60000, 30000, phoneNotPresent()), "Solar Heater"});
+      rules.push_back({4, onCondition(allOf({phonePresent(), after("18:00"), lightAbove(11)})), "TV ambient on"});
+      rules.push_back({4, offConditionDelayed(lightBelow(5), 120), "TV ambient off"});
+    }
+
+    // Same evaluation loop as SmartRuleSystem::update() step 2
+    static RuleDecision decisions[NUM_SOCKETS];
+    static void evaluate() {
+      for (int i = 0; i < NUM_SOCKETS; i++)
+        decisions[i] = RuleDecision::Skip;
+      for (const auto &rule : rules) {
+        RuleDecision decision = rule.evaluate();
+        if (decision != RuleDecision::Skip)
+          decisions[rule.socketNumber - 1] = decision;
+      }
+    }
+}
+
+// ============================================================================
+// SIMULATED INPUTS
+// ============================================================================
+static void setInputs(int tick) {
+  int minuteOfDay = (tick / 60) % 1440;
+  // Dark outside 07:30-18:30 (lux), solar export around noon
+  HostFakes::world.light = (minuteOfDay > 450 && minuteOfDay < 1110) ? 400 : 2;
+  HostFakes::world.exportPower = (minuteOfDay > 600 && minuteOfDay < 900) ? 1500 : 0;
+  HostFakes::world.importPower = HostFakes::world.exportPower > 0 ? 0 : 300;
+  HostFakes::world.phonePresent = (minuteOfDay < 480 || minuteOfDay > 1080);
+  sensors.update();
+  p1Meter->update();
+}
+
+template <typename F>
+static double timeTicks(int ticks, time_t start, F evaluate) {
+  using namespace std::chrono;
+  double totalUs = 0;
+  HostFakes::setClock(start);
+  for (int tick = 0; tick < ticks; tick++) {
+    setInputs(tick);
+    auto t0 = steady_clock::now();
+    evaluate();
+    totalUs += duration_cast<nanoseconds>(steady_clock::now() - t0).count() / 1000.0;
+    HostFakes::advanceMillis(1000);
+  }
+  return totalUs;
+}
+
+int main() {
+  setenv("TZ", "CET-1CEST,M3.5.0/2,M10.5.0/3", 1);
+  tzset();
+  Serial.enabled = false;
+
+  HostFakes::createDevices(4);
+  HostFakes::setClock(1717365600); // Mon 3 June 2024 00:00 CEST
+
+  const int ticks = 7 * 24 * 3600; // One week, one tick per second
+  const time_t start = HostFakes::epoch();
+
+  size_t heapBefore = heapLive;
+  size_t allocationsBefore = heapAllocations;
+  setupRules();
+  size_t compiledHeap = heapLive - heapBefore;
+  size_t compiledBlocks = heapAllocations - allocationsBefore;
+
+  heapBefore = heapLive;
+  allocationsBefore = heapAllocations;
+  Legacy::setupRules();
+  size_t closureHeap = heapLive - heapBefore;
+  size_t closureBlocks = heapAllocations - allocationsBefore;
+
+  // update() also applies decisions to the fake sockets; the closure loop
+  // only evaluates, so the comparison is conservative for the compiled rules
+  double compiledUs = timeTicks(ticks, start, []() { ruleSystem.update(); });
+  unsigned long setStateCalls = HostFakes::world.setStateCalls;
+  unsigned long evaluated = ruleSystem.getRulesEvaluated();
+  unsigned long skipped = ruleSystem.getRulesSkipped();
+  unsigned long shortCircuited = ruleSystem.getRulesShortCircuited();
+  double closureUs = timeTicks(ticks, start, []() { Legacy::evaluate(); });
+
+#if RULES_PROFILE
+  printf("Per rule (profiler)\n%-16s %6s %10s %8s %8s %8s %6s %10s %8s\n", "", "socket", "evals", "on", "off",
+         "skip", "acts", "avg us", "max us");
+  for (size_t i = 0; i < ruleSystem.getRuleCount(); i++) {
+    const SmartRuleSystem::RuleStats &stats = ruleSystem.getRuleStats(i);
+    printf("%-16s %6d %10lu %8lu %8lu %8lu %6lu %10.3f %8lu\n", ruleSystem.getRuleName(i), ruleSystem.getRuleSocket(i),
+           stats.evaluations, stats.decisionsOn, stats.decisionsOff, stats.decisionsSkip, stats.actuations,
+           stats.evaluations ? (double)stats.totalMicros / stats.evaluations : 0.0, stats.maxMicros);
+  }
+  printf("update(): %lu passes, avg %.3f us, max %lu us\n\n", ruleSystem.getPassesTimed(),
+         (double)ruleSystem.getPassTotalMicros() / ruleSystem.getPassesTimed(), ruleSystem.getPassMaxMicros());
+#endif
+
+  ruleSystem.clearRules();
+  for (int i = 0; i < 6; i++)
+    setupRules();
+  double largeUs = timeTicks(ticks, start, []() { ruleSystem.update(); });
+  unsigned long largeEvaluated = ruleSystem.getRulesEvaluated() - evaluated;
+  unsigned long largeSkipped = ruleSystem.getRulesSkipped() - skipped;
+  unsigned long largeShortCircuited = ruleSystem.getRulesShortCircuited() - shortCircuited;
+
+  printf("Rule evaluation, %d ticks (1 simulated week)\n", ticks);
+  printf("%-16s %12s %14s %12s\n", "", "us/tick", "heap bytes", "setup allocs");
+  printf("%-16s %12.3f %14zu %12zu\n", "compiled", compiledUs / ticks, compiledHeap, compiledBlocks);
+  printf("%-16s %12.3f %14zu %12zu\n", "closure tree", closureUs / ticks, closureHeap, closureBlocks);
+  printf("socket setState calls: %lu\n", setStateCalls);
+  printf("\n%-16s %12s %14s %12s %16s\n", "", "us/tick", "evaluated", "skipped", "short-circuited");
+  printf("%-16s %12.3f %14lu %12lu %16lu\n", "10 rules", compiledUs / ticks, evaluated, skipped, shortCircuited);
+  printf("%-16s %12.3f %14lu %12lu %16lu\n", "60 rules", largeUs / ticks, largeEvaluated, largeSkipped,
+         largeShortCircuited);
+  return 0;
+}
@@ -0,0 +1,159 @@
+// history_delta - what the dashboard's history charts cost per minute: the
+// four /history/<tier> answers in full, against one /history?tier=all
+// answer with only the points added since the page's cursors, as JSON and
+// packed.
+//
+//   pio run -e native_history_delta && .pio/build/native_history_delta/program [days]
+//
+// PowerHistory gets [days] of minute, hour and day points like main.cpp
+// gives them. Every minute a page asks for what is new and merges it the way
+// index.html does (new points at the end, as many dropped at the front as
+// the ring holds fewer); it is compared with the whole tiers each time, to
+// the packed encoding's resolution. Reported: bytes per minute for each way,
+// the time to write an answer, and the mismatches, which must be 0.
+#include <chrono>
+#include <vector>
+
+#include "PowerHistory.h"
+#include "TimeSync.h"
+
+TimeSync timeSync;
+
+static const PowerHistory::Tier TIERS[] = {PowerHistory::Tier::Minute, PowerHistory::Tier::Hour,
+                                           PowerHistory::Tier::Day, PowerHistory::Tier::Month};
+
+// ============================================================================
+// PAGE, as index.html
+// ============================================================================
+struct Tier
+{
+  uint32_t next = 0;
+  std::vector<double> imports, exports;
+};
+
+static int16_t get16(const uint8_t *at) { return (int16_t)(at[0] | at[1] << 8); }
+static uint32_t get32(const uint8_t *at) { return at[0] | at[1] << 8 | at[2] << 16 | (uint32_t)at[3] << 24; }
+
+// One tier's part of a packed answer, returns the bytes it took
+static size_t merge(const uint8_t *at, Tier *tiers) {
+  const uint8_t *start = at;
+  Tier &tier = tiers[at[0]];
+  bool reset = at[1] & 1;
+  uint16_t count = (uint16_t)get16(at + 2);
+  tier.next = get32(at + 4);
+  uint16_t points = (uint16_t)get16(at + 8);
+  uint16_t scale = (uint16_t)get16(at + 10);
+  at += 12;
+  if (reset) {
+    tier.imports.clear();
+    tier.exports.clear();
+  }
+  for (std::vector<double> *series : {&tier.imports, &tier.exports}) {
+    long value = 0;
+    for (int i = 0; i < points; i++) {
+      int16_t difference = get16(at);
+      at += 2;
+      if (difference == -32768) {
+        value = (int32_t)get32(at);
+        at += 4;
+      } else {
+        value += difference;
+      }
+      series->push_back((double)value / scale);
+    }
+    if (series->size() > count)
+      series->erase(series->begin(), series->end() - count);
+  }
+  return at - start;
+}
+
+// What a writer hands out, appended to answer
+static PowerHistory::Sink into(std::vector<uint8_t> &answer) {
+  return [&answer](const uint8_t *piece, size_t length) { answer.insert(answer.end(), piece, piece + length); };
+}
+
+// The whole tier, from a full packed answer
+static Tier whole(PowerHistory::Tier tier) {
+  std::vector<uint8_t> answer;
+  Tier all[4];
+  powerHistory.writeBinary(tier, UINT32_MAX, into(answer));
+  merge(answer.data(), all);
+  return all[(int)tier];
+}
+
+// ============================================================================
+// RUN
+// ============================================================================
+int main(int argc, char **argv) {
+  int days = argc > 1 ? atoi(argv[1]) : 3;
+  Serial.enabled = false;
+
+  Tier page[4];
+  unsigned long fullBytes = 0, jsonBytes = 0, packedBytes = 0, minutes = 0, mismatches = 0;
+  double fullMicros = 0, jsonMicros = 0, packedMicros = 0;
+  std::vector<uint8_t> answer;
+  float hourImport = 0, hourExport = 0, dayImport = 0, dayExport = 0;
+
+  for (int minute = 0; minute < days * 1440; minute++) {
+    // A day's curve: base load, an evening peak, solar export at noon
+    int ofDay = minute % 1440;
+    float import = 250 + 1800 * (ofDay >= 1080 && ofDay < 1260) + (minute * 7919 % 97);
+    float exportW = ofDay >= 600 && ofDay < 960 ? 2400 + (minute * 104729 % 311) : 0;
+    powerHistory.updateMinute(import, exportW);
+    hourImport += import / 60;
+    hourExport += exportW / 60;
+    if (minute % 60 == 59) {
+      powerHistory.updateHour(hourImport, hourExport);
+      dayImport += hourImport / 1000;
+      dayExport += hourExport / 1000;
+      hourImport = hourExport = 0;
+    }
+    if (ofDay == 1439) {
+      powerHistory.updateDay(dayImport, dayExport);
+      dayImport = dayExport = 0;
+    }
+
+    // Before: every tier whole, as JSON
+    auto start = std::chrono::steady_clock::now();
+    answer.clear();
+    for (PowerHistory::Tier tier : TIERS)
+      powerHistory.writeJson(tier, UINT32_MAX, into(answer));
+    fullBytes += answer.size() + 4 * 2;
+    fullMicros += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    // After: what is new since the page's cursors, JSON and packed
+    start = std::chrono::steady_clock::now();
+    answer.clear();
+    for (PowerHistory::Tier tier : TIERS)
+      powerHistory.writeJson(tier, page[(int)tier].next, into(answer));
+    jsonMicros += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    jsonBytes += answer.size() + 20 + 4; // {"boot":"..."} and the separators
+
+    start = std::chrono::steady_clock::now();
+    answer.assign(8, 0);
+    for (PowerHistory::Tier tier : TIERS)
+      powerHistory.writeBinary(tier, page[(int)tier].next, into(answer));
+    packedMicros += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    packedBytes += answer.size();
+
+    for (size_t at = 8; at < answer.size();)
+      at += merge(answer.data() + at, page);
+    for (PowerHistory::Tier tier : TIERS) {
+      Tier expected = whole(tier);
+      const Tier &shown = page[(int)tier];
+      if (shown.imports != expected.imports || shown.exports != expected.exports)
+        mismatches++;
+    }
+    minutes++;
+  }
+
+  printf("%d days, the page asking every minute\n", days);
+  printf("  every tier whole, JSON : %6.0f bytes/min, %5.1f us to write\n", (double)fullBytes / minutes,
+         fullMicros / minutes);
+  printf("  since the cursors, JSON: %6.0f bytes/min, %5.1f us to write\n", (double)jsonBytes / minutes,
+         jsonMicros / minutes);
+  printf("  since the cursors, bin : %6.0f bytes/min, %5.1f us to write\n", (double)packedBytes / minutes,
+         packedMicros / minutes);
+  printf("  mismatches: %lu\n", mismatches);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,6 @@
+// Adafruit_BME280.h - host stand-in, EnvironmentSensors is faked on the host
+#pragma once
+
+class Adafruit_BME280
+{
+};
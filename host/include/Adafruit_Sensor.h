@@ -0,0 +1,2 @@
+// Adafruit_Sensor.h - host stand-in
+#pragma once
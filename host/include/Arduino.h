@@ -0,0 +1,110 @@
+// Arduino.h - minimal Arduino core stand-in for the native (host) builds.
+// Only what the rule engine and its dependencies use; never used on the ESP32.
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <string>
+
+#define PI 3.1415926535897932384626433832795
+
+using std::max;
+using std::min;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+long random(long howbig);
+long random(long howsmall, long howbig);
+
+// esp32-hal-time
+bool getLocalTime(struct tm *info, uint32_t ms = 5000);
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char *server1,
+                const char *server2 = nullptr, const char *server3 = nullptr);
+
+class String
+{
+public:
+    String(const char *s = "") : value(s ? s : "") {}
+    String(const std::string &s) : value(s) {}
+    String(int v) : value(std::to_string(v)) {}
+    String(unsigned int v) : value(std::to_string(v)) {}
+    String(long v) : value(std::to_string(v)) {}
+    String(unsigned long v) : value(std::to_string(v)) {}
+    String(float v, unsigned int decimals = 2)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+        value = buf;
+    }
+
+    const char *c_str() const { return value.c_str(); }
+    unsigned int length() const { return value.length(); }
+    bool operator==(const String &other) const { return value == other.value; }
+    bool operator!=(const String &other) const { return value != other.value; }
+    String &operator+=(const String &other)
+    {
+        value += other.value;
+        return *this;
+    }
+    String &operator+=(char c)
+    {
+        value += c;
+        return *this;
+    }
+    bool reserve(unsigned int size)
+    {
+        value.reserve(size);
+        return true;
+    }
+    bool concat(const char *s, unsigned int length)
+    {
+        value.append(s, length);
+        return true;
+    }
+    String substring(unsigned int from) const
+    {
+        return String(value.substr(from < value.size() ? from : value.size()));
+    }
+    friend String operator+(const String &a, const String &b) { return String(a.value + b.value); }
+
+    // ArduinoJson writes into any class with these two
+    size_t write(uint8_t c)
+    {
+        value += (char)c;
+        return 1;
+    }
+    size_t write(const uint8_t *buffer, size_t length)
+    {
+        value.append((const char *)buffer, length);
+        return length;
+    }
+
+private:
+    std::string value;
+};
+
+class HardwareSerial
+{
+public:
+    bool enabled = true; // Benchmarks switch logging off
+
+    void begin(unsigned long) {}
+    int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    void print(const char *s);
+    void print(const String &s) { print(s.c_str()); }
+    void println(const char *s = "");
+    void println(const String &s) { println(s.c_str()); }
+    void write(uint8_t c);
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,6 @@
+// BH1750.h - host stand-in, EnvironmentSensors is faked on the host
+#pragma once
+
+class BH1750
+{
+};
@@ -0,0 +1,8 @@
+// HTTPClient.h - host stand-in, the native builds use fake devices
+#pragma once
+
+#include <WiFiClient.h>
+
+class HTTPClient
+{
+};
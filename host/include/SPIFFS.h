@@ -0,0 +1,91 @@
+// SPIFFS.h - in-memory SPIFFS stand-in for the native (host) builds.
+// Files live in a map for the lifetime of the program; File implements
+// what ArduinoJson needs to read from and write to it.
+#pragma once
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+
+class File
+{
+public:
+    File() {}
+    File(std::string *data, bool append) : data(data), position(append ? data->size() : 0) {}
+
+    explicit operator bool() const { return data != nullptr; }
+
+    int available() const { return data ? (int)(data->size() - position) : 0; }
+    int peek() const { return available() ? (uint8_t)(*data)[position] : -1; }
+    int read() { return available() ? (uint8_t)(*data)[position++] : -1; }
+    size_t readBytes(char *buffer, size_t length)
+    {
+        size_t n = 0;
+        while (n < length && available())
+            buffer[n++] = (char)read();
+        return n;
+    }
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t length)
+    {
+        if (!data)
+            return 0;
+        data->replace(position, length, (const char *)buffer, length);
+        position += length;
+        return length;
+    }
+    size_t print(const String &s) { return write((const uint8_t *)s.c_str(), s.length()); }
+    size_t size() const { return data ? data->size() : 0; }
+    bool seek(size_t pos)
+    {
+        position = pos;
+        return data && pos <= data->size();
+    }
+    void close() { data = nullptr; }
+
+private:
+    std::string *data = nullptr;
+    size_t position = 0;
+};
+
+class SPIFFSFS
+{
+public:
+    bool begin(bool formatOnFail = false) { return true; }
+    File open(const char *path, const char *mode = "r")
+    {
+        if (mode[0] == 'r')
+        {
+            auto it = files.find(path);
+            return it == files.end() ? File() : File(&it->second, false);
+        }
+        std::string &data = files[path];
+        if (mode[0] == 'w')
+            data.clear();
+        return File(&data, true);
+    }
+    bool exists(const char *path) const { return files.count(path) != 0; }
+    bool remove(const char *path) { return files.erase(path) != 0; }
+    bool rename(const char *from, const char *to)
+    {
+        auto it = files.find(from);
+        if (it == files.end())
+            return false;
+        files[to] = it->second;
+        files.erase(from);
+        return true;
+    }
+    size_t totalBytes() const { return 1536 * 1024; }
+    size_t usedBytes() const
+    {
+        size_t used = 0;
+        for (const auto &file : files)
+            used += file.second.size();
+        return used;
+    }
+
+private:
+    std::map<std::string, std::string> files;
+};
+
+extern SPIFFSFS SPIFFS;
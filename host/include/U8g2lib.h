@@ -0,0 +1,13 @@
+// U8g2lib.h - host stand-in, only enough for DisplayManager.h to parse
+#pragma once
+
+#include <Arduino.h>
+
+#define U8G2_R0 nullptr
+#define U8X8_PIN_NONE 255
+
+class U8G2_SH1106_128X64_NONAME_F_HW_I2C
+{
+public:
+    U8G2_SH1106_128X64_NONAME_F_HW_I2C(const void *rotation, uint8_t reset) {}
+};
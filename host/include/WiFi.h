@@ -0,0 +1,37 @@
+// WiFi.h - host stand-in, always reports a connected station
+#pragma once
+
+#include <Arduino.h>
+
+typedef enum
+{
+    WL_IDLE_STATUS = 0,
+    WL_CONNECTED = 3,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+class IPAddress
+{
+public:
+    IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : octets{a, b, c, d} {}
+    uint8_t operator[](int index) const { return octets[index]; }
+    String toString() const
+    {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+        return String(buf);
+    }
+
+private:
+    uint8_t octets[4];
+};
+
+class WiFiClass
+{
+public:
+    wl_status_t status() const { return WL_CONNECTED; }
+    IPAddress localIP() const { return IPAddress(127, 0, 0, 1); }
+    String SSID() const { return String("host"); }
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,8 @@
+// WiFiClient.h - host stand-in, the native builds use fake devices
+#pragma once
+
+#include <WiFi.h>
+
+class WiFiClient
+{
+};
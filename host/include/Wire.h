@@ -0,0 +1,4 @@
+// Wire.h - host stand-in (no I2C on the native builds)
+#pragma once
+
+#include <Arduino.h>
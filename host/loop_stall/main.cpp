@@ -0,0 +1,192 @@
+// loop_stall - worst-case loop() stall of the real HomeSocketDevice and
+// HomeP1Device code on AsyncHttpClient, against stand-in devices on
+// 127.0.0.1.
+//
+//   pio run -e native_stall && .pio/build/native_stall/program [seconds]
+//
+// A P1 meter and 8 sockets answer the HomeWizard API on ports 18080-18088.
+// Sockets 1-4 answer at once, 5 answers after 300 ms, 6 accepts but never
+// answers (times out), 7 refuses the connection and 8 is a blackhole
+// address, like a socket unplugged from the wall. The loop pumps the client,
+// reads the P1 meter, asks every socket for its state twice a second (far
+// more than main.cpp does) and toggles a socket every second; each pass is
+// timed. With the blocking HTTPClient one offline socket stalled the loop
+// for its whole timeout.
+//
+// Before that, the online sockets are read back to back, once with a new
+// connection per request and once with keep-alive, for requests per second
+// and the most sockets open at once. The stand-ins keep a connection open
+// for KEEP_ALIVE_S without requests.
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "HomeP1Device.h"
+#include "HomeSocketDevice.h"
+#include "HostFakes.h"
+#include "PollScheduler.h"
+
+// ============================================================================
+// STAND-IN DEVICES
+// ============================================================================
+enum class Mode
+{
+  Online,
+  Slow,     // Answers after SLOW_MS
+  Silent,   // Accepts, never answers
+  Refused,  // Nothing listening
+  Blackhole // Unrouted address, connect never completes
+};
+
+static const unsigned long SLOW_MS = 300;
+static const int BASE_PORT = 18080; // P1, sockets on BASE_PORT + number
+static const int KEEP_ALIVE_S = 5;
+static const int THROUGHPUT_S = 3;
+
+// ============================================================================
+// THROUGHPUT
+// ============================================================================
+// Back to back state reads of the online sockets, a new one as soon as the
+// previous answer is in
+static void throughput(bool keepAlive, HomeSocketDevice **sockets, int count, int seconds) {
+  httpClient.runUntilIdle(3000);
+  httpClient.setKeepAlive(keepAlive);
+  httpClient.resetStats();
+
+  unsigned long end = millis() + seconds * 1000UL;
+  while (millis() < end) {
+    httpClient.poll();
+    for (int i = 0; i < count; i++)
+      sockets[i]->getState();
+  }
+  httpClient.runUntilIdle(3000);
+
+  const AsyncHttpClient::Stats &stats = httpClient.getStats();
+  printf("%-11s %8.0f %10lu %10lu %8u %8lu\n", keepAlive ? "keep-alive" : "close", stats.succeeded / (double)seconds,
+         stats.connectionsOpened, stats.connectionsReused, (unsigned)stats.maxOpenSockets, stats.leaksClosed);
+}
+
+// ============================================================================
+// LOOP
+// ============================================================================
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 20;
+  Serial.enabled = false;
+  HostFakes::followRealTime();
+
+  const Mode modes[NUM_SOCKETS] = {Mode::Online, Mode::Online, Mode::Online, Mode::Online,
+                                   Mode::Slow, Mode::Silent, Mode::Refused, Mode::Blackhole};
+  const char *modeNames[] = {"online", "slow", "silent", "refused", "blackhole"};
+
+  HostFakes::StandIn p1Device;
+  p1Device.port = BASE_PORT;
+  p1Device.p1 = true;
+  p1Device.idleSeconds = KEEP_ALIVE_S;
+  if (!HostFakes::listenOn(p1Device))
+    return 1;
+
+  HostFakes::StandIn socketDevices[NUM_SOCKETS];
+  HomeSocketDevice *sockets[NUM_SOCKETS];
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    HostFakes::StandIn &device = socketDevices[i];
+    device.port = BASE_PORT + i + 1;
+    device.idleSeconds = KEEP_ALIVE_S;
+    device.latencyMs = modes[i] == Mode::Slow ? SLOW_MS : 0;
+    device.silent = modes[i] == Mode::Silent;
+    device.refused = modes[i] == Mode::Refused || modes[i] == Mode::Blackhole;
+    if (!HostFakes::listenOn(device))
+      return 1;
+
+    // The devices prefix "http://", the port rides along with the address
+    char address[32];
+    if (modes[i] == Mode::Blackhole)
+      snprintf(address, sizeof(address), "10.255.255.1:%d", socketDevices[i].port);
+    else
+      snprintf(address, sizeof(address), "127.0.0.1:%d", socketDevices[i].port);
+    sockets[i] = new HomeSocketDevice(address, i + 1);
+    pollScheduler.add(sockets[i], i + 1, i * 250);
+  }
+  char p1Address[32];
+  snprintf(p1Address, sizeof(p1Address), "127.0.0.1:%d", BASE_PORT);
+  HomeP1Device p1Meter(p1Address);
+
+  // Sockets 1-4 are online
+  printf("state reads of 4 online sockets, %d s each\n", THROUGHPUT_S);
+  printf("%-11s %8s %10s %10s %8s %8s\n", "connection", "req/s", "opened", "reused", "max fds", "leaks");
+  throughput(false, sockets, 4, THROUGHPUT_S);
+  throughput(true, sockets, 4, THROUGHPUT_S);
+  httpClient.resetStats();
+  printf("\n");
+
+  std::vector<unsigned long> passMicros;
+  passMicros.reserve(1 << 20);
+  unsigned long lastStatePoll = 0;
+  int firstPolled = 0;
+  unsigned long lastToggle = 0;
+  unsigned long toggles = 0;
+  unsigned long togglesQueued = 0;
+  int toggleSocket = 0;
+
+  unsigned long end = millis() + seconds * 1000UL;
+  while (millis() < end) {
+    unsigned long start = micros();
+
+    httpClient.poll();
+    p1Meter.update();
+
+    unsigned long now = millis();
+    if (now - lastStatePoll >= 500) {
+      // More sockets than client slots: rotate who asks first
+      for (int i = 0; i < NUM_SOCKETS; i++)
+        sockets[(firstPolled + i) % NUM_SOCKETS]->getState();
+      firstPolled = (firstPolled + 1) % NUM_SOCKETS;
+      lastStatePoll = now;
+    }
+    pollScheduler.poll();
+    for (HomeSocketDevice *socket : sockets)
+      socket->dispatch();
+
+    // Halfway between two state polls, so the toggle competes with the
+    // offline sockets only
+    if (now - lastToggle >= 1000 && now - lastStatePoll >= 250) {
+      HomeSocketDevice *socket = sockets[toggleSocket];
+      toggles++;
+      togglesQueued += socket->setState(!socket->getCurrentState()) != 0;
+      toggleSocket = (toggleSocket + 1) % NUM_SOCKETS;
+      lastToggle = now;
+    }
+
+    passMicros.push_back(micros() - start);
+    std::this_thread::sleep_for(std::chrono::microseconds(200)); // Rest of loop()
+  }
+
+  std::vector<unsigned long> sorted = passMicros;
+  std::sort(sorted.begin(), sorted.end());
+  auto percentile = [&](double p) { return sorted[(size_t)(p * (sorted.size() - 1))]; };
+
+  printf("%zu loop passes in %d s\n", passMicros.size(), seconds);
+  printf("loop pass: p50 %lu us, p99 %lu us, p99.9 %lu us, max %lu us\n", percentile(0.50),
+         percentile(0.99), percentile(0.999), sorted.back());
+
+  const AsyncHttpClient::Stats &stats = httpClient.getStats();
+  printf("\nrequests: started %lu, succeeded %lu, failed %lu, timeouts %lu, rejected %lu (slots full), "
+         "max in flight %u of %u\n",
+         stats.started, stats.succeeded, stats.failed, stats.timeouts, stats.rejected,
+         (unsigned)stats.maxInFlight, (unsigned)AsyncHttpClient::MAX_REQUESTS);
+  printf("connections: opened %lu, reused %lu, stale retries %lu, leaks %lu, open %u, max open %u of %u\n",
+         stats.connectionsOpened, stats.connectionsReused, stats.staleRetries, stats.leaksClosed,
+         (unsigned)stats.openSockets, (unsigned)stats.maxOpenSockets, (unsigned)AsyncHttpClient::MAX_CONNECTIONS);
+  printf("setState: %lu toggles, %lu queued\n", toggles, togglesQueued);
+
+  printf("\n%-8s %-10s %10s %10s %6s\n", "device", "mode", "served", "connected", "state");
+  printf("%-8s %-10s %10lu %10s %6.0f\n", "P1", "online", p1Device.requests.load(),
+         p1Meter.isConnected() ? "yes" : "no", p1Meter.getNetPower());
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "socket %d", i + 1);
+    printf("%-8s %-10s %10lu %10s %6s\n", name, modeNames[(int)modes[i]], socketDevices[i].requests.load(),
+           sockets[i]->isConnected() ? "yes" : "no", sockets[i]->getCurrentState() ? "on" : "off");
+  }
+  return 0;
+}
@@ -0,0 +1,292 @@
+// p1_stream - pushed P1 measurements against polling, with the real
+// HomeP1Device, WebSocketClient and AsyncHttpClient code and a stand-in
+// meter on 127.0.0.1.
+//
+//   pio run -e native_p1_stream && .pio/build/native_p1_stream/program [seconds]
+//
+// The stand-in makes a new measurement every second. It answers
+// /api/v1/data like the HomeWizard v1 API and pushes every measurement on
+// /api/ws after an authorization and a subscribe, like the v2 websocket
+// (plain ws here, the real one is wss). Between SILENT_FROM and SILENT_TO it
+// keeps the websocket open but sends nothing, so the device falls back to
+// polling and later reconnects.
+//
+// The loop runs like main.cpp: updateStream() every pass, update() every
+// POLL_S (30 s in main.cpp, shorter here to see the fallback work). Every
+// 10 ms it records the age of the value the device reports. A
+// second thread reads the values all the time and checks that every read
+// comes from a single measurement.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HomeP1Device.h"
+#include "HostFakes.h"
+
+// ============================================================================
+// STAND-IN METER
+// ============================================================================
+static const int PORT = 18090;
+static const int POLL_S = 5;
+static const int SILENT_FROM = 8;
+static const int SILENT_TO = 16;
+static const char *TOKEN = "0123456789ABCDEF";
+
+static std::chrono::steady_clock::time_point startTime;
+static std::atomic<unsigned long> framesSent{0};
+static std::atomic<unsigned long> dataServed{0};
+static std::atomic<unsigned long> pongs{0};
+
+static double elapsedSeconds() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+// Measurement k, one per second from 1: every field follows from k, so a
+// reader can tell when it got fields of two measurements
+static int currentMeasurement() {
+  return (int)elapsedSeconds() + 1;
+}
+
+static bool silent() {
+  double t = elapsedSeconds();
+  return t >= SILENT_FROM && t < SILENT_TO;
+}
+
+static void sendFrame(int fd, uint8_t opcode, const char *payload) {
+  size_t length = strlen(payload);
+  uint8_t frame[512];
+  size_t header = 2;
+  frame[0] = 0x80 | opcode;
+  if (length < 126) {
+    frame[1] = length;
+  } else {
+    frame[1] = 126;
+    frame[2] = length >> 8;
+    frame[3] = length & 0xFF;
+    header = 4;
+  }
+  memcpy(frame + header, payload, length);
+  send(fd, frame, header + length, MSG_NOSIGNAL);
+}
+
+// Next masked client frame from buffer, 0 when none is complete yet
+static size_t takeFrame(uint8_t *buffer, size_t received, uint8_t &opcode, char *text, size_t size) {
+  if (received < 2)
+    return 0;
+  opcode = buffer[0] & 0x0F;
+  size_t length = buffer[1] & 0x7F;
+  size_t header = 2;
+  if (length == 126) {
+    if (received < 4)
+      return 0;
+    length = (buffer[2] << 8) | buffer[3];
+    header = 4;
+  }
+  const uint8_t *mask = buffer + header;
+  header += 4;
+  if (received < header + length)
+    return 0;
+  size_t copied = std::min(length, size - 1);
+  for (size_t i = 0; i < copied; i++)
+    text[i] = buffer[header + i] ^ mask[i & 3];
+  text[copied] = '\0';
+  return header + length;
+}
+
+static void serveWebSocket(int fd) {
+  const char *upgrade = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                        "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n\r\n";
+  send(fd, upgrade, strlen(upgrade), MSG_NOSIGNAL);
+  sendFrame(fd, 0x1, "{\"type\":\"authorization_requested\",\"data\":{\"api_version\":\"2.0.0\"}}");
+
+  bool authorized = false;
+  bool subscribed = false;
+  int lastSent = 0;
+  uint8_t buffer[1024];
+  size_t received = 0;
+  auto lastPing = std::chrono::steady_clock::now();
+
+  while (true) {
+    pollfd waitFor = {fd, POLLIN, 0};
+    if (::poll(&waitFor, 1, 20) > 0) {
+      ssize_t n = recv(fd, buffer + received, sizeof(buffer) - received, 0);
+      if (n <= 0)
+        break;
+      received += n;
+      uint8_t opcode;
+      char text[256];
+      size_t used;
+      while ((used = takeFrame(buffer, received, opcode, text, sizeof(text))) > 0) {
+        memmove(buffer, buffer + used, received - used);
+        received -= used;
+        if (opcode == 0x8) {
+          close(fd);
+          return;
+        }
+        if (opcode == 0xA) {
+          pongs++;
+          continue;
+        }
+        if (strstr(text, "\"authorization\"")) {
+          authorized = strstr(text, TOKEN) != nullptr;
+          sendFrame(fd, 0x1, authorized ? "{\"type\":\"authorized\"}" : "{\"type\":\"error\",\"data\":\"user:unauthorized\"}");
+        } else if (strstr(text, "\"subscribe\"") && strstr(text, "\"measurement\"")) {
+          subscribed = authorized;
+        }
+      }
+    }
+
+    // A ping now and then, the client has to answer it
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastPing > std::chrono::seconds(2)) {
+      sendFrame(fd, 0x9, "hi");
+      lastPing = now;
+    }
+
+    int k = currentMeasurement();
+    if (subscribed && !silent() && k != lastSent) {
+      char message[384];
+      snprintf(message, sizeof(message),
+               "{\"type\":\"measurement\",\"data\":{\"protocol_version\":50,\"meter_model\":\"ISKRA 2M550T-101\","
+               "\"tariff\":2,\"energy_import_kwh\":%d.000,\"energy_export_kwh\":%d.000,\"power_w\":%d,"
+               "\"power_l1_w\":%d,\"voltage_l1_v\":231.1,\"current_a\":2.35,\"timestamp\":\"2025-01-21T10:15:%02dZ\"}}",
+               1000 + k, 2000 + k, 10 * k, 10 * k, k % 60);
+      sendFrame(fd, 0x1, message);
+      framesSent++;
+      lastSent = k;
+    }
+  }
+  close(fd);
+}
+
+static void serveConnection(int fd) {
+  char request[1024];
+  if (!HostFakes::readRequest(fd, request, sizeof(request))) {
+    close(fd);
+    return;
+  }
+
+  if (strncmp(request, "GET /api/ws", 11) == 0 && strcasestr(request, "Upgrade: websocket")) {
+    serveWebSocket(fd);
+    return;
+  }
+
+  int k = currentMeasurement();
+  char body[512];
+  snprintf(body, sizeof(body),
+           "{\"smr_version\":50,\"meter_model\":\"ISKRA 2M550T-101\",\"total_power_import_kwh\":%d.000,"
+           "\"total_power_export_kwh\":%d.000,\"active_power_w\":%d.000,\"active_power_l1_w\":%d.000}",
+           1000 + k, 2000 + k, 10 * k, 10 * k);
+  char answer[1024];
+  int length = snprintf(answer, sizeof(answer),
+                        "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %u\r\n"
+                        "Connection: close\r\n\r\n%s",
+                        (unsigned)strlen(body), body);
+  send(fd, answer, length, MSG_NOSIGNAL);
+  dataServed++;
+  close(fd);
+}
+
+// ============================================================================
+// LOOP
+// ============================================================================
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 32;
+  Serial.enabled = false;
+  HostFakes::followRealTime();
+  startTime = std::chrono::steady_clock::now();
+  if (!HostFakes::listenOn("127.0.0.1", PORT, serveConnection))
+    return 1;
+
+  char address[32];
+  snprintf(address, sizeof(address), "127.0.0.1:%d", PORT);
+  HomeP1Device p1Meter(address);
+  char streamUrl[64];
+  snprintf(streamUrl, sizeof(streamUrl), "ws://127.0.0.1:%d/api/ws", PORT);
+  p1Meter.enableStream(streamUrl, TOKEN);
+
+  // Reader on another thread, like the web server task would be
+  std::atomic<bool> running{true};
+  std::atomic<unsigned long> reads{0};
+  std::atomic<unsigned long> torn{0};
+  std::thread reader([&]() {
+    while (running) {
+      P1Sample sample = p1Meter.getSample();
+      float k = sample.importPower / 10;
+      if (sample.importPower != 0 && (sample.totalImport != 1000 + k || sample.totalExport != 2000 + k))
+        torn++;
+      reads++;
+    }
+  });
+
+  // Age of the reported value: seconds since the meter made it, by how
+  // the device is getting its values
+  std::vector<double> streamAges, pollAges;
+  unsigned long lastAge = 0;
+  unsigned long lastPoll = 0;
+  int lastSecond = -1;
+  std::string timeline;
+
+  unsigned long end = millis() + seconds * 1000UL;
+  while (millis() < end) {
+    httpClient.poll();
+    p1Meter.updateStream();
+
+    unsigned long now = millis();
+    if (now - lastPoll >= POLL_S * 1000UL) {
+      p1Meter.update();
+      lastPoll = now;
+    }
+
+    int seen = (int)(p1Meter.getSample().importPower / 10);
+    if (seen > 0 && now - lastAge >= 10) {
+      (p1Meter.isStreaming() ? streamAges : pollAges).push_back(elapsedSeconds() - (seen - 1));
+      lastAge = now;
+    }
+
+    int second = (int)elapsedSeconds();
+    if (second != lastSecond) {
+      timeline += p1Meter.isStreaming() ? 'S' : silent() ? '-' : 'p';
+      lastSecond = second;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  running = false;
+  reader.join();
+
+  auto report = [](const char *name, std::vector<double> &ages) {
+    if (ages.empty()) {
+      printf("%-7s %8s\n", name, "-");
+      return;
+    }
+    std::sort(ages.begin(), ages.end());
+    printf("%-7s %8.0f %8.0f %8.0f\n", name, 1000 * ages[ages.size() / 2], 1000 * ages[ages.size() * 99 / 100],
+           1000 * ages.back());
+  };
+  printf("source per second (S stream, p polling, - polling while the stream is silent):\n%s\n\n",
+         timeline.c_str());
+  printf("age of the reported value\n%-7s %8s %8s %8s\n", "source", "p50 ms", "p99 ms", "max ms");
+  report("stream", streamAges);
+  report("poll", pollAges);
+  printf("\nframes pushed %lu, /api/v1/data answered %lu, pongs %lu\n", framesSent.load(), dataServed.load(),
+         pongs.load());
+  printf("%lu reads on the reader thread, %lu mixed two measurements\n", reads.load(), torn.load());
+
+  bool fellBack = timeline.find('-') != std::string::npos;
+  bool resumed = timeline.rfind('S') > timeline.find_last_of('-');
+  if (torn > 0 || streamAges.empty() || !fellBack || !resumed) {
+    printf("FAILED: %s\n", torn > 0 ? "torn reads" : streamAges.empty() ? "no pushed measurements"
+                                                     : !fellBack        ? "no fallback"
+                                                                        : "stream did not resume");
+    return 1;
+  }
+  return 0;
+}
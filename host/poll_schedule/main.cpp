@@ -0,0 +1,201 @@
+// poll_schedule - socket state refreshes with the poll scheduler against
+// the polling it replaced, with the real HomeSocketDevice, PollScheduler
+// and AsyncHttpClient code and stand-in sockets on 127.0.0.1.
+//
+//   pio run -e native_poll_schedule && .pio/build/native_poll_schedule/program [seconds]
+//
+// Time runs SCALE times faster than on the device: every interval of both
+// policies is divided by SCALE and every result multiplied back, so a run
+// of 60 s stands for 10 minutes. Sockets 1-6 are switched by hand every
+// 50-150 s (device time), 7 is offline and 8 is never touched.
+//
+// "before" repeats what readStateInfo() and loop() case 40 did: one socket
+// per 13 step cycle of 200 ms, a 15 s per socket gate, a 30 s read interval
+// plus a 1 s stagger per socket number, and 100 ms between any two reads.
+// "scheduler" is pollScheduler.poll() every loop pass. Reported: how old a
+// socket's state gets before it is read again (the scheduler's staleness),
+// how long a change by hand goes unseen, and reads per minute.
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "HomeSocketDevice.h"
+#include "HostFakes.h"
+#include "PollScheduler.h"
+
+static const unsigned long SCALE = 10;
+static const int BASE_PORT = 18100;
+static const int OFFLINE_SOCKET = 7;
+static const int UNTOUCHED_SOCKET = 8;
+static const unsigned long ANSWER_MS = 20; // Stand-in latency, not scaled
+
+// ============================================================================
+// BEFORE: readStateInfo() and loop() case 40, scaled
+// ============================================================================
+struct BeforePolling
+{
+  HomeSocketDevice **sockets;
+  unsigned long lastStep = 0;
+  unsigned long lastGlobalRequest = 0;
+  unsigned long lastSocketUpdates[NUM_SOCKETS] = {};
+  unsigned long lastReadTime[NUM_SOCKETS] = {};
+  int failures[NUM_SOCKETS] = {};
+  int currentSocketIndex = 0;
+
+  void readStateInfo(int i, unsigned long now) {
+    if (now - lastGlobalRequest < 100 / SCALE)
+      return;
+    int number = i + 1;
+    unsigned long since = now - lastReadTime[i];
+    if (sockets[i]->getHealth().getFailuresInRow() > 0) {
+      unsigned long backoff = std::min(failures[i] * 2000UL, 120000UL) + (number - 1) * 2000UL;
+      if (since < backoff / SCALE)
+        return;
+    } else if (since < (30000UL + (number - 1) * 1000UL) / SCALE) {
+      return;
+    }
+    failures[i] = sockets[i]->getHealth().getFailuresInRow() == 0 ? 0 : failures[i] + 1;
+    if (!sockets[i]->getState())
+      return;
+    lastGlobalRequest = now;
+    lastReadTime[i] = now;
+  }
+
+  void loop(unsigned long now) {
+    // case 40 comes round once per cycle of 13 steps of 200 ms
+    if (now - lastStep < 13 * 200 / SCALE)
+      return;
+    lastStep = now;
+    if (now - lastSocketUpdates[currentSocketIndex] >= 15000 / SCALE) {
+      readStateInfo(currentSocketIndex, now);
+      lastSocketUpdates[currentSocketIndex] = now;
+    }
+    currentSocketIndex = (currentSocketIndex + 1) % NUM_SOCKETS;
+  }
+};
+
+// ============================================================================
+// RUN
+// ============================================================================
+struct Result
+{
+  std::vector<double> unseen; // Seconds a change by hand went unnoticed
+  unsigned long missed = 0;   // Switched back before it was seen
+  unsigned long reads = 0;
+};
+
+static uint32_t randomState = 12345;
+static unsigned long randomBetween(unsigned long low, unsigned long high) {
+  randomState = randomState * 1103515245u + 12345u;
+  return low + (randomState >> 8) % (high - low);
+}
+
+static Result run(bool scheduled, HomeSocketDevice **sockets, HostFakes::StandIn *standIns, int seconds) {
+  Result result;
+  BeforePolling before;
+  before.sockets = sockets;
+
+  PollScheduler::Intervals intervals;
+  intervals.fast /= SCALE;
+  intervals.base /= SCALE;
+  intervals.max /= SCALE;
+  intervals.offlineStep /= SCALE;
+  pollScheduler.setIntervals(intervals);
+  pollScheduler.setBudget(4.0f * SCALE, 4);
+  for (int i = 0; i < NUM_SOCKETS; i++)
+    pollScheduler.add(sockets[i], i + 1, i * 250 / SCALE);
+  httpClient.resetStats();
+
+  unsigned long flipAt[NUM_SOCKETS];
+  unsigned long flipped[NUM_SOCKETS] = {}; // When the unseen change happened, 0 when none
+  unsigned long start = millis();
+  for (int i = 0; i < NUM_SOCKETS; i++)
+    flipAt[i] = start + randomBetween(50000, 150000) / SCALE;
+
+  while (millis() - start < seconds * 1000UL) {
+    httpClient.poll();
+    unsigned long now = millis();
+    if (scheduled)
+      pollScheduler.poll();
+    else
+      before.loop(now);
+
+    for (int i = 0; i < NUM_SOCKETS; i++) {
+      int number = i + 1;
+      if (number == OFFLINE_SOCKET || number == UNTOUCHED_SOCKET)
+        continue;
+      if (flipped[i] && sockets[i]->getCurrentState() == standIns[i].on) {
+        result.unseen.push_back((now - flipped[i]) * SCALE / 1000.0);
+        flipped[i] = 0;
+      }
+      if ((long)(now - flipAt[i]) >= 0) {
+        if (flipped[i])
+          result.missed++;
+        standIns[i].on = !standIns[i].on;
+        flipped[i] = flipped[i] ? 0 : now; // Switched back: nothing left to see
+        flipAt[i] = now + randomBetween(50000, 150000) / SCALE;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(500));
+  }
+  httpClient.runUntilIdle(3000);
+  result.reads = httpClient.getStats().started;
+  return result;
+}
+
+static void report(const char *name, Result &result, int seconds) {
+  double minutes = seconds * SCALE / 60.0;
+  printf("\n%s: %.0f reads per minute\n", name, result.reads / minutes);
+  printf("%-8s %8s %8s %8s %8s\n", "socket", "p50 s", "p90 s", "max s", "samples");
+  for (int number = 1; number <= NUM_SOCKETS; number++) {
+    PollScheduler::Staleness staleness = pollScheduler.getStaleness(number);
+    printf("%-8d %8.1f %8.1f %8.1f %8u%s\n", number, staleness.p50 * SCALE / 1000.0, staleness.p90 * SCALE / 1000.0,
+           staleness.max * SCALE / 1000.0, (unsigned)staleness.samples,
+           number == OFFLINE_SOCKET ? "  offline" : number == UNTOUCHED_SOCKET ? "  untouched" : "");
+  }
+  std::sort(result.unseen.begin(), result.unseen.end());
+  if (result.unseen.empty()) {
+    printf("changes by hand: none seen, %lu missed\n", result.missed);
+    return;
+  }
+  printf("changes by hand: %zu seen, unseen for p50 %.1f s, max %.1f s; %lu missed\n", result.unseen.size(),
+         result.unseen[result.unseen.size() / 2], result.unseen.back(), result.missed);
+}
+
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 60;
+  Serial.enabled = false;
+  HostFakes::followRealTime();
+
+  HostFakes::StandIn standIns[NUM_SOCKETS];
+  HomeSocketDevice *sockets[NUM_SOCKETS];
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    standIns[i].port = BASE_PORT + i + 1;
+    standIns[i].idleSeconds = 5;
+    standIns[i].latencyMs = ANSWER_MS;
+    standIns[i].refused = i + 1 == OFFLINE_SOCKET;
+    if (!HostFakes::listenOn(standIns[i]))
+      return 1;
+    char address[32];
+    snprintf(address, sizeof(address), "127.0.0.1:%d", standIns[i].port);
+    sockets[i] = new HomeSocketDevice(address, i + 1);
+    DeviceHealth::Policy breaker;
+    breaker.openMin /= SCALE;
+    breaker.openMax /= SCALE;
+    sockets[i]->getHealth().setPolicy(breaker);
+  }
+
+  printf("%d s per policy, %lu minutes on the device\n", seconds, seconds * SCALE / 60);
+  printf("staleness: how old a socket's state gets before it is read again\n");
+  Result before = run(false, sockets, standIns, seconds);
+  report("before", before, seconds);
+  pollScheduler.resetStats();
+  Result scheduled = run(true, sockets, standIns, seconds);
+  report("scheduler", scheduled, seconds);
+
+  const PollScheduler::Stats &stats = pollScheduler.getStats();
+  printf("scheduler: %lu reads, %lu waited for budget, %lu busy retries, %lu waited for a breaker, %lu expedited\n",
+         stats.reads, stats.budgetWaits, stats.busyRetries, stats.breakerWaits, stats.expedited);
+  return 0;
+}
@@ -0,0 +1,152 @@
+// presence - phone presence with NetworkCheck's non-blocking probes against
+// the blocking ping that isDevicePresent() used to send, with the real
+// NetworkCheck code and real ICMP. Needs root, or ping sockets allowed
+// (net.ipv4.ping_group_range).
+//
+//   pio run -e native_presence && .pio/build/native_presence/program
+//
+// Two devices are tracked: 127.0.0.1 answers, 198.51.100.1 (a documentation
+// address) never does. The timing is shortened (probe timeout 200 ms, away
+// after 4 s without a reply) so a run takes seconds. When the program may
+// write net.ipv4.icmp_echo_ignore_all, 127.0.0.1 stops answering twice: for
+// 2 s, which the hysteresis should ride out, and for 7 s, which should make
+// it away and back.
+//
+// "before" is what ESP32Ping's Ping.ping(ip, 1) did: one echo request,
+// then wait for the reply or 1 s. Reported: how long one call of each holds
+// up loop(), and when the changes were seen.
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HostFakes.h"
+#include "NetworkCheck.h"
+
+static const char *ANSWERS = "127.0.0.1";
+static const char *SILENT = "198.51.100.1";
+static const unsigned long SHORT_OUTAGE_AT = 3000, SHORT_OUTAGE_MS = 2000;
+static const unsigned long LONG_OUTAGE_AT = 8000, LONG_OUTAGE_MS = 7000;
+static const unsigned long RUN_MS = 19000;
+
+static bool ignoreEcho(bool ignore) {
+  FILE *file = fopen("/proc/sys/net/ipv4/icmp_echo_ignore_all", "w");
+  if (!file)
+    return false;
+  bool written = fputs(ignore ? "1" : "0", file) >= 0;
+  return fclose(file) == 0 && written;
+}
+
+// ============================================================================
+// BEFORE: one echo request, wait for the reply or 1 s
+// ============================================================================
+static unsigned long blockingPing(const char *ip) {
+  int fd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+  if (fd < 0)
+    fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP);
+  if (fd < 0)
+    return 0;
+  uint8_t packet[16] = {8, 0, 0, 0, 0x12, 0x34, 0, 1};
+  uint32_t sum = 0;
+  for (size_t i = 0; i < sizeof(packet); i += 2)
+    sum += (packet[i] << 8) | packet[i + 1];
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  packet[2] = ~sum >> 8;
+  packet[3] = ~sum & 0xFF;
+  sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  inet_aton(ip, &to.sin_addr);
+
+  unsigned long start = millis();
+  sendto(fd, packet, sizeof(packet), 0, (sockaddr *)&to, sizeof(to));
+  while (millis() - start < 1000) {
+    pollfd wait = {fd, POLLIN, 0};
+    if (::poll(&wait, 1, 1000 - (millis() - start)) <= 0)
+      break;
+    uint8_t buffer[96];
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    size_t offset = n > 0 && (buffer[0] >> 4) == 4 ? (buffer[0] & 0x0F) * 4 : 0;
+    if (n > (ssize_t)offset && buffer[offset] == 0)
+      break; // Echo reply
+  }
+  close(fd);
+  return millis() - start;
+}
+
+// ============================================================================
+// RUN
+// ============================================================================
+int main() {
+  HostFakes::followRealTime();
+
+  printf("before, one Ping.ping(ip, 1) in loop():\n");
+  printf("  %-14s %5lu ms\n", ANSWERS, blockingPing(ANSWERS));
+  printf("  %-14s %5lu ms\n", SILENT, blockingPing(SILENT));
+
+  NetworkCheck check;
+  NetworkCheck::Timing timing;
+  timing.probeTimeout = 200;
+  timing.presentInterval = 500;
+  timing.confirmInterval = 250;
+  timing.absentInterval = 500;
+  timing.awayAfter = 4000;
+  check.setTiming(timing);
+  check.addDevice(ANSWERS);
+  check.addDevice(SILENT);
+
+  bool outages = ignoreEcho(false);
+  printf("\nNetworkCheck, poll() every loop pass:\n");
+  if (!outages)
+    printf("  (cannot write icmp_echo_ignore_all: no outages)\n");
+
+  std::vector<unsigned long> pollMicros;
+  bool wasPresent[2] = {};
+  bool ignoring = false;
+  unsigned long start = millis();
+  while (millis() - start < RUN_MS) {
+    unsigned long at = millis() - start;
+    bool ignore = (at >= SHORT_OUTAGE_AT && at < SHORT_OUTAGE_AT + SHORT_OUTAGE_MS) ||
+                  (at >= LONG_OUTAGE_AT && at < LONG_OUTAGE_AT + LONG_OUTAGE_MS);
+    if (outages && ignore != ignoring) {
+      ignoreEcho(ignore);
+      ignoring = ignore;
+      printf("  %6.2f s  %s %s\n", at / 1000.0, ANSWERS, ignore ? "stops answering" : "answers again");
+    }
+
+    auto before = std::chrono::steady_clock::now();
+    check.poll();
+    pollMicros.push_back(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - before).count());
+
+    for (uint8_t i = 0; i < check.getDeviceCount(); i++) {
+      if (check.isDevicePresent(i) != wasPresent[i]) {
+        wasPresent[i] = check.isDevicePresent(i);
+        printf("  %6.2f s  %s %s\n", (millis() - start) / 1000.0, check.getDevice(i).ip.c_str(),
+               wasPresent[i] ? "present" : "away");
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  if (outages)
+    ignoreEcho(false);
+
+  std::sort(pollMicros.begin(), pollMicros.end());
+  printf("\npoll(): %zu calls, p50 %lu us, p99 %lu us, max %lu us\n", pollMicros.size(),
+         pollMicros[pollMicros.size() / 2], pollMicros[pollMicros.size() * 99 / 100], pollMicros.back());
+  const NetworkCheck::Stats &stats = check.getStats();
+  printf("probes %lu, replies %lu, timeouts %lu, ridden out %lu, stray %lu, send errors %lu\n", stats.probes,
+         stats.replies, stats.timeouts, stats.ridOut, icmpEcho.getStats().stray, stats.sendErrors);
+  for (uint8_t i = 0; i < check.getDeviceCount(); i++) {
+    const NetworkCheck::Device &device = check.getDevice(i);
+    printf("%-14s availability %3.0f%%, round trip p50 %lu ms\n", device.ip.c_str(),
+           device.health.availability() * 100, device.health.latencyPercentile(50));
+  }
+  return 0;
+}
@@ -0,0 +1,207 @@
+// replay_year - replays a whole year of the setupRules() rules minute by
+// minute against the virtual clock and fake devices, and writes the socket
+// on/off timeline as CSV.
+//
+//   pio run -e native_replay && .pio/build/native_replay/program [timeline.csv]
+//
+// The clock runs in CET/CEST, so both DST changes, the sunrise/sunset drift
+// and weekends are covered. Light, solar power and phone presence follow the
+// sun times the rule system computes, with a deterministic random cloud
+// cover per day and an away-from-home pattern. Like main.cpp the rules are
+// rebuilt at midnight and PowerHistory gets its minute/hour/day updates.
+// The printed checksum changes whenever the timeline does.
+#include <chrono>
+#include <vector>
+
+#include "GlobalVars.h"
+#include "HostFakes.h"
+#include "PowerHistory.h"
+#include "SmartRuleSystem.h"
+
+struct Transition
+{
+  time_t when;
+  uint8_t socket; // 1-based
+  bool on;
+  const char *rule;
+};
+
+struct Day
+{
+  int dayOfYear;
+  float clouds;        // 0 clear - 1 overcast
+  int leaveMinute;     // workdays: away from leaveMinute to homeMinute
+  int homeMinute;
+  bool eveningOut;     // away 19:30-23:30
+};
+
+static Day planDay(const tm &t) {
+  Day day;
+  day.dayOfYear = t.tm_yday;
+  day.clouds = (rand() % 101) / 100.0f;
+  day.leaveMinute = 8 * 60 + rand() % 20;
+  day.homeMinute = 17 * 60 + rand() % 60;
+  day.eveningOut = rand() % 7 == 0;
+  return day;
+}
+
+static bool phoneAtHome(const Day &day, const tm &t) {
+  int minute = t.tm_hour * 60 + t.tm_min;
+  bool weekend = t.tm_wday == 0 || t.tm_wday == 6;
+  if (!weekend && minute >= day.leaveMinute && minute < day.homeMinute)
+    return false;
+  if (t.tm_wday == 6 && minute >= 13 * 60 && minute < 16 * 60) // Saturday shopping
+    return false;
+  if (day.eveningOut && minute >= 19 * 60 + 30 && minute < 23 * 60 + 30)
+    return false;
+  return true;
+}
+
+// Sun based inputs: lux at the sensor and solar production in W
+static void weather(const Day &day, const tm &t) {
+  int minute = t.tm_hour * 60 + t.tm_min;
+  int sunrise = SmartRuleSystem::sunriseMinutes;
+  int sunset = SmartRuleSystem::sunsetMinutes;
+  float sun = 0;
+  if (sunset > sunrise && minute > sunrise && minute < sunset)
+    sun = sinf(PI * (minute - sunrise) / (sunset - sunrise));
+
+  float dim = 1.0f - 0.8f * day.clouds;
+  HostFakes::world.light = sun > 0 ? 3 + 800 * sun * dim : 1.5f; // street light at night
+
+  float season = 0.5f + 0.5f * cosf(2 * PI * (day.dayOfYear - 172) / 365.0f);
+  float production = 3200 * sun * (0.3f + 0.7f * season) * (1.0f - 0.7f * day.clouds);
+  float load = 250;
+  if (minute >= 17 * 60 + 30 && minute < 20 * 60)
+    load += 900; // cooking
+  for (int i = 0; i < NUM_SOCKETS; i++)
+    if (HostFakes::world.socketOn[i])
+      load += 100;
+  if (HostFakes::world.socketOn[2])
+    load += 900; // socket 3 drives the heater
+
+  float net = production - load;
+  HostFakes::world.exportPower = net > 0 ? net : 0;
+  HostFakes::world.importPower = net < 0 ? -net : 0;
+  HostFakes::world.temperature = 10 - 8 * cosf(2 * PI * (day.dayOfYear - 15) / 365.0f) + 4 * sun;
+}
+
+static long utcOffsetMinutes(const tm &t) {
+  return t.tm_gmtoff / 60;
+}
+
+int main(int argc, char **argv) {
+  const char *csvPath = argc > 1 ? argv[1] : "timeline.csv";
+  setenv("TZ", "CET-1CEST,M3.5.0/2,M10.5.0/3", 1);
+  tzset();
+  Serial.enabled = false;
+  srand(2025);
+
+  HostFakes::createDevices(4);
+  HostFakes::setClock(1735686000); // Wed 1 January 2025 00:00 CET
+  setupRules();
+
+  std::vector<Transition> timeline;
+  timeline.reserve(8192);
+  std::vector<time_t> dstChanges;
+  unsigned long onMinutes[NUM_SOCKETS] = {};
+  bool wasOn[NUM_SOCKETS] = {};
+
+  time_t now = HostFakes::epoch();
+  tm t;
+  localtime_r(&now, &t);
+  Day day = planDay(t);
+  long offset = utcOffsetMinutes(t);
+  int lastDay = t.tm_yday;
+
+  const long minutes = 365L * 1440;
+  auto start = std::chrono::steady_clock::now();
+
+  for (long m = 0; m < minutes; m++) {
+    now = HostFakes::epoch();
+    localtime_r(&now, &t);
+
+    if (t.tm_yday != lastDay) {
+      // main.cpp rebuilds the rules for fresh daily random times
+      ruleSystem.clearRules();
+      setupRules();
+      day = planDay(t);
+      lastDay = t.tm_yday;
+    }
+    if (utcOffsetMinutes(t) != offset) {
+      dstChanges.push_back(now);
+      offset = utcOffsetMinutes(t);
+    }
+
+    HostFakes::world.phonePresent = phoneAtHome(day, t);
+    weather(day, t);
+    sensors.update();
+    p1Meter->update();
+
+    ruleSystem.update();
+
+    if (powerHistory.shouldUpdateMinute())
+      powerHistory.updateMinute(p1Meter->getCurrentImport(), p1Meter->getCurrentExport());
+    if (powerHistory.shouldUpdateHour())
+      powerHistory.resetHourAccumulator();
+    if (powerHistory.shouldUpdateDay())
+      powerHistory.resetDayAccumulator();
+
+    for (int i = 0; i < NUM_SOCKETS; i++) {
+      bool on = HostFakes::world.socketOn[i];
+      if (on != wasOn[i]) {
+        timeline.push_back({now, (uint8_t)(i + 1), on, lastActiveRuleName});
+        wasOn[i] = on;
+      }
+      if (on)
+        onMinutes[i]++;
+    }
+
+    HostFakes::advanceMillis(60000);
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // Timeline as CSV, local time
+  FILE *csv = fopen(csvPath, "w");
+  uint32_t checksum = 2166136261u; // FNV-1a over the CSV lines
+  if (csv)
+    fprintf(csv, "time,socket,state,rule\n");
+  for (const auto &change : timeline) {
+    char line[96];
+    char when[20];
+    tm local;
+    localtime_r(&change.when, &local);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &local);
+    int length = snprintf(line, sizeof(line), "%s,%d,%s,%s\n", when, change.socket, change.on ? "on" : "off", change.rule);
+    for (int i = 0; i < length; i++)
+      checksum = (checksum ^ (uint8_t)line[i]) * 16777619u;
+    if (csv)
+      fputs(line, csv);
+  }
+  if (csv)
+    fclose(csv);
+
+  printf("Replayed %ld minutes (365 days) in %.3f s: %.0f sim-min/s\n", minutes, seconds, minutes / seconds);
+  for (time_t change : dstChanges) {
+    char when[32];
+    tm local;
+    localtime_r(&change, &local);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M %Z", &local);
+    printf("DST change at %s\n", when);
+  }
+  printf("\n%-8s %10s %10s\n", "socket", "switches", "on hours");
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    if (!::sockets[i])
+      continue;
+    int switches = 0;
+    for (const auto &change : timeline)
+      switches += change.socket == i + 1;
+    printf("%-8d %10d %10.1f\n", i + 1, switches, onMinutes[i] / 60.0);
+  }
+  printf("\nrules evaluated %lu, cached %lu, short-circuited %lu\n", ruleSystem.getRulesEvaluated(),
+         ruleSystem.getRulesSkipped(), ruleSystem.getRulesShortCircuited());
+  printf("power history, last days: %s\n", powerHistory.getDayDataJson().c_str());
+  printf("timeline: %zu changes, checksum %08x, written to %s\n", timeline.size(), checksum, csv ? csvPath : "(failed)");
+  return 0;
+}
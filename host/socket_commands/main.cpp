@@ -0,0 +1,111 @@
+// socket_commands - bursts of setState() through the per-socket command
+// queue against one PUT per call like before, with the real
+// HomeSocketDevice and AsyncHttpClient code and a stand-in socket on
+// 127.0.0.1 that answers after an injected latency.
+//
+//   pio run -e native_socket_commands && .pio/build/native_socket_commands/program [latency ms]
+//
+// "before" sends every call straight away, as setState() did: a PUT per
+// call, as long as the client has a free slot. Scenarios:
+//  - toggle burst: 10 toggles 20 ms apart, like clicks on the dashboard
+//  - competing: two callers that want on and off, every 10 ms for 0.5 s
+//  - redundant: on 5 times while the socket is already on
+// Reported: PUTs the socket received, whether it ends in the state asked
+// for last, and when it got there.
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "HomeSocketDevice.h"
+#include "HostFakes.h"
+
+static const int PORT = 18120;
+
+static unsigned long latencyMs = 150;
+static HostFakes::StandIn standIn;
+
+// ============================================================================
+// SCENARIOS
+// ============================================================================
+static String stateUrl;
+
+// What setState() did before the queue: a PUT per call
+static bool sendNow(bool state) {
+  const char *payload = state ? "{\"power_on\":true}" : "{\"power_on\":false}";
+  return httpClient.request("PUT", stateUrl, payload, 2000, [](const HttpResponse &) {});
+}
+
+struct Call
+{
+  unsigned long at; // ms after the start
+  bool state;
+};
+
+static void run(const char *name, const std::vector<Call> &calls, bool startOn, HomeSocketDevice &socket) {
+  for (int queuedPolicy = 0; queuedPolicy <= 1; queuedPolicy++) {
+    // Settle the socket in its starting state, and the device knowing it
+    standIn.on = startOn;
+    socket.getState();
+    httpClient.runUntilIdle(3000);
+    standIn.puts = 0;
+
+    unsigned long start = millis();
+    size_t next = 0;
+    uint32_t lastId = 0;
+    while (next < calls.size() || httpClient.inFlight() > 0) {
+      httpClient.poll();
+      unsigned long now = millis();
+      while (next < calls.size() && now - start >= calls[next].at) {
+        if (queuedPolicy)
+          lastId = socket.setState(calls[next].state);
+        else
+          sendNow(calls[next].state);
+        next++;
+      }
+      if (queuedPolicy)
+        socket.dispatch();
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    bool wanted = calls.back().state;
+    unsigned long settled = standIn.puts > 0 ? standIn.lastPutAt - start : 0;
+    const char *status = queuedPolicy ? HomeSocketDevice::statusName(socket.getCommand(lastId).status) : "-";
+    printf("%-14s %-7s %6zu %6lu %10s %10lu %10s\n", name, queuedPolicy ? "queue" : "before", calls.size(),
+           standIn.puts.load(), standIn.on == wanted ? "yes" : "NO", settled, status);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1)
+    latencyMs = atoi(argv[1]);
+  Serial.enabled = false;
+  HostFakes::followRealTime();
+  standIn.port = PORT;
+  standIn.latencyMs = latencyMs;
+  if (!HostFakes::listenOn(standIn))
+    return 1;
+
+  char address[32];
+  snprintf(address, sizeof(address), "127.0.0.1:%d", PORT);
+  stateUrl = String("http://") + address + "/api/v1/state";
+  HomeSocketDevice socket(address, 1);
+
+  std::vector<Call> burst;
+  for (int i = 0; i < 10; i++)
+    burst.push_back({i * 20UL, i % 2 == 0});
+  std::vector<Call> competing;
+  for (int i = 0; i < 50; i++)
+    competing.push_back({i * 10UL, i % 2 == 0});
+  competing.push_back({500, true});
+  std::vector<Call> redundant;
+  for (int i = 0; i < 5; i++)
+    redundant.push_back({i * 20UL, true});
+
+  printf("%lu ms per answer\n", latencyMs);
+  printf("%-14s %-7s %6s %6s %10s %10s %10s\n", "scenario", "policy", "calls", "PUTs", "ends right", "settled ms",
+         "last cmd");
+  run("toggle burst", burst, false, socket);
+  run("competing", competing, false, socket);
+  run("redundant", redundant, true, socket);
+  return 0;
+}
@@ -0,0 +1,214 @@
+// socket_reach - 2 of 8 sockets unplugged, with only their circuit breakers
+// and with the reachability cache in front, with the real HomeSocketDevice,
+// PollScheduler, SocketSweep, Reachability and AsyncHttpClient code and
+// real ICMP. Needs root, for a raw ICMP socket and to switch off echo
+// replies (net.ipv4.icmp_echo_ignore_all).
+//
+//   pio run -e native_socket_reach && .pio/build/native_socket_reach/program [seconds]
+//
+// Each socket has its own stand-in on 127.0.0.1X, so each has its own
+// address. All answer at first, which is when the cache learns that they
+// answer ping. Then sockets 7 and 8 are unplugged: their stand-ins hold
+// every request without answering, so each one runs into the 2 s timeout,
+// and echo replies are switched off. The loop runs like main.cpp, with a
+// sweep every SWEEP_S (5 minutes in main.cpp) and a setState() to each
+// unplugged socket every COMMAND_S, like rules that keep trying. After
+// [seconds] both are plugged back in.
+//
+// Reported per policy: requests to the unplugged sockets that ran into the
+// timeout and the client slot time they held, how long the sweeps took,
+// what became of the setState() calls, loop pass times, and how long after
+// being plugged back in the sockets were read again.
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "HomeSocketDevice.h"
+#include "HostFakes.h"
+#include "PollScheduler.h"
+#include "Reachability.h"
+#include "SocketSweep.h"
+
+static const int PORT = 18140;
+static const int UNPLUGGED[] = {7, 8};
+static const unsigned long SWEEP_S = 10;
+static const unsigned long COMMAND_S = 5;
+static const unsigned long BACK_WAIT_S = 130; // Longest breaker wait, and some
+
+// ============================================================================
+// STAND-IN SOCKETS
+// ============================================================================
+// Unplugged: a stand-in that holds every request without answering, and no
+// echo replies
+static bool ignoreEcho(bool ignore) {
+  FILE *file = fopen("/proc/sys/net/ipv4/icmp_echo_ignore_all", "w");
+  if (!file)
+    return false;
+  bool written = fputs(ignore ? "1" : "0", file) >= 0;
+  return fclose(file) == 0 && written;
+}
+
+// ============================================================================
+// RUN
+// ============================================================================
+struct Result
+{
+  unsigned long timeouts = 0; // Requests to the unplugged sockets
+  std::vector<unsigned long> sweeps;
+  unsigned long commands = 0, refused = 0, failed = 0;
+  std::vector<unsigned long> failedAfter; // ms from setState() to failed
+  std::vector<unsigned long> passes;      // us
+  double backAfter[2] = {-1, -1};         // s, -1 when not read again in time
+};
+
+// One loop() pass, as in main.cpp
+static void pass(HomeSocketDevice **sockets, bool gated, Result &result) {
+  auto start = std::chrono::steady_clock::now();
+  httpClient.poll();
+  if (gated)
+    reachability.poll();
+  pollScheduler.poll();
+  socketSweep.poll();
+  for (int i = 0; i < NUM_SOCKETS; i++)
+    sockets[i]->dispatch();
+  result.passes.push_back(
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+static Result run(bool gated, HostFakes::StandIn *standIns, int seconds) {
+  Result result;
+  HomeSocketDevice *sockets[NUM_SOCKETS];
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    char address[32];
+    snprintf(address, sizeof(address), "%s:%d", standIns[i].ip, standIns[i].port);
+    sockets[i] = new HomeSocketDevice(address, i + 1);
+    pollScheduler.add(sockets[i], i + 1, i * 250);
+  }
+
+  // All plugged in: every socket answers a read, and its echo
+  for (int i = 0; i < NUM_SOCKETS; i++)
+    standIns[i].silent = false;
+  ignoreEcho(false);
+  unsigned long start = millis();
+  while (millis() - start < 3000)
+    pass(sockets, true, result);
+  result.passes.clear();
+
+  // Unplugged
+  for (int number : UNPLUGGED)
+    standIns[number - 1].silent = true;
+  ignoreEcho(true);
+  httpClient.resetStats();
+  start = millis();
+  unsigned long lastSweep = start, lastCommand = start;
+  unsigned long sweepsBefore = socketSweep.getStats().sweeps;
+  std::vector<std::pair<HomeSocketDevice *, std::pair<uint32_t, unsigned long>>> commands;
+  while (millis() - start < seconds * 1000UL) {
+    unsigned long now = millis();
+    if (now - lastSweep >= SWEEP_S * 1000 && socketSweep.start(sockets, NUM_SOCKETS, SocketSweep::LOOP_WIDTH))
+      lastSweep = now;
+    if (!socketSweep.running() && socketSweep.getStats().sweeps - sweepsBefore > result.sweeps.size())
+      result.sweeps.push_back(socketSweep.getStats().lastSweepMs);
+    if (now - lastCommand >= COMMAND_S * 1000) {
+      lastCommand = now;
+      for (int number : UNPLUGGED) {
+        HomeSocketDevice *socket = sockets[number - 1];
+        bool state = !socket->getCurrentState();
+        uint32_t id = socket->setState(state);
+        result.commands++;
+        if (id == 0)
+          result.refused++;
+        else
+          commands.push_back({socket, {id, now}});
+      }
+    }
+    for (auto &command : commands) {
+      if (command.second.second != 0 &&
+          command.first->getCommand(command.second.first).status == HomeSocketDevice::CommandStatus::Failed) {
+        result.failed++;
+        result.failedAfter.push_back(now - command.second.second);
+        command.second.second = 0;
+      }
+    }
+    pass(sockets, gated, result);
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  socketSweep.runUntilDone(5000);
+  result.timeouts = httpClient.getStats().timeouts;
+
+  // Plugged back in
+  for (int number : UNPLUGGED)
+    standIns[number - 1].silent = false;
+  ignoreEcho(false);
+  start = millis();
+  Result ignored;
+  while (millis() - start < BACK_WAIT_S * 1000 && (result.backAfter[0] < 0 || result.backAfter[1] < 0)) {
+    for (int k = 0; k < 2; k++) {
+      HomeSocketDevice *socket = sockets[UNPLUGGED[k] - 1];
+      if (result.backAfter[k] < 0 && socket->getHealth().lastOk() && socket->isConnected())
+        result.backAfter[k] = (millis() - start) / 1000.0;
+    }
+    pass(sockets, gated, ignored);
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  httpClient.runUntilIdle(3000);
+  return result;
+}
+
+static unsigned long percentile(std::vector<unsigned long> values, int percent) {
+  if (values.empty())
+    return 0;
+  std::sort(values.begin(), values.end());
+  return values[(values.size() - 1) * percent / 100];
+}
+
+static void report(const char *name, const Result &result) {
+  printf("\n%s\n", name);
+  printf("  timeouts on unplugged sockets: %lu (%.0f s of client slots held)\n", result.timeouts,
+         result.timeouts * 2.0);
+  printf("  sweeps: %zu, p50 %lu ms, max %lu ms\n", result.sweeps.size(), percentile(result.sweeps, 50),
+         percentile(result.sweeps, 100));
+  printf("  setState() to unplugged: %lu, refused at once %lu, failed after p50 %lu ms (%lu)\n", result.commands,
+         result.refused, percentile(result.failedAfter, 50), result.failed);
+  printf("  loop pass: p50 %lu us, p99 %lu us, max %lu us\n", percentile(result.passes, 50),
+         percentile(result.passes, 99), percentile(result.passes, 100));
+  for (int k = 0; k < 2; k++) {
+    if (result.backAfter[k] < 0)
+      printf("  socket %d plugged back in: not read within %lu s\n", UNPLUGGED[k], BACK_WAIT_S);
+    else
+      printf("  socket %d plugged back in: read again after %.1f s\n", UNPLUGGED[k], result.backAfter[k]);
+  }
+}
+
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 60;
+  Serial.enabled = false;
+  HostFakes::followRealTime();
+
+  HostFakes::StandIn standIns[NUM_SOCKETS];
+  char ips[NUM_SOCKETS][16];
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    snprintf(ips[i], sizeof(ips[i]), "127.0.0.%d", 11 + i);
+    standIns[i].ip = ips[i];
+    standIns[i].port = PORT;
+    if (!HostFakes::listenOn(standIns[i]))
+      return 1;
+  }
+  if (!ignoreEcho(false)) {
+    fprintf(stderr, "cannot write icmp_echo_ignore_all, run as root\n");
+    return 1;
+  }
+
+  printf("8 sockets, %d and %d unplugged for %d s\n", UNPLUGGED[0], UNPLUGGED[1], seconds);
+  Result breaker = run(false, standIns, seconds);
+  report("breaker only", breaker);
+  Result gated = run(true, standIns, seconds);
+  report("breaker and reachability", gated);
+
+  const Reachability::Stats &stats = reachability.getStats();
+  printf("\nreachability: %lu echoes, %lu replies, %lu timeouts, %lu requests refused\n", stats.probes,
+         stats.replies, stats.timeouts, stats.refused);
+  ignoreEcho(false);
+  return 0;
+}
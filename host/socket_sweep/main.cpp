@@ -0,0 +1,95 @@
+// socket_sweep - time to read all 8 sockets at boot: one after another
+// like setup() did, and with SocketSweep at several widths, with the real
+// HomeSocketDevice, SocketSweep and AsyncHttpClient code against stand-in
+// sockets on 127.0.0.1 that answer after an injected latency.
+//
+//   pio run -e native_socket_sweep && .pio/build/native_socket_sweep/program [latency ms]
+//
+// Every sweep uses fresh connections, like the first one after boot. The
+// second table has socket 8 accepting but never answering, so its read
+// runs into the 2 s timeout; after three of those its circuit breaker opens
+// and the sweeps skip it until the breaker lets a probe through.
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "HomeSocketDevice.h"
+#include "HostFakes.h"
+#include "SocketSweep.h"
+
+static const int BASE_PORT = 18110;
+static const int ROUNDS = 5;
+
+static unsigned long latencyMs = 150;
+
+// ============================================================================
+// SWEEPS
+// ============================================================================
+// What setup() did: one socket, wait for it, the next one
+static unsigned long oneByOne(HomeSocketDevice **sockets, int &online) {
+  unsigned long start = millis();
+  online = 0;
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    sockets[i]->getState();
+    httpClient.runUntilIdle(3000);
+    online += sockets[i]->isConnected();
+  }
+  return millis() - start;
+}
+
+static unsigned long sweep(HomeSocketDevice **sockets, int width, int &online) {
+  socketSweep.start(sockets, NUM_SOCKETS, width);
+  socketSweep.runUntilDone(10000);
+  online = socketSweep.getStats().lastOnline;
+  return socketSweep.getStats().lastSweepMs;
+}
+
+static void table(const char *title, HomeSocketDevice **sockets) {
+  printf("\n%s\n%-12s %8s %8s %8s %7s\n", title, "method", "p50 ms", "max ms", "RTTs", "online");
+  const int widths[] = {0, 1, 2, 4, 6};
+  for (int width : widths) {
+    std::vector<unsigned long> times;
+    int online = 0;
+    for (int round = 0; round < ROUNDS; round++)
+      times.push_back(width == 0 ? oneByOne(sockets, online) : sweep(sockets, width, online));
+    std::sort(times.begin(), times.end());
+    char name[16];
+    if (width == 0)
+      snprintf(name, sizeof(name), "one by one");
+    else
+      snprintf(name, sizeof(name), "width %d", width);
+    printf("%-12s %8lu %8lu %8.1f %7d\n", name, times[ROUNDS / 2], times.back(),
+           times[ROUNDS / 2] / (double)latencyMs, online);
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1)
+    latencyMs = atoi(argv[1]);
+  Serial.enabled = false;
+  HostFakes::followRealTime();
+  httpClient.setKeepAlive(false); // Fresh connections, like at boot
+
+  HostFakes::StandIn standIns[NUM_SOCKETS];
+  HomeSocketDevice *sockets[NUM_SOCKETS];
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    standIns[i].port = BASE_PORT + i + 1;
+    standIns[i].latencyMs = latencyMs;
+    standIns[i].on = true;
+    if (!HostFakes::listenOn(standIns[i]))
+      return 1;
+    char address[32];
+    snprintf(address, sizeof(address), "127.0.0.1:%d", standIns[i].port);
+    sockets[i] = new HomeSocketDevice(address, i + 1);
+  }
+
+  printf("state reads of %d sockets, %lu ms latency, %d rounds\n", NUM_SOCKETS, latencyMs, ROUNDS);
+  table("all online", sockets);
+  standIns[NUM_SOCKETS - 1].silent = true;
+  table("socket 8 silent (2 s timeout)", sockets);
+
+  printf("\nmost reads in flight: %u of %u client slots\n", (unsigned)socketSweep.getStats().maxInFlight,
+         (unsigned)AsyncHttpClient::MAX_REQUESTS);
+  return 0;
+}
@@ -0,0 +1,64 @@
+// verify_rules - checks that per-socket, highest-precedence-first rule
+// evaluation with short-circuiting decides exactly like evaluating every
+// rule in insertion order (last non-SKIP wins).
+//
+//   pio run -e native_verify && .pio/build/native_verify/program
+//
+// Built with RULES_VERIFY_ORDER=1, so every update() also runs the
+// reference evaluation and counts mismatches. The setupRules() rules, plus
+// a shadowed stateful rule on socket 2, are replayed for 120 days in 10 s
+// ticks with noisy light, solar power and phone presence. Exit code is 1
+// when any pass differed.
+#include <cstdlib>
+
+#include "GlobalVars.h"
+#include "HostFakes.h"
+#include "SmartRuleSystem.h"
+
+static float noisy(float base, float spread) {
+  return base + spread * ((rand() % 2001) - 1000) / 1000.0f;
+}
+
+int main() {
+  setenv("TZ", "CET-1CEST,M3.5.0/2,M10.5.0/3", 1);
+  tzset();
+  Serial.enabled = false;
+  srand(1);
+
+  HostFakes::createDevices(4);
+  HostFakes::setClock(1709247600); // Fri 1 March 2024 00:00 CET, crosses the DST change
+  setupRules();
+
+  // Socket 2 is free in setupRules(): shadow a stateful rule with a later,
+  // higher precedence one so skipping it would show up
+  ruleSystem.addRule(2, "Verify delayed off",
+                     ruleSystem.offConditionDelayed(ruleSystem.lightBelow(5), 120));
+  ruleSystem.addRule(2, "Verify evening",
+                     ruleSystem.period("18:00", "22:00", ruleSystem.phonePresent()));
+
+  const long ticks = 120L * 24 * 360; // 120 days, one tick per 10 s
+  for (long tick = 0; tick < ticks; tick++) {
+    int minuteOfDay = (tick / 6) % 1440;
+    bool daylight = minuteOfDay > 420 && minuteOfDay < 1140;
+    HostFakes::world.light = daylight ? noisy(300, 295) : noisy(6, 6);
+    HostFakes::world.exportPower = daylight ? noisy(900, 900) : 0;
+    if (HostFakes::world.exportPower < 0)
+      HostFakes::world.exportPower = 0;
+    HostFakes::world.importPower = HostFakes::world.exportPower > 0 ? noisy(10, 10) : noisy(300, 200);
+    if (rand() % 500 == 0)
+      HostFakes::world.phonePresent = !HostFakes::world.phonePresent;
+    sensors.update();
+    p1Meter->update();
+
+    ruleSystem.update();
+    HostFakes::advanceMillis(10000);
+  }
+
+  printf("Rule order verification, %ld passes (120 days)\n", ticks);
+  printf("rules evaluated:       %lu\n", ruleSystem.getRulesEvaluated());
+  printf("rules cached:          %lu\n", ruleSystem.getRulesSkipped());
+  printf("rules short-circuited: %lu\n", ruleSystem.getRulesShortCircuited());
+  printf("socket setState calls: %lu\n", HostFakes::world.setStateCalls);
+  printf("order mismatches:      %lu\n", ruleSystem.getOrderMismatches());
+  return ruleSystem.getOrderMismatches() == 0 ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+// web_assets - what a browser loads for the dashboard's first paint, with the
+// page from SPIFFS as before and with the gzipped assets in flash, on the
+// real HttpServer on 127.0.0.1.
+//
+//   pio run -e native_web_assets && .pio/build/native_web_assets/program [rounds]
+//
+// Before: "/" streamed a chunk at a time from data/index.html (a file read
+// per chunk, like SPIFFS), no favicon, Chart.js from the CDN. After: "/",
+// /favicon.ico and /chart.umd.js?v= from WebAssets.h as WebInterface serves
+// them, gzip and ETags included. Reported: bytes the ESP sends for a first
+// visit and for the next one (the browser revalidates the page with its
+// ETag), and the time from request to last byte for each, median of
+// [rounds]; then what each asset's body is of the first visit's bytes, so
+// Chart.js's share shows with the file vendored. The file reads here are a PC's, not SPIFFS', so the before times
+// are a lower bound.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HostFakes.h"
+#include "HttpServer.h"
+#include "WebAssets.h"
+
+static const int PORT = 18183;
+
+// ============================================================================
+// SERVERS
+// ============================================================================
+static void spiffsPage(HttpServer &http) {
+  http.on("/", HttpServer::Method::Get, [](const HttpServer::Request &, HttpServer::Response &res) {
+    FILE *file = fopen("data/index.html", "rb");
+    if (!file) {
+      res.send(404, "text/plain", "index.html missing");
+      return;
+    }
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    std::shared_ptr<FILE> open(file, fclose);
+    res.addHeader("Cache-Control", "public, max-age=604800");
+    res.sendStream(200, "text/html", size, [open](uint8_t *buffer, size_t max, size_t offset) {
+      fseek(open.get(), offset, SEEK_SET);
+      return fread(buffer, 1, max, open.get());
+    });
+  });
+}
+
+// As WebInterface::begin()
+static void flashAssets(HttpServer &http) {
+  for (const WebAsset &asset : WEB_ASSETS) {
+    HttpServer::Handler serve = [&asset](const HttpServer::Request &req, HttpServer::Response &res) {
+      bool pinned = req.arg("v") == asset.hash;
+      res.addHeader("Cache-Control", pinned ? "public, max-age=31536000, immutable" : "no-cache");
+      if (res.notModified(req, asset.etag))
+        return;
+      res.addHeader("Content-Encoding", "gzip");
+      res.sendStatic(200, asset.contentType, asset.data, asset.length);
+    };
+    http.on(asset.path, HttpServer::Method::Get, serve);
+    if (strcmp(asset.path, "/index.html") == 0)
+      http.on("/", HttpServer::Method::Get, serve);
+  }
+}
+
+// ============================================================================
+// BROWSER
+// ============================================================================
+struct Browser
+{
+  int fd = -1;
+  std::map<std::string, std::string> etags;
+  unsigned long bytes = 0;
+  std::string last;
+};
+
+static std::string headerValue(const std::string &answer, const char *name) {
+  const char *at = strcasestr(answer.c_str(), name);
+  if (!at)
+    return "";
+  at += strlen(name);
+  while (*at == ' ')
+    at++;
+  return std::string(at, strcspn(at, "\r"));
+}
+
+static void get(Browser &browser, const std::string &path) {
+  if (browser.fd < 0) {
+    browser.fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    connect(browser.fd, (sockaddr *)&addr, sizeof(addr));
+  }
+  std::string request = "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\nAccept-Encoding: gzip, deflate\r\n";
+  auto etag = browser.etags.find(path);
+  if (etag != browser.etags.end())
+    request += "If-None-Match: " + etag->second + "\r\n";
+  request += "\r\n";
+  send(browser.fd, request.c_str(), request.size(), MSG_NOSIGNAL);
+
+  std::string answer;
+  size_t total = std::string::npos;
+  char buffer[8192];
+  while (answer.size() < total) {
+    ssize_t n = recv(browser.fd, buffer, sizeof(buffer), 0);
+    if (n <= 0)
+      break;
+    answer.append(buffer, n);
+    size_t headerEnd = answer.find("\r\n\r\n");
+    if (total == std::string::npos && headerEnd != std::string::npos)
+      total = headerEnd + 4 + strtoul(("0" + headerValue(answer, "Content-Length:")).c_str(), nullptr, 10);
+  }
+  browser.bytes += answer.size();
+  std::string tag = headerValue(answer, "ETag:");
+  if (!tag.empty())
+    browser.etags[path] = tag;
+  browser.last = answer.substr(0, answer.find("\r\n\r\n"));
+}
+
+// The page, then what it links to, as the embedded page names them
+static void visit(Browser &browser, bool after, bool again) {
+  if (!after) {
+    if (again) // max-age: not asked again for a week, firmware updates included
+      return;
+    get(browser, "/");
+    get(browser, "/favicon.ico"); // 404; Chart.js comes from the CDN
+    return;
+  }
+  get(browser, "/");
+  if (again) // The rest is kept as immutable
+    return;
+  bool chart = false;
+  for (const WebAsset &asset : WEB_ASSETS) {
+    chart |= strcmp(asset.path, "/chart.umd.js") == 0;
+    if (strcmp(asset.path, "/index.html") != 0)
+      get(browser, std::string(asset.path) + "?v=" + asset.hash);
+  }
+  if (!chart)
+    get(browser, "/chart.umd.js"); // 404, then the CDN: built without vendor/chart.js
+}
+
+// ============================================================================
+// RUN
+// ============================================================================
+// Returns the first visit's bytes
+static unsigned long run(bool after, int rounds) {
+  HttpServer *http = new HttpServer();
+  if (after)
+    flashAssets(*http);
+  else
+    spiffsPage(*http);
+  if (!http->begin(PORT)) {
+    fprintf(stderr, "cannot listen on %d\n", PORT);
+    exit(1);
+  }
+  std::atomic<bool> running{true};
+  std::thread server([&]() {
+    while (running)
+      http->serveFor(20);
+  });
+
+  std::vector<double> firstTimes, againTimes;
+  unsigned long firstBytes = 0, againBytes = 0;
+  std::string againAnswer;
+  for (int round = 0; round < rounds; round++) {
+    Browser browser;
+    auto start = std::chrono::steady_clock::now();
+    visit(browser, after, false);
+    firstTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    firstBytes = browser.bytes;
+
+    browser.bytes = 0;
+    start = std::chrono::steady_clock::now();
+    visit(browser, after, true);
+    againTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    againBytes = browser.bytes;
+    againAnswer = browser.last.substr(0, browser.last.find("\r\n"));
+    if (browser.fd >= 0)
+      close(browser.fd);
+  }
+  running = false;
+  server.join();
+  delete http;
+
+  std::sort(firstTimes.begin(), firstTimes.end());
+  std::sort(againTimes.begin(), againTimes.end());
+  printf("%s\n", after ? "after: gzipped in flash" : "before: SPIFFS, Chart.js from the CDN");
+  printf("  first visit: %6lu bytes from the ESP, %.2f ms\n", firstBytes, firstTimes[rounds / 2]);
+  printf("  next visit : %6lu bytes from the ESP, %.2f ms%s\n", againBytes, againTimes[rounds / 2],
+         after ? (" (" + againAnswer + ")").c_str() : " (max-age: not asked, for a week)");
+  return firstBytes;
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 200;
+  Serial.enabled = false;
+  HostFakes::followRealTime();
+
+  for (const WebAsset &asset : WEB_ASSETS)
+    printf("%-14s %7u bytes gzipped, ETag %s\n", asset.path, (unsigned)asset.length, asset.etag);
+  printf("\n");
+  run(false, rounds);
+  unsigned long firstBytes = run(true, rounds);
+  for (const WebAsset &asset : WEB_ASSETS)
+    printf("  %-14s %5.1f%% of the first visit\n", asset.path, 100.0 * asset.length / firstBytes);
+  return 0;
+}
@@ -0,0 +1,342 @@
+// web_cache - three dashboards polling /data every 2 s and the four history
+// charts every minute, with the browser's ETag revalidation, on the real
+// HttpServer on 127.0.0.1.
+//
+//   pio run -e native_web_cache && .pio/build/native_web_cache/program [seconds]
+//
+// The loop runs like main.cpp: WORK_US of other work, the web interface's
+// update() and serveFor(60). Without the cache every request serializes its
+// answer again. With it the server mirrors WebInterface: every
+// CHANGE_INTERVAL the data is compared at the page's resolution, /data gets
+// a new version when it changed (or DATA_REFRESH passed, for uptime and the
+// like), a history tier gets one when it got a point, and an answer is
+// serialized once per version and answered 304 while the dashboard's
+// If-None-Match still matches.
+//
+// Two homes: a busy one whose power reading changes every second and a quiet
+// one (night, standby) where it changes every QUIET_S. Reported per home and
+// mode: bytes each dashboard received per minute, answers serialized per
+// minute, the share of 304s and the time spent in handlers per minute.
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HostFakes.h"
+#include "HttpServer.h"
+
+static const int PORT = 18182;
+static const int DASHBOARDS = 3;
+static const unsigned long WORK_US = 2000;
+static const unsigned long PASS_WAIT_MS = 60;
+static const unsigned long POLL_MS = 2000;
+static const unsigned long HISTORY_MS = 60000;
+static const unsigned long CHANGE_INTERVAL = 250;
+static const unsigned long DATA_REFRESH = 10000;
+static const unsigned long QUIET_S = 30;
+static const unsigned long SWITCH_S = 20;
+
+static const char *const TIERS[] = {"minute", "hour", "day", "month"};
+static const int TIER_POINTS[] = {60, 24, 7, 30};
+
+// ============================================================================
+// DATA
+// ============================================================================
+struct Home
+{
+  long power = 412;
+  bool sockets[8] = {};
+
+  bool operator==(const Home &other) const {
+    return power == other.power && memcmp(sockets, other.sockets, sizeof(sockets)) == 0;
+  }
+};
+
+static unsigned long serialized = 0; // Answers built
+
+static std::string dataJson(const Home &home) {
+  serialized++;
+  char part[512];
+  snprintf(part, sizeof(part), "{\"import_power\":%ld,\"export_power\":0,\"temperature\":21.4,\"humidity\":48.2,"
+           "\"light\":120,\"phone_present\":true,\"switches\":[", home.power);
+  std::string json = part;
+  for (int i = 0; i < 8; i++) {
+    snprintf(part, sizeof(part),
+             "%s{\"state\":%s,\"duration\":%d,\"online\":true,\"stale_p50\":3,\"stale_p90\":9,"
+             "\"command\":\"done\",\"reach\":\"reachable\",\"health\":{\"breaker\":\"closed\",\"avail\":100,"
+             "\"lat_p50\":42,\"lat_p99\":180,\"ok\":%d,\"timeouts\":0,\"errors\":0,\"parse_errors\":0}}",
+             i ? "," : "", home.sockets[i] ? "true" : "false", 100 * i, 1000 + i);
+    json += part;
+  }
+  json += "],\"last_rule\":\"Solar surplus boiler\",\"last_rule_time\":\"12:01 Mon\",\"rule_history\":[],"
+          "\"http\":{\"requests\":12345,\"reused\":12000,\"open\":3,\"max_open\":6,\"leaks\":0},\"phones\":[],"
+          "\"ip\":\"192.168.1.20\",\"free_ram\":180,\"uptime\":86400}";
+  while (json.size() < 3500)
+    json.insert(json.size() - 1, " ");
+  return json;
+}
+
+// As PowerHistory::bufferToJson
+static std::string historyJson(const std::vector<float> &points, int tier) {
+  serialized++;
+  std::string imports, exports;
+  char value[32];
+  for (float point : points) {
+    snprintf(value, sizeof(value), "%s%.2f", imports.empty() ? "" : ",", point);
+    imports += value;
+    snprintf(value, sizeof(value), "%s%.2f", exports.empty() ? "" : ",", point / 3);
+    exports += value;
+  }
+  snprintf(value, sizeof(value), "%d", (int)points.size());
+  return "{\"import\":[" + imports + "],\"export\":[" + exports + "],\"count\":" + value + ",\"unit\":\"" +
+         (tier == 0 ? "W" : tier == 1 ? "Wh" : "kWh") + "\"}";
+}
+
+// ============================================================================
+// SERVER, as WebInterface
+// ============================================================================
+struct Cached
+{
+  bool valid = false;
+  uint32_t version = 0;
+  String body;
+  char etag[40] = "";
+};
+
+struct Server
+{
+  HttpServer http;
+  bool caching;
+  Home home, shown;
+  std::vector<float> history[4];
+  uint32_t historyVersion[4] = {};
+  uint32_t dataVersion = 0;
+  unsigned long lastLook = 0, lastDataChange = 0;
+  unsigned long handlerMicros = 0;
+  Cached dataCache, historyCache[4];
+
+  explicit Server(bool caching) : caching(caching) {
+    for (int t = 0; t < 4; t++) {
+      for (int i = 0; i < TIER_POINTS[t]; i++)
+        history[t].push_back(300 + (i * 37) % 500);
+    }
+  }
+
+  void send(const HttpServer::Request &req, HttpServer::Response &res, Cached &cache, const char *name,
+            uint32_t version, const std::function<std::string()> &build) {
+    unsigned long start = micros();
+    if (!caching) {
+      res.send(200, "application/json", String(build().c_str()));
+    } else {
+      if (!cache.valid || cache.version != version) {
+        cache.body = String(build().c_str());
+        cache.version = version;
+        cache.valid = true;
+        snprintf(cache.etag, sizeof(cache.etag), "\"2f9c11a0-%s-%lu\"", name, (unsigned long)version);
+      }
+      res.addHeader("Cache-Control", "no-cache");
+      if (!res.notModified(req, cache.etag))
+        res.send(200, "application/json", cache.body);
+    }
+    handlerMicros += micros() - start;
+  }
+
+  void begin() {
+    http.on("/data", HttpServer::Method::Get, [this](const HttpServer::Request &req, HttpServer::Response &res) {
+      send(req, res, dataCache, "data", dataVersion, [this]() { return dataJson(home); });
+    });
+    for (int t = 0; t < 4; t++) {
+      std::string path = std::string("/history/") + TIERS[t];
+      http.on(path.c_str(), HttpServer::Method::Get, [this, t](const HttpServer::Request &req, HttpServer::Response &res) {
+        send(req, res, historyCache[t], TIERS[t], historyVersion[t], [this, t]() { return historyJson(history[t], t); });
+      });
+    }
+    if (!http.begin(PORT)) {
+      fprintf(stderr, "cannot listen on %d\n", PORT);
+      exit(1);
+    }
+  }
+
+  void update(unsigned long now) {
+    if (now - lastLook < CHANGE_INTERVAL)
+      return;
+    lastLook = now;
+    if (home == shown && now - lastDataChange < DATA_REFRESH)
+      return;
+    shown = home;
+    lastDataChange = now;
+    dataVersion++;
+  }
+
+  void addMinute(float power) {
+    history[0].erase(history[0].begin());
+    history[0].push_back(power);
+    historyVersion[0]++;
+  }
+};
+
+static void busyWork() {
+  unsigned long start = micros();
+  while (micros() - start < WORK_US) {
+  }
+}
+
+// ============================================================================
+// DASHBOARDS
+// ============================================================================
+struct Dashboard
+{
+  unsigned long bytes = 0;
+  unsigned long answers = 0;
+  unsigned long notModified = 0;
+  std::map<std::string, std::string> etags; // The browser's cache
+};
+
+static int connectToServer() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  timeval timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static std::string headerValue(const std::string &answer, const char *name) {
+  const char *at = strcasestr(answer.c_str(), name);
+  if (!at)
+    return "";
+  at += strlen(name);
+  while (*at == ' ')
+    at++;
+  return std::string(at, strcspn(at, "\r"));
+}
+
+static void get(int &fd, Dashboard &dashboard, const std::string &path) {
+  if (fd < 0)
+    fd = connectToServer();
+  std::string request = "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n";
+  auto etag = dashboard.etags.find(path);
+  if (etag != dashboard.etags.end())
+    request += "If-None-Match: " + etag->second + "\r\n";
+  request += "\r\n";
+  send(fd, request.c_str(), request.size(), MSG_NOSIGNAL);
+
+  std::string answer;
+  size_t total = std::string::npos;
+  char buffer[4096];
+  while (answer.size() < total) {
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) {
+      close(fd);
+      fd = -1;
+      return;
+    }
+    answer.append(buffer, n);
+    size_t headerEnd = answer.find("\r\n\r\n");
+    if (total == std::string::npos && headerEnd != std::string::npos)
+      total = headerEnd + 4 + strtoul(("0" + headerValue(answer, "Content-Length:")).c_str(), nullptr, 10);
+  }
+  dashboard.bytes += answer.size();
+  dashboard.answers++;
+  if (answer.compare(0, 12, "HTTP/1.1 304") == 0)
+    dashboard.notModified++;
+  std::string tag = headerValue(answer, "ETag:");
+  if (!tag.empty())
+    dashboard.etags[path] = tag;
+}
+
+static void browse(std::atomic<bool> *running, Dashboard *dashboard) {
+  int fd = -1;
+  auto lastHistory = std::chrono::steady_clock::now() - std::chrono::milliseconds(HISTORY_MS);
+  while (*running) {
+    get(fd, *dashboard, "/data");
+    if (std::chrono::steady_clock::now() - lastHistory >= std::chrono::milliseconds(HISTORY_MS)) {
+      lastHistory = std::chrono::steady_clock::now();
+      for (const char *tier : TIERS)
+        get(fd, *dashboard, std::string("/history/") + tier);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MS));
+  }
+  if (fd >= 0)
+    close(fd);
+}
+
+// ============================================================================
+// RUN
+// ============================================================================
+static void run(bool quiet, bool caching, int seconds) {
+  serialized = 0;
+  Server *server = new Server(caching);
+  server->begin();
+
+  std::atomic<bool> running{true};
+  std::vector<Dashboard> dashboards(DASHBOARDS);
+  std::vector<std::thread> threads;
+  for (Dashboard &dashboard : dashboards)
+    threads.emplace_back(browse, &running, &dashboard);
+
+  unsigned long changeEvery = quiet ? QUIET_S * 1000 : 1000;
+  unsigned long start = millis(), lastReading = start, lastMinute = start, lastSwitch = start;
+  while (millis() - start < seconds * 1000UL) {
+    unsigned long now = millis();
+    busyWork();
+    if (now - lastReading >= changeEvery) {
+      lastReading = now;
+      server->home.power += (now / changeEvery) % 2 ? 7 : -5;
+    }
+    if (now - lastMinute >= 60000) {
+      lastMinute = now;
+      server->addMinute(server->home.power);
+    }
+    if (now - lastSwitch >= SWITCH_S * 1000) {
+      lastSwitch = now;
+      server->home.sockets[3] = !server->home.sockets[3];
+    }
+    server->http.poll();
+    server->update(millis());
+    server->http.serveFor(PASS_WAIT_MS);
+  }
+  running = false;
+  for (std::thread &thread : threads)
+    thread.join();
+
+  unsigned long bytes = 0, answers = 0, notModified = 0;
+  for (Dashboard &dashboard : dashboards) {
+    bytes += dashboard.bytes;
+    answers += dashboard.answers;
+    notModified += dashboard.notModified;
+  }
+  double minutes = seconds / 60.0;
+  printf("%s home, %s\n", quiet ? "quiet" : "busy", caching ? "versioned cache + ETag" : "no cache");
+  printf("  per dashboard: %.1f KB/min\n", bytes / 1024.0 / DASHBOARDS / minutes);
+  printf("  serialized: %.0f answers/min for %.0f requests/min, %.0f%% answered 304\n", serialized / minutes,
+         answers / minutes, answers ? 100.0 * notModified / answers : 0.0);
+  printf("  in handlers: %.0f us/min\n", server->handlerMicros / minutes);
+  delete server;
+}
+
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 60;
+  Serial.enabled = false;
+  HostFakes::followRealTime();
+
+  printf("%d dashboards for %d s: /data every 2 s, the four history charts every minute\n\n", DASHBOARDS, seconds);
+  for (int quiet = 0; quiet < 2; quiet++) {
+    run(quiet, false, seconds);
+    run(quiet, true, seconds);
+  }
+  return 0;
+}
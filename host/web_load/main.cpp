@@ -0,0 +1,389 @@
+// web_load - the dashboard's requests from several browsers at once, against
+// the old serving pattern and against HttpServer, on 127.0.0.1.
+//
+//   pio run -e native_web_load && .pio/build/native_web_load/program [seconds]
+//
+// The server side runs like main.cpp's loop(): a step of WORK_US other work
+// every STEP_MS, then a wait of PASS_WAIT_MS; between steps the passes only
+// wait, at most PASS_WAIT_MS and no longer than until the next step.
+//
+//   WebServer:  like WebServer::handleClient() at the end of the pass, one
+//               connection is taken per pass, its request read and answered
+//               with "Connection: close", then the pass sleeps.
+//   HttpServer: the real server; serveFor() is every wait.
+//
+// Each client is a browser tab in a tight loop: GET /data mostly, now and
+// then the history of one tier or the page itself (data/index.html when run
+// from the repository), THINK_MS apart, keep-alive when the server allows.
+// Reported per server and number of clients: latency p50/p99 from sending the
+// request (connecting included) to the last byte, requests per second,
+// connections opened and requests that failed.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HostFakes.h"
+#include "HttpServer.h"
+
+static const int PORT = 18180;
+static const unsigned long WORK_US = 2000;
+static const unsigned long PASS_WAIT_MS = 60;
+static const unsigned long STEP_MS = 200;
+static const unsigned long THINK_MS = 50;
+
+// ============================================================================
+// PAYLOADS
+// ============================================================================
+static std::string page;    // index.html
+static std::string data;    // /data, ~3.5 KB like the real one
+static std::string history; // One tier, 60 points
+
+static void makePayloads() {
+  FILE *file = fopen("data/index.html", "rb");
+  if (file) {
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+      page.append(buffer, n);
+    fclose(file);
+  } else {
+    page.assign(35000, 'x');
+  }
+
+  char part[512];
+  data = "{\"import_power\":1234.5,\"export_power\":0,\"temperature\":21.4,\"humidity\":48.2,\"switches\":[";
+  for (int i = 0; i < 8; i++) {
+    snprintf(part, sizeof(part),
+             "%s{\"state\":true,\"duration\":%d,\"online\":true,\"stale_p50\":3,\"stale_p90\":9,"
+             "\"command\":\"done\",\"reach\":\"reachable\",\"health\":{\"breaker\":\"closed\",\"avail\":100,"
+             "\"lat_p50\":42,\"lat_p99\":180,\"ok\":%d,\"timeouts\":0,\"errors\":0,\"parse_errors\":0}}",
+             i ? "," : "", 100 * i, 1000 + i);
+    data += part;
+  }
+  data += "],\"rule_history\":[";
+  for (int i = 0; i < 3; i++) {
+    snprintf(part, sizeof(part), "%s{\"name\":\"Solar surplus boiler %d\",\"time\":\"12:0%d\"}", i ? "," : "", i, i);
+    data += part;
+  }
+  data += "],\"phones\":[";
+  for (int i = 0; i < 4; i++) {
+    snprintf(part, sizeof(part), "%s{\"ip\":\"192.168.1.%d\",\"present\":true,\"last_reply\":2,\"avail\":1,\"lat_p50\":12}",
+             i ? "," : "", 50 + i);
+    data += part;
+  }
+  data += "],\"ip\":\"192.168.1.20\",\"free_ram\":180,\"uptime\":86400}";
+  while (data.size() < 3500)
+    data.insert(data.size() - 1, " ");
+
+  history = "[";
+  for (int i = 0; i < 60; i++) {
+    snprintf(part, sizeof(part), "%s{\"t\":%d,\"import\":%d.5,\"export\":%d.25}", i ? "," : "", 1700000000 + i * 60,
+             1000 + i, i);
+    history += part;
+  }
+  history += "]";
+}
+
+// What both servers answer: type and body, empty type for a 404
+static const std::string *route(const char *path, const char *&type) {
+  type = "application/json";
+  if (strcmp(path, "/data") == 0)
+    return &data;
+  if (strncmp(path, "/history/", 9) == 0)
+    return &history;
+  type = "text/html";
+  if (strcmp(path, "/") == 0)
+    return &page;
+  type = "";
+  return nullptr;
+}
+
+// ============================================================================
+// SERVERS
+// ============================================================================
+static std::atomic<bool> serving{false};
+
+static void busyWork() {
+  unsigned long start = micros();
+  while (micros() - start < WORK_US) {
+  }
+}
+
+static int listenSocket() {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(listener, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 16) < 0) {
+    close(listener);
+    return -1;
+  }
+  fcntl(listener, F_SETFL, fcntl(listener, F_GETFL, 0) | O_NONBLOCK);
+  return listener;
+}
+
+// One connection per call, read and answered while the caller waits, then
+// closed: what WebServer::handleClient() does
+static void handleClientLikeWebServer(int listener) {
+  int fd = accept(listener, nullptr, nullptr);
+  if (fd < 0)
+    return;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+  timeval timeout = {5, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  char request[1024];
+  size_t received = 0;
+  while (received < sizeof(request) - 1) {
+    ssize_t n = recv(fd, request + received, sizeof(request) - 1 - received, 0);
+    if (n <= 0)
+      break;
+    received += n;
+    request[received] = '\0';
+    if (strstr(request, "\r\n\r\n"))
+      break;
+  }
+  request[received] = '\0';
+  char path[128] = "";
+  sscanf(request, "%*s %127s", path);
+
+  const char *type;
+  const std::string *body = route(path, type);
+  std::string answer = body ? "HTTP/1.1 200 OK\r\n" : "HTTP/1.1 404 Not Found\r\n";
+  answer += "Content-Type: " + std::string(body ? type : "text/plain") + "\r\nContent-Length: " +
+            std::to_string(body ? body->size() : 0) + "\r\nConnection: close\r\n\r\n";
+  if (body)
+    answer += *body;
+  send(fd, answer.data(), answer.size(), MSG_NOSIGNAL);
+  close(fd);
+}
+
+static void runWebServerLike() {
+  int listener = listenSocket();
+  if (listener < 0) {
+    fprintf(stderr, "cannot listen on %d\n", PORT);
+    exit(1);
+  }
+  while (serving) {
+    busyWork();
+    handleClientLikeWebServer(listener);
+    std::this_thread::sleep_for(std::chrono::milliseconds(PASS_WAIT_MS));
+  }
+  close(listener);
+}
+
+static HttpServer::Stats runHttpServer() {
+  HttpServer server;
+  for (const char *path : {"/", "/data", "/history/minute", "/history/hour", "/history/day", "/history/month"}) {
+    server.on(path, HttpServer::Method::Get, [](const HttpServer::Request &request, HttpServer::Response &response) {
+      const char *type;
+      const std::string *body = route(request.path, type);
+      response.addHeader("Access-Control-Allow-Origin", "*");
+      if (body == &page) {
+        // Streamed, like the SPIFFS file
+        response.sendStream(200, type, page.size(), [](uint8_t *buffer, size_t max, size_t offset) {
+          size_t n = std::min(max, page.size() - offset);
+          memcpy(buffer, page.data() + offset, n);
+          return n;
+        });
+      } else {
+        response.send(200, type, String(body->c_str()));
+      }
+    });
+  }
+  if (!server.begin(PORT)) {
+    fprintf(stderr, "cannot listen on %d\n", PORT);
+    exit(1);
+  }
+  unsigned long lastStep = 0;
+  while (serving) {
+    unsigned long now = millis();
+    if (now - lastStep < STEP_MS) {
+      server.serveFor(std::min(STEP_MS - (now - lastStep), PASS_WAIT_MS));
+      continue;
+    }
+    lastStep = now;
+    busyWork();
+    server.serveFor(PASS_WAIT_MS);
+  }
+  return server.getStats();
+}
+
+// ============================================================================
+// LOAD
+// ============================================================================
+struct Load
+{
+  std::vector<unsigned long> latencies; // us
+  unsigned long connections = 0;
+  unsigned long failed = 0;
+};
+
+struct Connection
+{
+  int fd = -1;
+
+  bool open(Load &load) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    timeval timeout = {10, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    load.connections++;
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+      shut();
+      return false;
+    }
+    return true;
+  }
+
+  void shut() {
+    if (fd >= 0)
+      close(fd);
+    fd = -1;
+  }
+
+  // One request; false when the connection broke before the whole answer
+  bool get(const char *path, int &status, bool &keepAlive) {
+    char request[160];
+    int length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\nAccept: */*\r\n\r\n", path);
+    if (send(fd, request, length, MSG_NOSIGNAL) != length)
+      return false;
+
+    std::string answer;
+    char buffer[8192];
+    size_t headerEnd = std::string::npos;
+    size_t total = 0;
+    while (true) {
+      ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+      if (n <= 0)
+        return false;
+      answer.append(buffer, n);
+      if (headerEnd == std::string::npos) {
+        headerEnd = answer.find("\r\n\r\n");
+        if (headerEnd == std::string::npos)
+          continue;
+        headerEnd += 4;
+        const char *contentLength = strcasestr(answer.c_str(), "\r\nContent-Length:");
+        total = headerEnd + (contentLength ? strtoul(contentLength + 17, nullptr, 10) : 0);
+        keepAlive = !strcasestr(answer.c_str(), "\r\nConnection: close");
+        status = atoi(answer.c_str() + 9);
+      }
+      if (answer.size() >= total)
+        return true;
+    }
+  }
+};
+
+static void browse(std::atomic<bool> *running, Load *load, int seed) {
+  static const char *paths[] = {"/data", "/data", "/data", "/data", "/history/minute", "/data",
+                                "/data", "/data", "/data", "/history/hour", "/data", "/data",
+                                "/data", "/data", "/history/day", "/data", "/data", "/data",
+                                "/history/month", "/"};
+  Connection connection;
+  int next = seed * 7;
+  while (*running) {
+    const char *path = paths[next++ % 20];
+    auto start = std::chrono::steady_clock::now();
+    int status = 0;
+    bool keepAlive = false, ok = false;
+    // A kept-alive connection the server closed meanwhile is retried once
+    for (int attempt = 0; attempt < 2 && !ok; attempt++) {
+      bool fresh = connection.fd < 0;
+      if (fresh && !connection.open(*load))
+        break;
+      ok = connection.get(path, status, keepAlive) && status == 200;
+      if (!ok || !keepAlive)
+        connection.shut();
+      if (!ok && fresh)
+        break;
+    }
+    if (!*running)
+      break;
+    if (ok)
+      load->latencies.push_back(
+          std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    else
+      load->failed++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(THINK_MS));
+  }
+  connection.shut();
+}
+
+static unsigned long percentile(std::vector<unsigned long> values, int percent) {
+  if (values.empty())
+    return 0;
+  std::sort(values.begin(), values.end());
+  return values[(values.size() - 1) * percent / 100];
+}
+
+static void run(bool httpServer, int clients, int seconds) {
+  serving = true;
+  HttpServer::Stats stats;
+  std::thread server([httpServer, &stats]() {
+    if (httpServer)
+      stats = runHttpServer();
+    else
+      runWebServerLike();
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  std::atomic<bool> running{true};
+  std::vector<Load> loads(clients);
+  std::vector<std::thread> browsers;
+  for (int i = 0; i < clients; i++)
+    browsers.emplace_back(browse, &running, &loads[i], i);
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  running = false;
+  for (std::thread &browser : browsers)
+    browser.join();
+  serving = false;
+  server.join();
+
+  Load all;
+  for (Load &load : loads) {
+    all.latencies.insert(all.latencies.end(), load.latencies.begin(), load.latencies.end());
+    all.connections += load.connections;
+    all.failed += load.failed;
+  }
+  printf("  %d client%s: p50 %6.1f ms, p99 %6.1f ms, %5.1f req/s, %4lu connections, %lu failed\n", clients,
+         clients > 1 ? "s" : " ", percentile(all.latencies, 50) / 1000.0, percentile(all.latencies, 99) / 1000.0,
+         all.latencies.size() / (double)seconds, all.connections, all.failed);
+  if (httpServer)
+    printf("             kept alive %lu of %lu, evicted %lu, slowest handler %lu us\n", stats.keptAlive,
+           stats.requests, stats.evicted, stats.maxHandlerMicros);
+}
+
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 10;
+  Serial.enabled = false;
+  HostFakes::followRealTime();
+  makePayloads();
+
+  printf("pass: %lu us work + %lu ms wait; clients think %lu ms; /data %zu bytes, page %zu bytes\n", WORK_US,
+         PASS_WAIT_MS, THINK_MS, data.size(), page.size());
+  printf("\nWebServer (one connection per pass, Connection: close)\n");
+  for (int clients : {1, 3, 6})
+    run(false, clients, seconds);
+  printf("\nHttpServer (serveFor, keep-alive, %u connections)\n", HttpServer::MAX_CLIENTS);
+  for (int clients : {1, 3, 6})
+    run(true, clients, seconds);
+  return 0;
+}
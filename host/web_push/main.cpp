@@ -0,0 +1,331 @@
+// web_push - three dashboards kept up to date by polling /data every 2 s and
+// by the /events stream, on the real HttpServer on 127.0.0.1.
+//
+//   pio run -e native_web_push && .pio/build/native_web_push/program [seconds]
+//
+// The loop runs like main.cpp: WORK_US of other work, the web interface's
+// update() (which looks for changes every PUSH_INTERVAL while a stream is
+// open) and serveFor(60). The data changes like at home: the P1 meter
+// pushes a new power reading every second, the sensors change every
+// SENSOR_S, a socket switches every SWITCH_S. The server side mirrors
+// WebInterface: /data is the whole ~3.5 KB document, a stream gets it once,
+// then "patch" events with only what changed, a heartbeat every 15 s and
+// the whole document again every 60 s.
+//
+// Reported per mode: bytes each dashboard received per minute, whole
+// documents and patches serialized per minute, and how long after a power reading changed the
+// dashboards had it (p50/p99).
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HostFakes.h"
+#include "HttpServer.h"
+
+static const int PORT = 18181;
+static const int DASHBOARDS = 3;
+static const unsigned long WORK_US = 2000;
+static const unsigned long PASS_WAIT_MS = 60;
+static const unsigned long POLL_MS = 2000;
+static const unsigned long PUSH_INTERVAL = 250;
+static const unsigned long HEARTBEAT_INTERVAL = 15000;
+static const unsigned long SNAPSHOT_INTERVAL = 60000;
+static const unsigned long SENSOR_S = 10;
+static const unsigned long SWITCH_S = 20;
+
+// ============================================================================
+// DATA
+// ============================================================================
+// Every power reading gets the next number, so a dashboard can tell which one
+// it has; changedAt[n] is when reading n came in
+static std::mutex changesLock;
+static std::vector<std::chrono::steady_clock::time_point> changedAt;
+
+struct Home
+{
+  long reading = 0;
+  int temperature = 214;
+  bool sockets[8] = {};
+};
+
+static unsigned long serialized = 0; // Whole documents
+static unsigned long patches = 0;
+
+static std::string dataJson(const Home &home) {
+  serialized++;
+  char part[512];
+  snprintf(part, sizeof(part), "{\"import_power\":%ld,\"export_power\":0,\"temperature\":%.1f,\"humidity\":48.2,"
+           "\"light\":120,\"phone_present\":true,\"switches\":[", home.reading, home.temperature / 10.0);
+  std::string json = part;
+  for (int i = 0; i < 8; i++) {
+    snprintf(part, sizeof(part),
+             "%s{\"state\":%s,\"duration\":%d,\"online\":true,\"stale_p50\":3,\"stale_p90\":9,"
+             "\"command\":\"done\",\"reach\":\"reachable\",\"health\":{\"breaker\":\"closed\",\"avail\":100,"
+             "\"lat_p50\":42,\"lat_p99\":180,\"ok\":%d,\"timeouts\":0,\"errors\":0,\"parse_errors\":0}}",
+             i ? "," : "", home.sockets[i] ? "true" : "false", 100 * i, 1000 + i);
+    json += part;
+  }
+  json += "],\"last_rule\":\"Solar surplus boiler\",\"last_rule_time\":\"12:01 Mon\",\"rule_history\":[";
+  for (int i = 0; i < 3; i++) {
+    snprintf(part, sizeof(part), "%s{\"name\":\"Rule %d\",\"time\":\"11:5%d Mon\"}", i ? "," : "", i, i);
+    json += part;
+  }
+  json += "],\"http\":{\"requests\":12345,\"reused\":12000,\"open\":3,\"max_open\":6,\"leaks\":0},\"phones\":[";
+  for (int i = 0; i < 4; i++) {
+    snprintf(part, sizeof(part), "%s{\"ip\":\"192.168.1.%d\",\"present\":true,\"last_reply\":2,\"avail\":1,\"lat_p50\":12}",
+             i ? "," : "", 50 + i);
+    json += part;
+  }
+  json += "],\"ip\":\"192.168.1.20\",\"free_ram\":180,\"uptime\":86400}";
+  while (json.size() < 3500)
+    json.insert(json.size() - 1, " ");
+  return json;
+}
+
+// ============================================================================
+// SERVER, as WebInterface
+// ============================================================================
+struct Server
+{
+  HttpServer http;
+  Home home, pushed;
+  unsigned long lastPush = 0, lastHeartbeat = 0, lastSnapshot = 0;
+
+  void begin() {
+    http.on("/data", HttpServer::Method::Get, [this](const HttpServer::Request &, HttpServer::Response &res) {
+      res.send(200, "application/json", String(dataJson(home).c_str()));
+    });
+    http.on("/events", HttpServer::Method::Get, [this](const HttpServer::Request &, HttpServer::Response &res) {
+      res.startEvents("data", String(dataJson(home).c_str()));
+    });
+    if (!http.begin(PORT)) {
+      fprintf(stderr, "cannot listen on %d\n", PORT);
+      exit(1);
+    }
+  }
+
+  void pushChanges(unsigned long now) {
+    if (http.getEventClientCount() == 0 || now - lastPush < PUSH_INTERVAL)
+      return;
+    lastPush = now;
+    if (now - lastSnapshot >= SNAPSHOT_INTERVAL) {
+      lastSnapshot = now;
+      http.sendEvent("data", String(dataJson(home).c_str()));
+      pushed = home;
+      return;
+    }
+
+    std::string patch;
+    char part[128];
+    if (home.reading != pushed.reading) {
+      snprintf(part, sizeof(part), ",\"import_power\":%ld,\"export_power\":0", home.reading);
+      patch += part;
+    }
+    if (home.temperature != pushed.temperature) {
+      snprintf(part, sizeof(part), ",\"temperature\":%.1f", home.temperature / 10.0);
+      patch += part;
+    }
+    std::string switches;
+    for (int i = 0; i < 8; i++) {
+      if (home.sockets[i] == pushed.sockets[i])
+        continue;
+      snprintf(part, sizeof(part), ",\"%d\":{\"state\":%s,\"online\":true,\"duration\":0,\"command\":\"done\"}", i,
+               home.sockets[i] ? "true" : "false");
+      switches += part;
+    }
+    if (!switches.empty())
+      patch += ",\"switches\":{" + switches.substr(1) + "}";
+    if (!patch.empty()) {
+      patches++;
+      http.sendEvent("patch", String(("{" + patch.substr(1) + "}").c_str()));
+      pushed = home;
+    }
+    if (now - lastHeartbeat >= HEARTBEAT_INTERVAL) {
+      lastHeartbeat = now;
+      http.sendEvent("heartbeat", "{\"uptime\":86400,\"free_ram\":180}");
+    }
+  }
+};
+
+static void busyWork() {
+  unsigned long start = micros();
+  while (micros() - start < WORK_US) {
+  }
+}
+
+// ============================================================================
+// DASHBOARDS
+// ============================================================================
+struct Dashboard
+{
+  unsigned long bytes = 0;
+  long seen = -1; // Newest power reading shown
+  std::vector<double> delays; // ms from a reading coming in to it being shown
+};
+
+static void saw(Dashboard &dashboard, const char *text) {
+  const char *power = strstr(text, "\"import_power\":");
+  if (!power)
+    return;
+  long reading = strtol(power + 15, nullptr, 10);
+  if (reading <= dashboard.seen)
+    return;
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(changesLock);
+  // Readings it skipped count from when they came in too: shown only now
+  for (long n = dashboard.seen + 1; n <= reading && n < (long)changedAt.size(); n++) {
+    if (n > 0)
+      dashboard.delays.push_back(std::chrono::duration<double, std::milli>(now - changedAt[n]).count());
+  }
+  dashboard.seen = reading;
+}
+
+static int connectToServer() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  timeval timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void pollData(std::atomic<bool> *running, Dashboard *dashboard) {
+  int fd = -1;
+  while (*running) {
+    if (fd < 0)
+      fd = connectToServer();
+    const char request[] = "GET /data HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL);
+    std::string answer;
+    size_t total = std::string::npos;
+    char buffer[4096];
+    while (answer.size() < total) {
+      ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+      if (n <= 0)
+        break;
+      answer.append(buffer, n);
+      size_t headerEnd = answer.find("\r\n\r\n");
+      if (total == std::string::npos && headerEnd != std::string::npos)
+        total = headerEnd + 4 + strtoul(strcasestr(answer.c_str(), "Content-Length:") + 15, nullptr, 10);
+    }
+    dashboard->bytes += answer.size();
+    saw(*dashboard, answer.c_str());
+    std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MS));
+  }
+  close(fd);
+}
+
+static void listenEvents(std::atomic<bool> *running, Dashboard *dashboard) {
+  int fd = connectToServer();
+  const char request[] = "GET /events HTTP/1.1\r\nHost: 127.0.0.1\r\nAccept: text/event-stream\r\n\r\n";
+  send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL);
+  std::string stream;
+  char buffer[4096];
+  while (*running) {
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n == 0)
+      break;
+    if (n < 0)
+      continue; // Timeout, look at running
+    dashboard->bytes += n;
+    stream.append(buffer, n);
+    size_t end;
+    while ((end = stream.find("\n\n")) != std::string::npos) {
+      saw(*dashboard, stream.substr(0, end).c_str());
+      stream.erase(0, end + 2);
+    }
+  }
+  close(fd);
+}
+
+// ============================================================================
+// RUN
+// ============================================================================
+static double percentile(std::vector<double> values, int percent) {
+  if (values.empty())
+    return 0;
+  std::sort(values.begin(), values.end());
+  return values[(values.size() - 1) * percent / 100];
+}
+
+static void run(bool push, int seconds) {
+  {
+    std::lock_guard<std::mutex> lock(changesLock);
+    changedAt.assign(1, std::chrono::steady_clock::now());
+  }
+  serialized = 0;
+  patches = 0;
+  Server *server = new Server();
+  server->begin();
+
+  std::atomic<bool> running{true};
+  std::vector<Dashboard> dashboards(DASHBOARDS);
+  std::vector<std::thread> threads;
+  for (Dashboard &dashboard : dashboards)
+    threads.emplace_back(push ? listenEvents : pollData, &running, &dashboard);
+
+  unsigned long start = millis(), lastReading = start, lastSensor = start, lastSwitch = start;
+  while (millis() - start < seconds * 1000UL) {
+    unsigned long now = millis();
+    busyWork();
+    if (now - lastReading >= 1000) {
+      lastReading = now;
+      std::lock_guard<std::mutex> lock(changesLock);
+      changedAt.push_back(std::chrono::steady_clock::now());
+      server->home.reading = changedAt.size() - 1;
+    }
+    if (now - lastSensor >= SENSOR_S * 1000) {
+      lastSensor = now;
+      server->home.temperature++;
+    }
+    if (now - lastSwitch >= SWITCH_S * 1000) {
+      lastSwitch = now;
+      server->home.sockets[3] = !server->home.sockets[3];
+    }
+    server->http.poll();
+    server->pushChanges(millis());
+    server->http.serveFor(PASS_WAIT_MS);
+  }
+  running = false;
+  for (std::thread &thread : threads)
+    thread.join();
+
+  std::vector<double> delays;
+  unsigned long bytes = 0;
+  for (Dashboard &dashboard : dashboards) {
+    delays.insert(delays.end(), dashboard.delays.begin(), dashboard.delays.end());
+    bytes += dashboard.bytes;
+  }
+  double minutes = seconds / 60.0;
+  printf("%s\n", push ? "push (/events)" : "polling (/data every 2 s)");
+  printf("  per dashboard: %.1f KB/min\n", bytes / 1024.0 / DASHBOARDS / minutes);
+  printf("  serialized: %.0f documents/min, %.0f patches/min\n", serialized / minutes, patches / minutes);
+  printf("  power reading shown after: p50 %.0f ms, p99 %.0f ms\n", percentile(delays, 50), percentile(delays, 99));
+  delete server;
+}
+
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 60;
+  Serial.enabled = false;
+  HostFakes::followRealTime();
+
+  printf("%d dashboards for %d s, a power reading every second\n\n", DASHBOARDS, seconds);
+  run(false, seconds);
+  run(true, seconds);
+  return 0;
+}
@@ -0,0 +1,151 @@
+// AsyncHttpClient.h
+#ifndef ASYNC_HTTP_CLIENT_H
+#define ASYNC_HTTP_CLIENT_H
+
+#include <Arduino.h>
+#include <functional>
+
+// Outcome of one request, handed to the completion callback. body points
+// into the client's buffer and is only valid during the callback.
+struct HttpResponse
+{
+    enum class Error : uint8_t
+    {
+        None,
+        Connect,  // Refused, unreachable or no socket
+        Timeout,  // No complete answer within the request's timeout
+        TooLarge, // Answer larger than AsyncHttpClient::RESPONSE_SIZE
+        Closed    // Connection dropped mid answer, or not HTTP
+    };
+
+    Error error;
+    int status; // HTTP status code, 0 on errors
+    const char *body;
+    size_t length;
+    unsigned long elapsedMs;
+
+    bool ok() const { return error == Error::None && status == 200; }
+};
+
+// Event driven HTTP/1.1 client on non-blocking lwIP sockets. request()
+// only claims a slot; poll(), called from loop(), moves every request one
+// step through connect, send, receive and parse without ever waiting, and
+// calls the callback when it completes or times out. Callbacks only ever
+// run from poll(), never from inside request(). Plain http to IPv4
+// addresses ("http://192.168.1.50/api/v1/state", optional :port).
+//
+// Connections are kept alive and pooled per address:port, at most
+// MAX_CONNECTIONS sockets open in total. An idle connection is closed after
+// KEEP_ALIVE_IDLE, when the device closed it, or to make room for another
+// device. A request on a reused connection the device already dropped is
+// retried once on a fresh one. Sockets the client holds but no request
+// owns are reported and closed (leaksClosed).
+class AsyncHttpClient
+{
+public:
+    using Callback = std::function<void(const HttpResponse &)>;
+
+    static constexpr uint8_t MAX_REQUESTS = 6;    // In flight at once, one connection each
+    static constexpr uint8_t MAX_CONNECTIONS = 6; // Open sockets, busy plus idle; lwIP has ~10
+    static constexpr size_t RESPONSE_SIZE = 2048; // P1 /api/v1/data fits with headers
+    static constexpr unsigned long DEFAULT_TIMEOUT = 2000;
+    static constexpr unsigned long KEEP_ALIVE_IDLE = 10000;
+    static constexpr uint16_t KEEP_ALIVE_MAX_USES = 100; // Then a fresh connection
+
+    struct Stats
+    {
+        unsigned long started = 0;
+        unsigned long succeeded = 0; // Complete answer, any status
+        unsigned long failed = 0;    // Connect errors, overflows, dropped connections
+        unsigned long timeouts = 0;
+        unsigned long rejected = 0;  // request() while all slots were busy
+        uint8_t maxInFlight = 0;
+
+        unsigned long connectionsOpened = 0;
+        unsigned long connectionsReused = 0;
+        unsigned long staleRetries = 0; // Reused connection was already closed
+        unsigned long leaksClosed = 0;
+        uint8_t openSockets = 0;
+        uint8_t maxOpenSockets = 0; // High-water mark
+    };
+
+    // false when the url is not http://a.b.c.d[:port]/path, the request does
+    // not fit the buffer or all slots are busy; the callback is not called
+    // in that case
+    bool request(const char *method, const String &url, const char *body, unsigned long timeoutMs, Callback done);
+    bool get(const String &url, unsigned long timeoutMs, Callback done) { return request("GET", url, nullptr, timeoutMs, done); }
+
+    void poll(); // Never blocks
+    // Setup only: polls until nothing is in flight or maxMs passed
+    void runUntilIdle(unsigned long maxMs);
+
+    // Off: "Connection: close" and a new socket per request
+    void setKeepAlive(bool enabled);
+    bool getKeepAlive() const { return keepAlive; }
+
+    uint8_t inFlight() const;
+    const Stats &getStats() const { return stats; }
+    void resetStats();
+
+private:
+    enum class State : uint8_t
+    {
+        Idle,
+        Connecting,
+        Sending,
+        Receiving,
+        Completing // Callback running, buffer still in use
+    };
+
+    enum class ConnectionState : uint8_t
+    {
+        Free,
+        Busy, // Owned by a request
+        Idle  // Kept alive for the next request to the same device
+    };
+
+    struct Connection
+    {
+        ConnectionState state = ConnectionState::Free;
+        int fd = -1;
+        uint32_t address = 0; // Network byte order
+        uint16_t port = 0;
+        unsigned long idleSince = 0;
+        uint16_t uses = 0;
+    };
+
+    struct Request
+    {
+        State state = State::Idle;
+        int8_t connection = -1; // Index in connections, -1 when connect failed
+        bool reused = false;
+        uint32_t address = 0;
+        uint16_t port = 0;
+        unsigned long started = 0;
+        unsigned long timeout = 0;
+        size_t requestLength = 0;
+        size_t sent = 0;
+        size_t received = 0;
+        Callback done;
+        char buffer[RESPONSE_SIZE]; // Request text first, then the answer
+    };
+
+    Request requests[MAX_REQUESTS];
+    Connection connections[MAX_CONNECTIONS];
+    Stats stats;
+    bool keepAlive = true;
+    unsigned long lastConnectionCheck = 0;
+
+    bool connectFresh(Request &req);
+    int8_t openConnection(uint32_t address, uint16_t port);
+    void closeConnection(int8_t index);
+    void checkConnections(unsigned long now);
+
+    void step(Request &req, unsigned long now);
+    bool answerComplete(const Request &req) const;
+    void finish(Request &req, HttpResponse::Error error, unsigned long now);
+};
+
+extern AsyncHttpClient httpClient;
+
+#endif
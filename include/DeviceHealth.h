@@ -0,0 +1,106 @@
+// DeviceHealth.h
+#ifndef DEVICE_HEALTH_H
+#define DEVICE_HEALTH_H
+
+#include <Arduino.h>
+
+struct HttpResponse;
+
+// How the requests to one device went: a latency histogram, counts per
+// outcome, availability over the last WINDOW requests, and a circuit
+// breaker.
+//
+// The breaker opens after failuresToOpen failures in a row and then refuses
+// requests, so a device that is gone costs one timeout per open period
+// instead of one per request. When the open period is over one probe is let
+// through (half open): it closes the breaker when it succeeds and opens it
+// again for twice as long, up to openMax, when it fails. Every open period
+// is stretched or shortened by up to jitterPercent, so devices that went
+// away together do not all probe in the same loop pass.
+class DeviceHealth
+{
+public:
+    enum class Outcome : uint8_t
+    {
+        Ok,
+        Timeout,
+        Connect, // Refused, unreachable or dropped
+        Http,    // Answered, but not 2xx
+        Parse    // 2xx, but not what we expected
+    };
+
+    enum class State : uint8_t
+    {
+        Closed,   // Requests go through
+        Open,     // Requests refused until the open period is over
+        HalfOpen  // One probe in flight
+    };
+
+    struct Policy
+    {
+        uint8_t failuresToOpen = 3;
+        unsigned long openMin = 2000;
+        unsigned long openMax = 120000;
+        uint8_t jitterPercent = 25;
+    };
+
+    struct Counts
+    {
+        unsigned long ok = 0;
+        unsigned long timeouts = 0;
+        unsigned long connectErrors = 0;
+        unsigned long httpErrors = 0;
+        unsigned long parseErrors = 0;
+    };
+
+    static constexpr uint8_t WINDOW = 32;  // Requests in availability()
+    static constexpr uint8_t BUCKETS = 9;  // 25 ms doubling up to 3.2 s, and above
+
+    // Before every request: false while the breaker is open, or when the
+    // half open probe is already out. A request that could not be started
+    // after all gives its turn back with cancelRequest().
+    bool allowRequest();
+    void cancelRequest();
+    void record(Outcome outcome, unsigned long latencyMs);
+    // Outcome of an answer from AsyncHttpClient; parsed is false when the
+    // body did not hold what the device needed
+    void record(const HttpResponse &response, bool parsed);
+
+    // Ends the open period early, half open: the next allowRequest()
+    // probes. For when something else saw the device come back.
+    void retryNow();
+    void setPolicy(const Policy &newPolicy) { policy = newPolicy; }
+    State getState() const { return state; }
+    const char *getStateName() const;
+    bool isAvailable() const { return state != State::Open; }
+    bool lastOk() const { return lastSucceeded; }
+    uint16_t getFailuresInRow() const { return failuresInRow; }
+    unsigned long retryIn() const; // Until the breaker lets a probe through, 0 when not open
+
+    float availability() const; // Share of the last WINDOW requests that succeeded, 1 without any
+    // Upper bound of the bucket holding the percent-th percentile of the
+    // latencies of answered requests, 0 without any
+    unsigned long latencyPercentile(uint8_t percent) const;
+    const Counts &getCounts() const { return counts; }
+    const uint32_t *getHistogram() const { return histogram; }
+    static unsigned long bucketLimit(uint8_t bucket); // Upper bound in ms, 0 for the last
+
+private:
+    Policy policy;
+    State state = State::Closed;
+    bool probeOut = false;
+    bool lastSucceeded = false;
+    uint16_t failuresInRow = 0;
+    unsigned long openedAt = 0;
+    unsigned long openFor = 0;  // This open period, jitter included
+    unsigned long backoff = 0;  // Before jitter, doubled by every failed probe
+
+    Counts counts;
+    uint32_t histogram[BUCKETS] = {};
+    uint32_t window = 0; // Bit per request, 1 when it succeeded, newest in bit 0
+    uint8_t windowCount = 0;
+
+    void open(unsigned long period);
+};
+
+#endif
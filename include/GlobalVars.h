@@ -27,6 +27,10 @@ extern DisplayManager display;
 extern TimeSync timeSync;
 extern NetworkCheck *phoneCheck;
 
+class SmartRuleSystem; // Forward declaration
+extern SmartRuleSystem ruleSystem;
+void setupRules(); // Rules.cpp
+
 struct RuleHistoryEntry
 {
     char name[32];
@@ -43,8 +47,10 @@ struct Config
     String wifi_ssid;
     String wifi_password;
     String p1_ip;
+    String p1_stream; // ws:// url of pushed measurements, empty: polling only
+    String p1_token;
     String socket_ip[NUM_SOCKETS];
-    String phone_ip;
+    String phone_ips[NetworkCheck::MAX_DEVICES]; // "phone_ips", or the single "phone_ip"
 
     float yesterdayImport;
     float yesterdayExport;
@@ -66,18 +72,15 @@ struct TimingControl
     const unsigned long LIGHT_SENSOR_INTERVAL = 500;  // 10 seconds
     const unsigned long DISPLAY_INTERVAL = 1500;      // 1.5 second
     const unsigned long P1_INTERVAL = 30000;          // 30 second
-    const unsigned long SOCKET_INTERVAL = 15000;      // 5 seconds
+    const unsigned long SOCKET_SWEEP_INTERVAL = 300000; // All sockets at once, 5 minutes
     const unsigned long WIFI_CHECK_INTERVAL = 30000;  // 30 seconds
-    const unsigned long PHONE_CHECK_INTERVAL = 60000; // 60 seconds
 
     unsigned long lastEnvSensorUpdate = 0;
     unsigned long lastLightSensorUpdate = 0;
     unsigned long lastDisplayUpdate = 0;
     unsigned long lastP1Update = 0;
     unsigned long lastSocketUpdate = 0; // for a time interval to update the socket array (as group) each socket will have individual timers too
-    unsigned long lastSocketUpdates[NUM_SOCKETS] = {0};
     unsigned long lastWiFiCheck = 0;
-    unsigned long lastPhoneCheck = 0;
 };
 
 // create a public variable for last rule used, so it can be exchanged with const char *ruleName in the addRule function by default it should contain "none"
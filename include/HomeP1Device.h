@@ -3,40 +3,74 @@
 #define HOME_P1_DEVICE_H
 
 #include <Arduino.h>
-#include <HTTPClient.h>
-#include <ArduinoJson.h>
-#include <WiFiClient.h>
+#include <WiFi.h>
+#include "AsyncHttpClient.h"
+#include "DeviceHealth.h"
+#include "JsonFields.h"
+#include "SeqLock.h"
+#include "WebSocketClient.h"
+
+// One measurement, published as a whole so readers never mix two
+struct P1Sample
+{
+    float importPower;
+    float exportPower;
+    float totalImport;
+    float totalExport;
+};
 
 class HomeP1Device
 {
 private:
-    HTTPClient http;
-    WiFiClient client;
     String baseUrl;
-    float lastImportPower;
-    float lastExportPower;
-
-    float lastTotalImport;
-    float lastTotalExport;
+    String dataUrl; // baseUrl + "/api/v1/data"
+    SeqLock<P1Sample> latest; // Written from loop(), read from any task
 
     unsigned long lastReadTime;
     const unsigned long READ_INTERVAL = 1000;
     const unsigned long HTTP_TIMEOUT = 5000;
-    bool lastReadSuccess;
-    bool getPowerData(float &importPower, float &exportPower);
-    bool makeRequest(const String &endpoint, const String &method, const String &payload = "");
+    DeviceHealth health; // Polled reads; the breaker holds them off while the meter is gone
+    bool readPending = false; // GET in flight on httpClient
+    void onPowerData(const HttpResponse &response);
+    void store(float power, float totalImport, float totalExport);
     int socketNumber;
 
+    // Pushed measurements, polling only fills in while there are none
+    WebSocketClient stream;
+    String streamUrl; // Empty: polling only
+    String streamToken;
+    bool streamActive = false;     // Connect attempt or open stream
+    bool streamSubscribed = false; // Subscribe sent on this connection
+    unsigned long streamFrames = 0; // Measurements on this connection
+    unsigned long lastFrameTime = 0;
+    unsigned long streamEnded = 0;
+    unsigned long streamWait = 0; // Before the next attempt
+    const unsigned long STREAM_STALE = 3000; // Without a measurement: poll again
+    const unsigned long STREAM_RETRY_MIN = 10000;
+    const unsigned long STREAM_RETRY_MAX = 300000;
+    void onStreamMessage(const char *text, size_t length);
+
 public:
     HomeP1Device(const char *ip);
     HomeP1Device(const char *ip, int socketNum);
+    // Subscribes to pushed measurements on a ws:// url; the meter is polled
+    // until they arrive and whenever they stop
+    void enableStream(const String &url, const String &token);
+    // Every loop() pass: takes pushed measurements, notices a silent
+    // stream and reconnects with backoff. Nothing to do without a stream.
+    void updateStream();
+    // Starts a read, at most every READ_INTERVAL and not while measurements
+    // are pushed or the breaker is open; values change when it completes
     void update();
+    bool isStreaming() const;
+    const DeviceHealth &getHealth() const { return health; }
     float getCurrentImport() const;
     float getCurrentExport() const;
     float getNetPower() const;
     bool isConnected() const;
     float getTotalImport() const;
     float getTotalExport() const;
+    P1Sample getSample() const { return latest.read(); }
 };
 
 #endif
\ No newline at end of file
@@ -2,32 +2,96 @@
 #define HOME_SOCKET_DEVICE_H
 
 #include <Arduino.h>
-#include <HTTPClient.h>
-#include <ArduinoJson.h>
-#include <WiFiClient.h>
+#include <WiFi.h>
+#include "AsyncHttpClient.h"
+#include "DeviceHealth.h"
+#include "JsonFields.h"
+#include "Reachability.h"
 
 class HomeSocketDevice
 {
+public:
+    // What became of a setState()
+    enum class CommandStatus : uint8_t
+    {
+        None,       // Unknown id, or too long ago
+        Queued,     // Waiting for the PUT before it, or for a free connection
+        Sent,       // PUT in flight
+        Done,       // The socket confirmed it
+        Unchanged,  // Already the state the socket has or is getting: not sent
+        Superseded, // A newer setState() came before it was sent
+        Failed      // PUT failed, breaker opened or WiFi gone
+    };
+
+    struct Command
+    {
+        uint32_t id = 0; // 0: none
+        bool state = false;
+        CommandStatus status = CommandStatus::None;
+    };
+
+    static const char *statusName(CommandStatus status);
+
 private:
        String baseUrl;
+    String stateUrl; // baseUrl + "/api/v1/state"
     bool lastKnownState;
-    unsigned long lastReadTime;
-    const unsigned long READ_INTERVAL = 30000;
+    const unsigned long HTTP_TIMEOUT = 2000;
     bool lastReadSuccess;
 
-    int consecutiveFailures;
+    DeviceHealth health; // Every GET and PUT, and the breaker that gates them
+    uint8_t reachId;     // In reachability: refused at once while unplugged
+    uint16_t seenRecoveries = 0;
     String deviceIP; // Store IP for better logging
-    bool makeHttpRequest(const String &endpoint, const String &method, const String &payload, String &response);
     int socketNumber;
     unsigned long lastLogTime; // For controlling log frequency
 
+    // Requests run on httpClient; their answers arrive in these
+    bool readPending = false;  // One GET at a time
+    uint32_t stateVersion = 0; // Bumped by setState and every PUT answer, older reads are stale
+    void onStateRead(const HttpResponse &response, uint32_t version);
+    void onStateWritten(const HttpResponse &response);
+    bool mayConnect(); // WiFi up and the address not known to be unreachable
+    void record(const HttpResponse &response, bool parsed);
+
+    // One PUT in flight at a time and one waiting behind it: a newer
+    // setState() replaces the waiting one, so a burst of toggles costs at
+    // most two PUTs and the socket ends in the last state asked for
+    Command queued;
+    Command sent;
+    static const uint8_t FINISHED_COMMANDS = 4; // Kept for getCommand()
+    Command finished[FINISHED_COMMANDS];
+    uint8_t finishedNext = 0;
+    bool confirmedState = false; // Last state the socket reported or accepted
+    bool confirmedKnown = false;
+    static uint32_t nextCommandId;
+    void finish(Command command, CommandStatus status);
+
 public:
     HomeSocketDevice(const char *ip, int socketNum);
-    void readStateInfo();
-    bool setState(bool state);
+    // Queues the state and returns at once with the command's id, 0 when
+    // refused (WiFi down, breaker open or unreachable). Optimistic: lastKnownState
+    // follows at once, reverted when the command fails.
+    uint32_t setState(bool state);
+    // Every loop() pass: sends the queued command once the connection is
+    // free; setState() already tries once
+    void dispatch();
+    Command getCommand(uint32_t id) const; // status None when unknown
+    Command getLatestCommand() const;
+    // Starts a GET, the state is updated when it completes. Regular reads
+    // are started by pollScheduler. Both refuse while the breaker is open
+    // or the socket does not answer ping.
     bool getState();
-    bool isConnected() const { return consecutiveFailures == 0; }
+    // Until the breaker opens or the address stops answering: a single
+    // failed request does not take the socket out of the rules
+    bool isConnected() const { return health.isAvailable() && reachability.isReachable(reachId); }
+    // Until getState() may be let through again, 0 when it is not held back
+    unsigned long retryIn() const;
+    Reachability::State getReachability() const { return reachability.getState(reachId); }
+    bool isReadPending() const { return readPending; }
     bool getCurrentState() const { return lastKnownState; }
+    const DeviceHealth &getHealth() const { return health; }
+    DeviceHealth &getHealth() { return health; }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,195 @@
+// HttpServer.h
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+
+// Event driven HTTP/1.1 server on non-blocking lwIP sockets, the server side
+// of AsyncHttpClient. poll() accepts connections, reads requests, runs the
+// handler of every complete one and sends the answers a bit at a time, for
+// all clients at once and without ever waiting. Handlers only run from
+// poll(), on the loop() task, so they can use the sockets and httpClient
+// like the rest of loop() does.
+//
+// serveFor() is loop()'s idle time: it waits in select() on the server's
+// sockets and serves whatever arrives, so a request is answered when it
+// comes in instead of when loop() gets round to the web server.
+//
+// Connections are kept alive (HTTP/1.1, or 1.0 with "Connection:
+// keep-alive") until KEEP_ALIVE_IDLE without a request. A new connection
+// while all MAX_CLIENTS are taken closes the one idle the longest, or waits
+// in the listen backlog until one is done.
+//
+// A handler can answer with startEvents() instead: the connection becomes a
+// Server-Sent Events stream (text/event-stream) that stays open, and
+// sendEvent() queues an event for every such stream. At most
+// MAX_EVENT_CLIENTS streams are open, so a slot stays free for requests; a
+// stream whose client falls EVENT_BACKLOG behind is closed, and the browser's
+// EventSource reconnects and starts over.
+class HttpServer
+{
+public:
+    enum class Method : uint8_t
+    {
+        Get,
+        Post,
+        Other
+    };
+
+    static constexpr uint8_t MAX_CLIENTS = 4;   // Connections at once; lwIP sockets are scarce
+    static constexpr size_t HEADER_SIZE = 1024; // Request line and headers
+    static constexpr size_t MAX_BODY = 16384;   // rules.json uploads
+    static constexpr size_t CHUNK_SIZE = 1024;  // Streamed bodies are read this much at a time
+    static constexpr unsigned long KEEP_ALIVE_IDLE = 15000;
+    static constexpr unsigned long REQUEST_TIMEOUT = 5000; // To receive a request, or to send its answer
+    static constexpr uint8_t MAX_EVENT_CLIENTS = MAX_CLIENTS - 1;
+    static constexpr size_t EVENT_BACKLOG = 8192; // Unsent event bytes per stream, two snapshots
+    static constexpr unsigned long EVENT_RETRY = 3000; // Browser reconnect delay after a dropped stream
+
+    class Request
+    {
+    public:
+        Method method = Method::Other;
+        const char *path = "";
+
+        bool hasArg(const char *name) const;
+        String arg(const char *name) const;     // Query parameter, decoded, "" when missing
+        String header(const char *name) const;  // "" when missing
+        const String &body() const { return *bodyText; }
+
+    private:
+        friend class HttpServer;
+        const char *query = "";
+        const char *headers = ""; // From the CRLF ending the request line
+        const String *bodyText = nullptr;
+    };
+
+    // Writes up to max bytes of the body, from offset on; returns how many
+    using Filler = std::function<size_t(uint8_t *buffer, size_t max, size_t offset)>;
+
+    class Response
+    {
+    public:
+        void addHeader(const char *name, const String &value);
+        void send(int status, const char *contentType, const String &body);
+        void send(int status, const char *contentType, const char *body) { send(status, contentType, String(body)); }
+        // Copied, so data can be a buffer on the handler's stack; binary is fine
+        void send(int status, const char *contentType, const uint8_t *data, size_t length);
+        // Not copied: data must stay valid, like flash or a static buffer
+        void sendStatic(int status, const char *contentType, const uint8_t *data, size_t length);
+        // length bytes from filler, read as the connection takes them
+        void sendStream(int status, const char *contentType, size_t length, Filler filler);
+        // Keeps the connection as an event stream, first event included
+        void startEvents(const char *event, const String &data);
+        // Tags the answer with etag (quotes included); when the request's
+        // If-None-Match has it already, answers 304 without a body and
+        // returns true, so the handler has nothing more to send
+        bool notModified(const Request &request, const char *etag);
+        bool isSent() const { return status != 0; }
+
+    private:
+        friend class HttpServer;
+        int status = 0;
+        const char *contentType = "";
+        String extraHeaders;
+        String owned;
+        const uint8_t *data = nullptr;
+        size_t length = 0;
+        Filler filler;
+        bool events = false;
+    };
+
+    using Handler = std::function<void(const Request &, Response &)>;
+
+    struct Stats
+    {
+        unsigned long requests = 0;
+        unsigned long notFound = 0;
+        unsigned long notModified = 0;      // 304s: the client's copy was current
+        unsigned long accepted = 0;         // Connections
+        unsigned long keptAlive = 0;        // Requests on a connection that served one before
+        unsigned long evicted = 0;          // Idle connections closed for a new one
+        unsigned long timeouts = 0;         // Requests or answers that took too long
+        unsigned long rejected = 0;         // Malformed or too large
+        unsigned long maxHandlerMicros = 0; // Slowest handler
+        unsigned long events = 0;           // Sent to a stream
+        unsigned long eventBytes = 0;
+        unsigned long streamsDropped = 0;   // Fell EVENT_BACKLOG behind
+        uint8_t maxClients = 0;
+    };
+
+    ~HttpServer();
+    bool begin(uint16_t port);
+    void on(const char *path, Method method, Handler handler); // Exact path, without the query
+    void onNotFound(Handler handler) { notFound = handler; }
+
+    // Queues an event for every open stream, returns how many there are
+    uint8_t sendEvent(const char *event, const String &data);
+    uint8_t getEventClientCount() const;
+
+    void poll(); // Never blocks
+    // Serves for ms, waiting in select() between requests
+    void serveFor(unsigned long ms);
+
+    uint8_t getClientCount() const;
+    const Stats &getStats() const { return stats; }
+    void resetStats() { stats = Stats(); }
+
+private:
+    enum class State : uint8_t
+    {
+        Free,
+        Reading, // Waiting for, or receiving, a request
+        Writing, // Sending the answer
+        Events   // An event stream: head holds what is still to be sent
+    };
+
+    struct Client
+    {
+        State state = State::Free;
+        int fd = -1;
+        unsigned long lastActivity = 0;
+        unsigned long requestStarted = 0; // First byte of the request being read
+        bool servedBefore = false;
+        bool keepAlive = false;
+
+        char header[HEADER_SIZE];
+        size_t received = 0;   // Bytes in header, may run into the body or the next request
+        size_t headerEnd = 0;  // Length of the header section with its blank line, 0 until complete
+        size_t bodyLength = 0; // Content-Length
+        String body;
+
+        String head; // Status line and headers of the answer
+        Response response;
+        size_t sent = 0; // Of head, then of the body
+    };
+
+    struct Route
+    {
+        String path;
+        Method method;
+        Handler handler;
+    };
+
+    int listener = -1;
+    Client clients[MAX_CLIENTS];
+    std::vector<Route> routes;
+    Handler notFound;
+    Stats stats;
+
+    Client *roomForClient(); // Free, or idle the longest; nullptr when all busy
+    void acceptClients(unsigned long now);
+    void readRequest(Client &client, unsigned long now);
+    bool parse(Client &client); // false when the request was answered with an error
+    void dispatch(Client &client);
+    void startAnswer(Client &client, Response &response);
+    void writeAnswer(Client &client, unsigned long now);
+    void serveEvents(Client &client, unsigned long now);
+    void finishAnswer(Client &client); // Answer sent: next request or close
+    void fail(Client &client, int status);
+    void drop(Client &client);
+};
+
+#endif
@@ -0,0 +1,57 @@
+// IcmpEcho.h
+#ifndef ICMP_ECHO_H
+#define ICMP_ECHO_H
+
+#include <Arduino.h>
+#include <functional>
+
+// One non-blocking ICMP socket for everything that pings: the phone check
+// and the socket reachability cache share it, lwIP has only ~10 sockets.
+// send() returns at once with the probe's sequence number; poll() reads the
+// replies that arrived and offers each to the listeners until one claims
+// it. Nothing waits for a reply, timeouts are up to the senders.
+class IcmpEcho
+{
+public:
+    static constexpr uint8_t MAX_LISTENERS = 2;
+    static constexpr unsigned long REOPEN_INTERVAL = 10000; // After socket() failed
+
+    // from in network byte order; true when the reply was to one of its probes
+    using Listener = std::function<bool(uint32_t from, uint16_t sequence)>;
+
+    struct Stats
+    {
+        unsigned long sent = 0;
+        unsigned long replies = 0;
+        unsigned long stray = 0;      // Replies nobody claimed: late, or not ours
+        unsigned long sendErrors = 0;
+    };
+
+    IcmpEcho();
+    ~IcmpEcho();
+    int8_t listen(Listener listener); // -1 when full
+    void unlisten(int8_t id);
+    // Echo request to address (network byte order). false when it could not
+    // be sent; isOpen() tells whether the socket is gone.
+    bool send(uint32_t address, uint16_t &sequence);
+    void poll(); // Never blocks
+    bool isOpen() const { return fd >= 0; }
+    const Stats &getStats() const { return stats; }
+
+private:
+    Listener listeners[MAX_LISTENERS];
+    int fd = -1;
+    bool raw = false; // Raw socket: replies start with the IP header, identifier is ours
+    uint16_t identifier;
+    uint16_t nextSequence = 1;
+    unsigned long lastOpenAttempt = 0;
+    bool everOpened = false;
+    Stats stats;
+
+    bool ready(); // Open, or opened again after REOPEN_INTERVAL
+    void close();
+};
+
+extern IcmpEcho icmpEcho;
+
+#endif
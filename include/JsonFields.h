@@ -0,0 +1,63 @@
+// JsonFields.h
+#ifndef JSON_FIELDS_H
+#define JSON_FIELDS_H
+
+#include <Arduino.h>
+
+// Picks a few top-level number, bool and short string fields out of a JSON
+// object in one pass over the text, without building a document: other
+// fields are skipped, and scanning stops once every field was seen. A
+// nested object is read by a second JsonFields of its own.
+//
+//   float power;
+//   JsonFields fields;
+//   fields.number("active_power_w", power);
+//   if (fields.read(body, length)) ...
+class JsonFields
+{
+public:
+    static constexpr uint8_t MAX_FIELDS = 6;
+
+    JsonFields &number(const char *key, float &out);
+    JsonFields &flag(const char *key, bool &out);
+    // Copied without unescaping, NUL terminated; a longer string counts as
+    // missing
+    JsonFields &text(const char *key, char *out, size_t size);
+    // Found when the value is an object and inner.read() accepts it
+    JsonFields &object(const char *key, JsonFields &inner);
+
+    // true when the text is a JSON object holding every registered field
+    // with the right type. Outputs of fields that were found are written
+    // even when it returns false.
+    bool read(const char *json, size_t length);
+
+    // Key of the first field missing after read(), for error messages
+    const char *missing() const;
+
+private:
+    enum class Kind : uint8_t
+    {
+        Number,
+        Flag,
+        Text,
+        Object
+    };
+
+    struct Field
+    {
+        const char *key;
+        uint8_t keyLength;
+        Kind kind;
+        void *out; // float, bool, char[size] or JsonFields
+        size_t size;
+        bool found;
+    };
+
+    Field fields[MAX_FIELDS];
+    uint8_t count = 0;
+
+    JsonFields &add(const char *key, Kind kind, void *out, size_t size);
+    bool store(Field &field, const char *value, size_t length);
+};
+
+#endif
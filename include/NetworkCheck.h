@@ -4,22 +4,89 @@
 
 #include <Arduino.h>
 #include <WiFi.h>
-#include <ESP32Ping.h>
+#include "DeviceHealth.h"
+#include "IcmpEcho.h"
 
+// Presence of the phones (config "phone_ips") on the network, by ICMP echo.
+// poll(), called from every loop() pass, sends the probes that are due and
+// reads the replies on icmpEcho's non-blocking socket; nothing ever waits
+// for a reply. isDevicePresent() only reads the outcome, so the web handlers and
+// the rules can call it as often as they like.
+//
+// Every probe sent stays in a table (device, sequence number, time) until
+// its reply is matched or it times out. A device is present from its first
+// reply. It is only away after MISSES_TO_LEAVE missed probes in a row and
+// no reply for awayAfter, so a phone that dozes off for a minute does not
+// flap the rules; after a miss it is probed more often to find out sooner.
 class NetworkCheck
 {
+public:
+    static constexpr uint8_t MAX_DEVICES = 4;
+    static constexpr uint8_t MAX_PROBES = 8; // Out at once, all devices
+    static constexpr uint8_t MISSES_TO_LEAVE = 3;
+
+    struct Timing
+    {
+        unsigned long probeTimeout = 1000;
+        unsigned long presentInterval = 20000; // Between probes of a present device
+        unsigned long confirmInterval = 5000;  // After a miss, while still present
+        unsigned long absentInterval = 10000;  // Away: an arrival shows within this
+        unsigned long awayAfter = 180000;      // Without a reply, and MISSES_TO_LEAVE misses
+    };
+
+    struct Device
+    {
+        String ip;
+        uint32_t address = 0; // Network byte order, 0 when ip is not an address
+        bool present = false;
+        uint8_t misses = 0;  // In a row
+        unsigned long lastReply = 0;
+        unsigned long changedAt = 0;
+        unsigned long nextProbe = 0;
+        DeviceHealth health; // Probe round trips; absence is normal, so no breaker
+    };
+
+    struct Stats
+    {
+        unsigned long probes = 0;
+        unsigned long replies = 0;
+        unsigned long timeouts = 0;
+        unsigned long sendErrors = 0; // Table full, no socket or sendto() refused
+        unsigned long ridOut = 0;     // Misses that did not make a device away
+    };
+
+    NetworkCheck();
+    ~NetworkCheck();
+    bool addDevice(const char *ip); // false when full or not an address
+    void poll();                    // Never blocks
+    bool isDevicePresent();         // Any device
+    bool isDevicePresent(uint8_t index) const;
+    uint8_t getDeviceCount() const { return deviceCount; }
+    const Device &getDevice(uint8_t index) const { return devices[index]; }
+    void setTiming(const Timing &newTiming) { timing = newTiming; }
+    const Stats &getStats() const { return stats; }
+
 private:
-    String deviceIP;
-    bool lastKnownState;
-    unsigned long lastCheckTime;
-    const unsigned long CHECK_INTERVAL = 60000; // Check every minute
-    int consecutiveFailures;
+    struct Probe
+    {
+        bool active = false;
+        uint8_t device = 0;
+        uint16_t sequence = 0;
+        unsigned long sentAt = 0;
+    };
 
-    bool pingDevice();
+    Device devices[MAX_DEVICES];
+    uint8_t deviceCount = 0;
+    Probe probes[MAX_PROBES];
+    Timing timing;
+    Stats stats;
+    int8_t listenerId = -1;
 
-public:
-    NetworkCheck(const char *ip);
-    bool isDevicePresent();
+    bool sendProbe(uint8_t index, unsigned long now);
+    bool onReply(uint32_t from, uint16_t sequence);
+    void expireProbes(unsigned long now);
+    void replied(uint8_t index, unsigned long roundTrip, unsigned long now);
+    void missed(uint8_t index, unsigned long now);
 };
 
 #endif
\ No newline at end of file
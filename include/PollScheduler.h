@@ -0,0 +1,113 @@
+// PollScheduler.h
+#ifndef POLL_SCHEDULER_H
+#define POLL_SCHEDULER_H
+
+#include <Arduino.h>
+#include "Constants.h"
+
+class HomeSocketDevice;
+
+// Decides when each socket's state is read. The sockets sit in a min-heap
+// keyed by the time they are due; poll(), called from loop(), starts the
+// reads that are due while the request budget allows. How soon a socket is
+// due again depends on what its last read found:
+//  - after setState() or a change nobody asked for: every fast interval,
+//    FAST_READS times
+//  - unchanged: from the base interval, 1.5x longer per read up to max
+//  - failed: again after offlineStep until the socket's circuit breaker
+//    opens (DeviceHealth) or its address stops answering ping
+//    (Reachability), then when either lets a request through
+// The socket reports every finished read with readDone(), also for reads
+// the scheduler did not start.
+class PollScheduler
+{
+public:
+    static constexpr uint8_t MAX_DEVICES = NUM_SOCKETS;
+    static constexpr uint8_t FAST_READS = 3;
+    static constexpr uint8_t STALENESS_SAMPLES = 32; // Per device
+    static constexpr unsigned long BUSY_RETRY = 100; // All client slots taken
+
+    struct Intervals
+    {
+        unsigned long fast = 1000;
+        unsigned long base = 15000;
+        unsigned long max = 30000;
+        unsigned long offlineStep = 2000; // After a failed read, breaker still closed
+    };
+
+    struct Stats
+    {
+        unsigned long reads = 0;         // Started by the scheduler
+        unsigned long budgetWaits = 0;   // Reads that were due but over budget
+        unsigned long busyRetries = 0;   // getState() refused, retried after BUSY_RETRY
+        unsigned long breakerWaits = 0;  // Due while the breaker was open or the socket unreachable
+        unsigned long expedited = 0;     // setState(), suspected or seen changes
+    };
+
+    // Time between two successful reads of a device, the age its state
+    // reaches before it is refreshed; over the last STALENESS_SAMPLES reads
+    struct Staleness
+    {
+        unsigned long p50;
+        unsigned long p90;
+        unsigned long max;
+        uint8_t samples;
+    };
+
+    PollScheduler();
+
+    // number is the socket number, 1 based; first read after firstDelay
+    void add(HomeSocketDevice *device, int number, unsigned long firstDelay);
+    void poll(); // Never blocks
+    // Read soon: after setState() or when a manual change is suspected
+    void expedite(int number);
+    void readDone(int number, bool ok, bool changed);
+
+    // At most requestsPerSecond reads on average, burst at once
+    void setBudget(float requestsPerSecond, uint8_t burst);
+    void setIntervals(const Intervals &newIntervals) { intervals = newIntervals; }
+
+    Staleness getStaleness(int number) const;
+    unsigned long getInterval(int number) const; // Until the next read, as last planned
+    const Stats &getStats() const { return stats; }
+    void resetStats();
+
+private:
+    struct Entry
+    {
+        HomeSocketDevice *device = nullptr;
+        unsigned long due = 0;
+        unsigned long interval = 0;
+        uint8_t fastReadsLeft = 0;
+        bool reading = false; // Out of the heap until readDone()
+        bool waited = false;  // Counted in budgetWaits for this read
+        bool everRead = false;
+        unsigned long lastRead = 0;
+        uint32_t staleness[STALENESS_SAMPLES];
+        uint8_t stalenessNext = 0;
+        uint8_t stalenessCount = 0;
+    };
+
+    Entry entries[MAX_DEVICES]; // By number - 1
+    uint8_t heap[MAX_DEVICES];  // Entry indexes, earliest due first
+    int8_t position[MAX_DEVICES]; // Index in heap, -1 when not in it
+    uint8_t heapSize = 0;
+
+    Intervals intervals;
+    float budgetPerSecond = 4;
+    uint8_t budgetBurst = 4;
+    float tokens = 4;
+    unsigned long lastRefill = 0;
+    Stats stats;
+
+    bool earlier(uint8_t a, uint8_t b) const;
+    void swap(uint8_t i, uint8_t j);
+    void siftUp(uint8_t i);
+    void siftDown(uint8_t i);
+    void schedule(uint8_t index, unsigned long due); // Insert or move
+    void remove(uint8_t index);
+};
+
+extern PollScheduler pollScheduler;
+
+#endif
@@ -4,6 +4,7 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <SPIFFS.h>
+#include <functional>
 
 struct PowerDataPoint
 {
@@ -15,6 +16,14 @@ struct PowerDataPoint
 class PowerHistory
 {
 public:
+    enum class Tier : uint8_t
+    {
+        Minute,
+        Hour,
+        Day,
+        Month
+    };
+
     PowerHistory();
 
     // Call these from main loop at appropriate intervals
@@ -27,6 +36,29 @@ public:
     String getHourDataJson();
     String getDayDataJson();
     String getMonthDataJson();
+    // Points the tier got since boot, loaded ones included: goes up whenever
+    // its points change, so its JSON can be kept until then, and is the
+    // cursor of the delta writers below
+    uint32_t getVersion(Tier tier) const { return versions[(int)tier]; }
+    static const char *tierName(Tier tier);
+
+    // Takes what a writer below writes, a few bytes at a time, in order
+    using Sink = std::function<void(const uint8_t *piece, size_t length)>;
+
+    // The tier's points added after cursor since (an earlier getVersion()),
+    // or all it holds (with "reset") when since is not one it can answer,
+    // handed to out straight from the ring buffer. Nothing is kept between
+    // pieces, so the same bytes come again while getVersion() stays.
+    //
+    // JSON: "minute":{"unit":"W","count":60,"next":123,"reset":false,
+    //       "import":[...],"export":[...]}, a member for the caller's object.
+    // Binary, little endian: tier (u8), flags (u8, 1 = reset), count (u16,
+    // points held now), next (u32), points that follow (u16), scale (u16),
+    // then the import values and the export values, each times scale as
+    // an int16 difference to the one before (the first to 0), or -32768
+    // followed by the int32 value when the difference does not fit
+    void writeJson(Tier tier, uint32_t since, const Sink &out) const;
+    void writeBinary(Tier tier, uint32_t since, const Sink &out) const;
 
     // Load/save daily data from SPIFFS
     void loadFromSpiffs();
@@ -65,6 +97,8 @@ private:
     int dayCount = 0;
     int monthCount = 0;
 
+    uint32_t versions[4] = {};
+
     // Timing
     unsigned long lastMinuteUpdate = 0;
     unsigned long lastHourUpdate = 0;
@@ -79,6 +113,18 @@ private:
     float dayImportAccum = 0;
     float dayExportAccum = 0;
 
+    // A tier's ring buffer, for the delta writers
+    struct Ring
+    {
+        const PowerDataPoint *data;
+        int size;
+        int count;
+        int index; // Where the next point goes
+        const char *unit;
+        uint16_t scale; // Binary values are in unit / scale
+    };
+    Ring ring(Tier tier) const;
+
     // Helper to create JSON array from circular buffer
     String bufferToJson(PowerDataPoint *buffer, int count, int currentIndex, int maxSize, const char *unit);
 };
@@ -0,0 +1,99 @@
+// Reachability.h
+#ifndef REACHABILITY_H
+#define REACHABILITY_H
+
+#include <Arduino.h>
+#include "IcmpEcho.h"
+
+// Whether a device's address answers at all, so the requests to a socket
+// that is unplugged are refused at once instead of each one waiting out its
+// HTTP timeout and holding a client slot meanwhile.
+//
+// Nothing is probed while requests succeed, apart from one echo after the
+// first answer to learn whether the device answers ping at all. After a
+// request fails without an answer (timeout, refused or unreachable) the
+// address gets an ICMP echo: no reply within probeTimeout makes it
+// unreachable, and it is then probed every probeInterval until it replies.
+// Only unreachable addresses are refused. An address that never answered an
+// echo is never gated, so a device that ignores ping is left to its circuit
+// breaker instead of being shut out for good.
+class Reachability
+{
+public:
+    static constexpr uint8_t MAX_ADDRESSES = 12;
+    static constexpr uint8_t NONE = 0xFF;
+
+    enum class State : uint8_t
+    {
+        Unknown,    // Requests go through; nothing learned yet
+        Reachable,  // Answered a request or an echo
+        Checking,   // A request failed, echo out
+        Unreachable // Echo unanswered: requests refused until one is answered
+    };
+
+    struct Timing
+    {
+        unsigned long probeTimeout = 300;  // A LAN device answers in a few ms
+        unsigned long probeInterval = 3000; // While unreachable
+    };
+
+    struct Stats
+    {
+        unsigned long probes = 0;
+        unsigned long replies = 0;
+        unsigned long timeouts = 0;
+        unsigned long refused = 0; // Requests not started because unreachable
+    };
+
+    ~Reachability();
+    // "a.b.c.d" or "a.b.c.d:port"; the same address twice gets the same id.
+    // NONE when full or not an address: such an id is never gated.
+    uint8_t add(const char *ip);
+    // Before every request; counts it in refused when false
+    bool allowRequest(uint8_t id);
+    bool isReachable(uint8_t id) const; // Not known to be unreachable
+    void requestFailed(uint8_t id);    // No answer at all: check the address
+    void requestSucceeded(uint8_t id);
+    // Until an unreachable address is probed again and may be back, 0 when
+    // requests are allowed
+    unsigned long retryIn(uint8_t id) const;
+    // Bumped whenever an unreachable address answers again, so its users
+    // can stop waiting for a backoff of their own
+    uint16_t getRecoveries(uint8_t id) const;
+    State getState(uint8_t id) const;
+    static const char *stateName(State state);
+
+    void poll(); // Never blocks
+    void setTiming(const Timing &newTiming) { timing = newTiming; }
+    const Stats &getStats() const { return stats; }
+
+private:
+    struct Entry
+    {
+        uint32_t address = 0; // Network byte order
+        char ip[16] = "";     // For the log
+        State state = State::Unknown;
+        bool echoSeen = false;  // Answered an echo once: may be gated
+        bool echoTried = false; // The echo after the first answer went out
+        bool probeWanted = false;
+        bool probeOut = false;
+        uint16_t sequence = 0;
+        unsigned long sentAt = 0;
+        unsigned long nextProbe = 0;
+        uint16_t recoveries = 0;
+    };
+
+    Entry entries[MAX_ADDRESSES];
+    uint8_t count = 0;
+    Timing timing;
+    Stats stats;
+    int8_t listenerId = -1;
+
+    void probeSoon(Entry &entry, unsigned long delay);
+    void expired(Entry &entry);
+    bool onReply(uint32_t from, uint16_t sequence);
+};
+
+extern Reachability reachability;
+
+#endif
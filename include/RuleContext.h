@@ -0,0 +1,64 @@
+// RuleContext.h
+#ifndef RULE_CONTEXT_H
+#define RULE_CONTEXT_H
+
+#include <cstdint>
+#include "Constants.h"
+
+// Input sources a rule can depend on. Each compiled rule records the
+// union of its instructions' inputs; update() only re-runs rules whose
+// inputs changed since the previous pass.
+enum RuleInput : uint16_t
+{
+    INPUT_CLOCK = 1 << 0,   // minute of day, day of week, sun times
+    INPUT_LIGHT = 1 << 1,   // BH1750 lux
+    INPUT_CLIMATE = 1 << 2, // BME280 temperature, humidity, pressure
+    INPUT_POWER = 1 << 3,   // P1 import / export
+    INPUT_PHONE = 1 << 4,   // phone presence
+    INPUT_TICK = 1 << 5,    // millis() based or opaque: evaluate every pass
+    INPUT_SOCKET = 1 << 8,  // socket N state is INPUT_SOCKET << N (0-based)
+    INPUT_ALL = 0xFFFF
+};
+
+// Snapshot of every input the rules read, taken once at the start of
+// SmartRuleSystem::update(). All rules of one pass see the same minute,
+// sensor values and socket states, and nothing in the pass calls
+// getLocalTime() or the sensors again.
+struct RuleContext
+{
+    unsigned long now; // millis() when the snapshot was taken
+
+    // Clock, all -1 / 0 until the time is synchronised
+    bool timeValid;
+    int minuteOfDay; // 0-1439
+    int second;      // 0-59, to turn minute boundaries into millis()
+    int dayOfWeek;   // 1-7 (Mon-Sun)
+    uint8_t dayMask; // MONDAY..SUNDAY bit from Constants.h
+    int dayOfYear;   // 0-365
+    int sunriseMinutes;
+    int sunsetMinutes;
+
+    // Environment sensors
+    float light; // lux
+    bool hasBME280;
+    float temperature; // degrees C
+    float humidity;    // percent
+    float pressure;    // hPa
+
+    // P1 meter, 0 W when not present
+    bool hasP1;
+    float importPower;
+    float exportPower;
+
+    // Phone presence
+    bool hasPhoneCheck;
+    bool phonePresent;
+
+    // Sockets (0-based), physical state as read at the start of the pass
+    bool socketOn[NUM_SOCKETS];
+    unsigned long socketChangedAt[NUM_SOCKETS]; // millis() of last state change
+};
+
+static_assert(NUM_SOCKETS <= 8, "RuleInput has 8 socket bits");
+
+#endif
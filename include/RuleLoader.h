@@ -0,0 +1,55 @@
+// RuleLoader.h
+#ifndef RULE_LOADER_H
+#define RULE_LOADER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <vector>
+#include "SmartRuleSystem.h"
+
+// Builds rules from a rules.json stream with the regular SmartRuleSystem
+// builders. The "rules" array is read one element at a time into a small
+// document, so the file size does not matter; only the compiled program
+// and one NUL separated name store stay behind. Format in README.md.
+class RuleLoader
+{
+public:
+    explicit RuleLoader(SmartRuleSystem &target) : rs(target) {}
+
+    // Adds every rule of the stream to the target, false on the first error
+    bool parse(Stream &in);
+
+    const char *getError() const { return error; }
+    int getRuleCount() const { return ruleCount; }
+
+private:
+    SmartRuleSystem &rs;
+    std::vector<char> names;
+    int ruleCount = 0;
+    bool failed = false;
+    char error[96] = "";
+
+    void addRule(JsonObjectConst rule);
+    RuleAction action(JsonVariantConst value);
+    RuleCondition condition(JsonVariantConst value);
+    RuleCondition conditionOrTrue(JsonVariantConst value); // Missing "when" = always
+    TimeOfDay time(JsonVariantConst value);
+    TimeOfDay clock(JsonVariantConst value); // "HH:MM", anything else fails
+    void fail(const char *format, ...);
+};
+
+// Result of loadRulesFile(), for Serial and the POST /rules response
+struct RuleLoadReport
+{
+    int ruleCount = 0;
+    unsigned long loadMicros = 0;
+    size_t rulesetBytes = 0; // SmartRuleSystem::getRulesetBytes() of the new set
+    int heapUsed = 0;        // Free heap before minus after, old set released
+    char error[96] = "";
+};
+
+// Parses path into a staging rule system and swaps it into ruleSystem only
+// when the whole file loaded; on any error the running rules stay as they are
+bool loadRulesFile(const char *path, RuleLoadReport &report);
+
+#endif
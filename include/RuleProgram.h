@@ -0,0 +1,198 @@
+// RuleProgram.h
+#ifndef RULE_PROGRAM_H
+#define RULE_PROGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "RuleContext.h"
+
+enum class RuleDecision
+{
+    Skip,
+    On,
+    Off
+};
+
+// Opcodes of the rule bytecode. Condition ops set the accumulator,
+// jumps short-circuit allOf/anyOf, Decide/CallAction/Hysteresis/SolarHeater
+// end the program.
+enum class RuleOp : uint8_t
+{
+    Const,         // acc = u8
+    Not,           // acc = !acc
+    JumpIfFalse,   // if !acc: pc += i16
+    JumpIfTrue,    // if acc: pc += i16
+    Decide,        // u8 = decisions(whenTrue, whenFalse), CONTINUE falls through
+    CallCondition, // acc = conditionCalls[i16](context)
+    CallAction,    // return actionCalls[i16](context)
+
+    LightBelow, // f32 = lux
+    LightAbove,
+    TemperatureAbove, // f32 = degrees C, false without BME280
+    TemperatureBelow,
+    HumidityAbove, // f32 = percent, false without BME280
+    HumidityBelow,
+    PressureAbove, // f32 = hPa, false without BME280
+    PressureBelow,
+    ExportAbove, // f32 = watts, false without P1 meter
+    ExportBelow,
+    ImportAbove,
+
+    PhonePresent, // false without phone check
+    PhoneAbsent,  // false without phone check
+    DayMask,      // u8 = MONDAY..SUNDAY bits from Constants.h
+
+    TimeBetween,  // i16 = start, i32 = end (minutes, both inclusive)
+    TimeAfter,    // i16 = start, i32 = window length (0 = until midnight)
+    PeriodEnding, // i16 = end, true during the last 2 minutes up to end
+
+    SunUp,
+    SunDown,
+    BeforeSunrise, // i32 = minutes
+    AfterSunrise,
+    BeforeSunset,
+    AfterSunset,
+
+    SocketOn,  // u8 = socket index (0-based)
+    SocketOff,
+    OnFor,     // u8 = socket index, i32 = minutes
+    OffFor,
+
+    // Stateful ops, u8 = state slot in SmartRuleSystem
+    HoldFor,     // acc = acc has held for i32 ms (restarts after firing)
+    TimeWindow,  // acc = window i16..i32 open, one-shot off when it closes
+    Hysteresis,  // return On/Off once acc held i16 / !acc held i32 minutes, else Skip
+    SolarHeater  // return heater decision, acc = extra condition, limits in the slot
+};
+
+// One instruction is 8 bytes so a whole ruleset sits in a single small array
+struct RuleInstr
+{
+    RuleOp op;
+    uint8_t u8;  // socket index, day mask, decision pair
+    int16_t i16; // minutes of day, jump offset, call index
+    union
+    {
+        float f32;   // sensor threshold
+        int32_t i32; // second time operand or duration
+    };
+};
+
+// Callables referenced by CallCondition / CallAction
+typedef std::function<bool(const RuleContext &)> ConditionCall;
+typedef std::function<RuleDecision(const RuleContext &)> ActionCall;
+
+// Result type of a callable taking a RuleContext, or taking nothing.
+// Missing when F cannot be called that way (keeps the ctors below SFINAE friendly).
+template <typename F, typename = void>
+struct RuleContextResult
+{
+};
+template <typename F>
+struct RuleContextResult<F, decltype(void(std::declval<F &>()(std::declval<const RuleContext &>())))>
+{
+    typedef decltype(std::declval<F &>()(std::declval<const RuleContext &>())) type;
+};
+template <typename F, typename = void>
+struct RulePlainResult
+{
+};
+template <typename F>
+struct RulePlainResult<F, decltype(void(std::declval<F &>()()))>
+{
+    typedef decltype(std::declval<F &>()()) type;
+};
+
+// A relocatable piece of bytecode plus the opaque callables it refers to.
+// Builders return these and combinators concatenate them; addRule() copies
+// the final code into the rule system's shared program array.
+class RuleProgram
+{
+public:
+    // Decide operand: what to do for a true / false accumulator
+    static constexpr uint8_t CONTINUE = 3;
+    static uint8_t decisions(uint8_t whenTrue, uint8_t whenFalse) { return whenTrue | (whenFalse << 4); }
+    static uint8_t decisions(RuleDecision whenTrue, RuleDecision whenFalse) { return decisions((uint8_t)whenTrue, (uint8_t)whenFalse); }
+
+    std::vector<RuleInstr> code;
+    std::vector<ConditionCall> conditionCalls;
+    std::vector<ActionCall> actionCalls;
+    // Keeps state between passes (timers, closures): the rule must run every
+    // pass even when a higher precedence rule already decided its socket
+    bool stateful = false;
+
+    void emit(RuleOp op, uint8_t u8 = 0, int16_t i16 = 0, int32_t i32 = 0);
+    void emitFloat(RuleOp op, float f32);
+    void append(const RuleProgram &other); // relocates call indices
+    size_t emitJump(RuleOp op);            // returns position for patchJump()
+    void patchJump(size_t at);             // jump to the current end of code
+};
+
+// Boolean expression. Any callable returning bool converts into one, so
+// hand-written lambdas keep working next to the compiled builders. They
+// should prefer reading the RuleContext over calling sensors themselves.
+class RuleCondition : public RuleProgram
+{
+public:
+    RuleCondition() { emit(RuleOp::Const, 1); } // always true
+    explicit RuleCondition(RuleProgram program) : RuleProgram(std::move(program)) {}
+
+    // [](const RuleContext &ctx) { return ctx.light < 5; }
+    template <typename F, typename = typename std::enable_if<
+                              std::is_convertible<typename RuleContextResult<F>::type, bool>::value>::type>
+    RuleCondition(F fn)
+    {
+        emit(RuleOp::CallCondition, 0, (int16_t)conditionCalls.size());
+        conditionCalls.emplace_back(std::move(fn));
+        stateful = true; // Opaque, may keep state
+    }
+
+    // []() { return digitalRead(PIN) == HIGH; }
+    template <typename F, typename = typename std::enable_if<
+                              std::is_convertible<typename RulePlainResult<F>::type, bool>::value>::type,
+              typename = void>
+    RuleCondition(F fn)
+    {
+        emit(RuleOp::CallCondition, 0, (int16_t)conditionCalls.size());
+        conditionCalls.emplace_back([fn](const RuleContext &) mutable -> bool { return fn(); });
+        stateful = true;
+    }
+
+    static RuleCondition constant(bool value);
+    static RuleCondition op(RuleOp op, uint8_t u8 = 0, int16_t i16 = 0, int32_t i32 = 0);
+    static RuleCondition threshold(RuleOp op, float value);
+};
+
+// Program that yields a RuleDecision. Lambdas returning RuleDecision are
+// wrapped as a single CallAction instruction.
+class RuleAction : public RuleProgram
+{
+public:
+    RuleAction() {} // empty program decides Skip
+    explicit RuleAction(RuleProgram program) : RuleProgram(std::move(program)) {}
+
+    template <typename F, typename = typename std::enable_if<
+                              std::is_same<typename RuleContextResult<F>::type, RuleDecision>::value>::type>
+    RuleAction(F fn)
+    {
+        emit(RuleOp::CallAction, 0, (int16_t)actionCalls.size());
+        actionCalls.emplace_back(std::move(fn));
+        stateful = true;
+    }
+
+    template <typename F, typename = typename std::enable_if<
+                              std::is_same<typename RulePlainResult<F>::type, RuleDecision>::value>::type,
+              typename = void>
+    RuleAction(F fn)
+    {
+        emit(RuleOp::CallAction, 0, (int16_t)actionCalls.size());
+        actionCalls.emplace_back([fn](const RuleContext &) mutable -> RuleDecision { return fn(); });
+        stateful = true;
+    }
+};
+
+#endif
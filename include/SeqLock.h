@@ -0,0 +1,46 @@
+// SeqLock.h
+#ifndef SEQ_LOCK_H
+#define SEQ_LOCK_H
+
+#include <atomic>
+#include <stdint.h>
+
+// Latest value of a small struct, written by one task and read by any
+// number of others without a mutex. The writer never waits; a reader that
+// overlapped a write simply copies again. T must be trivially copyable.
+template <typename T>
+class SeqLock
+{
+public:
+    void write(const T &value)
+    {
+        uint32_t start = sequence.load(std::memory_order_relaxed);
+        sequence.store(start + 1, std::memory_order_relaxed); // Odd: write in progress
+        std::atomic_thread_fence(std::memory_order_release);
+        data = value;
+        sequence.store(start + 2, std::memory_order_release);
+    }
+
+    T read() const
+    {
+        T copy;
+        uint32_t before, after;
+        do
+        {
+            before = sequence.load(std::memory_order_acquire);
+            copy = data;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        return copy;
+    }
+
+    // Number of writes so far
+    uint32_t version() const { return sequence.load(std::memory_order_acquire) / 2; }
+
+private:
+    std::atomic<uint32_t> sequence{0};
+    T data{};
+};
+
+#endif
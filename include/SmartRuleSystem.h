@@ -1,7 +1,5 @@
 #ifndef SMART_RULE_SYSTEM_H
 #define SMART_RULE_SYSTEM_H
-#include <map>
-#include <string>
 #include <functional>
 #include <vector>
 #include "GlobalVars.h"
@@ -10,6 +8,13 @@
 #include "EnvironmentSensor.h"
 #include "NetworkCheck.h"
 #include "Constants.h"
+#include "RuleProgram.h"
+#include "TimeOfDay.h"
+
+// Per-rule counters and update() timing for /rules/stats, 0 removes them
+#ifndef RULES_PROFILE
+#define RULES_PROFILE 1
+#endif
 
 extern TimeSync timeSync;
 extern EnvironmentSensors sensors;
@@ -17,13 +22,6 @@ extern NetworkCheck *phoneCheck;
 extern HomeSocketDevice *sockets[];
 extern HomeP1Device *p1Meter;
 
-enum class RuleDecision
-{
-    Skip,
-    On,
-    Off
-};
-
 class SmartRuleSystem
 {
 public:
@@ -51,34 +49,34 @@ public:
     static const char *getSunsetTime();
 
     // --- Sun-based conditions ---
-    static std::function<bool()> sunUp();
-    static std::function<bool()> sunDown();
-    static std::function<bool()> beforeSunrise(int minutes);
-    static std::function<bool()> afterSunrise(int minutes);
-    static std::function<bool()> beforeSunset(int minutes);
-    static std::function<bool()> afterSunset(int minutes);
+    static RuleCondition sunUp();
+    static RuleCondition sunDown();
+    static RuleCondition beforeSunrise(int minutes);
+    static RuleCondition afterSunrise(int minutes);
+    static RuleCondition beforeSunset(int minutes);
+    static RuleCondition afterSunset(int minutes);
 
     // --- Temperature conditions (requires BME280) ---
-    static std::function<bool()> temperatureAbove(float threshold);
-    static std::function<bool()> temperatureBelow(float threshold);
+    static RuleCondition temperatureAbove(float threshold);
+    static RuleCondition temperatureBelow(float threshold);
 
     // --- Humidity conditions (requires BME280) ---
-    static std::function<bool()> humidityAbove(float threshold);
-    static std::function<bool()> humidityBelow(float threshold);
+    static RuleCondition humidityAbove(float threshold);
+    static RuleCondition humidityBelow(float threshold);
 
     // --- Air pressure conditions (requires BME280) ---
-    static std::function<bool()> pressureAbove(float threshold);
-    static std::function<bool()> pressureBelow(float threshold);
+    static RuleCondition pressureAbove(float threshold);
+    static RuleCondition pressureBelow(float threshold);
 
     // --- Socket state conditions ---
     // Check state of other sockets (1-indexed, same as addRule)
-    std::function<bool()> socketIsOn(int socketNumber);
-    std::function<bool()> socketIsOff(int socketNumber);
+    RuleCondition socketIsOn(int socketNumber);
+    RuleCondition socketIsOff(int socketNumber);
 
     // --- Duration conditions ---
     // Check how long a socket has been in current state
-    std::function<bool()> hasBeenOnFor(int socketNumber, unsigned long minutes);
-    std::function<bool()> hasBeenOffFor(int socketNumber, unsigned long minutes);
+    RuleCondition hasBeenOnFor(int socketNumber, unsigned long minutes);
+    RuleCondition hasBeenOffFor(int socketNumber, unsigned long minutes);
 
     struct SocketState
     {
@@ -87,91 +85,122 @@ public:
         unsigned long lastManualChange = 0;
         static constexpr unsigned long MANUAL_COOLDOWN = 300000; // 5 min
         unsigned long lastStateChange = 0;
+        int16_t winningRule = -1; // Rule that decided the last pass, -1 = none
     };
 
+#if RULES_PROFILE
+    struct RuleStats
+    {
+        unsigned long evaluations = 0; // Actually run, cached reuse not counted
+        unsigned long decisionsOn = 0;
+        unsigned long decisionsOff = 0;
+        unsigned long decisionsSkip = 0;
+        unsigned long actuations = 0; // Socket switched because this rule won
+        unsigned long totalMicros = 0;
+        unsigned long maxMicros = 0;
+    };
+#endif
+
     struct Rule
     {
         int socketNumber;
-        std::function<RuleDecision()> evaluate;
+        uint16_t codeStart;  // Offset into the shared program array
+        uint16_t codeLength; // Number of instructions for this rule
+        uint16_t inputs;     // RuleInput bits the rule reads
+        RuleDecision lastDecision; // Reused while none of the inputs change
+        bool decisionValid;        // lastDecision matches the inputs seen so far
+        bool stateful;             // Always evaluated, see RuleProgram::stateful
+        unsigned long lastPass;    // update() pass that last ran or reused it
         std::function<bool()> timeWindow;
         const char *name; // Add this
+#if RULES_PROFILE
+        RuleStats stats;
+#endif
     };
 
     SmartRuleSystem();
 
     // Rule management
+    // The action is compiled into the shared program array; plain lambdas
+    // are accepted too and run as a single CallAction instruction.
+    // Rules added later take precedence: per socket they are evaluated from
+    // the last added down and evaluation stops at the first non-SKIP
+    // decision, except for stateful rules which always run.
     void addRule(int socketNumber,
                  const char *ruleName, // Add this
-                 std::function<RuleDecision()> evaluate,
+                 RuleAction evaluate,
                  std::function<bool()> timeWindow = nullptr);
     void update();
 
-    std::function<RuleDecision()> delayedOnOff(const char *startTime, const char *endTime, int onDelayMinutes, int offDelayMinutes, std::function<bool()> condition = []()
-                                                                                                                                    { return true; });
+    RuleAction delayedOnOff(TimeOfDay startTime, TimeOfDay endTime, int onDelayMinutes, int offDelayMinutes, RuleCondition condition = RuleCondition());
 
     // Condition builders
-    // static std::function<bool()> timeWindowBetween(const char *start, const char *end);
-    std::function<bool()> timeWindowBetween(const char *start, const char *end);
+    // Times are TimeOfDay values; "HH:MM" strings convert once, when the rule is built
+    RuleCondition timeWindowBetween(TimeOfDay start, TimeOfDay end);
+
+    RuleAction period(TimeOfDay startTime, TimeOfDay endTime, RuleCondition condition = RuleCondition());
+
+    RuleAction boolPeriod(TimeOfDay startTime, TimeOfDay endTime, RuleCondition condition);
 
-    std::function<RuleDecision()> period(const char *startTime, const char *endTime, std::function<bool()> condition = []()
-                                                                                     { return true; });
+    // Runs action inside the window and returns outside (default Off) otherwise
+    RuleAction during(TimeOfDay startTime, TimeOfDay endTime, RuleAction action, RuleDecision outside = RuleDecision::Off);
 
-    std::function<RuleDecision()> boolPeriod(const char *startTime, const char *endTime, std::function<bool()> condition);
+    RuleAction onAfter(TimeOfDay time, int durationMins = 0, RuleCondition condition = RuleCondition());
 
-    std::function<RuleDecision()> onAfter(const char *timeStr, int durationMins = 0, std::function<bool()> condition = []()
-                                                                                     { return true; });
+    RuleAction offAfter(TimeOfDay time, int durationMins = 0, RuleCondition condition = RuleCondition());
 
-    std::function<RuleDecision()> offAfter(const char *timeStr, int durationMins = 0, std::function<bool()> condition = []()
-                                                                                      { return true; });
+    RuleAction onCondition(RuleCondition condition);
+    RuleAction offCondition(RuleCondition condition);
 
-    std::function<RuleDecision()> onCondition(std::function<bool()> condition);
-    std::function<RuleDecision()> offCondition(std::function<bool()> condition);
+    // Opt a rule out of short-circuiting: it runs every pass even when a
+    // higher precedence rule already decided (lambdas and timers are stateful already)
+    static RuleAction stateful(RuleAction action);
     // const char *getLastActiveRule() const { return lastActiveRuleName; }
 
-    const char *rndTime(const char *time, int maxMinutes, int extraSeed = 0);
-    std::function<RuleDecision()> offConditionDelayed(std::function<bool()> condition, int delaySeconds);
-    static std::function<bool()> lightAbove(float threshold);
-
-    static std::function<bool()> lightBelow(float threshold);
-    std::function<RuleDecision()> onConditionDelayed(std::function<bool()> condition, int delaySeconds);
-    static std::function<bool()> phoneNotPresent();
-    static std::function<bool()> phonePresent();
-    static std::function<bool()> isWorkday();
-    static std::function<bool()> isWeekend();
-    static std::function<bool()> isMonday();
-    static std::function<bool()> isTuesday();
-    static std::function<bool()> isWednesday();
-    static std::function<bool()> isThursday();
-    static std::function<bool()> isFriday();
-    static std::function<bool()> isSaturday();
-    static std::function<bool()> isSunday();
-
-    static std::function<bool()> allOf(std::vector<std::function<bool()>> conditions);
-    static std::function<bool()> anyOf(std::vector<std::function<bool()>> conditions);
-    static std::function<bool()> notOf(std::function<bool()> condition);
-
-    static std::function<bool()> powerSolarActive();
-    static std::function<bool()> powerProducing();
-    static std::function<bool()> powerConsuming();
-    static std::function<bool()> powerProductionBelow(float threshold);
-    static std::function<bool()> powerProductionAbove(float threshold);
+    TimeOfDay rndTime(TimeOfDay time, int maxMinutes, int extraSeed = 0);
+    RuleAction offConditionDelayed(RuleCondition condition, int delaySeconds);
+    static RuleCondition lightAbove(float threshold);
+
+    static RuleCondition lightBelow(float threshold);
+    RuleAction onConditionDelayed(RuleCondition condition, int delaySeconds);
+    static RuleCondition phoneNotPresent();
+    static RuleCondition phonePresent();
+    static RuleCondition isWorkday();
+    static RuleCondition isWeekend();
+    static RuleCondition isMonday();
+    static RuleCondition isTuesday();
+    static RuleCondition isWednesday();
+    static RuleCondition isThursday();
+    static RuleCondition isFriday();
+    static RuleCondition isSaturday();
+    static RuleCondition isSunday();
+
+    static RuleCondition allOf(std::vector<RuleCondition> conditions);
+    static RuleCondition anyOf(std::vector<RuleCondition> conditions);
+    static RuleCondition notOf(RuleCondition condition);
+
+    static RuleCondition powerSolarActive();
+    static RuleCondition powerProducing();
+    static RuleCondition powerConsuming();
+    static RuleCondition powerProductionBelow(float threshold);
+    static RuleCondition powerProductionAbove(float threshold);
     int getDailyRandom(int index);   // Get dailyRandom[index] (0-9)
     int getDailyRandom60(int index); // Get dailyRandom60[index] (0-4)
     int getDailyRandom24(int index); // Get dailyRandom24[index] (0-2)
 
-    static std::function<bool()> after(const char *timeStr, int durationMins = 0);
+    static RuleCondition after(TimeOfDay time, int durationMins = 0);
 
     // Helper functions for time generation
-    const char *addMinutesToTime(const char *baseTime, int minutesToAdd);
-    const char *addHoursToTime(const char *baseTime, int hoursToAdd);
+    // Returned by value, wrapping around midnight
+    TimeOfDay addMinutesToTime(TimeOfDay baseTime, int minutesToAdd);
+    TimeOfDay addHoursToTime(TimeOfDay baseTime, int hoursToAdd);
 
-    std::function<RuleDecision()> solarHeaterControl(
+    RuleAction solarHeaterControl(
         float exportThreshold,
         float importThreshold,
         unsigned long minOnTime = 30000,
         unsigned long minOffTime = 30000,
-        std::function<bool()> extraCondition = []()
-        { return true; });
+        RuleCondition extraCondition = RuleCondition());
 
     unsigned long getLastActiveRuleTime() const { return lastActiveRuleTime; }
     RuleDecision getLastActiveRuleState() const { return lastActiveRuleState; }
@@ -182,14 +211,72 @@ public:
 
     void clearRules(); // Clear all rules
 
+    // Runtime loaded rule sets (RuleLoader): names of all rules back to back,
+    // NUL separated and in addRule() order; the rule system owns the copy
+    void setRuleNames(std::vector<char> names);
+    // Takes over the rules, program and state slots of other (a staging
+    // system that was built completely) and hands back the old ones
+    void swapRules(SmartRuleSystem &other);
+    size_t getRulesetBytes() const; // Heap held by rules, program, call tables and names
+
+    // Incremental evaluation: rules whose inputs did not change since the
+    // previous update() reuse their last decision
+    unsigned long getRulesEvaluated() const { return rulesEvaluated; }
+    unsigned long getRulesSkipped() const { return rulesSkipped; }
+    // Not needed because a higher precedence rule for the socket already decided
+    unsigned long getRulesShortCircuited() const { return rulesShortCircuited; }
+    // RULES_VERIFY_ORDER builds: passes where the short-circuit result differed
+    // from evaluating every rule in insertion order (must stay 0)
+    unsigned long getOrderMismatches() const { return orderMismatches; }
+
+    // Next-transition scheduler: earliest moment a time based condition
+    // (window start/end, period() turn-off, sun offsets) can flip. Clock
+    // dependent rules are only re-run when this moment is reached.
+    unsigned long getNextEventMillis() const { return nextEventMillis; } // 0 = clock not set
+    TimeOfDay getNextEventTime() const { return TimeOfDay::fromMinutes(nextClockMinute); }
+
+#if RULES_PROFILE
+    // Profiler: per-rule counters and the duration of the last update() passes
+    static constexpr uint8_t PASS_SAMPLES = 32;
+    size_t getRuleCount() const { return rules.size(); }
+    const char *getRuleName(size_t index) const { return rules[index].name; }
+    int getRuleSocket(size_t index) const { return rules[index].socketNumber; }
+    const RuleStats &getRuleStats(size_t index) const { return rules[index].stats; }
+    unsigned long getPassesTimed() const { return passesTimed; } // Since boot or resetStats()
+    unsigned long getPassMaxMicros() const { return passMaxMicros; }
+    unsigned long getPassTotalMicros() const { return passTotalMicros; }
+    // Copies up to PASS_SAMPLES pass durations, oldest first, returns the count
+    int getPassMicros(unsigned long *out) const;
+    void resetStats();
+#endif
+
 private:
-    struct DelayedState
+    // State of one stateful builder (delayedOnOff, timeWindowBetween,
+    // on/offConditionDelayed, solarHeaterControl), handed out when the rule
+    // is built and addressed by index from its instruction
+    struct RuleSlot
     {
-        bool lastCondition = false;
-        unsigned long conditionChangeTime = 0;
+        // Which builder with which parameters: a rebuild (midnight, a new
+        // rules.json) carries timers and heater state over to the slot of
+        // the same builder with the same parameters, the nth to the nth
+        const char *builder = nullptr;
+        int32_t key[2] = {};
+        bool active = false;     // condition held / timer running / window open / heater on
+        unsigned long since = 0; // millis() of the last change (window: its end time)
+        // solarHeaterControl() parameters, too wide for one instruction
+        float exportThreshold = 0;
+        float importThreshold = 0;
+        unsigned long minOnTime = 0;
+        unsigned long minOffTime = 0;
     };
-
-    std::map<std::string, DelayedState> delayedStates;
+    static constexpr uint8_t MAX_RULE_SLOTS = 32;
+    RuleSlot slots[MAX_RULE_SLOTS];
+    uint8_t slotCount = 0;
+    int allocateSlot(const char *builder, int32_t key0, int32_t key1 = 0); // -1 when the pool is full
+    // Slots of the rules clearRules() dropped, until the first update() after
+    std::vector<RuleSlot> retiredSlots;
+    // Copies active/since from the matching slot in from, when there is one
+    void carrySlotState(int index, const RuleSlot *from, int count);
 
     unsigned long lastActiveRuleTime = 0;
     RuleDecision lastActiveRuleState = RuleDecision::Skip;
@@ -197,10 +284,50 @@ private:
     // const char *lastActiveRuleName = "None";
     // int lastActiveRuleSocket = 0;
 
-    static char timeBuffer[6]; // Static buffer for time string
     std::vector<SocketState> sockets;
     std::vector<Rule> rules;
 
+    // All rules share one contiguous instruction array; closures that could
+    // not be compiled are kept in the call tables and referenced by index
+    std::vector<RuleInstr> program;
+    std::vector<ConditionCall> conditionCalls;
+    std::vector<ActionCall> actionCalls;
+
+    void captureContext(RuleContext &ctx); // one snapshot per update()
+    static uint16_t inputsOf(const RuleInstr &instr);
+    uint16_t changedInputs(const RuleContext &previous, const RuleContext &current) const;
+    int nextTransitionMinute(const RuleContext &ctx) const;
+    int nextClockMinute = 0; // Minute of day of the next transition, 1440 = midnight
+    unsigned long nextEventMillis = 0;
+    RuleContext lastContext;
+    bool lastContextValid = false; // false forces a full pass (startup, rule changes)
+    unsigned long rulesEvaluated = 0;
+    unsigned long rulesSkipped = 0;
+    unsigned long rulesShortCircuited = 0;
+    unsigned long orderMismatches = 0;
+    unsigned long passCount = 0;
+#if RULES_PROFILE
+    unsigned long passMicros[PASS_SAMPLES] = {}; // Ring buffer, no allocation per pass
+    uint8_t passSampleIndex = 0;
+    uint8_t passSampleCount = 0;
+    unsigned long passesTimed = 0;
+    unsigned long passMaxMicros = 0;
+    unsigned long passTotalMicros = 0;
+#endif
+    std::vector<uint16_t> socketRules[NUM_SOCKETS]; // Rule indices per socket, in insertion order
+    std::vector<char> ruleNames;                    // See setRuleNames(), empty for setupRules()
+    RuleDecision decide(Rule &rule, const RuleContext &ctx, uint16_t changed);
+    void verifyOrder(const RuleContext &ctx);
+    RuleDecision execute(const Rule &rule, const RuleContext &ctx);
+    RuleDecision run(const RuleInstr *pc, const RuleInstr *end,
+                     const ConditionCall *conditions, const ActionCall *actions,
+                     const RuleContext &ctx, bool &acc);
+    bool testOp(const RuleInstr &instr, const RuleContext &ctx);
+    bool holdFor(const RuleInstr &instr, const RuleContext &ctx, bool condition);
+    bool timeWindow(const RuleInstr &instr, const RuleContext &ctx);
+    RuleDecision hysteresis(const RuleInstr &instr, const RuleContext &ctx, bool condition);
+    RuleDecision solarHeater(const RuleInstr &instr, const RuleContext &ctx, bool condition);
+
     void detectManualChanges();
     void evaluateRules();
     void applyVirtualState();
@@ -213,23 +340,8 @@ private:
     static int lastGeneratedDay; // Track which day we generated for
 
     void generateDailyRandoms(); // Generate all randoms for the day
-    int timeWindowCounter = 0;
-
-    struct TimeWindowState
-    {
-        bool isActive;
-        unsigned long endTimeMillis;
-
-        // Default constructor
-        TimeWindowState() : isActive(false), endTimeMillis(0) {}
-
-        // Parameterized constructor
-        TimeWindowState(bool active, unsigned long endTime)
-            : isActive(active), endTimeMillis(endTime) {}
-    };
-    std::map<std::string, TimeWindowState> activeTimeWindows;
 
-    unsigned long calculateEndTime(int hour, int minute);
+    unsigned long calculateEndTime(TimeOfDay end, const RuleContext &ctx);
     static void calculateDailySunTimes();
     static float getLocalEarthRadius(float latitudeDeg);
 };
@@ -0,0 +1,67 @@
+// SocketSweep.h
+#ifndef SOCKET_SWEEP_H
+#define SOCKET_SWEEP_H
+
+#include <Arduino.h>
+#include <functional>
+#include "AsyncHttpClient.h"
+#include "Constants.h"
+
+class HomeSocketDevice;
+
+// Reads the state of a group of sockets with at most `width` reads in
+// flight, starting the next one as soon as one completes, so a sweep takes
+// about ceil(count / width) round trips instead of count. Like a read
+// started by pollScheduler, every read reports to the scheduler when it
+// completes. poll() never blocks; runUntilDone() is for setup().
+//
+// The width is capped by AsyncHttpClient::MAX_REQUESTS, which is sized for
+// lwIP's ~10 sockets (web server and P1 stream included). A sweep in loop()
+// should leave a few slots free for setState() and the P1 meter.
+class SocketSweep
+{
+public:
+    static constexpr uint8_t LOOP_WIDTH = 4; // In loop(): slots left for setState() and the P1 meter
+
+    // number is the socket number, 1 based
+    using Callback = std::function<void(int number, bool ok, unsigned long elapsedMs)>;
+
+    struct Stats
+    {
+        unsigned long sweeps = 0;
+        unsigned long lastSweepMs = 0;
+        uint8_t lastOnline = 0;
+        uint8_t maxInFlight = 0;
+    };
+
+    // sockets[0..count), null entries skipped. false while a sweep runs.
+    bool start(HomeSocketDevice **sockets, uint8_t count, uint8_t width, Callback done = nullptr);
+    void poll();
+    bool running() const { return active; }
+    // Setup only: polls the client and the sweep until it is done or maxMs passed
+    void runUntilDone(unsigned long maxMs);
+    const Stats &getStats() const { return stats; }
+
+private:
+    enum class Slot : uint8_t
+    {
+        Waiting,
+        Reading,
+        Done
+    };
+
+    HomeSocketDevice *devices[NUM_SOCKETS];
+    Slot slots[NUM_SOCKETS];
+    unsigned long readStarted[NUM_SOCKETS];
+    uint8_t count = 0;
+    uint8_t width = 1;
+    bool active = false;
+    unsigned long started = 0;
+    uint8_t online = 0;
+    Callback callback;
+    Stats stats;
+};
+
+extern SocketSweep socketSweep;
+
+#endif
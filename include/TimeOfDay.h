@@ -0,0 +1,79 @@
+// TimeOfDay.h
+#ifndef TIME_OF_DAY_H
+#define TIME_OF_DAY_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Minutes since midnight (0-1439). "HH:MM" / "H:MM" strings convert
+// implicitly and are parsed once, at compile time for literals:
+//   constexpr TimeOfDay wakeUp = "07:10";
+//   rs.period("07:10", "07:44", ...); // same thing, no sscanf per tick
+// Malformed strings parse as 00:00.
+class TimeOfDay
+{
+public:
+    static constexpr int MINUTES_PER_DAY = 1440;
+
+    constexpr TimeOfDay() : minutes(0) {}
+    constexpr TimeOfDay(const char *hhmm) : minutes(parse(hhmm)) {}
+    constexpr TimeOfDay(int hour, int minute) : minutes(wrap(hour * 60 + minute)) {}
+
+    static constexpr TimeOfDay fromMinutes(int minutesSinceMidnight) { return TimeOfDay(0, minutesSinceMidnight); }
+
+    constexpr int toMinutes() const { return minutes; }
+    constexpr int hour() const { return minutes / 60; }
+    constexpr int minute() const { return minutes % 60; }
+
+    // Wraps around midnight, negative values count backwards
+    constexpr TimeOfDay addMinutes(int delta) const { return fromMinutes(minutes + delta); }
+    constexpr TimeOfDay addHours(int delta) const { return fromMinutes(minutes + delta * 60); }
+
+    // Writes "HH:MM" into buffer (at least 6 bytes), returns buffer
+    char *format(char *buffer) const
+    {
+        buffer[0] = '0' + hour() / 10;
+        buffer[1] = '0' + hour() % 10;
+        buffer[2] = ':';
+        buffer[3] = '0' + minute() / 10;
+        buffer[4] = '0' + minute() % 10;
+        buffer[5] = '\0';
+        return buffer;
+    }
+
+    constexpr bool operator==(TimeOfDay other) const { return minutes == other.minutes; }
+    constexpr bool operator!=(TimeOfDay other) const { return minutes != other.minutes; }
+    constexpr bool operator<(TimeOfDay other) const { return minutes < other.minutes; }
+
+    // Single-expression helpers so they stay constexpr under C++11
+    static constexpr int digit(char c) { return (c >= '0' && c <= '9') ? c - '0' : -1; }
+    static constexpr int valid(int hour, int minute)
+    {
+        return (hour >= 0 && hour < 24 && minute >= 0 && minute < 60) ? hour * 60 + minute : 0;
+    }
+    // Exactly "HH:MM" with hour 0-23 and minute 0-59; parse() reads anything
+    // else as some minute of the day, so check first where text comes from outside
+    static constexpr bool isValid(const char *s)
+    {
+        return s && digit(s[0]) >= 0 && digit(s[1]) >= 0 && s[2] == ':' && digit(s[3]) >= 0 && digit(s[4]) >= 0 &&
+               s[5] == '\0' && digit(s[0]) * 10 + digit(s[1]) < 24 && digit(s[3]) < 6;
+    }
+    static constexpr int parse(const char *s)
+    {
+        return !s || digit(s[0]) < 0 ? 0
+               : s[1] == ':'         ? (digit(s[2]) < 0 || digit(s[3]) < 0 ? 0 : valid(digit(s[0]), digit(s[2]) * 10 + digit(s[3])))
+               : digit(s[1]) < 0 || s[2] != ':' || digit(s[3]) < 0 || digit(s[4]) < 0
+                   ? 0
+                   : valid(digit(s[0]) * 10 + digit(s[1]), digit(s[3]) * 10 + digit(s[4]));
+    }
+
+private:
+    int16_t minutes;
+
+    static constexpr int wrap(int m) { return ((m % MINUTES_PER_DAY) + MINUTES_PER_DAY) % MINUTES_PER_DAY; }
+};
+
+// "07:10"_hm, for places where a plain string would be ambiguous
+constexpr TimeOfDay operator"" _hm(const char *hhmm, size_t) { return TimeOfDay(hhmm); }
+
+#endif
@@ -5,6 +5,7 @@
 #include <Arduino.h>
 #include <time.h>
 #include <WiFi.h>
+#include "TimeOfDay.h"
 
 class TimeSync
 {
@@ -43,7 +44,7 @@ public:
     bool isFriday();
     bool isSaturday();
 
-    bool isTimeBetween(const char *startTime, const char *endTime);
+    bool isTimeBetween(TimeOfDay startTime, TimeOfDay endTime); // both inclusive, may span midnight
     int getCurrentMinutes();
     bool isTimeSet() const { return timeInitialized; }
 
@@ -5,10 +5,9 @@
 #include <WiFi.h>
 #include <SPIFFS.h>
 #include <ArduinoJson.h>
-#include <WebServer.h>
 #include "GlobalVars.h"
-
-using WebServer = ::WebServer;
+#include "HttpServer.h"
+#include "SmartRuleSystem.h" // RULES_PROFILE
 
 class WebInterface
 {
@@ -25,21 +24,92 @@ private:
         unsigned long socket_durations[NUM_SOCKETS] = {0};
     };
 
-    WebServer server;
+    // What the page shows, at the resolution it shows it: /data's version
+    // goes up when this changes, and the event streams get what changed
+    struct Shown
+    {
+        long importPower = -1; // W
+        long exportPower = -1;
+        long dailyImport = -1; // 0.1 kWh, -1 when not known
+        long dailyExport = -1;
+        long temperature = 0; // 0.1 degree
+        long humidity = 0;
+        long light = 0;
+        bool phonePresent = false;
+        bool socketStates[NUM_SOCKETS] = {};
+        bool socketOnline[NUM_SOCKETS] = {};
+        uint8_t socketCommands[NUM_SOCKETS] = {};
+        const char *lastRule = nullptr;
+        char lastRuleTime[12] = "";
+        int ruleHistoryIndex = -1;
+
+        bool operator==(const Shown &other) const;
+    };
+
+    // A serialized answer, kept until the version it was made from changes
+    struct CachedResponse
+    {
+        bool valid = false;
+        uint32_t version = 0;
+        String body;
+        char etag[40] = "";
+    };
+
+    HttpServer server;
     unsigned long lastCheck = 0;
     static const unsigned long CHECK_INTERVAL = 30000;
 
+    // The sources are looked at every CHANGE_INTERVAL. Uptime, durations,
+    // health and the like change all the time without being part of Shown,
+    // so /data takes them along at least every DATA_REFRESH
+    static const unsigned long CHANGE_INTERVAL = 250;
+    static const unsigned long DATA_REFRESH = 10000;
+    unsigned long lastLook = 0;
+    unsigned long lastDataChange = 0;
+    uint32_t dataVersion = 0;
+    uint32_t bootId = 0; // In every ETag, as versions start over at boot
+
+    // Event stream: the heartbeat carries uptime and free RAM and tells the
+    // page the stream is alive, the snapshot brings the slow details along
+    static const unsigned long HEARTBEAT_INTERVAL = 15000;
+    static const unsigned long SNAPSHOT_INTERVAL = 60000;
+    unsigned long lastHeartbeat = 0;
+    unsigned long lastSnapshot = 0;
+
     CachedData cached;
+    // Reused, not on the ~8 KB loop() stack: dataJson() runs under the
+    // server's poll and dispatch frames, or under pushChanges()
+    StaticJsonDocument<4096> dataDoc; // ~3.5 KB with every device's health and command, and 4 phones
+    StaticJsonDocument<1536> patchDoc;
+    Shown shown;
+    Shown pushed;
+    CachedResponse dataCache;
+    CachedResponse historyCache[4]; // By PowerHistory::Tier
 
     void updateCache();
-    void handleSwitch(int switchNumber);
+    String dataJson(); // The whole /data document
+    Shown measure();
+    void refresh(unsigned long now, bool force = false);
+    const String &cachedBody(CachedResponse &cache, const char *name, uint32_t version,
+                             const std::function<String()> &build);
+    void sendCached(const HttpServer::Request &request, HttpServer::Response &response, CachedResponse &cache,
+                    const char *name, uint32_t version, const std::function<String()> &build);
+    void pushChanges(unsigned long now);
+    void handleSwitch(int switchNumber, const HttpServer::Request &request, HttpServer::Response &response);
+    void handleSwitchStatus(int switchNumber, const HttpServer::Request &request, HttpServer::Response &response);
+    void handleHistory(const HttpServer::Request &request, HttpServer::Response &response);
+    void handleRulesUpload(const HttpServer::Request &request, HttpServer::Response &response);
+#if RULES_PROFILE
+    void handleRuleStats(const HttpServer::Request &request, HttpServer::Response &response);
+#endif
 
 public:
-    // Removed manual buffer allocation
-    WebInterface() : server(8080) {}
+    static const uint16_t PORT = 8080;
 
     void begin();
     void update();
+    // loop()'s idle time: answers requests as they come in
+    void serveFor(unsigned long ms) { server.serveFor(ms); }
 
     // Simplified destructor as there is no dynamic memory to clean up
     ~WebInterface() {}
@@ -0,0 +1,65 @@
+// WebSocketClient.h
+#ifndef WEB_SOCKET_CLIENT_H
+#define WEB_SOCKET_CLIENT_H
+
+#include <Arduino.h>
+#include <functional>
+
+// One long-lived ws:// connection on a non-blocking lwIP socket, for
+// devices that push their measurements. Like AsyncHttpClient, poll() moves
+// it through connect, upgrade and receive without waiting, and the message
+// callback only runs from poll(). Text messages up to BUFFER_SIZE in single
+// frames; pings are answered, fragmented or oversized messages close the
+// connection. Plain ws to IPv4 addresses ("ws://192.168.1.40/api/ws").
+class WebSocketClient
+{
+public:
+    using MessageCallback = std::function<void(const char *text, size_t length)>;
+
+    static constexpr size_t BUFFER_SIZE = 1024;
+    static constexpr unsigned long CONNECT_TIMEOUT = 3000; // Until the upgrade answer
+
+    enum class State : uint8_t
+    {
+        Closed,
+        Connecting,
+        Upgrading, // Upgrade request sent, waiting for 101
+        Open
+    };
+
+    ~WebSocketClient() { close(); }
+
+    // false when the url is not ws://a.b.c.d[:port]/path or no socket is
+    // free; otherwise poll() reports progress through getState()
+    bool connect(const String &url);
+    void close();
+    void poll();
+
+    // Only while Open; false when the frame could not be sent whole
+    bool sendText(const char *text);
+
+    void onMessage(MessageCallback callback) { messageCallback = callback; }
+    State getState() const { return state; }
+    bool isOpen() const { return state == State::Open; }
+    unsigned long getMessages() const { return messages; }
+
+private:
+    State state = State::Closed;
+    int fd = -1;
+    unsigned long started = 0;
+    unsigned long messages = 0;
+    MessageCallback messageCallback;
+
+    char request[192]; // Upgrade request
+    size_t requestLength = 0;
+    size_t sent = 0;
+
+    uint8_t buffer[BUFFER_SIZE + 1]; // Upgrade answer, then frames; +1 for a terminator
+    size_t received = 0;
+
+    bool readUpgrade();
+    bool readFrames();
+    bool sendFrame(uint8_t opcode, const uint8_t *payload, size_t length);
+};
+
+#endif
@@ -10,6 +10,8 @@
 #include "EnvironmentSensor.h"
 #include "HomeP1Device.h"
 #include "HomeSocketDevice.h"
+#include "PollScheduler.h"
+#include "SocketSweep.h"
 #include "TimeSync.h"
 #include "WebInterface.h"
 #include "NetworkCheck.h"
@@ -25,10 +27,9 @@ extern NetworkCheck *phoneCheck;
 
 unsigned long lastLightSensorUpdate;
 unsigned long lastPhoneCheck;
-static unsigned long lastHeaterCheck = 0;
-const unsigned long HEATER_CHECK_INTERVAL = 5000;
 
 bool loadConfiguration();
+void buildRules();
 void connectWiFi();
 bool canChangeState(int switchIndex, bool newState);
 void checkMaxOnTime();
@@ -56,7 +57,4 @@ extern unsigned long lastStateChangeTime[NUM_SOCKETS];
 extern bool switchForceOff[NUM_SOCKETS];
 extern unsigned long lastTimeDisplay;
 extern HomeP1Device *p1Meter;
-extern EnvironmentSensors sensors;
-
-void setupRules();
-extern SmartRuleSystem ruleSystem;
\ No newline at end of file
+extern EnvironmentSensors sensors;
\ No newline at end of file
@@ -0,0 +1,150 @@
+# embed_web.py - gzips the dashboard into include/WebAssets.h before a build.
+#
+# PlatformIO runs it as a pre: extra script; it also runs on its own:
+#
+#   python3 scripts/embed_web.py           (writes include/WebAssets.h)
+#   python3 scripts/embed_web.py --report  (sizes only)
+#
+# The page (data/index.html), data/favicon.ico and Chart.js
+# (vendor/chart.js/chart.umd.js) become static const byte arrays, gzipped,
+# each with the first 16 hex digits of its SHA-256 as ETag. Chart.js is
+# never downloaded by the build: the vendored file is used only when its
+# SHA-256 is the one vendor/chart.js/SHA256SUMS pins (a sha256sum line,
+# committed with the file), so a changed or swapped file stops the build.
+# Without the file it is left out with a warning, and the page falls back
+# to Chart.js from the CDN. The page's links to the
+# other assets get ?v=<hash> added, so those can be cached as immutable and
+# a new firmware still gets a new copy. The header is only rewritten when
+# its content changes, so an unchanged page does not rebuild anything.
+import gzip
+import hashlib
+import os
+import sys
+
+CHART_VERSION = "4.4.1"
+CHART_SUMS = "vendor/chart.js/SHA256SUMS"
+
+# (file, path served at, content type), the page last so it links the others' hashes
+ASSETS = [
+    ("data/favicon.ico", "/favicon.ico", "image/x-icon"),
+    ("vendor/chart.js/chart.umd.js", "/chart.umd.js", "application/javascript"),
+    ("data/index.html", "/index.html", "text/html"),
+]
+OUTPUT = "include/WebAssets.h"
+
+
+# False when the file is not vendored; stops the build when it is but does
+# not match its pin
+def check_pinned(project, name):
+    path = os.path.join(project, name)
+    if not os.path.exists(path):
+        print("embed_web > warning: %s missing, the page loads Chart.js from the CDN; to embed it put "
+              "dist/chart.umd.js of Chart.js %s (npm chart.js@%s) there and its sha256sum line in %s"
+              % (name, CHART_VERSION, CHART_VERSION, CHART_SUMS))
+        return False
+    pins = {}
+    sums = os.path.join(project, CHART_SUMS)
+    if os.path.exists(sums):
+        with open(sums) as file:
+            for line in file:
+                fields = line.split()
+                if len(fields) == 2:
+                    pins[fields[1].lstrip("*")] = fields[0].lower()
+    pinned = pins.get(os.path.basename(name))
+    if pinned is None:
+        sys.exit("embed_web > %s has no SHA-256 for %s" % (CHART_SUMS, os.path.basename(name)))
+    with open(path, "rb") as file:
+        actual = hashlib.sha256(file.read()).hexdigest()
+    if actual != pinned:
+        sys.exit("embed_web > %s has SHA-256 %s, %s pins %s" % (name, actual, CHART_SUMS, pinned))
+    return True
+
+
+def identifier(path):
+    name = "".join(c if c.isalnum() else "_" for c in path.strip("/")).upper()
+    return "WEB_ASSET_" + name
+
+
+def build(project):
+    chart = check_pinned(project, ASSETS[1][0])
+    assets = []
+    hashes = {}
+    for name, path, content_type in ASSETS:
+        if name == ASSETS[1][0] and not chart:
+            continue
+        with open(os.path.join(project, name), "rb") as file:
+            content = file.read()
+        if content_type == "text/html":
+            for linked, digest in hashes.items():
+                content = content.replace(('"%s"' % linked).encode(), ('"%s?v=%s"' % (linked, digest)).encode())
+        digest = hashlib.sha256(content).hexdigest()[:16]
+        hashes[path] = digest
+        # mtime 0: the same input gives the same bytes, and no rebuild
+        packed = gzip.compress(content, compresslevel=9, mtime=0)
+        assets.append((name, path, content_type, digest, content, packed))
+    return assets
+
+
+def header(assets):
+    lines = [
+        "// WebAssets.h - generated by scripts/embed_web.py, do not edit",
+        "#ifndef WEB_ASSETS_H",
+        "#define WEB_ASSETS_H",
+        "",
+        "#include <Arduino.h>",
+        "",
+        "// A file of the dashboard, gzipped; in flash, served without copying",
+        "struct WebAsset",
+        "{",
+        "    const char *path;",
+        "    const char *contentType;",
+        "    const char *hash; // Content hash, also the ?v= of links to it",
+        "    const char *etag; // The hash, quoted",
+        "    const uint8_t *data;",
+        "    size_t length;",
+        "};",
+        "",
+    ]
+    for name, path, content_type, digest, content, packed in assets:
+        lines.append("// %s: %d bytes, %d gzipped" % (name, len(content), len(packed)))
+        lines.append("static const uint8_t %s[] = {" % identifier(path))
+        for i in range(0, len(packed), 20):
+            lines.append("    " + ", ".join("0x%02x" % b for b in packed[i:i + 20]) + ",")
+        lines.append("};")
+        lines.append("")
+    lines.append("static const WebAsset WEB_ASSETS[] = {")
+    for name, path, content_type, digest, content, packed in assets:
+        lines.append('    {"%s", "%s", "%s", "\\"%s\\"", %s, sizeof(%s)},'
+                     % (path, content_type, digest, digest, identifier(path), identifier(path)))
+    lines.append("};")
+    lines.append("")
+    lines.append("#endif")
+    return "\n".join(lines) + "\n"
+
+
+def main(project, report=False):
+    assets = build(project)
+    if report:
+        for name, path, content_type, digest, content, packed in assets:
+            print("%-30s %7d bytes, %6d gzipped, %s" % (name, len(content), len(packed), digest))
+        return
+    text = header(assets)
+    output = os.path.join(project, OUTPUT)
+    if os.path.exists(output):
+        with open(output) as file:
+            if file.read() == text:
+                return
+    with open(output, "w") as file:
+        file.write(text)
+    print("embed_web > wrote %s" % OUTPUT)
+
+
+try:
+    Import("env")  # noqa: F821 - PlatformIO's SCons
+except NameError:
+    env = None
+
+if env is not None:
+    main(env.subst("$PROJECT_DIR"))
+elif __name__ == "__main__":
+    main(os.path.dirname(os.path.dirname(os.path.abspath(sys.argv[0]))), "--report" in sys.argv)
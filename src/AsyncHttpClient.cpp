@@ -0,0 +1,462 @@
+#define DEBUG_ASYNC_HTTP 0
+
+#include "AsyncHttpClient.h"
+#include <errno.h>
+
+#if defined(ESP32)
+#include <lwip/sockets.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // lwIP never raises SIGPIPE
+#endif
+
+AsyncHttpClient httpClient;
+
+// Splits "http://a.b.c.d[:port]/path" into address, port and path
+static bool parseUrl(const char *url, sockaddr_in &addr, const char *&path) {
+  if (strncmp(url, "http://", 7) != 0)
+    return false;
+  const char *host = url + 7;
+  path = strchr(host, '/');
+  size_t hostLength = path ? path - host : strlen(host);
+  if (!path)
+    path = "/";
+
+  char hostBuffer[24];
+  if (hostLength == 0 || hostLength >= sizeof(hostBuffer))
+    return false;
+  memcpy(hostBuffer, host, hostLength);
+  hostBuffer[hostLength] = '\0';
+
+  int port = 80;
+  char *colon = strchr(hostBuffer, ':');
+  if (colon) {
+    *colon = '\0';
+    port = atoi(colon + 1);
+    if (port <= 0 || port > 65535)
+      return false;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  return inet_pton(AF_INET, hostBuffer, &addr.sin_addr) == 1;
+}
+
+// Value of a response header, nullptr when the headers don't have it
+static const char *findHeader(const char *answer, const char *headerEnd, const char *name) {
+  char pattern[32];
+  snprintf(pattern, sizeof(pattern), "\r\n%s:", name);
+  const char *found = strcasestr(answer, pattern);
+  if (!found || found > headerEnd)
+    return nullptr;
+  found += strlen(pattern);
+  while (*found == ' ')
+    found++;
+  return found;
+}
+
+static bool isChunked(const char *answer, const char *headerEnd) {
+  const char *encoding = findHeader(answer, headerEnd, "Transfer-Encoding");
+  return encoding && strncasecmp(encoding, "chunked", 7) == 0;
+}
+
+// Joins the chunks of a chunked body in place, returns the new length
+static size_t decodeChunked(char *body, size_t length) {
+  const char *in = body;
+  const char *end = body + length;
+  char *out = body;
+  while (in < end) {
+    char *afterSize;
+    unsigned long size = strtoul(in, &afterSize, 16);
+    const char *data = strstr(afterSize, "\r\n");
+    if (size == 0 || !data || data + 2 + size > end)
+      break;
+    memmove(out, data + 2, size);
+    out += size;
+    in = data + 2 + size + 2; // Skip the CRLF after the chunk
+  }
+  *out = '\0';
+  return out - body;
+}
+
+bool AsyncHttpClient::request(const char *method, const String &url, const char *body,
+                              unsigned long timeoutMs, Callback done) {
+  Request *req = nullptr;
+  for (auto &candidate : requests) {
+    if (candidate.state == State::Idle) {
+      req = &candidate;
+      break;
+    }
+  }
+  if (!req) {
+    stats.rejected++;
+    return false;
+  }
+
+  sockaddr_in addr;
+  const char *path;
+  if (!parseUrl(url.c_str(), addr, path))
+    return false;
+
+  char host[24];
+  inet_ntop(AF_INET, &addr.sin_addr, host, sizeof(host));
+  size_t bodyLength = body ? strlen(body) : 0;
+  int length = snprintf(req->buffer, sizeof(req->buffer),
+                        "%s %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n",
+                        method, path, host, keepAlive ? "keep-alive" : "close");
+  if (body)
+    length += snprintf(req->buffer + length, length < (int)sizeof(req->buffer) ? sizeof(req->buffer) - length : 0,
+                       "Content-Type: application/json\r\nContent-Length: %u\r\n\r\n%s",
+                       (unsigned)bodyLength, body);
+  else
+    length += snprintf(req->buffer + length, length < (int)sizeof(req->buffer) ? sizeof(req->buffer) - length : 0,
+                       "\r\n");
+  if (length <= 0 || length >= (int)sizeof(req->buffer))
+    return false;
+
+  req->address = addr.sin_addr.s_addr;
+  req->port = ntohs(addr.sin_port);
+  req->started = millis();
+  req->timeout = timeoutMs;
+  req->requestLength = length;
+  req->done = done;
+  stats.started++;
+
+  // An idle keep-alive connection to the same device skips the handshake
+  int8_t idle = -1;
+  for (int8_t i = 0; keepAlive && i < MAX_CONNECTIONS; i++) {
+    const Connection &connection = connections[i];
+    if (connection.state == ConnectionState::Idle && connection.address == req->address &&
+        connection.port == req->port) {
+      idle = i;
+      break;
+    }
+  }
+  if (idle >= 0) {
+    connections[idle].state = ConnectionState::Busy;
+    connections[idle].uses++;
+    req->connection = idle;
+    req->reused = true;
+    req->sent = 0;
+    req->received = 0;
+    req->state = State::Sending;
+    stats.connectionsReused++;
+  } else {
+    // Refused right away shows as connection -1; poll() reports it,
+    // callbacks never run from here
+    connectFresh(*req);
+  }
+
+  uint8_t active = inFlight();
+  if (active > stats.maxInFlight)
+    stats.maxInFlight = active;
+
+#if DEBUG_ASYNC_HTTP
+  Serial.printf("HTTP > %s %s (slot %d, %s)\n", method, url.c_str(), (int)(req - requests),
+                req->reused ? "reused" : "new connection");
+#endif
+  return true;
+}
+
+bool AsyncHttpClient::connectFresh(Request &req) {
+  req.connection = openConnection(req.address, req.port);
+  req.reused = false;
+  req.sent = 0;
+  req.received = 0;
+  req.state = State::Connecting;
+  return req.connection >= 0;
+}
+
+int8_t AsyncHttpClient::openConnection(uint32_t address, uint16_t port) {
+  int8_t index = -1;
+  for (int8_t i = 0; i < MAX_CONNECTIONS && index < 0; i++)
+    if (connections[i].state == ConnectionState::Free)
+      index = i;
+  if (index < 0) {
+    // Pool full: the longest idle connection makes room
+    for (int8_t i = 0; i < MAX_CONNECTIONS; i++)
+      if (connections[i].state == ConnectionState::Idle &&
+          (index < 0 || connections[i].idleSince < connections[index].idleSince))
+        index = i;
+    if (index < 0)
+      return -1;
+    closeConnection(index);
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = address;
+  if (::connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+    close(fd);
+    return -1;
+  }
+
+  Connection &connection = connections[index];
+  connection.state = ConnectionState::Busy;
+  connection.fd = fd;
+  connection.address = address;
+  connection.port = port;
+  connection.uses = 1;
+  stats.connectionsOpened++;
+  stats.openSockets++;
+  if (stats.openSockets > stats.maxOpenSockets)
+    stats.maxOpenSockets = stats.openSockets;
+  return index;
+}
+
+void AsyncHttpClient::closeConnection(int8_t index) {
+  Connection &connection = connections[index];
+  if (connection.fd >= 0) {
+    close(connection.fd);
+    stats.openSockets--;
+  }
+  connection.fd = -1;
+  connection.state = ConnectionState::Free;
+}
+
+// Drops idle connections that timed out or that the device closed, and
+// busy ones no request owns any more (a leak)
+void AsyncHttpClient::checkConnections(unsigned long now) {
+  for (int8_t i = 0; i < MAX_CONNECTIONS; i++) {
+    Connection &connection = connections[i];
+    if (connection.state == ConnectionState::Idle) {
+      if (now - connection.idleSince >= KEEP_ALIVE_IDLE) {
+        closeConnection(i);
+        continue;
+      }
+      // Readable while idle: closed by the device (0), reset, or stray data
+      char peek;
+      ssize_t n = recv(connection.fd, &peek, 1, MSG_PEEK | MSG_DONTWAIT);
+      if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        closeConnection(i);
+    } else if (connection.state == ConnectionState::Busy) {
+      bool owned = false;
+      for (const auto &req : requests)
+        if (req.state != State::Idle && req.connection == i)
+          owned = true;
+      if (!owned) {
+        Serial.printf("HTTP > Socket %d held without a request, closing (leak)\n", connection.fd);
+        stats.leaksClosed++;
+        closeConnection(i);
+      }
+    }
+  }
+}
+
+void AsyncHttpClient::setKeepAlive(bool enabled) {
+  keepAlive = enabled;
+  if (!enabled)
+    for (int8_t i = 0; i < MAX_CONNECTIONS; i++)
+      if (connections[i].state == ConnectionState::Idle)
+        closeConnection(i);
+}
+
+void AsyncHttpClient::resetStats() {
+  uint8_t open = stats.openSockets;
+  stats = Stats();
+  stats.openSockets = open;
+  stats.maxOpenSockets = open;
+}
+
+uint8_t AsyncHttpClient::inFlight() const {
+  uint8_t count = 0;
+  for (const auto &req : requests)
+    if (req.state != State::Idle)
+      count++;
+  return count;
+}
+
+void AsyncHttpClient::poll() {
+  unsigned long now = millis();
+  for (auto &req : requests) {
+    if (req.state == State::Idle || req.state == State::Completing)
+      continue;
+    if (now - req.started >= req.timeout) {
+      finish(req, HttpResponse::Error::Timeout, now);
+      continue;
+    }
+    step(req, now);
+  }
+
+  if (now - lastConnectionCheck >= 250) {
+    checkConnections(now);
+    lastConnectionCheck = now;
+  }
+}
+
+void AsyncHttpClient::runUntilIdle(unsigned long maxMs) {
+  unsigned long start = millis();
+  while (inFlight() > 0 && millis() - start < maxMs) {
+    poll();
+    delay(1);
+  }
+}
+
+void AsyncHttpClient::step(Request &req, unsigned long now) {
+  if (req.state == State::Connecting) {
+    if (req.connection < 0) {
+      finish(req, HttpResponse::Error::Connect, now);
+      return;
+    }
+    // Writable means the handshake finished, SO_ERROR tells how
+    int fd = connections[req.connection].fd;
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(fd, &writable);
+    timeval noWait = {0, 0};
+    if (select(fd + 1, nullptr, &writable, nullptr, &noWait) <= 0)
+      return;
+    int error = 0;
+    socklen_t length = sizeof(error);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+    if (error != 0) {
+      finish(req, HttpResponse::Error::Connect, now);
+      return;
+    }
+    req.state = State::Sending;
+  }
+
+  int fd = connections[req.connection].fd;
+
+  if (req.state == State::Sending) {
+    ssize_t n = send(fd, req.buffer + req.sent, req.requestLength - req.sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      if (req.reused && req.sent == 0) {
+        // The device closed the kept-alive connection, nothing was sent yet
+        closeConnection(req.connection);
+        stats.staleRetries++;
+        connectFresh(req);
+        return;
+      }
+      finish(req, HttpResponse::Error::Closed, now);
+      return;
+    }
+    req.sent += n;
+    if (req.sent < req.requestLength)
+      return;
+    req.state = State::Receiving; // Buffer is free for the answer once bytes arrive
+  }
+
+  if (req.state == State::Receiving) {
+    // Drain whatever arrived, the buffer keeps one byte for the terminator
+    while (true) {
+      if (req.received >= sizeof(req.buffer) - 1) {
+        finish(req, HttpResponse::Error::TooLarge, now);
+        return;
+      }
+      ssize_t n = recv(fd, req.buffer + req.received, sizeof(req.buffer) - 1 - req.received, MSG_DONTWAIT);
+      if (n > 0) {
+        req.received += n;
+        req.buffer[req.received] = '\0';
+        if (answerComplete(req)) {
+          finish(req, HttpResponse::Error::None, now);
+          return;
+        }
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+      if (req.received == 0 && req.reused) {
+        // Closed or reset before any answer: a stale keep-alive connection.
+        // The buffer still holds the request, send it on a fresh one.
+        closeConnection(req.connection);
+        stats.staleRetries++;
+        connectFresh(req);
+        return;
+      }
+      // Server closed: that ends an answer without Content-Length
+      finish(req, n == 0 && req.received > 0 ? HttpResponse::Error::None : HttpResponse::Error::Closed, now);
+      return;
+    }
+  }
+}
+
+// Headers complete and the whole body present, by Content-Length or the
+// last chunk
+bool AsyncHttpClient::answerComplete(const Request &req) const {
+  const char *headerEnd = strstr(req.buffer, "\r\n\r\n");
+  if (!headerEnd)
+    return false;
+  const char *body = headerEnd + 4;
+  if (isChunked(req.buffer, headerEnd))
+    return strncmp(body, "0\r\n\r\n", 5) == 0 || strstr(body, "\r\n0\r\n\r\n") != nullptr;
+  const char *contentLength = findHeader(req.buffer, headerEnd, "Content-Length");
+  if (!contentLength)
+    return false; // Read until the server closes
+  size_t bodyLength = strtoul(contentLength, nullptr, 10);
+  return req.received >= (size_t)(body - req.buffer) + bodyLength;
+}
+
+void AsyncHttpClient::finish(Request &req, HttpResponse::Error error, unsigned long now) {
+  HttpResponse response = {error, 0, "", 0, now - req.started};
+  bool reusable = false;
+  if (error == HttpResponse::Error::None) {
+    const char *headerEnd = strstr(req.buffer, "\r\n\r\n");
+    if (strncmp(req.buffer, "HTTP/1.", 7) != 0 || !headerEnd) {
+      response.error = HttpResponse::Error::Closed;
+    } else {
+      response.status = atoi(req.buffer + 9);
+      response.body = headerEnd + 4;
+      response.length = req.received - (response.body - req.buffer);
+      if (isChunked(req.buffer, headerEnd))
+        response.length = decodeChunked(req.buffer + (response.body - req.buffer), response.length);
+
+      // Keep the connection when the answer had a known end and the device
+      // did not ask to close
+      const char *connectionHeader = findHeader(req.buffer, headerEnd, "Connection");
+      bool delimited = isChunked(req.buffer, headerEnd) || findHeader(req.buffer, headerEnd, "Content-Length");
+      reusable = keepAlive && delimited && req.buffer[7] == '1' &&
+                 !(connectionHeader && strncasecmp(connectionHeader, "close", 5) == 0);
+    }
+  }
+
+  if (req.connection >= 0) {
+    Connection &connection = connections[req.connection];
+    if (reusable && connection.uses < KEEP_ALIVE_MAX_USES) {
+      connection.state = ConnectionState::Idle;
+      connection.idleSince = now;
+    } else {
+      closeConnection(req.connection);
+    }
+    req.connection = -1;
+  }
+
+  if (response.error == HttpResponse::Error::None)
+    stats.succeeded++;
+  else if (response.error == HttpResponse::Error::Timeout)
+    stats.timeouts++;
+  else
+    stats.failed++;
+
+#if DEBUG_ASYNC_HTTP
+  Serial.printf("HTTP > done: error %d, status %d, %lu ms%s\n", (int)response.error, response.status,
+                response.elapsedMs, reusable ? ", kept alive" : "");
+#endif
+
+  // The slot is not reused until the callback returned, so the body stays
+  // valid even when the callback starts the next request
+  req.state = State::Completing;
+  Callback done = std::move(req.done);
+  req.done = nullptr;
+  if (done)
+    done(response);
+  req.state = State::Idle;
+}
@@ -0,0 +1,161 @@
+#include "DeviceHealth.h"
+#include "AsyncHttpClient.h"
+
+bool DeviceHealth::allowRequest() {
+  switch (state) {
+  case State::Closed:
+    return true;
+  case State::Open:
+    if (millis() - openedAt < openFor)
+      return false;
+    state = State::HalfOpen; // Open period over: one probe
+    probeOut = true;
+    return true;
+  case State::HalfOpen:
+    if (probeOut)
+      return false;
+    probeOut = true;
+    return true;
+  }
+  return true;
+}
+
+void DeviceHealth::cancelRequest() {
+  if (state == State::HalfOpen)
+    probeOut = false; // The next allowRequest() probes
+}
+
+void DeviceHealth::record(Outcome outcome, unsigned long latencyMs) {
+  bool ok = outcome == Outcome::Ok;
+  switch (outcome) {
+  case Outcome::Ok:
+    counts.ok++;
+    break;
+  case Outcome::Timeout:
+    counts.timeouts++;
+    break;
+  case Outcome::Connect:
+    counts.connectErrors++;
+    break;
+  case Outcome::Http:
+    counts.httpErrors++;
+    break;
+  case Outcome::Parse:
+    counts.parseErrors++;
+    break;
+  }
+
+  // Latency of everything that answered; a timeout only says "too slow"
+  if (outcome != Outcome::Timeout && outcome != Outcome::Connect) {
+    uint8_t bucket = 0;
+    while (bucket < BUCKETS - 1 && latencyMs >= bucketLimit(bucket))
+      bucket++;
+    histogram[bucket]++;
+  }
+
+  window = (window << 1) | (ok ? 1 : 0);
+  if (windowCount < WINDOW)
+    windowCount++;
+  lastSucceeded = ok;
+
+  if (ok) {
+    failuresInRow = 0;
+    state = State::Closed; // Also for a late answer while open
+    probeOut = false;
+    backoff = 0;
+    return;
+  }
+
+  if (failuresInRow < 0xFFFF)
+    failuresInRow++;
+  if (state == State::HalfOpen) {
+    backoff = min(backoff * 2, policy.openMax); // The probe failed
+    open(backoff);
+  } else if (state == State::Closed && failuresInRow >= policy.failuresToOpen) {
+    backoff = policy.openMin;
+    open(backoff);
+  }
+}
+
+void DeviceHealth::record(const HttpResponse &response, bool parsed) {
+  Outcome outcome;
+  switch (response.error) {
+  case HttpResponse::Error::None:
+    outcome = !response.ok() ? Outcome::Http : parsed ? Outcome::Ok : Outcome::Parse;
+    break;
+  case HttpResponse::Error::Timeout:
+    outcome = Outcome::Timeout;
+    break;
+  case HttpResponse::Error::TooLarge:
+    outcome = Outcome::Parse; // It answered, with something we can't use
+    break;
+  default:
+    outcome = Outcome::Connect;
+    break;
+  }
+  record(outcome, response.elapsedMs);
+}
+
+void DeviceHealth::open(unsigned long period) {
+  // Jitter: anywhere in period +- jitterPercent
+  unsigned long spread = period * policy.jitterPercent / 100;
+  openFor = period - spread + (spread > 0 ? random(2 * spread + 1) : 0);
+  openedAt = millis();
+  state = State::Open;
+  probeOut = false;
+}
+
+void DeviceHealth::retryNow() {
+  if (state == State::Open) {
+    state = State::HalfOpen;
+    probeOut = false;
+  }
+}
+
+unsigned long DeviceHealth::retryIn() const {
+  if (state != State::Open)
+    return 0;
+  unsigned long elapsed = millis() - openedAt;
+  return elapsed < openFor ? openFor - elapsed : 0;
+}
+
+const char *DeviceHealth::getStateName() const {
+  switch (state) {
+  case State::Open:
+    return "open";
+  case State::HalfOpen:
+    return "half-open";
+  default:
+    return "closed";
+  }
+}
+
+float DeviceHealth::availability() const {
+  if (windowCount == 0)
+    return 1.0f;
+  uint32_t mask = windowCount >= 32 ? 0xFFFFFFFF : (1UL << windowCount) - 1;
+  return __builtin_popcount(window & mask) / (float)windowCount;
+}
+
+unsigned long DeviceHealth::bucketLimit(uint8_t bucket) {
+  return bucket < BUCKETS - 1 ? 25UL << bucket : 0;
+}
+
+unsigned long DeviceHealth::latencyPercentile(uint8_t percent) const {
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < BUCKETS; i++)
+    total += histogram[i];
+  if (total == 0)
+    return 0;
+  // Rank of the percentile, 1 based
+  uint32_t rank = (total * percent + 99) / 100;
+  if (rank == 0)
+    rank = 1;
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < BUCKETS; i++) {
+    seen += histogram[i];
+    if (seen >= rank)
+      return i < BUCKETS - 1 ? bucketLimit(i) : bucketLimit(BUCKETS - 2) * 2; // Above the last bound: reported as twice it
+  }
+  return 0;
+}
@@ -233,8 +233,16 @@ void DisplayManager::showSwitchesPage(const bool switches[],
   }
 
   // Modified layout for 8 switches: 2 rows of 4
-  auto drawSwitch = [&](int x, int y, bool state, bool isOnline) {
+  auto drawSwitch = [&](int x, int y, bool state, HomeSocketDevice *socket) {
     const int radius = 5; // Slightly smaller for 8 switches
+    bool isOnline = socket != nullptr && socket->isConnected(); // Breaker not open
+
+    // Under a socket that missed some of its last requests: a bar as wide
+    // as the share it answered
+    if (socket != nullptr && socket->getHealth().availability() < 1.0f) {
+      int width = (int)(socket->getHealth().availability() * (2 * radius) + 0.5f);
+      display.drawHLine(x - radius, y + radius + 2, width);
+    }
 
     if (!isOnline) {
       display.drawCircle(x, y, radius);
@@ -256,15 +264,13 @@ void DisplayManager::showSwitchesPage(const bool switches[],
   // Draw switches 1-4 on first row
   for (int i = 0; i < 4 && i < NUM_SOCKETS; i++) {
     int x = startX + (i * (diameter + spacing));
-    bool isConnected = (sockets[i] != nullptr) ? sockets[i]->isConnected() : false;
-    drawSwitch(x, row1Y, switches[i], isConnected);
+    drawSwitch(x, row1Y, switches[i], sockets[i]);
   }
 
   // Draw switches 5-8 on second row
   for (int i = 4; i < 8 && i < NUM_SOCKETS; i++) {
     int x = startX + ((i - 4) * (diameter + spacing));
-    bool isConnected = (sockets[i] != nullptr) ? sockets[i]->isConnected() : false;
-    drawSwitch(x, row2Y, switches[i], isConnected);
+    drawSwitch(x, row2Y, switches[i], sockets[i]);
   }
 
   display.setFont(u8g2_font_profont10_tr);
@@ -2,9 +2,8 @@
 #include "HomeP1Device.h"
 
 HomeP1Device::HomeP1Device(const char *ip)
-    : baseUrl("http://" + String(ip)), lastImportPower(0), lastExportPower(0),
-      lastTotalImport(0), lastTotalExport(0), lastReadTime(0),
-      lastReadSuccess(false) {
+    : baseUrl("http://" + String(ip)), dataUrl(baseUrl + "/api/v1/data"),
+      lastReadTime(0) {
   Serial.printf("P1 meter initialized at: %s\n", ip);
 }
 
@@ -12,100 +11,177 @@ HomeP1Device::HomeP1Device(const char *ip)
 #define max(a, b) (((a) > (b)) ? (a) : (b))
 #endif
 
+void HomeP1Device::enableStream(const String &url, const String &token) {
+  streamUrl = url;
+  streamToken = token;
+  streamWait = 0; // First attempt on the next update()
+  stream.onMessage([this](const char *text, size_t length) {
+    onStreamMessage(text, length);
+  });
+  Serial.printf("P1 meter stream: %s\n", url.c_str());
+}
+
 void HomeP1Device::update() {
-  if (millis() - lastReadTime >= READ_INTERVAL) {
-    lastReadSuccess = getPowerData(lastImportPower, lastExportPower);
+  if (isStreaming()) {
+    return;
+  }
+  // One read at a time; a slow meter stretches the interval instead of
+  // piling up requests
+  if (readPending || millis() - lastReadTime < READ_INTERVAL) {
+    return;
+  }
+  if (WiFi.status() != WL_CONNECTED || !health.allowRequest()) {
+    return;
+  }
+
+  readPending = httpClient.get(dataUrl, HTTP_TIMEOUT, [this](const HttpResponse &response) {
+    onPowerData(response);
+  });
+  if (readPending) {
     lastReadTime = millis();
+  } else {
+    health.cancelRequest();
   }
 }
 
-bool HomeP1Device::getPowerData(float &importPower, float &exportPower) {
-  // Create LOCAL instances (not persistent)
-  WiFiClient localClient;
-  HTTPClient localHttp;
-
-  // Configure timeouts
-  localClient.setTimeout(8000); // 8 seconds for P1 meter
-  localHttp.setTimeout(8000);
-  // NO setConnectTimeout() - causes socket exhaustion!
-  localHttp.setReuse(false);
-
-  Serial.printf("P1 > Fetching from: %s/api/v1/data\n", baseUrl.c_str());
+void HomeP1Device::onPowerData(const HttpResponse &response) {
+  readPending = false;
 
-  if (!localHttp.begin(localClient, baseUrl + "/api/v1/data")) {
-    Serial.println("P1 > HTTP begin failed!");
-    localClient.stop();
-    delay(50);
-    return false;
+  if (!response.ok()) {
+    health.record(response, false);
+    Serial.printf("P1 > HTTP error: %d (error %d, %lu ms), breaker %s\n", response.status, (int)response.error,
+                  response.elapsedMs, health.getStateName());
+    return;
+  }
+  Serial.printf("P1 > Payload length: %u (%lu ms)\n", (unsigned)response.length, response.elapsedMs);
+
+  // Only the three fields we use, read straight from the client's buffer
+  float power = 0, totalImport = 0, totalExport = 0;
+  JsonFields fields;
+  fields.number("active_power_w", power)
+      .number("total_power_import_kwh", totalImport)
+      .number("total_power_export_kwh", totalExport);
+
+  bool parsed = fields.read(response.body, response.length);
+  health.record(response, parsed);
+  if (!parsed) {
+    Serial.printf("P1 > JSON parse error: no %s\n", fields.missing() ? fields.missing() : "object");
+    return;
   }
 
-  int httpCode = localHttp.GET();
-  Serial.printf("P1 > HTTP code: %d\n", httpCode);
+  Serial.printf("Received P1 power data: %.2f W\n", power);
+  Serial.printf("Today total import: %.2f kWh\n", totalImport);
+  Serial.printf("Today total export: %.2f kWh\n", totalExport);
 
-  if (httpCode == HTTP_CODE_OK) {
-    String payload = localHttp.getString();
-    Serial.printf("P1 > Payload length: %d\n", payload.length());
+  store(power, totalImport, totalExport);
+}
 
-    StaticJsonDocument<1536> doc;
-    DeserializationError error = deserializeJson(doc, payload);
+void HomeP1Device::store(float power, float totalImport, float totalExport) {
+  latest.write({max(power, 0), max(-power, 0), totalImport, totalExport});
+}
 
-    if (error) {
-      Serial.printf("P1 > JSON parse error: %s\n", error.c_str());
-      localHttp.end();
-      localClient.stop();
-      delay(100);
-      return false;
+void HomeP1Device::updateStream() {
+  if (streamUrl.length() == 0) {
+    return;
+  }
+  stream.poll();
+  unsigned long now = millis(); // After poll(): a measurement it delivered is never in the future
+
+  if (stream.isOpen()) {
+    if (!streamSubscribed) {
+      // Token first when the meter wants one, then ask for measurements
+      if (streamToken.length() > 0) {
+        String authorization = "{\"type\":\"authorization\",\"data\":\"" + streamToken + "\"}";
+        stream.sendText(authorization.c_str());
+      }
+      stream.sendText("{\"type\":\"subscribe\",\"data\":\"measurement\"}");
+      streamSubscribed = true;
+      streamFrames = 0;
+      lastFrameTime = now; // Counts as stale STREAM_STALE from here
     }
+    if (now - lastFrameTime < STREAM_STALE)
+      return;
+    Serial.printf("P1 > No measurement pushed for %lu ms, polling again\n", now - lastFrameTime);
+    stream.close();
+  }
+  if (stream.getState() != WebSocketClient::State::Closed)
+    return; // Still connecting
+
+  if (streamActive) {
+    // The attempt failed or the stream ended: wait longer after every
+    // attempt that brought nothing, start over after one that did
+    streamActive = false;
+    streamSubscribed = false;
+    if (streamFrames > 0)
+      streamWait = STREAM_RETRY_MIN;
+    else
+      streamWait = streamWait == 0 ? STREAM_RETRY_MIN : min(streamWait * 2, STREAM_RETRY_MAX);
+    streamEnded = now;
+    Serial.printf("P1 > Stream closed after %lu measurements, retry in %lu s\n", streamFrames, streamWait / 1000);
+    streamFrames = 0;
+  }
 
-    float power = doc["active_power_w"].as<float>();
-    lastTotalImport = doc["total_power_import_kwh"].as<float>();
-    lastTotalExport = doc["total_power_export_kwh"].as<float>();
-
-    Serial.printf("Received P1 power data: %.2f W\n", power);
-    Serial.printf("Today total import: %.2f kWh\n", lastTotalImport);
-    Serial.printf("Today total export: %.2f kWh\n", lastTotalExport);
-
-    importPower = max(power, 0);
-    exportPower = max(-power, 0);
-
-    lastImportPower = importPower;
-    lastExportPower = exportPower;
-
-    localHttp.end();
-    localClient.stop();
-    delay(100); // CRITICAL: Let socket close properly
-    return true;
+  if (now - streamEnded < streamWait || WiFi.status() != WL_CONNECTED)
+    return;
+  streamActive = stream.connect(streamUrl);
+  if (!streamActive) {
+    Serial.printf("P1 > Can't open stream %s\n", streamUrl.c_str());
+    streamWait = STREAM_RETRY_MAX; // Bad url or no socket
+    streamEnded = now;
+  }
+}
 
-  } else {
-    Serial.printf("P1 > HTTP error: %d\n", httpCode);
+// {"type":"measurement","data":{"power_w":-543,"energy_import_kwh":...}}
+void HomeP1Device::onStreamMessage(const char *text, size_t length) {
+  char type[24] = "";
+  float power = 0, totalImport = 0, totalExport = 0;
+  JsonFields data;
+  data.number("power_w", power)
+      .number("energy_import_kwh", totalImport)
+      .number("energy_export_kwh", totalExport);
+  JsonFields message;
+  message.text("type", type, sizeof(type)).object("data", data);
+  bool complete = message.read(text, length);
+
+  if (strcmp(type, "measurement") != 0) {
+    if (strcmp(type, "error") == 0)
+      Serial.printf("P1 > Stream error: %.*s\n", (int)length, text);
+    return; // Authorization and other notices
+  }
+  if (!complete) {
+    Serial.printf("P1 > Measurement without %s\n", data.missing() ? data.missing() : "data");
+    return;
   }
+  streamFrames++;
+  lastFrameTime = millis();
+  store(power, totalImport, totalExport);
+}
 
-  localHttp.end();
-  localClient.stop();
-  delay(100); // CRITICAL: Let socket close properly
-  return false;
+bool HomeP1Device::isStreaming() const {
+  return stream.isOpen() && streamFrames > 0 && millis() - lastFrameTime < STREAM_STALE;
 }
 
 float HomeP1Device::getCurrentImport() const {
-  return lastImportPower;
+  return latest.read().importPower;
 }
 
 float HomeP1Device::getCurrentExport() const {
-  return lastExportPower;
+  return latest.read().exportPower;
 }
 
 float HomeP1Device::getTotalImport() const {
-  return lastTotalImport;
+  return latest.read().totalImport;
 }
 
 float HomeP1Device::getTotalExport() const {
-  return lastTotalExport;
+  return latest.read().totalExport;
 }
 
 float HomeP1Device::getNetPower() const {
-  return lastImportPower - lastExportPower;
+  P1Sample sample = latest.read();
+  return sample.importPower - sample.exportPower;
 }
 
 bool HomeP1Device::isConnected() const {
-  return lastReadSuccess;
+  return isStreaming() || health.lastOk();
 }
\ No newline at end of file
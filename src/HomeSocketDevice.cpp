@@ -1,178 +1,265 @@
 #define DEBUG_HOME_SOCKET_DEVICE 0
 #include "HomeSocketDevice.h"
+#include "PollScheduler.h"
+
+uint32_t HomeSocketDevice::nextCommandId = 1;
 
 HomeSocketDevice::HomeSocketDevice(const char *ip, int socketNum)
-    : baseUrl("http://" + String(ip)), lastKnownState(false), lastReadTime(0),
-      lastReadSuccess(false), consecutiveFailures(0), deviceIP(ip),
-      lastLogTime(0), socketNumber(socketNum) {
+    : baseUrl("http://" + String(ip)), stateUrl(baseUrl + "/api/v1/state"),
+      lastKnownState(false), lastReadSuccess(false), deviceIP(ip),
+      socketNumber(socketNum), lastLogTime(0) {
   Serial.printf("Initializing socket %d at IP: %s\n", socketNum, ip);
+  reachId = reachability.add(ip);
 }
 
-void HomeSocketDevice::readStateInfo() {
-  // GLOBAL rate limiter - prevents ANY socket from polling within 100ms of another
-  static unsigned long lastGlobalRequest = 0;
-
-  unsigned long currentTime = millis();
-
-  // Enforce minimum 100ms between ANY socket requests to prevent network congestion
-  if (currentTime - lastGlobalRequest < 100) {
-    return; // Too soon since last socket request from any socket
+bool HomeSocketDevice::mayConnect() {
+  if (WiFi.status() != WL_CONNECTED) {
+    return false;
   }
+  // Answering ping again: no need to sit out the rest of the breaker's wait
+  uint16_t recoveries = reachability.getRecoveries(reachId);
+  if (recoveries != seenRecoveries) {
+    seenRecoveries = recoveries;
+    health.retryNow();
+  }
+  return reachability.allowRequest(reachId);
+}
 
-  unsigned long timeSinceLastRead = currentTime - lastReadTime;
+void HomeSocketDevice::record(const HttpResponse &response, bool parsed) {
+  health.record(response, parsed);
+  if (response.error == HttpResponse::Error::Timeout || response.error == HttpResponse::Error::Connect) {
+    reachability.requestFailed(reachId); // No answer at all: is it still there?
+  } else {
+    reachability.requestSucceeded(reachId);
+  }
+}
 
-  // Disconnected: use exponential backoff (2s, 4s, 6s... max 120s)
-  if (consecutiveFailures > 0) {
-    unsigned long baseBackoff = min(consecutiveFailures * 2000UL, 120000UL);
+unsigned long HomeSocketDevice::retryIn() const {
+  return max(health.retryIn(), reachability.retryIn(reachId));
+}
 
-    // ADD STAGGER: Each socket gets different retry time to prevent synchronized spikes
-    // Socket 1: +0s, Socket 2: +2s, Socket 3: +4s, etc.
-    unsigned long stagger = (socketNumber - 1) * 2000;
-    unsigned long backoffTime = baseBackoff + stagger;
+bool HomeSocketDevice::getState() {
+  if (readPending || !mayConnect() || !health.allowRequest()) {
+    return false;
+  }
 
-    if (timeSinceLastRead < backoffTime) {
-      return;
-    }
-  } else {
-    // Connected: regular polling interval WITH stagger to spread out polls
-    unsigned long stagger = (socketNumber - 1) * 1000; // 1s stagger for connected sockets
-    if (timeSinceLastRead < (READ_INTERVAL + stagger)) {
-      return;
-    }
+  uint32_t version = stateVersion;
+  readPending = httpClient.get(stateUrl, HTTP_TIMEOUT, [this, version](const HttpResponse &response) {
+    onStateRead(response, version);
+  });
+  if (!readPending) {
+    health.cancelRequest();
   }
+  return readPending;
+}
 
-  // About to make network request - update global timestamp
-  lastGlobalRequest = currentTime;
+void HomeSocketDevice::onStateRead(const HttpResponse &response, uint32_t version) {
+  readPending = false;
+  unsigned long currentTime = millis();
 
-  // Regular status check
-  bool previousState = lastKnownState;
-  if (!getState()) {
-    consecutiveFailures++;
+  bool powerOn = false;
+  JsonFields fields;
+  fields.flag("power_on", powerOn);
+  bool valid = response.ok() && fields.read(response.body, response.length);
+  bool wasFailing = health.getFailuresInRow() > 0;
+  record(response, valid);
+  if (!valid) {
+#if DEBUG_HOME_SOCKET_DEVICE
+    Serial.printf("Socket %d > %s/api/v1/state > Get > %s (error %d, HTTP %d)\n",
+                  socketNumber, deviceIP.c_str(), response.ok() ? "JSON error" : "HTTP error",
+                  (int)response.error, response.status);
+#endif
+    lastReadSuccess = false;
+    pollScheduler.readDone(socketNumber, false, false);
     if (currentTime - lastLogTime >= 30000) {
-      unsigned long nextBackoff = min((consecutiveFailures) * 2000UL, 120000UL);
-      unsigned long stagger = (socketNumber - 1) * 2000;
-      Serial.printf("Socket %d > %s > Offline (retry in %lu sec)\n",
-                    socketNumber, deviceIP.c_str(), (nextBackoff + stagger) / 1000);
-      lastLogTime = currentTime;
-    }
-  } else {
-    if (consecutiveFailures > 0) {
-      Serial.printf("Socket %d > %s > Back online\n", socketNumber, deviceIP.c_str());
+      Serial.printf("Socket %d > %s > Offline, breaker %s (retry in %lu sec)\n",
+                    socketNumber, deviceIP.c_str(), health.getStateName(),
+                    pollScheduler.getInterval(socketNumber) / 1000);
       lastLogTime = currentTime;
     }
-    consecutiveFailures = 0;
-
-    // If the state changed from our last known state, log it
-    if (previousState != lastKnownState) {
-      Serial.printf("Socket %d > %s > State changed from %s to %s\n",
-                    socketNumber, deviceIP.c_str(),
-                    previousState ? "ON" : "OFF",
-                    lastKnownState ? "ON" : "OFF");
-    }
+    return;
   }
 
-  lastReadTime = currentTime;
-}
-
-bool HomeSocketDevice::makeHttpRequest(const String &endpoint,
-                                       const String &method,
-                                       const String &payload,
-                                       String &response) {
-  if (WiFi.status() != WL_CONNECTED) {
-    return false;
+  if (wasFailing) {
+    Serial.printf("Socket %d > %s > Back online\n", socketNumber, deviceIP.c_str());
+    lastLogTime = currentTime;
   }
+  lastReadSuccess = true;
 
-  WiFiClient newClient;
-  HTTPClient http;
-  newClient.setTimeout(2000); // REDUCED from 5000 to 2000
-  // NO setConnectTimeout() - this causes socket exhaustion!
+  // A setState() or PUT answer since this GET started wins over what the
+  // GET saw, and so does a command still on its way
+  if (version != stateVersion || queued.status == CommandStatus::Queued || sent.status == CommandStatus::Sent) {
+    pollScheduler.readDone(socketNumber, true, false);
+    return;
+  }
 
-  String fullUrl = baseUrl + endpoint;
+  bool previousState = lastKnownState;
+  lastKnownState = powerOn;
+  confirmedState = powerOn;
+  confirmedKnown = true;
+  // Not our doing: switched by hand or from the app
+  pollScheduler.readDone(socketNumber, true, previousState != lastKnownState);
+#if DEBUG_HOME_SOCKET_DEVICE
+  Serial.printf("Socket %d > %s/api/v1/state > Get > is %s (%lu ms)\n",
+                socketNumber, deviceIP.c_str(), lastKnownState ? "on" : "off", response.elapsedMs);
+#endif
 
-  if (!http.begin(newClient, fullUrl)) {
-    newClient.stop();
-    delay(50);
-    return false;
+  // If the state changed from our last known state, log it
+  if (previousState != lastKnownState) {
+    Serial.printf("Socket %d > %s > State changed from %s to %s\n",
+                  socketNumber, deviceIP.c_str(),
+                  previousState ? "ON" : "OFF",
+                  lastKnownState ? "ON" : "OFF");
   }
+}
 
-  http.setTimeout(2000); // REDUCED from 5000 to 2000
-  http.setReuse(false);
+uint32_t HomeSocketDevice::setState(bool state) {
+  Serial.printf("setState(%s) called for socket %s\n", state ? "true" : "false",
+                deviceIP.c_str());
+  if (WiFi.status() != WL_CONNECTED) {
+    return 0;
+  }
+  bool reachable = mayConnect();
+  if (!reachable || !health.isAvailable()) {
+    Serial.printf("Socket %d > %s > %s, state not sent\n", socketNumber, deviceIP.c_str(),
+                  reachable ? "Breaker open" : "Unreachable");
+    return 0;
+  }
 
-  int httpCode;
-  if (method == "GET") {
-    httpCode = http.GET();
-  } else if (method == "PUT") {
-    http.addHeader("Content-Type", "application/json");
-    httpCode = http.PUT(payload);
-  } else {
-    http.end();
-    newClient.stop();
-    delay(50);
-    return false;
+  Command command;
+  command.id = nextCommandId++;
+  if (nextCommandId == 0) {
+    nextCommandId = 1;
   }
+  command.state = state;
+  stateVersion++; // Reads already out saw the state before this
+  lastKnownState = state;
 
-  bool success = (httpCode == HTTP_CODE_OK);
-  if (success) {
-    response = http.getString();
+  if (queued.status == CommandStatus::Queued) {
+    finish(queued, CommandStatus::Superseded);
+    queued.status = CommandStatus::None;
+  }
+  // What the socket will be once the PUT in flight is answered
+  bool inFlight = sent.status == CommandStatus::Sent;
+  if ((inFlight || confirmedKnown) && state == (inFlight ? sent.state : confirmedState)) {
+    finish(command, CommandStatus::Unchanged);
+    return command.id;
   }
 
-  http.end();
-  newClient.stop();
-  delay(100); // CRITICAL: Let socket close properly
-  return success;
+  command.status = CommandStatus::Queued;
+  queued = command;
+  dispatch();
+  return command.id;
 }
 
-bool HomeSocketDevice::getState() {
-  String response;
-  if (!makeHttpRequest("/api/v1/state", "GET", "", response)) {
-#if DEBUG_HOME_SOCKET_DEVICE
-    Serial.printf("Socket %d > %s/api/v1/state > Get > HTTP error\n",
-                  socketNumber, deviceIP.c_str());
-#endif
-    lastReadSuccess = false;
-    return false;
+void HomeSocketDevice::dispatch() {
+  if (queued.status != CommandStatus::Queued || sent.status == CommandStatus::Sent) {
+    return;
+  }
+  bool wifi = WiFi.status() == WL_CONNECTED;
+  bool reachable = wifi && mayConnect();
+  if (!reachable || !health.isAvailable()) {
+    Serial.printf("Socket %d > %s > %s, turn %s dropped\n", socketNumber, deviceIP.c_str(),
+                  !wifi ? "No WiFi" : !reachable ? "Unreachable" : "Breaker open", queued.state ? "on" : "off");
+    finish(queued, CommandStatus::Failed);
+    queued.status = CommandStatus::None;
+    lastKnownState = confirmedState;
+    return;
+  }
+  if (!health.allowRequest()) {
+    return; // Half open, the probe is still out
   }
 
-  StaticJsonDocument<256> doc;
-  DeserializationError error = deserializeJson(doc, response);
+  const char *payload = queued.state ? "{\"power_on\":true}" : "{\"power_on\":false}";
+  if (!httpClient.request("PUT", stateUrl, payload, HTTP_TIMEOUT, [this](const HttpResponse &response) {
+        onStateWritten(response);
+      })) {
+    health.cancelRequest(); // No free connection, next pass
+    return;
+  }
+  sent = queued;
+  sent.status = CommandStatus::Sent;
+  queued.status = CommandStatus::None;
+  pollScheduler.expedite(socketNumber); // Confirm what the socket did
+}
 
-  if (error) {
-#if DEBUG_HOME_SOCKET_DEVICE
-    Serial.printf("Socket %d > %s/api/v1/state > Get > JSON error\n",
+void HomeSocketDevice::onStateWritten(const HttpResponse &response) {
+  record(response, true);
+  Command command = sent;
+  sent.status = CommandStatus::None;
+  stateVersion++; // A read that started before this answer may have seen the old state
+
+  if (!response.ok()) {
+    Serial.printf("Socket %d > %s > Disconnected\n",
                   socketNumber, deviceIP.c_str());
-#endif
     lastReadSuccess = false;
-    return false;
+    finish(command, CommandStatus::Failed);
+    // Undo the optimistic state unless a newer setState() is waiting
+    if (queued.status != CommandStatus::Queued) {
+      lastKnownState = confirmedState;
+    }
+  } else {
+    Serial.printf("PowerSocket %d > %s/api/v1/state > Put > turn %s (%lu ms)\n",
+                  socketNumber, deviceIP.c_str(), command.state ? "on" : "off", response.elapsedMs);
+    confirmedState = command.state;
+    confirmedKnown = true;
+    finish(command, CommandStatus::Done);
   }
+  dispatch(); // The one waiting behind it, if any
+}
 
-  lastKnownState = doc["power_on"] | false;
-#if DEBUG_HOME_SOCKET_DEVICE
-  Serial.printf("Socket %d > %s/api/v1/state > Get > is %s\n",
-                socketNumber, deviceIP.c_str(), lastKnownState ? "on" : "off");
-#endif
-  lastReadSuccess = true;
-  return true;
+void HomeSocketDevice::finish(Command command, CommandStatus status) {
+  command.status = status;
+  finished[finishedNext] = command;
+  finishedNext = (finishedNext + 1) % FINISHED_COMMANDS;
 }
 
-bool HomeSocketDevice::setState(bool state) {
-  Serial.printf("setState(%s) called for socket %s\n", state ? "true" : "false",
-                deviceIP.c_str());
-  StaticJsonDocument<128> doc;
-  doc["power_on"] = state;
-  String jsonString;
-  serializeJson(doc, jsonString);
-
-  String response;
-  // FIXED: Was passing empty string, now passing jsonString
-  if (!makeHttpRequest("/api/v1/state", "PUT", jsonString, response)) {
-    Serial.printf("Socket %d > %s > Disconnected\n",
-                  socketNumber, deviceIP.c_str());
-    lastReadSuccess = false;
-    return false;
+HomeSocketDevice::Command HomeSocketDevice::getCommand(uint32_t id) const {
+  if (id != 0) {
+    if (queued.id == id && queued.status == CommandStatus::Queued) {
+      return queued;
+    }
+    if (sent.id == id && sent.status == CommandStatus::Sent) {
+      return sent;
+    }
+    for (const Command &command : finished) {
+      if (command.id == id) {
+        return command;
+      }
+    }
   }
+  Command unknown;
+  unknown.id = id;
+  return unknown;
+}
 
-  lastKnownState = state;
-  Serial.printf("PowerSocket %d > %s/api/v1/state > Put > turn %s\n",
-                socketNumber, deviceIP.c_str(), state ? "on" : "off");
-  return true;
+HomeSocketDevice::Command HomeSocketDevice::getLatestCommand() const {
+  if (queued.status == CommandStatus::Queued) {
+    return queued;
+  }
+  if (sent.status == CommandStatus::Sent) {
+    // A newer one may have finished as Unchanged or Superseded already
+    const Command &newest = finished[(finishedNext + FINISHED_COMMANDS - 1) % FINISHED_COMMANDS];
+    return newest.id > sent.id ? newest : sent;
+  }
+  return finished[(finishedNext + FINISHED_COMMANDS - 1) % FINISHED_COMMANDS];
+}
+
+const char *HomeSocketDevice::statusName(CommandStatus status) {
+  switch (status) {
+  case CommandStatus::Queued:
+    return "queued";
+  case CommandStatus::Sent:
+    return "sent";
+  case CommandStatus::Done:
+    return "done";
+  case CommandStatus::Unchanged:
+    return "unchanged";
+  case CommandStatus::Superseded:
+    return "superseded";
+  case CommandStatus::Failed:
+    return "failed";
+  default:
+    return "none";
+  }
 }
\ No newline at end of file
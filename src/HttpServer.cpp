@@ -0,0 +1,688 @@
+#define DEBUG_HTTP_SERVER 0
+
+#include "HttpServer.h"
+#include <errno.h>
+
+#if defined(ESP32)
+#include <lwip/sockets.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // lwIP never raises SIGPIPE
+#endif
+
+static const char *statusText(int status) {
+  switch (status) {
+  case 200:
+    return "OK";
+  case 204:
+    return "No Content";
+  case 304:
+    return "Not Modified";
+  case 400:
+    return "Bad Request";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 408:
+    return "Request Timeout";
+  case 411:
+    return "Length Required";
+  case 413:
+    return "Payload Too Large";
+  case 431:
+    return "Request Header Fields Too Large";
+  case 500:
+    return "Internal Server Error";
+  case 503:
+    return "Service Unavailable";
+  default:
+    return status < 400 ? "OK" : "Error";
+  }
+}
+
+// Value of a request header, nullptr when the request doesn't have it.
+// headers starts at the CRLF ending the request line and is NUL terminated.
+static const char *findHeader(const char *headers, const char *name, size_t &length) {
+  char pattern[40];
+  snprintf(pattern, sizeof(pattern), "\r\n%s:", name);
+  const char *found = strcasestr(headers, pattern);
+  if (!found)
+    return nullptr;
+  found += strlen(pattern);
+  while (*found == ' ')
+    found++;
+  const char *end = strstr(found, "\r\n");
+  length = end ? end - found : strlen(found);
+  return found;
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+// One Server-Sent Event; data must be a single line, like compact JSON
+static String formatEvent(const char *event, const String &data) {
+  String text = "event: ";
+  text += event;
+  text += "\ndata: ";
+  text += data;
+  text += "\n\n";
+  return text;
+}
+
+// Finds name in "a=1&b=2", decodes its value into value when given
+static bool findArg(const char *query, const char *name, String *value) {
+  size_t nameLength = strlen(name);
+  const char *pair = query;
+  while (*pair) {
+    const char *end = strchr(pair, '&');
+    if (!end)
+      end = pair + strlen(pair);
+    const char *equals = (const char *)memchr(pair, '=', end - pair);
+    const char *keyEnd = equals ? equals : end;
+    if ((size_t)(keyEnd - pair) == nameLength && strncmp(pair, name, nameLength) == 0) {
+      if (value) {
+        *value = "";
+        for (const char *c = equals ? equals + 1 : end; c < end; c++) {
+          if (*c == '+') {
+            *value += ' ';
+          } else if (*c == '%' && c + 2 < end && hexValue(c[1]) >= 0 && hexValue(c[2]) >= 0) {
+            *value += (char)(hexValue(c[1]) * 16 + hexValue(c[2]));
+            c += 2;
+          } else {
+            *value += *c;
+          }
+        }
+      }
+      return true;
+    }
+    pair = *end ? end + 1 : end;
+  }
+  return false;
+}
+
+// ============================================================================
+// REQUEST / RESPONSE
+// ============================================================================
+bool HttpServer::Request::hasArg(const char *name) const {
+  return findArg(query, name, nullptr);
+}
+
+String HttpServer::Request::arg(const char *name) const {
+  String value;
+  findArg(query, name, &value);
+  return value;
+}
+
+String HttpServer::Request::header(const char *name) const {
+  size_t length;
+  const char *value = findHeader(headers, name, length);
+  String result;
+  if (value) {
+    result.reserve(length);
+    for (size_t i = 0; i < length; i++)
+      result += value[i];
+  }
+  return result;
+}
+
+void HttpServer::Response::addHeader(const char *name, const String &value) {
+  extraHeaders += name;
+  extraHeaders += ": ";
+  extraHeaders += value;
+  extraHeaders += "\r\n";
+}
+
+void HttpServer::Response::send(int code, const char *type, const String &body) {
+  status = code;
+  contentType = type;
+  owned = body;
+  data = (const uint8_t *)owned.c_str();
+  length = owned.length();
+}
+
+void HttpServer::Response::send(int code, const char *type, const uint8_t *bytes, size_t size) {
+  status = code;
+  contentType = type;
+  owned = String();
+  if (size > 0) {
+    // concat() copies a terminator from bytes[length] too: the last byte on its own
+    owned.reserve(size);
+    owned.concat((const char *)bytes, size - 1);
+    owned += (char)bytes[size - 1];
+  }
+  data = (const uint8_t *)owned.c_str();
+  length = size;
+}
+
+void HttpServer::Response::sendStatic(int code, const char *type, const uint8_t *bytes, size_t size) {
+  status = code;
+  contentType = type;
+  data = bytes;
+  length = size;
+}
+
+void HttpServer::Response::sendStream(int code, const char *type, size_t size, Filler fill) {
+  status = code;
+  contentType = type;
+  length = size;
+  filler = fill;
+}
+
+void HttpServer::Response::startEvents(const char *event, const String &data) {
+  status = 200;
+  contentType = "text/event-stream";
+  events = true;
+  owned = formatEvent(event, data);
+}
+
+bool HttpServer::Response::notModified(const Request &request, const char *etag) {
+  addHeader("ETag", etag);
+  String match = request.header("If-None-Match"); // One tag, a list of them, or *
+  if (match.length() == 0 || (strstr(match.c_str(), etag) == nullptr && strcmp(match.c_str(), "*") != 0))
+    return false;
+  status = 304;
+  contentType = "";
+  return true;
+}
+
+// ============================================================================
+// SERVER
+// ============================================================================
+HttpServer::~HttpServer() {
+  for (Client &client : clients)
+    drop(client);
+  if (listener >= 0)
+    ::close(listener);
+}
+
+bool HttpServer::begin(uint16_t port) {
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  if (listener < 0) {
+    Serial.printf("Web > No socket (errno %d)\n", errno);
+    return false;
+  }
+  int reuse = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(listener, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, MAX_CLIENTS) < 0) {
+    Serial.printf("Web > Cannot listen on port %u (errno %d)\n", port, errno);
+    ::close(listener);
+    listener = -1;
+    return false;
+  }
+  fcntl(listener, F_SETFL, fcntl(listener, F_GETFL, 0) | O_NONBLOCK);
+  return true;
+}
+
+void HttpServer::on(const char *path, Method method, Handler handler) {
+  routes.push_back({String(path), method, handler});
+}
+
+uint8_t HttpServer::sendEvent(const char *event, const String &data) {
+  uint8_t streams = getEventClientCount();
+  if (streams == 0)
+    return 0;
+  String text = formatEvent(event, data);
+  for (Client &client : clients) {
+    if (client.state != State::Events)
+      continue;
+    if (client.head.length() - client.sent + text.length() > EVENT_BACKLOG) {
+      // Not reading: closed, its EventSource reconnects and starts over
+      drop(client);
+      stats.streamsDropped++;
+      continue;
+    }
+    if (client.sent > 0) {
+      client.head = client.head.substring(client.sent);
+      client.sent = 0;
+    }
+    client.head += text;
+    stats.events++;
+  }
+  return streams;
+}
+
+uint8_t HttpServer::getEventClientCount() const {
+  uint8_t count = 0;
+  for (const Client &client : clients) {
+    if (client.state == State::Events)
+      count++;
+  }
+  return count;
+}
+
+uint8_t HttpServer::getClientCount() const {
+  uint8_t count = 0;
+  for (const Client &client : clients) {
+    if (client.state != State::Free)
+      count++;
+  }
+  return count;
+}
+
+void HttpServer::poll() {
+  if (listener < 0)
+    return;
+  unsigned long now = millis();
+  acceptClients(now);
+
+  for (Client &client : clients) {
+    if (client.state == State::Reading)
+      readRequest(client, now);
+    if (client.state == State::Writing)
+      writeAnswer(client, now);
+    if (client.state == State::Events)
+      serveEvents(client, now);
+  }
+}
+
+void HttpServer::serveFor(unsigned long ms) {
+  unsigned long start = millis();
+  while (true) {
+    poll();
+    long left = (long)ms - (long)(millis() - start);
+    if (left <= 0)
+      return;
+    if (listener < 0) {
+      delay(left);
+      return;
+    }
+
+    // Until a connection, a request or room to send comes up
+    fd_set readable, writable;
+    FD_ZERO(&readable);
+    FD_ZERO(&writable);
+    int highest = -1;
+    if (roomForClient()) {
+      FD_SET(listener, &readable);
+      highest = listener;
+    }
+    for (Client &client : clients) {
+      if (client.state == State::Free)
+        continue;
+      bool sending = client.state == State::Writing || (client.state == State::Events && client.sent < client.head.length());
+      FD_SET(client.fd, sending ? &writable : &readable);
+      if (client.fd > highest)
+        highest = client.fd;
+    }
+    timeval timeout = {left / 1000, (left % 1000) * 1000};
+    select(highest + 1, &readable, &writable, nullptr, &timeout);
+  }
+}
+
+HttpServer::Client *HttpServer::roomForClient() {
+  Client *idlest = nullptr;
+  for (Client &client : clients) {
+    if (client.state == State::Free)
+      return &client;
+    // A kept-alive connection between requests can make room
+    if (client.state == State::Reading && client.received == 0 && client.servedBefore &&
+        (!idlest || client.lastActivity < idlest->lastActivity))
+      idlest = &client;
+  }
+  return idlest;
+}
+
+void HttpServer::acceptClients(unsigned long now) {
+  while (true) {
+    // Full and all busy: new connections wait in the backlog meanwhile
+    Client *slot = roomForClient();
+    if (!slot)
+      return;
+    int fd = ::accept(listener, nullptr, nullptr);
+    if (fd < 0)
+      return;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    int noDelay = 1; // Answers go out in two sends: head, then body
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    if (slot->state != State::Free) {
+      drop(*slot);
+      stats.evicted++;
+    }
+
+    slot->state = State::Reading;
+    slot->fd = fd;
+    slot->lastActivity = now;
+    slot->servedBefore = false;
+    slot->received = 0;
+    slot->headerEnd = 0;
+    stats.accepted++;
+    uint8_t count = getClientCount();
+    if (count > stats.maxClients)
+      stats.maxClients = count;
+  }
+}
+
+void HttpServer::readRequest(Client &client, unsigned long now) {
+  while (true) {
+    if (client.headerEnd && client.body.length() >= client.bodyLength) {
+      dispatch(client);
+      return;
+    }
+
+    ssize_t n;
+    if (!client.headerEnd) {
+      if (client.received >= HEADER_SIZE - 1) {
+        fail(client, 431);
+        return;
+      }
+      n = recv(client.fd, client.header + client.received, HEADER_SIZE - 1 - client.received, MSG_DONTWAIT);
+    } else {
+      char buffer[512];
+      size_t missing = client.bodyLength - client.body.length();
+      n = recv(client.fd, buffer, missing < sizeof(buffer) ? missing : sizeof(buffer), MSG_DONTWAIT);
+      if (n > 0)
+        client.body.concat(buffer, n);
+    }
+
+    if (n == 0 || (n < 0 && errno != EWOULDBLOCK && errno != EAGAIN)) {
+      drop(client); // Gone
+      return;
+    }
+    if (n < 0) {
+      // Nothing more yet
+      bool waiting = client.received > 0 || client.headerEnd;
+      if (waiting && now - client.requestStarted > REQUEST_TIMEOUT) {
+        stats.timeouts++;
+        fail(client, 408);
+      } else if (!waiting && now - client.lastActivity > KEEP_ALIVE_IDLE) {
+        drop(client);
+      }
+      return;
+    }
+
+    if (client.received == 0 && !client.headerEnd)
+      client.requestStarted = now;
+    client.lastActivity = now;
+    if (!client.headerEnd) {
+      client.received += n;
+      client.header[client.received] = '\0';
+      if (!parse(client))
+        return;
+    }
+  }
+}
+
+bool HttpServer::parse(Client &client) {
+  char *end = strstr(client.header, "\r\n\r\n");
+  if (!end)
+    return true; // Not all there yet
+  client.headerEnd = end + 4 - client.header;
+
+  // Whatever came after the headers: the body, then maybe the next request
+  size_t extra = client.received - client.headerEnd;
+  // Only this request's headers, not a pipelined one's
+  char saved = client.header[client.headerEnd - 2];
+  client.header[client.headerEnd - 2] = '\0';
+  size_t length;
+  const char *headers = strstr(client.header, "\r\n");
+  bool chunked = findHeader(headers, "Transfer-Encoding", length) != nullptr;
+  const char *contentLength = findHeader(headers, "Content-Length", length);
+  client.bodyLength = contentLength ? strtoul(contentLength, nullptr, 10) : 0;
+  client.header[client.headerEnd - 2] = saved;
+  if (chunked) {
+    fail(client, 411); // Nothing here sends chunked requests
+    return false;
+  }
+  if (client.bodyLength > MAX_BODY) {
+    fail(client, 413);
+    return false;
+  }
+  size_t bodyPart = extra < client.bodyLength ? extra : client.bodyLength;
+  client.body = "";
+  if (client.bodyLength) {
+    client.body.reserve(client.bodyLength);
+    client.body.concat(client.header + client.headerEnd, bodyPart);
+  }
+  return true;
+}
+
+void HttpServer::dispatch(Client &client) {
+  // Request line: METHOD target HTTP/1.x
+  char *line = client.header;
+  char *lineEnd = strstr(line, "\r\n");
+  *lineEnd = '\0';
+  char *target = strchr(line, ' ');
+  char *version = target ? strchr(target + 1, ' ') : nullptr;
+  if (!target || !version) {
+    fail(client, 400);
+    return;
+  }
+  *target++ = '\0';
+  *version++ = '\0';
+
+  Request request;
+  request.method = strcmp(line, "GET") == 0 ? Method::Get : strcmp(line, "POST") == 0 ? Method::Post : Method::Other;
+  char *query = strchr(target, '?');
+  if (query) {
+    *query++ = '\0';
+    request.query = query;
+  }
+  request.path = target;
+  // Keep the request line's CRLF: header lookups match "\r\nName:"
+  *lineEnd = '\r';
+  char *headerEnd = client.header + client.headerEnd - 2;
+  char saved = *headerEnd;
+  *headerEnd = '\0';
+  request.headers = lineEnd;
+  request.bodyText = &client.body;
+
+  size_t length;
+  const char *connection = findHeader(request.headers, "Connection", length);
+  if (strcmp(version, "HTTP/1.0") == 0)
+    client.keepAlive = connection && strncasecmp(connection, "keep-alive", 10) == 0;
+  else
+    client.keepAlive = !(connection && strncasecmp(connection, "close", 5) == 0);
+
+  stats.requests++;
+  if (client.servedBefore)
+    stats.keptAlive++;
+
+  Response response;
+  Handler *handler = nullptr;
+  bool pathKnown = false;
+  for (Route &route : routes) {
+    if (route.path != request.path)
+      continue;
+    pathKnown = true;
+    if (route.method == request.method) {
+      handler = &route.handler;
+      break;
+    }
+  }
+  unsigned long started = micros();
+  if (handler) {
+    (*handler)(request, response);
+  } else {
+    stats.notFound++;
+    if (notFound)
+      notFound(request, response);
+    else
+      response.send(pathKnown ? 405 : 404, "text/plain", pathKnown ? "Method Not Allowed" : "Not Found");
+  }
+  unsigned long took = micros() - started;
+  if (took > stats.maxHandlerMicros)
+    stats.maxHandlerMicros = took;
+  if (!response.isSent())
+    response.send(500, "text/plain", "No answer");
+#if DEBUG_HTTP_SERVER
+  Serial.printf("Web > %s %s > %d in %lu us\n", line, request.path, response.status, took);
+#endif
+  *headerEnd = saved;
+  startAnswer(client, response);
+}
+
+void HttpServer::startAnswer(Client &client, Response &response) {
+  if (response.events) {
+    if (getEventClientCount() >= MAX_EVENT_CLIENTS) {
+      // Leaves room for requests; the page polls instead
+      client.keepAlive = false;
+      response = Response();
+      response.send(503, "text/plain", "Too many event streams");
+    } else {
+      char line[160];
+      snprintf(line, sizeof(line),
+               "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+               "Connection: keep-alive\r\n%s\r\nretry: %lu\n\n",
+               response.extraHeaders.c_str(), EVENT_RETRY);
+      client.head = line;
+      client.head += response.owned;
+      client.sent = 0;
+      client.state = State::Events;
+      client.lastActivity = millis();
+      stats.events++;
+      return;
+    }
+  }
+  client.response = response;
+  if (response.data == (const uint8_t *)response.owned.c_str()) // Now in client.response
+    client.response.data = (const uint8_t *)client.response.owned.c_str();
+
+  char line[160];
+  if (response.status == 304) { // No body, and nothing to say about the one the client has
+    stats.notModified++;
+    snprintf(line, sizeof(line), "HTTP/1.1 304 %s\r\nConnection: %s\r\n", statusText(304),
+             client.keepAlive ? "keep-alive" : "close");
+  } else {
+    snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %u\r\nConnection: %s\r\n",
+             response.status, statusText(response.status), response.contentType, (unsigned)response.length,
+             client.keepAlive ? "keep-alive" : "close");
+  }
+  client.head = line;
+  client.head += response.extraHeaders;
+  client.head += "\r\n";
+  client.sent = 0;
+  client.state = State::Writing;
+}
+
+void HttpServer::writeAnswer(Client &client, unsigned long now) {
+  Response &response = client.response;
+  size_t total = client.head.length() + response.length;
+  while (client.sent < total) {
+    ssize_t n;
+    if (client.sent < client.head.length()) {
+      n = ::send(client.fd, client.head.c_str() + client.sent, client.head.length() - client.sent,
+                 MSG_DONTWAIT | MSG_NOSIGNAL);
+    } else {
+      size_t offset = client.sent - client.head.length();
+      size_t left = response.length - offset;
+      if (response.filler) {
+        uint8_t chunk[CHUNK_SIZE];
+        size_t filled = response.filler(chunk, left < CHUNK_SIZE ? left : CHUNK_SIZE, offset);
+        if (filled == 0) {
+          drop(client); // The source ran dry before length: the client sees a short body
+          return;
+        }
+        n = ::send(client.fd, chunk, filled, MSG_DONTWAIT | MSG_NOSIGNAL);
+      } else {
+        n = ::send(client.fd, response.data + offset, left, MSG_DONTWAIT | MSG_NOSIGNAL);
+      }
+    }
+
+    if (n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+      if (now - client.lastActivity > REQUEST_TIMEOUT) {
+        stats.timeouts++;
+        drop(client);
+      }
+      return; // Send buffer full, more next time
+    }
+    if (n <= 0) {
+      drop(client);
+      return;
+    }
+    client.sent += n;
+    client.lastActivity = now;
+  }
+  finishAnswer(client);
+}
+
+void HttpServer::serveEvents(Client &client, unsigned long now) {
+  // Nothing comes from the browser, except the connection closing
+  char sink[64];
+  ssize_t n = recv(client.fd, sink, sizeof(sink), MSG_DONTWAIT);
+  if (n == 0 || (n < 0 && errno != EWOULDBLOCK && errno != EAGAIN)) {
+    drop(client);
+    return;
+  }
+
+  while (client.sent < client.head.length()) {
+    n = ::send(client.fd, client.head.c_str() + client.sent, client.head.length() - client.sent,
+               MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN))
+      return; // Send buffer full; sendEvent() drops the stream if it stays that way
+    if (n <= 0) {
+      drop(client);
+      return;
+    }
+    client.sent += n;
+    stats.eventBytes += n;
+    client.lastActivity = now;
+  }
+  client.head = "";
+  client.sent = 0;
+}
+
+void HttpServer::finishAnswer(Client &client) {
+  client.response = Response(); // Lets go of a streamed file
+  client.head = "";
+  if (!client.keepAlive) {
+    drop(client);
+    return;
+  }
+
+  // Keep what came after this request: the next one, pipelined
+  size_t used = client.headerEnd + client.bodyLength;
+  size_t left = client.received > used ? client.received - used : 0;
+  memmove(client.header, client.header + client.received - left, left);
+  client.header[left] = '\0';
+  client.received = left;
+  client.headerEnd = 0;
+  client.bodyLength = 0;
+  client.body = "";
+  client.servedBefore = true;
+  client.state = State::Reading;
+  client.requestStarted = client.lastActivity;
+  if (left && parse(client))
+    readRequest(client, client.lastActivity); // Not waiting for the socket, it's already here
+}
+
+void HttpServer::fail(Client &client, int status) {
+  if (status != 408)
+    stats.rejected++;
+  client.keepAlive = false;
+  Response response;
+  response.send(status, "text/plain", statusText(status));
+  startAnswer(client, response);
+}
+
+void HttpServer::drop(Client &client) {
+  if (client.fd >= 0)
+    ::close(client.fd);
+  client.fd = -1;
+  client.state = State::Free;
+  client.response = Response();
+  client.head = "";
+  client.body = "";
+  client.received = 0;
+  client.headerEnd = 0;
+}
@@ -0,0 +1,160 @@
+#include "IcmpEcho.h"
+#include <errno.h>
+
+#if defined(ESP32)
+#include <lwip/sockets.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+IcmpEcho icmpEcho;
+
+// ICMP echo request/reply header, RFC 792
+struct EchoHeader
+{
+  uint8_t type;
+  uint8_t code;
+  uint16_t checksum;
+  uint16_t identifier;
+  uint16_t sequence;
+};
+
+static const uint8_t ECHO_REPLY = 0;
+static const uint8_t ECHO_REQUEST = 8;
+
+static uint16_t checksum(const uint8_t *data, size_t length) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i + 1 < length; i += 2)
+    sum += (data[i] << 8) | data[i + 1];
+  if (length & 1)
+    sum += data[length - 1] << 8;
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  return htons(~sum & 0xFFFF);
+}
+
+IcmpEcho::IcmpEcho() : identifier((uint16_t)random(1, 0xFFFF)) {}
+
+IcmpEcho::~IcmpEcho() {
+  close();
+}
+
+int8_t IcmpEcho::listen(Listener listener) {
+  for (int8_t i = 0; i < MAX_LISTENERS; i++) {
+    if (!listeners[i]) {
+      listeners[i] = listener;
+      return i;
+    }
+  }
+  return -1;
+}
+
+void IcmpEcho::unlisten(int8_t id) {
+  if (id >= 0 && id < MAX_LISTENERS)
+    listeners[id] = nullptr;
+}
+
+bool IcmpEcho::ready() {
+  if (fd >= 0)
+    return true;
+  unsigned long now = millis();
+  if (everOpened && now - lastOpenAttempt < REOPEN_INTERVAL)
+    return false;
+  everOpened = true;
+  lastOpenAttempt = now;
+
+#if defined(ESP32)
+  fd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+  raw = true;
+#else
+  // Raw needs root on Linux; a ping socket does not, where it is allowed
+  fd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+  raw = fd >= 0;
+  if (fd < 0)
+    fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_ICMP);
+#endif
+  if (fd < 0) {
+    Serial.printf("Network > No ICMP socket (errno %d), retry in %lu s\n", errno, REOPEN_INTERVAL / 1000);
+    return false;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  return true;
+}
+
+void IcmpEcho::close() {
+  if (fd >= 0)
+    ::close(fd);
+  fd = -1;
+}
+
+bool IcmpEcho::send(uint32_t address, uint16_t &sequence) {
+  if (!ready()) {
+    stats.sendErrors++;
+    return false;
+  }
+
+  unsigned long now = millis();
+  uint8_t packet[sizeof(EchoHeader) + 8] = {};
+  EchoHeader *header = (EchoHeader *)packet;
+  header->type = ECHO_REQUEST;
+  header->identifier = htons(identifier);
+  header->sequence = htons(nextSequence);
+  memcpy(packet + sizeof(EchoHeader), &now, sizeof(now) < 8 ? sizeof(now) : 8);
+  header->checksum = checksum(packet, sizeof(packet));
+
+  sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  to.sin_addr.s_addr = address;
+  if (sendto(fd, packet, sizeof(packet), 0, (sockaddr *)&to, sizeof(to)) < 0) {
+    stats.sendErrors++;
+    if (errno == EBADF || errno == ENOTSOCK)
+      close();
+    return false; // Unreachable or no buffer: up to the sender
+  }
+  sequence = nextSequence++;
+  stats.sent++;
+  return true;
+}
+
+void IcmpEcho::poll() {
+  if (fd < 0)
+    return;
+  uint8_t buffer[96];
+  while (true) {
+    sockaddr_in from = {};
+    socklen_t fromLength = sizeof(from);
+    ssize_t n = recvfrom(fd, buffer, sizeof(buffer), MSG_DONTWAIT, (sockaddr *)&from, &fromLength);
+    if (n <= 0)
+      return;
+
+    // Raw sockets hand over the IP header too
+    size_t offset = 0;
+    if ((buffer[0] >> 4) == 4)
+      offset = (buffer[0] & 0x0F) * 4;
+    if ((size_t)n < offset + sizeof(EchoHeader))
+      continue;
+    EchoHeader header;
+    memcpy(&header, buffer + offset, sizeof(header));
+    if (header.type != ECHO_REPLY)
+      continue; // Our own requests to 127.0.0.1, unreachables, ...
+    if (raw && ntohs(header.identifier) != identifier)
+      continue; // Someone else's ping
+
+    uint16_t sequence = ntohs(header.sequence);
+    bool claimed = false;
+    for (Listener &listener : listeners) {
+      if (listener && listener(from.sin_addr.s_addr, sequence)) {
+        claimed = true;
+        break;
+      }
+    }
+    if (claimed)
+      stats.replies++;
+    else
+      stats.stray++; // Late, after its probe timed out
+  }
+}
@@ -0,0 +1,172 @@
+#include "JsonFields.h"
+
+JsonFields &JsonFields::number(const char *key, float &out) {
+  return add(key, Kind::Number, &out, 0);
+}
+
+JsonFields &JsonFields::flag(const char *key, bool &out) {
+  return add(key, Kind::Flag, &out, 0);
+}
+
+JsonFields &JsonFields::text(const char *key, char *out, size_t size) {
+  return add(key, Kind::Text, out, size);
+}
+
+JsonFields &JsonFields::object(const char *key, JsonFields &inner) {
+  return add(key, Kind::Object, &inner, 0);
+}
+
+JsonFields &JsonFields::add(const char *key, Kind kind, void *out, size_t size) {
+  if (count < MAX_FIELDS)
+    fields[count++] = {key, (uint8_t)strlen(key), kind, out, size, false};
+  return *this;
+}
+
+const char *JsonFields::missing() const {
+  for (uint8_t i = 0; i < count; i++)
+    if (!fields[i].found)
+      return fields[i].key;
+  return nullptr;
+}
+
+// Cursor over the text; every helper stops at end instead of relying on a
+// terminating NUL
+struct JsonCursor {
+  const char *at;
+  const char *end;
+
+  void skipSpace() {
+    while (at < end && (*at == ' ' || *at == '\t' || *at == '\r' || *at == '\n'))
+      at++;
+  }
+
+  bool take(char c) {
+    skipSpace();
+    if (at >= end || *at != c)
+      return false;
+    at++;
+    return true;
+  }
+
+  // At the opening quote; leaves the cursor after the closing one
+  bool skipString() {
+    at++;
+    while (at < end) {
+      if (*at == '\\')
+        at += 2;
+      else if (*at++ == '"')
+        return true;
+    }
+    return false;
+  }
+
+  // Any value: string, nested object/array, number or literal
+  bool skipValue() {
+    skipSpace();
+    if (at >= end)
+      return false;
+    if (*at == '"')
+      return skipString();
+    if (*at == '{' || *at == '[') {
+      int depth = 0;
+      while (at < end) {
+        if (*at == '"') {
+          if (!skipString())
+            return false;
+          continue;
+        }
+        if (*at == '{' || *at == '[')
+          depth++;
+        else if (*at == '}' || *at == ']')
+          depth--;
+        at++;
+        if (depth == 0)
+          return true;
+      }
+      return false;
+    }
+    const char *start = at;
+    while (at < end && *at != ',' && *at != '}' && *at != ']' && *at != ' ' && *at != '\r' && *at != '\n')
+      at++;
+    return at > start;
+  }
+};
+
+bool JsonFields::read(const char *json, size_t length) {
+  for (uint8_t i = 0; i < count; i++)
+    fields[i].found = false;
+
+  JsonCursor in = {json, json + length};
+  if (!in.take('{'))
+    return false;
+  if (in.take('}'))
+    return missing() == nullptr;
+
+  uint8_t remaining = count;
+  while (remaining > 0) {
+    in.skipSpace();
+    if (in.at >= in.end || *in.at != '"')
+      return false;
+    const char *key = in.at + 1;
+    if (!in.skipString())
+      return false;
+    size_t keyLength = in.at - 1 - key;
+    if (!in.take(':'))
+      return false;
+    in.skipSpace();
+
+    Field *field = nullptr;
+    for (uint8_t i = 0; i < count && !field; i++)
+      if (!fields[i].found && fields[i].keyLength == keyLength && memcmp(fields[i].key, key, keyLength) == 0)
+        field = &fields[i];
+
+    const char *value = in.at;
+    if (!in.skipValue())
+      return false;
+    size_t valueLength = in.at - value;
+
+    if (field && store(*field, value, valueLength)) {
+      field->found = true;
+      remaining--;
+    }
+
+    if (in.take(','))
+      continue;
+    if (in.take('}'))
+      break;
+    return false;
+  }
+  return remaining == 0;
+}
+
+// Writes the value when it has the field's type
+bool JsonFields::store(Field &field, const char *value, size_t length) {
+  switch (field.kind) {
+  case Kind::Number: {
+    if (*value != '-' && (*value < '0' || *value > '9'))
+      return false;
+    char digits[32];
+    if (length >= sizeof(digits))
+      return false;
+    memcpy(digits, value, length);
+    digits[length] = '\0';
+    *(float *)field.out = strtof(digits, nullptr);
+    return true;
+  }
+  case Kind::Flag:
+    if ((length == 4 && memcmp(value, "true", 4) == 0) || (length == 5 && memcmp(value, "false", 5) == 0)) {
+      *(bool *)field.out = *value == 't';
+      return true;
+    }
+    return false;
+  case Kind::Text:
+    if (*value != '"' || length - 2 >= field.size)
+      return false;
+    memcpy(field.out, value + 1, length - 2);
+    ((char *)field.out)[length - 2] = '\0';
+    return true;
+  case Kind::Object:
+    return *value == '{' && ((JsonFields *)field.out)->read(value, length);
+  }
+  return false;
+}
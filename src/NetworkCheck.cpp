@@ -1,44 +1,171 @@
 // NetworkCheck.cpp
+#define DEBUG_NETWORK_CHECK 0
+
 #include "NetworkCheck.h"
 
-NetworkCheck::NetworkCheck(const char *ip)
-    : deviceIP(ip), lastKnownState(false), lastCheckTime(0),
-      consecutiveFailures(0) {
+#if defined(ESP32)
+#include <lwip/inet.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+NetworkCheck::NetworkCheck() {
+  listenerId = icmpEcho.listen([this](uint32_t from, uint16_t sequence) { return onReply(from, sequence); });
+}
+
+NetworkCheck::~NetworkCheck() {
+  icmpEcho.unlisten(listenerId);
+}
+
+bool NetworkCheck::addDevice(const char *ip) {
+  if (deviceCount >= MAX_DEVICES)
+    return false;
+  in_addr address;
+  if (!ip || inet_aton(ip, &address) == 0) {
+    Serial.printf("Network > %s > Not an address, not tracked\n", ip ? ip : "");
+    return false;
+  }
+  Device &device = devices[deviceCount];
+  device.ip = ip;
+  device.address = address.s_addr;
+  device.nextProbe = millis() + deviceCount * 250; // Not all in the same pass
+  deviceCount++;
   Serial.printf("Network > %s > Check initialized\n", ip);
-  // Force first check to happen immediately by setting lastCheckTime far in the past
-  lastCheckTime = millis() - CHECK_INTERVAL - 1;
+  return true;
 }
 
 bool NetworkCheck::isDevicePresent() {
-  unsigned long currentTime = millis();
-  if (currentTime - lastCheckTime < CHECK_INTERVAL) {
-    return lastKnownState;
+  for (uint8_t i = 0; i < deviceCount; i++) {
+    if (devices[i].present)
+      return true;
+  }
+  return false;
+}
+
+bool NetworkCheck::isDevicePresent(uint8_t index) const {
+  return index < deviceCount && devices[index].present;
+}
+
+void NetworkCheck::poll() {
+  if (deviceCount == 0)
+    return;
+  unsigned long now = millis();
+
+  if (WiFi.status() != WL_CONNECTED) {
+    // No replies can come back: forget what is out, without counting misses
+    for (Probe &probe : probes)
+      probe.active = false;
+    return;
+  }
+  icmpEcho.poll(); // Replies come in through onReply()
+  expireProbes(now);
+
+  for (uint8_t i = 0; i < deviceCount; i++) {
+    if ((long)(now - devices[i].nextProbe) < 0)
+      continue;
+    bool out = false;
+    for (const Probe &probe : probes)
+      out |= probe.active && probe.device == i;
+    if (!out)
+      sendProbe(i, now);
+  }
+}
+
+bool NetworkCheck::sendProbe(uint8_t index, unsigned long now) {
+  Probe *slot = nullptr;
+  for (Probe &probe : probes) {
+    if (!probe.active) {
+      slot = &probe;
+      break;
+    }
+  }
+  Device &device = devices[index];
+  if (!slot) {
+    stats.sendErrors++;
+    device.nextProbe = now + timing.confirmInterval;
+    return false;
+  }
+
+  uint16_t sequence;
+  if (!icmpEcho.send(device.address, sequence)) {
+    stats.sendErrors++;
+    if (icmpEcho.isOpen())
+      missed(index, now); // Unreachable or no buffer: as good as no reply
+    else
+      device.nextProbe = now + timing.confirmInterval; // No socket, nothing learned
+    return false;
   }
 
-  lastCheckTime = currentTime;
-  bool pingResult = pingDevice();
+  slot->active = true;
+  slot->device = index;
+  slot->sequence = sequence;
+  slot->sentAt = now;
+  stats.probes++;
+  device.nextProbe = now + timing.presentInterval; // Until the probe decides
+  return true;
+}
 
-  if (pingResult) {
-    if (!lastKnownState) { // Device just became available
-      Serial.printf("Network > %s > Device detected\n", deviceIP.c_str());
+bool NetworkCheck::onReply(uint32_t from, uint16_t sequence) {
+  for (Probe &probe : probes) {
+    if (probe.active && probe.sequence == sequence && devices[probe.device].address == from) {
+      probe.active = false;
+      unsigned long now = millis();
+      replied(probe.device, now - probe.sentAt, now);
+      return true;
     }
-    consecutiveFailures = 0;
-  } else {
-    consecutiveFailures++;
-    if (lastKnownState) { // Device just became unavailable
-      Serial.printf("Network > %s > Device lost\n", deviceIP.c_str());
+  }
+  return false;
+}
+
+void NetworkCheck::expireProbes(unsigned long now) {
+  for (Probe &probe : probes) {
+    if (probe.active && now - probe.sentAt >= timing.probeTimeout) {
+      probe.active = false;
+      missed(probe.device, now);
     }
   }
+}
 
-  lastKnownState = pingResult;
-  return pingResult;
+void NetworkCheck::replied(uint8_t index, unsigned long roundTrip, unsigned long now) {
+  Device &device = devices[index];
+  stats.replies++;
+  device.health.record(DeviceHealth::Outcome::Ok, roundTrip);
+  device.misses = 0;
+  device.lastReply = now;
+  device.nextProbe = now + timing.presentInterval;
+  if (!device.present) {
+    device.present = true;
+    device.changedAt = now;
+    Serial.printf("Network > %s > Device detected (%lu ms)\n", device.ip.c_str(), roundTrip);
+  }
+#if DEBUG_NETWORK_CHECK
+  Serial.printf("Network > %s > Reply in %lu ms\n", device.ip.c_str(), roundTrip);
+#endif
 }
 
-bool NetworkCheck::pingDevice() {
-  bool success = Ping.ping(deviceIP.c_str(), 1); // 1 ping attempt
-  if (success) {
-    Serial.printf("Network > %s > Ping response: %.2fms\n", deviceIP.c_str(),
-                  Ping.averageTime());
+void NetworkCheck::missed(uint8_t index, unsigned long now) {
+  Device &device = devices[index];
+  stats.timeouts++;
+  device.health.record(DeviceHealth::Outcome::Timeout, timing.probeTimeout);
+  if (device.misses < 0xFF)
+    device.misses++;
+
+  if (!device.present) {
+    device.nextProbe = now + timing.absentInterval;
+    return;
+  }
+  if (device.misses >= MISSES_TO_LEAVE && now - device.lastReply >= timing.awayAfter) {
+    device.present = false;
+    device.changedAt = now;
+    device.nextProbe = now + timing.absentInterval;
+    Serial.printf("Network > %s > Device lost (no reply for %lu s)\n", device.ip.c_str(),
+                  (now - device.lastReply) / 1000);
+    return;
   }
-  return success;
+  // Still counted as present: look again soon
+  stats.ridOut++;
+  device.nextProbe = now + timing.confirmInterval;
+#if DEBUG_NETWORK_CHECK
+  Serial.printf("Network > %s > No reply (%u in a row)\n", device.ip.c_str(), device.misses);
+#endif
 }
\ No newline at end of file
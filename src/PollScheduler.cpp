@@ -0,0 +1,235 @@
+#define DEBUG_POLL_SCHEDULER 0
+
+#include "PollScheduler.h"
+#include "HomeSocketDevice.h"
+
+PollScheduler pollScheduler;
+
+PollScheduler::PollScheduler() {
+  for (uint8_t i = 0; i < MAX_DEVICES; i++)
+    position[i] = -1;
+}
+
+void PollScheduler::add(HomeSocketDevice *device, int number, unsigned long firstDelay) {
+  if (number < 1 || number > MAX_DEVICES)
+    return;
+  uint8_t index = number - 1;
+  Entry &entry = entries[index];
+  entry = Entry();
+  entry.device = device;
+  entry.interval = intervals.base;
+  schedule(index, millis() + firstDelay);
+}
+
+void PollScheduler::setBudget(float requestsPerSecond, uint8_t burst) {
+  budgetPerSecond = requestsPerSecond;
+  budgetBurst = burst;
+  tokens = burst;
+}
+
+void PollScheduler::resetStats() {
+  stats = Stats();
+  for (auto &entry : entries)
+    entry.stalenessCount = entry.stalenessNext = 0;
+}
+
+void PollScheduler::poll() {
+  unsigned long now = millis();
+
+  // Refill the budget
+  tokens += (now - lastRefill) * budgetPerSecond / 1000.0f;
+  if (tokens > budgetBurst)
+    tokens = budgetBurst;
+  lastRefill = now;
+
+  while (heapSize > 0) {
+    uint8_t index = heap[0];
+    Entry &entry = entries[index];
+    if ((long)(now - entry.due) < 0)
+      return; // Nothing due yet
+
+    if (tokens < 1) {
+      if (!entry.waited) {
+        stats.budgetWaits++;
+        entry.waited = true;
+      }
+      return;
+    }
+
+    if (!entry.device->getState()) {
+      unsigned long probe = entry.device->retryIn();
+      if (probe > 0) {
+        // Expedited or due early while the breaker is open or the socket
+        // does not answer ping
+        stats.breakerWaits++;
+        schedule(index, now + probe);
+        continue;
+      }
+      // Client slots full, WiFi down or a read of its own still running
+      stats.busyRetries++;
+      schedule(index, now + BUSY_RETRY);
+      continue;
+    }
+    tokens -= 1;
+    stats.reads++;
+    entry.waited = false;
+    entry.reading = true;
+    remove(index);
+  }
+}
+
+void PollScheduler::expedite(int number) {
+  if (number < 1 || number > MAX_DEVICES || !entries[number - 1].device)
+    return;
+  uint8_t index = number - 1;
+  Entry &entry = entries[index];
+  entry.fastReadsLeft = FAST_READS;
+  entry.interval = intervals.fast;
+  stats.expedited++;
+  // A read in flight reschedules itself in readDone()
+  if (!entry.reading && (long)(entry.due - (millis() + intervals.fast)) > 0)
+    schedule(index, millis() + intervals.fast);
+}
+
+void PollScheduler::readDone(int number, bool ok, bool changed) {
+  if (number < 1 || number > MAX_DEVICES || !entries[number - 1].device)
+    return;
+  uint8_t index = number - 1;
+  Entry &entry = entries[index];
+  unsigned long now = millis();
+  entry.reading = false;
+  bool known = entry.everRead; // The first read has nothing to compare with
+
+  if (!ok) {
+    entry.fastReadsLeft = 0;
+    // The breaker's open period, jittered and doubling, once it has opened;
+    // or the next echo, once the socket is known unreachable
+    unsigned long probe = entry.device->retryIn();
+    entry.interval = probe > 0 ? probe : intervals.offlineStep;
+  } else {
+    if (entry.everRead) {
+      entry.staleness[entry.stalenessNext] = now - entry.lastRead;
+      entry.stalenessNext = (entry.stalenessNext + 1) % STALENESS_SAMPLES;
+      if (entry.stalenessCount < STALENESS_SAMPLES)
+        entry.stalenessCount++;
+    }
+    entry.everRead = true;
+    entry.lastRead = now;
+
+    if (changed && known) {
+      entry.fastReadsLeft = FAST_READS; // Someone is using it, watch closely
+      stats.expedited++;
+    }
+    if (entry.fastReadsLeft > 0) {
+      entry.fastReadsLeft--;
+      entry.interval = intervals.fast;
+    } else if (entry.interval < intervals.base) {
+      entry.interval = intervals.base;
+    } else {
+      entry.interval = min(entry.interval * 3 / 2, intervals.max);
+    }
+  }
+#if DEBUG_POLL_SCHEDULER
+  Serial.printf("Poll > socket %d %s%s, next in %lu ms\n", number, ok ? "read" : "failed",
+                changed ? " (changed)" : "", entry.interval);
+#endif
+  schedule(index, now + entry.interval);
+}
+
+unsigned long PollScheduler::getInterval(int number) const {
+  if (number < 1 || number > MAX_DEVICES)
+    return 0;
+  return entries[number - 1].interval;
+}
+
+PollScheduler::Staleness PollScheduler::getStaleness(int number) const {
+  Staleness result = {0, 0, 0, 0};
+  if (number < 1 || number > MAX_DEVICES)
+    return result;
+  const Entry &entry = entries[number - 1];
+  if (entry.stalenessCount == 0)
+    return result;
+
+  uint32_t sorted[STALENESS_SAMPLES];
+  memcpy(sorted, entry.staleness, entry.stalenessCount * sizeof(uint32_t));
+  // Insertion sort, at most 32 samples
+  for (uint8_t i = 1; i < entry.stalenessCount; i++) {
+    uint32_t value = sorted[i];
+    int8_t j = i - 1;
+    while (j >= 0 && sorted[j] > value) {
+      sorted[j + 1] = sorted[j];
+      j--;
+    }
+    sorted[j + 1] = value;
+  }
+  uint8_t last = entry.stalenessCount - 1;
+  result.p50 = sorted[last * 50 / 100];
+  result.p90 = sorted[last * 90 / 100];
+  result.max = sorted[last];
+  result.samples = entry.stalenessCount;
+  return result;
+}
+
+// ============================================================================
+// HEAP
+// ============================================================================
+bool PollScheduler::earlier(uint8_t a, uint8_t b) const {
+  return (long)(entries[heap[a]].due - entries[heap[b]].due) < 0;
+}
+
+void PollScheduler::swap(uint8_t i, uint8_t j) {
+  uint8_t entry = heap[i];
+  heap[i] = heap[j];
+  heap[j] = entry;
+  position[heap[i]] = i;
+  position[heap[j]] = j;
+}
+
+void PollScheduler::siftUp(uint8_t i) {
+  while (i > 0 && earlier(i, (i - 1) / 2)) {
+    swap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+void PollScheduler::siftDown(uint8_t i) {
+  while (true) {
+    uint8_t smallest = i;
+    uint8_t left = 2 * i + 1;
+    uint8_t right = 2 * i + 2;
+    if (left < heapSize && earlier(left, smallest))
+      smallest = left;
+    if (right < heapSize && earlier(right, smallest))
+      smallest = right;
+    if (smallest == i)
+      return;
+    swap(i, smallest);
+    i = smallest;
+  }
+}
+
+void PollScheduler::schedule(uint8_t index, unsigned long due) {
+  entries[index].due = due;
+  if (position[index] < 0) {
+    heap[heapSize] = index;
+    position[index] = heapSize;
+    heapSize++;
+  }
+  siftUp(position[index]);
+  siftDown(position[index]);
+}
+
+void PollScheduler::remove(uint8_t index) {
+  int8_t i = position[index];
+  if (i < 0)
+    return;
+  heapSize--;
+  if (i != heapSize) {
+    // The last entry takes its place and moves to where it belongs
+    swap(i, heapSize);
+    uint8_t moved = heap[i];
+    siftUp(i);
+    siftDown(position[moved]);
+  }
+  position[index] = -1;
+}
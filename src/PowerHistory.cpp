@@ -55,6 +55,7 @@ void PowerHistory::updateMinute(float importW, float exportW) {
   minuteIndex = (minuteIndex + 1) % MINUTE_POINTS;
   if (minuteCount < MINUTE_POINTS)
     minuteCount++;
+  versions[(int)Tier::Minute]++;
 
   // Add to hour accumulator (convert W to Wh: W * (1/60) hour)
   addToHourAccumulator(importW, exportW, 60000);
@@ -70,6 +71,7 @@ void PowerHistory::updateHour(float importWh, float exportWh) {
   hourIndex = (hourIndex + 1) % HOUR_POINTS;
   if (hourCount < HOUR_POINTS)
     hourCount++;
+  versions[(int)Tier::Hour]++;
 
   // Add to day accumulator
   addToDayAccumulator(importWh, exportWh);
@@ -86,6 +88,7 @@ void PowerHistory::updateDay(float importKwh, float exportKwh) {
   dayIndex = (dayIndex + 1) % DAY_POINTS;
   if (dayCount < DAY_POINTS)
     dayCount++;
+  versions[(int)Tier::Day]++;
 
   // Update 30-day buffer
   monthData[monthIndex].import_wh = importKwh;
@@ -95,6 +98,7 @@ void PowerHistory::updateDay(float importKwh, float exportKwh) {
   monthIndex = (monthIndex + 1) % MONTH_POINTS;
   if (monthCount < MONTH_POINTS)
     monthCount++;
+  versions[(int)Tier::Month]++;
 
   Serial.printf("PowerHistory > Day update: Import=%.2fkWh, Export=%.2fkWh\n", importKwh, exportKwh);
 
@@ -176,6 +180,105 @@ String PowerHistory::getMonthDataJson() {
   return bufferToJson(monthData, monthCount, monthIndex, MONTH_POINTS, "kWh");
 }
 
+const char *PowerHistory::tierName(Tier tier) {
+  static const char *const names[] = {"minute", "hour", "day", "month"};
+  return names[(int)tier];
+}
+
+PowerHistory::Ring PowerHistory::ring(Tier tier) const {
+  switch (tier) {
+  case Tier::Minute:
+    return {minuteData, MINUTE_POINTS, minuteCount, minuteIndex, "W", 1};
+  case Tier::Hour:
+    return {hourData, HOUR_POINTS, hourCount, hourIndex, "Wh", 1};
+  case Tier::Day:
+    return {dayData, DAY_POINTS, dayCount, dayIndex, "kWh", 100};
+  default:
+    return {monthData, MONTH_POINTS, monthCount, monthIndex, "kWh", 100};
+  }
+}
+
+// Points after since: how many, all held when since is not answerable
+static int pointsSince(uint32_t added, uint32_t since, int count, bool &reset) {
+  reset = since > added || added - since > (uint32_t)count;
+  return reset ? count : (int)(added - since);
+}
+
+// printf as one piece for out
+static void put(const PowerHistory::Sink &out, const char *format, ...) {
+  char piece[112];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(piece, sizeof(piece), format, args);
+  va_end(args);
+  if (n > 0)
+    out((const uint8_t *)piece, (size_t)n < sizeof(piece) ? n : sizeof(piece) - 1);
+}
+
+void PowerHistory::writeJson(Tier tier, uint32_t since, const Sink &out) const {
+  Ring r = ring(tier);
+  uint32_t next = versions[(int)tier];
+  bool reset;
+  int n = pointsSince(next, since, r.count, reset);
+  int first = (r.index - n + r.size) % r.size;
+  const char *format = r.scale == 1 ? "%s%.1f" : "%s%.2f";
+
+  put(out, "\"%s\":{\"unit\":\"%s\",\"count\":%d,\"next\":%lu,\"reset\":%s,\"import\":[", tierName(tier), r.unit,
+      r.count, (unsigned long)next, reset ? "true" : "false");
+  for (int i = 0; i < n; i++)
+    put(out, format, i ? "," : "", r.data[(first + i) % r.size].import_wh);
+  put(out, "],\"export\":[");
+  for (int i = 0; i < n; i++)
+    put(out, format, i ? "," : "", r.data[(first + i) % r.size].export_wh);
+  put(out, "]}");
+}
+
+void PowerHistory::writeBinary(Tier tier, uint32_t since, const Sink &out) const {
+  Ring r = ring(tier);
+  uint32_t next = versions[(int)tier];
+  bool reset;
+  int n = pointsSince(next, since, r.count, reset);
+  int first = (r.index - n + r.size) % r.size;
+
+  // Filled, then handed out: the tier's head, then a value at a time
+  uint8_t piece[12];
+  uint8_t *at = piece;
+  auto put16 = [&at](uint16_t value) {
+    *at++ = value & 0xff;
+    *at++ = value >> 8;
+  };
+  auto put32 = [&at](uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8)
+      *at++ = (value >> shift) & 0xff;
+  };
+  *at++ = (uint8_t)tier;
+  *at++ = reset ? 1 : 0;
+  put16(r.count);
+  put32(next);
+  put16(n);
+  put16(r.scale);
+  out(piece, at - piece);
+  for (int series = 0; series < 2; series++) {
+    long previous = 0;
+    for (int i = 0; i < n; i++) {
+      const PowerDataPoint &point = r.data[(first + i) % r.size];
+      float value = series == 0 ? point.import_wh : point.export_wh;
+      float fixed = value * r.scale;
+      long scaled = fixed > -2e9f && fixed < 2e9f ? lround(fixed) : 0; // NaN too
+      long difference = scaled - previous;
+      at = piece;
+      if (difference > -32768 && difference <= 32767) {
+        put16((uint16_t)(int16_t)difference);
+      } else {
+        put16(0x8000);
+        put32((uint32_t)(int32_t)scaled);
+      }
+      out(piece, at - piece);
+      previous = scaled;
+    }
+  }
+}
+
 void PowerHistory::saveToSpiffs() {
   StaticJsonDocument<2048> doc;
 
@@ -260,5 +363,7 @@ void PowerHistory::loadFromSpiffs() {
     i++;
   }
 
+  versions[(int)Tier::Day] += dayCount;
+  versions[(int)Tier::Month] += monthCount;
   Serial.printf("PowerHistory > Loaded from SPIFFS: %d days, %d months\n", dayCount, monthCount);
 }
@@ -0,0 +1,197 @@
+#define DEBUG_REACHABILITY 0
+
+#include "Reachability.h"
+#include <WiFi.h>
+
+#if defined(ESP32)
+#include <lwip/inet.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+Reachability reachability;
+
+Reachability::~Reachability() {
+  icmpEcho.unlisten(listenerId);
+}
+
+uint8_t Reachability::add(const char *ip) {
+  // The host part only, without a port
+  char host[16];
+  size_t length = 0;
+  while (ip && ip[length] && ip[length] != ':' && length < sizeof(host) - 1) {
+    host[length] = ip[length];
+    length++;
+  }
+  host[length] = '\0';
+  in_addr address;
+  if (inet_aton(host, &address) == 0)
+    return NONE;
+
+  for (uint8_t id = 0; id < count; id++) {
+    if (entries[id].address == address.s_addr)
+      return id;
+  }
+  if (count >= MAX_ADDRESSES)
+    return NONE;
+  if (listenerId < 0) {
+    // Not in the constructor: icmpEcho may not be constructed yet then
+    listenerId = icmpEcho.listen([this](uint32_t from, uint16_t sequence) { return onReply(from, sequence); });
+  }
+  Entry &entry = entries[count];
+  entry.address = address.s_addr;
+  strcpy(entry.ip, host);
+  return count++;
+}
+
+bool Reachability::allowRequest(uint8_t id) {
+  if (isReachable(id))
+    return true;
+  stats.refused++;
+  return false;
+}
+
+bool Reachability::isReachable(uint8_t id) const {
+  return id >= count || entries[id].state != State::Unreachable;
+}
+
+void Reachability::requestFailed(uint8_t id) {
+  if (id >= count)
+    return;
+  Entry &entry = entries[id];
+  if (entry.state == State::Checking || entry.state == State::Unreachable)
+    return; // Already on it
+  entry.state = State::Checking;
+  probeSoon(entry, 0);
+}
+
+void Reachability::requestSucceeded(uint8_t id) {
+  if (id >= count)
+    return;
+  Entry &entry = entries[id];
+  if (entry.state == State::Unreachable) {
+    // A request that started before it was refused
+    entry.recoveries++;
+    entry.probeWanted = false;
+  }
+  entry.state = State::Reachable;
+  if (!entry.echoTried) {
+    // Does it answer ping at all? Only then can it be gated later
+    entry.echoTried = true;
+    probeSoon(entry, 0);
+  }
+}
+
+unsigned long Reachability::retryIn(uint8_t id) const {
+  if (isReachable(id))
+    return 0;
+  const Entry &entry = entries[id];
+  // By then the next echo is answered or has timed out
+  unsigned long decided = (entry.probeOut ? entry.sentAt : entry.nextProbe) + timing.probeTimeout;
+  long wait = (long)(decided - millis());
+  return wait > 0 ? wait : 1;
+}
+
+uint16_t Reachability::getRecoveries(uint8_t id) const {
+  return id < count ? entries[id].recoveries : 0;
+}
+
+Reachability::State Reachability::getState(uint8_t id) const {
+  return id < count ? entries[id].state : State::Unknown;
+}
+
+const char *Reachability::stateName(State state) {
+  switch (state) {
+  case State::Reachable:
+    return "reachable";
+  case State::Checking:
+    return "checking";
+  case State::Unreachable:
+    return "unreachable";
+  default:
+    return "unknown";
+  }
+}
+
+void Reachability::poll() {
+  if (count == 0)
+    return;
+  unsigned long now = millis();
+
+  if (WiFi.status() != WL_CONNECTED) {
+    // No replies can come back: nothing is learned while the WiFi is down
+    for (uint8_t id = 0; id < count; id++) {
+      if (entries[id].probeOut) {
+        entries[id].probeOut = false;
+        entries[id].probeWanted = true;
+      }
+    }
+    return;
+  }
+  icmpEcho.poll(); // Replies come in through onReply()
+
+  for (uint8_t id = 0; id < count; id++) {
+    Entry &entry = entries[id];
+    if (entry.probeOut && now - entry.sentAt >= timing.probeTimeout)
+      expired(entry);
+    if (!entry.probeWanted || entry.probeOut || (long)(now - entry.nextProbe) < 0)
+      continue;
+
+    entry.probeWanted = false;
+    if (!icmpEcho.send(entry.address, entry.sequence)) {
+      // No socket or no route: try again later, the state stays as it is
+      if (entry.state == State::Checking)
+        entry.state = State::Unknown;
+      else if (entry.state == State::Unreachable)
+        probeSoon(entry, timing.probeInterval);
+      continue;
+    }
+    entry.probeOut = true;
+    entry.sentAt = now;
+    stats.probes++;
+  }
+}
+
+void Reachability::probeSoon(Entry &entry, unsigned long delay) {
+  entry.probeWanted = true;
+  entry.nextProbe = millis() + delay;
+}
+
+void Reachability::expired(Entry &entry) {
+  entry.probeOut = false;
+  stats.timeouts++;
+  if (entry.state == State::Checking) {
+    if (!entry.echoSeen) {
+      entry.state = State::Unknown; // Never answered ping: not ours to gate
+      return;
+    }
+    entry.state = State::Unreachable;
+    Serial.printf("Network > %s > Unreachable, requests refused until it answers\n", entry.ip);
+  }
+  if (entry.state == State::Unreachable)
+    probeSoon(entry, timing.probeInterval);
+}
+
+bool Reachability::onReply(uint32_t from, uint16_t sequence) {
+  for (uint8_t id = 0; id < count; id++) {
+    Entry &entry = entries[id];
+    if (!entry.probeOut || entry.sequence != sequence || entry.address != from)
+      continue;
+    entry.probeOut = false;
+    entry.echoSeen = true;
+    stats.replies++;
+    if (entry.state == State::Unreachable) {
+      entry.recoveries++;
+      entry.probeWanted = false;
+      Serial.printf("Network > %s > Reachable again (%lu ms)\n", entry.ip, millis() - entry.sentAt);
+    }
+#if DEBUG_REACHABILITY
+    Serial.printf("Network > %s > Echo in %lu ms\n", entry.ip, millis() - entry.sentAt);
+#endif
+    // Also after a failed request: the address answers, the request failed
+    // for another reason and is the breaker's business
+    entry.state = State::Reachable;
+    return true;
+  }
+  return false;
+}
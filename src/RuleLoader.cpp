@@ -0,0 +1,293 @@
+#define DEBUG_RULE_LOADER 0
+
+#include "RuleLoader.h"
+#include <SPIFFS.h>
+#include <stdarg.h>
+
+// Size of one "rules" element; a rule with a dozen nested conditions fits
+static const size_t RULE_DOC_SIZE = 1536;
+static const uint8_t RULE_NESTING = 16; // during > action > allOf > notOf ... nests deep
+
+// Builders taking one number, looked up by their JSON key
+struct NumberCondition {
+  const char *key;
+  RuleCondition (*build)(float value);
+};
+
+static RuleCondition beforeSunriseF(float minutes) { return SmartRuleSystem::beforeSunrise((int)minutes); }
+static RuleCondition afterSunriseF(float minutes) { return SmartRuleSystem::afterSunrise((int)minutes); }
+static RuleCondition beforeSunsetF(float minutes) { return SmartRuleSystem::beforeSunset((int)minutes); }
+static RuleCondition afterSunsetF(float minutes) { return SmartRuleSystem::afterSunset((int)minutes); }
+
+static const NumberCondition numberConditions[] = {
+    {"lightAbove", SmartRuleSystem::lightAbove},
+    {"lightBelow", SmartRuleSystem::lightBelow},
+    {"temperatureAbove", SmartRuleSystem::temperatureAbove},
+    {"temperatureBelow", SmartRuleSystem::temperatureBelow},
+    {"humidityAbove", SmartRuleSystem::humidityAbove},
+    {"humidityBelow", SmartRuleSystem::humidityBelow},
+    {"pressureAbove", SmartRuleSystem::pressureAbove},
+    {"pressureBelow", SmartRuleSystem::pressureBelow},
+    {"productionAbove", SmartRuleSystem::powerProductionAbove},
+    {"productionBelow", SmartRuleSystem::powerProductionBelow},
+    {"beforeSunrise", beforeSunriseF},
+    {"afterSunrise", afterSunriseF},
+    {"beforeSunset", beforeSunsetF},
+    {"afterSunset", afterSunsetF},
+};
+
+// Conditions without parameters, written as plain strings
+struct NamedCondition {
+  const char *name;
+  RuleCondition (*build)();
+};
+
+static const NamedCondition namedConditions[] = {
+    {"workday", SmartRuleSystem::isWorkday},
+    {"weekend", SmartRuleSystem::isWeekend},
+    {"monday", SmartRuleSystem::isMonday},
+    {"tuesday", SmartRuleSystem::isTuesday},
+    {"wednesday", SmartRuleSystem::isWednesday},
+    {"thursday", SmartRuleSystem::isThursday},
+    {"friday", SmartRuleSystem::isFriday},
+    {"saturday", SmartRuleSystem::isSaturday},
+    {"sunday", SmartRuleSystem::isSunday},
+    {"phonePresent", SmartRuleSystem::phonePresent},
+    {"phoneNotPresent", SmartRuleSystem::phoneNotPresent},
+    {"sunUp", SmartRuleSystem::sunUp},
+    {"sunDown", SmartRuleSystem::sunDown},
+    {"solarActive", SmartRuleSystem::powerSolarActive},
+    {"producing", SmartRuleSystem::powerProducing},
+    {"consuming", SmartRuleSystem::powerConsuming},
+};
+
+void RuleLoader::fail(const char *format, ...) {
+  if (failed)
+    return; // Keep the first error, later ones are follow-ups
+  failed = true;
+  va_list args;
+  va_start(args, format);
+  vsnprintf(error, sizeof(error), format, args);
+  va_end(args);
+}
+
+// Skips whitespace, returns the next character without consuming it
+static int peekToken(Stream &in) {
+  int c = in.peek();
+  while (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+    in.read();
+    c = in.peek();
+  }
+  return c;
+}
+
+bool RuleLoader::parse(Stream &in) {
+  if (!in.find("\"rules\"") || !in.find("[")) {
+    fail("no \"rules\" array");
+    return false;
+  }
+
+  StaticJsonDocument<RULE_DOC_SIZE> doc;
+  if (peekToken(in) != ']') {
+    do {
+      DeserializationError err = deserializeJson(doc, in, DeserializationOption::NestingLimit(RULE_NESTING));
+      if (err) {
+        fail("rule %d: %s", ruleCount + 1, err.c_str());
+        return false;
+      }
+      addRule(doc.as<JsonObjectConst>());
+      if (failed)
+        return false;
+    } while (in.findUntil(",", "]"));
+  }
+
+  rs.setRuleNames(std::move(names));
+  return true;
+}
+
+void RuleLoader::addRule(JsonObjectConst rule) {
+  int socket = rule["socket"] | 0;
+  const char *name = rule["name"] | "";
+  if (socket < 1 || socket > NUM_SOCKETS) {
+    fail("rule %d: socket must be 1-%d", ruleCount + 1, NUM_SOCKETS);
+    return;
+  }
+  if (name[0] == '\0') {
+    fail("rule %d: missing name", ruleCount + 1);
+    return;
+  }
+
+  RuleAction compiled = action(rule["action"]);
+  if (failed)
+    return;
+
+  // Names land in one store; the pointers are set by setRuleNames() once
+  // the store stops growing
+  names.insert(names.end(), name, name + strlen(name) + 1);
+  rs.addRule(socket, "", compiled);
+  ruleCount++;
+
+#if DEBUG_RULE_LOADER
+  Serial.printf("RuleLoader > socket %d: %s\n", socket, name);
+#endif
+}
+
+TimeOfDay RuleLoader::time(JsonVariantConst value) {
+  // "HH:MM", or {"at": "HH:MM", "random": N, "seed": K} for the daily
+  // random offset setupRules() uses: at + getDailyRandom(K) % N minutes
+  if (value.is<const char *>())
+    return clock(value);
+  if (value.is<JsonObjectConst>()) {
+    TimeOfDay at = value["at"].isNull() ? TimeOfDay() : clock(value["at"]);
+    int random = value["random"] | 0;
+    if (random <= 0)
+      return at;
+    return rs.addMinutesToTime(at, rs.getDailyRandom(value["seed"] | 0) % random);
+  }
+  fail("rule %d: expected a time", ruleCount + 1);
+  return TimeOfDay();
+}
+
+TimeOfDay RuleLoader::clock(JsonVariantConst value) {
+  const char *text = value.as<const char *>();
+  if (!text) {
+    fail("rule %d: expected a time", ruleCount + 1);
+    return TimeOfDay();
+  }
+  if (!TimeOfDay::isValid(text)) {
+    fail("rule %d: bad time \"%s\"", ruleCount + 1, text);
+    return TimeOfDay();
+  }
+  return TimeOfDay(text);
+}
+
+RuleCondition RuleLoader::conditionOrTrue(JsonVariantConst value) {
+  return value.isNull() ? RuleCondition() : condition(value);
+}
+
+RuleCondition RuleLoader::condition(JsonVariantConst value) {
+  if (value.is<const char *>()) {
+    const char *name = value.as<const char *>();
+    for (const auto &named : namedConditions)
+      if (strcmp(name, named.name) == 0)
+        return named.build();
+    fail("rule %d: unknown condition \"%s\"", ruleCount + 1, name);
+    return RuleCondition();
+  }
+
+  JsonObjectConst object = value.as<JsonObjectConst>();
+  if (object.isNull() || object.size() != 1) {
+    fail("rule %d: a condition is a string or an object with one key", ruleCount + 1);
+    return RuleCondition();
+  }
+  JsonPairConst pair = *object.begin();
+  const char *key = pair.key().c_str();
+  JsonVariantConst arg = pair.value();
+
+  if (strcmp(key, "allOf") == 0 || strcmp(key, "anyOf") == 0) {
+    std::vector<RuleCondition> conditions;
+    for (JsonVariantConst item : arg.as<JsonArrayConst>())
+      conditions.push_back(condition(item));
+    return strcmp(key, "allOf") == 0 ? SmartRuleSystem::allOf(conditions) : SmartRuleSystem::anyOf(conditions);
+  }
+  if (strcmp(key, "notOf") == 0)
+    return SmartRuleSystem::notOf(condition(arg));
+  if (strcmp(key, "after") == 0)
+    return SmartRuleSystem::after(time(arg));
+  if (strcmp(key, "socketOn") == 0)
+    return rs.socketIsOn(arg | 0);
+  if (strcmp(key, "socketOff") == 0)
+    return rs.socketIsOff(arg | 0);
+
+  for (const auto &number : numberConditions)
+    if (strcmp(key, number.key) == 0) {
+      if (arg.is<float>())
+        return number.build(arg.as<float>());
+      fail("rule %d: %s needs a number", ruleCount + 1, key);
+      return RuleCondition();
+    }
+
+  fail("rule %d: unknown condition \"%s\"", ruleCount + 1, key);
+  return RuleCondition();
+}
+
+RuleAction RuleLoader::action(JsonVariantConst value) {
+  JsonObjectConst object = value.as<JsonObjectConst>();
+  if (object.isNull() || object.size() != 1) {
+    fail("rule %d: an action is an object with one key", ruleCount + 1);
+    return RuleAction();
+  }
+  JsonPairConst pair = *object.begin();
+  const char *key = pair.key().c_str();
+  JsonVariantConst arg = pair.value();
+
+  if (strcmp(key, "period") == 0)
+    return rs.period(time(arg["start"]), time(arg["end"]), conditionOrTrue(arg["when"]));
+  if (strcmp(key, "onAfter") == 0)
+    return rs.onAfter(time(arg["time"]), arg["minutes"] | 0, conditionOrTrue(arg["when"]));
+  if (strcmp(key, "offAfter") == 0)
+    return rs.offAfter(time(arg["time"]), arg["minutes"] | 0, conditionOrTrue(arg["when"]));
+  if (strcmp(key, "onCondition") == 0)
+    return rs.onCondition(condition(arg));
+  if (strcmp(key, "offCondition") == 0)
+    return rs.offCondition(condition(arg));
+  if (strcmp(key, "onConditionDelayed") == 0)
+    return rs.onConditionDelayed(condition(arg["when"]), arg["seconds"] | 0);
+  if (strcmp(key, "offConditionDelayed") == 0)
+    return rs.offConditionDelayed(condition(arg["when"]), arg["seconds"] | 0);
+  if (strcmp(key, "delayedOnOff") == 0)
+    return rs.delayedOnOff(time(arg["start"]), time(arg["end"]), arg["onDelay"] | 0, arg["offDelay"] | 0,
+                           conditionOrTrue(arg["when"]));
+  if (strcmp(key, "solarHeaterControl") == 0)
+    return rs.solarHeaterControl(arg["export"] | 0.0f, arg["import"] | 0.0f,
+                                 arg["minOnMs"] | 30000UL, arg["minOffMs"] | 30000UL,
+                                 conditionOrTrue(arg["when"]));
+  if (strcmp(key, "during") == 0) {
+    const char *outside = arg["outside"] | "off";
+    RuleDecision decision = strcmp(outside, "on") == 0     ? RuleDecision::On
+                            : strcmp(outside, "skip") == 0 ? RuleDecision::Skip
+                                                           : RuleDecision::Off;
+    return rs.during(time(arg["start"]), time(arg["end"]), action(arg["action"]), decision);
+  }
+
+  fail("rule %d: unknown action \"%s\"", ruleCount + 1, key);
+  return RuleAction();
+}
+
+bool loadRulesFile(const char *path, RuleLoadReport &report) {
+  File file = SPIFFS.open(path, "r");
+  if (!file) {
+    snprintf(report.error, sizeof(report.error), "%s not found", path);
+    return false;
+  }
+
+  uint32_t heapBefore = ESP.getFreeHeap();
+  unsigned long start = micros();
+
+  // Build next to the running rules; they keep working if anything fails
+  SmartRuleSystem *staging = new SmartRuleSystem();
+  RuleLoader loader(*staging);
+  bool ok = loader.parse(file);
+  file.close();
+
+  if (ok) {
+    ruleSystem.swapRules(*staging); // staging now holds the old rules
+    report.ruleCount = loader.getRuleCount();
+    report.rulesetBytes = ruleSystem.getRulesetBytes();
+  } else {
+    strncpy(report.error, loader.getError(), sizeof(report.error) - 1);
+    report.error[sizeof(report.error) - 1] = '\0';
+  }
+  delete staging;
+
+  report.loadMicros = micros() - start;
+  report.heapUsed = (int)heapBefore - (int)ESP.getFreeHeap();
+
+  if (ok) {
+    Serial.printf("Loaded %d rules from %s in %lu us, ruleset %u bytes, heap used %+d bytes\n",
+                  report.ruleCount, path, report.loadMicros, (unsigned)report.rulesetBytes, report.heapUsed);
+  } else {
+    Serial.printf("ERROR: %s not loaded, keeping current rules: %s\n", path, report.error);
+  }
+  return ok;
+}
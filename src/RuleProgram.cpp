@@ -0,0 +1,66 @@
+// RuleProgram.cpp
+#include "RuleProgram.h"
+
+void RuleProgram::emit(RuleOp op, uint8_t u8, int16_t i16, int32_t i32) {
+  RuleInstr instr;
+  instr.op = op;
+  instr.u8 = u8;
+  instr.i16 = i16;
+  instr.i32 = i32;
+  code.push_back(instr);
+}
+
+void RuleProgram::emitFloat(RuleOp op, float f32) {
+  RuleInstr instr;
+  instr.op = op;
+  instr.u8 = 0;
+  instr.i16 = 0;
+  instr.f32 = f32;
+  code.push_back(instr);
+}
+
+void RuleProgram::append(const RuleProgram &other) {
+  // Jumps are relative so only call indices need to move
+  int16_t conditionBase = (int16_t)conditionCalls.size();
+  int16_t actionBase = (int16_t)actionCalls.size();
+
+  for (RuleInstr instr : other.code) {
+    if (instr.op == RuleOp::CallCondition) {
+      instr.i16 += conditionBase;
+    } else if (instr.op == RuleOp::CallAction) {
+      instr.i16 += actionBase;
+    }
+    code.push_back(instr);
+  }
+  conditionCalls.insert(conditionCalls.end(), other.conditionCalls.begin(), other.conditionCalls.end());
+  actionCalls.insert(actionCalls.end(), other.actionCalls.begin(), other.actionCalls.end());
+  stateful |= other.stateful;
+}
+
+size_t RuleProgram::emitJump(RuleOp op) {
+  emit(op);
+  return code.size() - 1;
+}
+
+void RuleProgram::patchJump(size_t at) {
+  // Offset is counted from the instruction after the jump
+  code[at].i16 = (int16_t)(code.size() - at - 1);
+}
+
+RuleCondition RuleCondition::constant(bool value) {
+  RuleProgram program;
+  program.emit(RuleOp::Const, value ? 1 : 0);
+  return RuleCondition(std::move(program));
+}
+
+RuleCondition RuleCondition::op(RuleOp op, uint8_t u8, int16_t i16, int32_t i32) {
+  RuleProgram program;
+  program.emit(op, u8, i16, i32);
+  return RuleCondition(std::move(program));
+}
+
+RuleCondition RuleCondition::threshold(RuleOp op, float value) {
+  RuleProgram program;
+  program.emitFloat(op, value);
+  return RuleCondition(std::move(program));
+}
@@ -0,0 +1,63 @@
+// Rules.cpp - rule set for the sockets, kept apart from main.cpp so the
+// native (host) builds can compile the same rules
+#include "GlobalVars.h"
+#include "SmartRuleSystem.h"
+
+void setupRules() {
+  auto &rs = ruleSystem;
+
+  // Randomised end times, fixed when the rules are built
+  TimeOfDay eveningEndTime = rs.addMinutesToTime("23:00", rs.getDailyRandom(0) % 24);
+  TimeOfDay weekendEndTime = rs.addMinutesToTime("23:00", rs.getDailyRandom60(1) % 54);
+  TimeOfDay nightOffTime = rs.addMinutesToTime("23:55", rs.getDailyRandom(1) % 5);
+
+  // Morning rule (weekdays) - varies end time by 0-35 minutes after 07:45
+  rs.addRule(1, "Good morning",
+             rs.period("07:10", "07:44", // Ends at 07:44 to ensure off by 07:45
+                       rs.allOf({rs.lightBelow(5), rs.isWorkday()})));
+
+  // Morning OFF rule - EXACTLY at 07:45 as departure reminder
+  rs.addRule(1, "Leave for car",
+             rs.offAfter("07:45", 2,       // 2 minute window to ensure it turns off
+                         rs.isWorkday())); // Only on workdays
+
+  // Evening rule (weekdays)
+  rs.addRule(1, "Evening",
+             rs.period("17:15", eveningEndTime, // Changed to period()
+                       rs.allOf({rs.lightBelow(5), rs.isWorkday()})));
+
+  rs.addRule(1, "Good night",
+             rs.offAfter(eveningEndTime, 2, // 2 minute window to ensure it turns off
+                         rs.isWorkday()));  // Only on workdays
+
+  // Weekend rule with phone presence
+  rs.addRule(1, "Weekend",
+             rs.period("19:00", weekendEndTime, // Changed to period()
+                       rs.allOf({rs.lightBelow(5), rs.phoneNotPresent(), rs.isWeekend()})));
+
+  // Add explicit weekend off rule
+  rs.addRule(1, "Weekend night",
+             rs.offAfter(weekendEndTime, 2, // Turns OFF at calculated end time
+                         rs.isWeekend()));
+
+  // Late night off rule
+  rs.addRule(1, "Night off",
+             rs.offAfter(nightOffTime, 5));
+  // Smart solar heater rule that maintains different ON/OFF thresholds
+  // this one is quite complex and uses the P1Meter object
+  // Outside 07:00-19:00 the heater is forced OFF
+  rs.addRule(3, "Solar Heater",
+             rs.during("07:00", "19:00",
+                       rs.solarHeaterControl(
+                           1020,                    // Export threshold
+                           5,                       // Import threshold
+                           60000,                   // Minimum ON time
+                           30000,                   // Minimum OFF time
+                           rs.phoneNotPresent()))); // Phone presence check
+
+  rs.addRule(4, "TV ambient on",
+             rs.onCondition(rs.allOf({rs.phonePresent(), rs.after("18:00"), rs.lightAbove(11)})));
+
+  rs.addRule(4, "TV ambient off",
+             rs.offConditionDelayed(rs.lightBelow(5), 120));
+}
@@ -1,9 +1,12 @@
 #define DEBUG_RULES 0
+#ifndef RULES_VERIFY_ORDER
+#define RULES_VERIFY_ORDER 0 // 1 = also evaluate every rule in insertion order and compare
+#endif
 
 #include "SmartRuleSystem.h"
 #include "GlobalVars.h"
+#include "PollScheduler.h"
 #include <cstdint>
-char SmartRuleSystem::timeBuffer[6];
 
 int SmartRuleSystem::dailyRandom[10] = {0};
 int SmartRuleSystem::dailyRandom60[5] = {0};
@@ -35,17 +38,646 @@ SmartRuleSystem::SmartRuleSystem() : sockets(NUM_SOCKETS) {
 
 void SmartRuleSystem::addRule(int socketNumber,
                               const char *ruleName, // Add this
-                              std::function<RuleDecision()> evaluate,
+                              RuleAction evaluate,
                               std::function<bool()> timeWindow) {
+  // Copy the rule's bytecode into the shared program array, relocating
+  // call indices to the system-wide call tables
+  int16_t conditionBase = (int16_t)conditionCalls.size();
+  int16_t actionBase = (int16_t)actionCalls.size();
+
   Rule rule = {
       .socketNumber = socketNumber,
-      .evaluate = evaluate,
+      .codeStart = (uint16_t)program.size(),
+      .codeLength = (uint16_t)evaluate.code.size(),
+      .inputs = 0,
+      .lastDecision = RuleDecision::Skip,
+      .decisionValid = false,
+      .stateful = evaluate.stateful,
+      .lastPass = 0,
       .timeWindow = timeWindow,
       .name = ruleName // Add this
   };
+
+  for (RuleInstr instr : evaluate.code) {
+    if (instr.op == RuleOp::CallCondition) {
+      instr.i16 += conditionBase;
+    } else if (instr.op == RuleOp::CallAction) {
+      instr.i16 += actionBase;
+    }
+    rule.inputs |= inputsOf(instr);
+    program.push_back(instr);
+  }
+  for (auto &call : evaluate.conditionCalls) {
+    conditionCalls.push_back(std::move(call));
+  }
+  for (auto &call : evaluate.actionCalls) {
+    actionCalls.push_back(std::move(call));
+  }
+
+  int socketIndex = socketNumber - 1;
+  if (socketIndex >= 0 && socketIndex < NUM_SOCKETS) {
+    socketRules[socketIndex].push_back((uint16_t)rules.size());
+  }
   rules.push_back(rule);
 }
 
+// ============================================================================
+// RULE INTERPRETER
+// ============================================================================
+
+void SmartRuleSystem::captureContext(RuleContext &ctx) {
+  ctx.now = millis();
+
+  struct tm timeinfo;
+  ctx.timeValid = getLocalTime(&timeinfo);
+  if (ctx.timeValid) {
+    ctx.minuteOfDay = timeinfo.tm_hour * 60 + timeinfo.tm_min;
+    ctx.second = timeinfo.tm_sec;
+    ctx.dayOfWeek = timeinfo.tm_wday == 0 ? 7 : timeinfo.tm_wday;
+    ctx.dayMask = 1 << (ctx.dayOfWeek - 1);
+    ctx.dayOfYear = timeinfo.tm_yday;
+    if (ctx.dayOfYear != lastSunCalcDay)
+      calculateDailySunTimes();
+  } else {
+    ctx.minuteOfDay = -1;
+    ctx.second = 0;
+    ctx.dayOfWeek = -1;
+    ctx.dayMask = 0;
+    ctx.dayOfYear = -1;
+  }
+  ctx.sunriseMinutes = sunriseMinutes;
+  ctx.sunsetMinutes = sunsetMinutes;
+
+  ctx.light = sensors.getLightLevel();
+  ctx.hasBME280 = sensors.hasBME280();
+  ctx.temperature = ctx.hasBME280 ? sensors.getTemperature() : 0;
+  ctx.humidity = ctx.hasBME280 ? sensors.getHumidity() : 0;
+  ctx.pressure = ctx.hasBME280 ? sensors.getPressure() : 0;
+
+  ctx.hasP1 = p1Meter != nullptr;
+  ctx.importPower = p1Meter ? p1Meter->getCurrentImport() : 0;
+  ctx.exportPower = p1Meter ? p1Meter->getCurrentExport() : 0;
+
+  ctx.hasPhoneCheck = phoneCheck != nullptr;
+  ctx.phonePresent = phoneCheck && phoneCheck->isDevicePresent();
+
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    ctx.socketOn[i] = sockets[i].physicalState;
+    ctx.socketChangedAt[i] = sockets[i].lastStateChange;
+  }
+}
+
+uint16_t SmartRuleSystem::inputsOf(const RuleInstr &instr) {
+  switch (instr.op) {
+  case RuleOp::Const:
+  case RuleOp::Not:
+  case RuleOp::JumpIfFalse:
+  case RuleOp::JumpIfTrue:
+  case RuleOp::Decide:
+    return 0;
+  case RuleOp::LightBelow:
+  case RuleOp::LightAbove:
+    return INPUT_LIGHT;
+  case RuleOp::TemperatureAbove:
+  case RuleOp::TemperatureBelow:
+  case RuleOp::HumidityAbove:
+  case RuleOp::HumidityBelow:
+  case RuleOp::PressureAbove:
+  case RuleOp::PressureBelow:
+    return INPUT_CLIMATE;
+  case RuleOp::ExportAbove:
+  case RuleOp::ExportBelow:
+  case RuleOp::ImportAbove:
+    return INPUT_POWER;
+  case RuleOp::PhonePresent:
+  case RuleOp::PhoneAbsent:
+    return INPUT_PHONE;
+  case RuleOp::DayMask:
+  case RuleOp::TimeBetween:
+  case RuleOp::TimeAfter:
+  case RuleOp::PeriodEnding:
+  case RuleOp::SunUp:
+  case RuleOp::SunDown:
+  case RuleOp::BeforeSunrise:
+  case RuleOp::AfterSunrise:
+  case RuleOp::BeforeSunset:
+  case RuleOp::AfterSunset:
+    return INPUT_CLOCK;
+  case RuleOp::SocketOn:
+  case RuleOp::SocketOff:
+    return INPUT_SOCKET << instr.u8;
+  case RuleOp::OnFor: // Elapsed time since the last change is millis() based
+  case RuleOp::OffFor:
+    return (INPUT_SOCKET << instr.u8) | INPUT_TICK;
+  default: // Closures may read anything, including their own timers
+    return INPUT_TICK;
+  }
+}
+
+uint16_t SmartRuleSystem::changedInputs(const RuleContext &previous, const RuleContext &current) const {
+  uint16_t changed = INPUT_TICK;
+  // The clock only counts as changed at a scheduled transition, a new day
+  // or when it jumps back (DST end, NTP correction)
+  if (previous.timeValid != current.timeValid || previous.dayOfYear != current.dayOfYear ||
+      current.minuteOfDay < previous.minuteOfDay || current.minuteOfDay >= nextClockMinute)
+    changed |= INPUT_CLOCK;
+  if (previous.light != current.light)
+    changed |= INPUT_LIGHT;
+  if (previous.hasBME280 != current.hasBME280 || previous.temperature != current.temperature ||
+      previous.humidity != current.humidity || previous.pressure != current.pressure)
+    changed |= INPUT_CLIMATE;
+  if (previous.hasP1 != current.hasP1 || previous.importPower != current.importPower ||
+      previous.exportPower != current.exportPower)
+    changed |= INPUT_POWER;
+  if (previous.hasPhoneCheck != current.hasPhoneCheck || previous.phonePresent != current.phonePresent)
+    changed |= INPUT_PHONE;
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    if (previous.socketOn[i] != current.socketOn[i])
+      changed |= INPUT_SOCKET << i;
+  }
+  return changed;
+}
+
+// Minute of day at which a condition reading the clock can next change
+// value, 1440 (midnight) when nothing changes before the day ends
+int SmartRuleSystem::nextTransitionMinute(const RuleContext &ctx) const {
+  int cur = ctx.minuteOfDay;
+  int next = 1440;
+  auto consider = [cur, &next](int boundary) {
+    boundary = ((boundary % 1440) + 1440) % 1440;
+    if (boundary > cur && boundary < next)
+      next = boundary;
+  };
+  bool sunrise = ctx.sunriseMinutes >= 0 && ctx.sunriseMinutes < 1440;
+  bool sunset = ctx.sunsetMinutes >= 0 && ctx.sunsetMinutes < 1440;
+
+  for (const RuleInstr &instr : program) {
+    switch (instr.op) {
+    case RuleOp::TimeBetween: // Both ends inclusive
+      consider(instr.i16);
+      consider(instr.i32 + 1);
+      break;
+    case RuleOp::TimeAfter:
+      consider(instr.i16);
+      if (instr.i32 != 0)
+        consider(instr.i16 + instr.i32);
+      break;
+    case RuleOp::TimeWindow:
+      consider(instr.i16);
+      consider(instr.i32 + 1);
+      break;
+    case RuleOp::PeriodEnding: // Last 2 minutes up to and including the end
+      consider(instr.i16 - 2);
+      consider(instr.i16 + 1);
+      break;
+    case RuleOp::SunUp:
+    case RuleOp::SunDown:
+      if (sunrise)
+        consider(ctx.sunriseMinutes);
+      if (sunset)
+        consider(ctx.sunsetMinutes);
+      break;
+    case RuleOp::BeforeSunrise:
+    case RuleOp::AfterSunrise:
+      if (sunrise) {
+        consider(ctx.sunriseMinutes);
+        consider(ctx.sunriseMinutes + (instr.op == RuleOp::AfterSunrise ? instr.i32 : -instr.i32));
+      }
+      break;
+    case RuleOp::BeforeSunset:
+    case RuleOp::AfterSunset:
+      if (sunset) {
+        consider(ctx.sunsetMinutes);
+        consider(ctx.sunsetMinutes + (instr.op == RuleOp::AfterSunset ? instr.i32 : -instr.i32));
+      }
+      break;
+    default: // DayMask only changes at midnight
+      break;
+    }
+  }
+  return next;
+}
+
+// Cached decision unless one of the rule's inputs changed (or it missed a
+// change while short-circuited)
+RuleDecision SmartRuleSystem::decide(Rule &rule, const RuleContext &ctx, uint16_t changed) {
+  rule.lastPass = passCount;
+  if (rule.decisionValid && !(rule.inputs & changed)) {
+    rulesSkipped++;
+    return rule.lastDecision;
+  }
+#if RULES_PROFILE
+  unsigned long start = micros();
+  rule.lastDecision = execute(rule, ctx);
+  unsigned long elapsed = micros() - start;
+  RuleStats &stats = rule.stats;
+  stats.evaluations++;
+  stats.totalMicros += elapsed;
+  if (elapsed > stats.maxMicros)
+    stats.maxMicros = elapsed;
+  if (rule.lastDecision == RuleDecision::On)
+    stats.decisionsOn++;
+  else if (rule.lastDecision == RuleDecision::Off)
+    stats.decisionsOff++;
+  else
+    stats.decisionsSkip++;
+#else
+  rule.lastDecision = execute(rule, ctx);
+#endif
+  rule.decisionValid = true;
+  rulesEvaluated++;
+  return rule.lastDecision;
+}
+
+#if RULES_PROFILE
+int SmartRuleSystem::getPassMicros(unsigned long *out) const {
+  int start = (passSampleIndex - passSampleCount + PASS_SAMPLES) % PASS_SAMPLES;
+  for (int i = 0; i < passSampleCount; i++)
+    out[i] = passMicros[(start + i) % PASS_SAMPLES];
+  return passSampleCount;
+}
+
+void SmartRuleSystem::resetStats() {
+  for (auto &rule : rules)
+    rule.stats = RuleStats();
+  passSampleIndex = 0;
+  passSampleCount = 0;
+  passesTimed = 0;
+  passMaxMicros = 0;
+  passTotalMicros = 0;
+}
+#endif
+
+// Reference evaluation: every rule in insertion order, last non-SKIP wins.
+// Stateful rules ran this pass already, so their decision is reused rather
+// than stepping their timers twice; one that was not run at all this pass
+// has missed a step and counts as a mismatch.
+void SmartRuleSystem::verifyOrder(const RuleContext &ctx) {
+  RuleDecision expected[NUM_SOCKETS];
+  for (int i = 0; i < NUM_SOCKETS; i++)
+    expected[i] = RuleDecision::Skip;
+
+  for (const auto &rule : rules) {
+    int socketIndex = rule.socketNumber - 1;
+    if (socketIndex < 0 || socketIndex >= NUM_SOCKETS || !::sockets[socketIndex])
+      continue;
+    if (rule.stateful && rule.lastPass != passCount) {
+      orderMismatches++;
+      Serial.printf("ERROR: Stateful rule '%s' was not evaluated\n", rule.name);
+    }
+    RuleDecision decision = rule.stateful ? rule.lastDecision : execute(rule, ctx);
+    if (decision != RuleDecision::Skip)
+      expected[socketIndex] = decision;
+  }
+
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    if (::sockets[i] && expected[i] != sockets[i].virtualState) {
+      orderMismatches++;
+      Serial.printf("ERROR: Socket %d rule order mismatch at minute %d: expected %d, got %d\n",
+                    i + 1, ctx.minuteOfDay, (int)expected[i], (int)sockets[i].virtualState);
+    }
+  }
+}
+
+RuleDecision SmartRuleSystem::execute(const Rule &rule, const RuleContext &ctx) {
+  const RuleInstr *pc = program.data() + rule.codeStart;
+  bool acc = false;
+  return run(pc, pc + rule.codeLength, conditionCalls.data(), actionCalls.data(), ctx, acc);
+}
+
+RuleDecision SmartRuleSystem::run(const RuleInstr *pc, const RuleInstr *end,
+                                  const ConditionCall *conditions, const ActionCall *actions,
+                                  const RuleContext &ctx, bool &acc) {
+  while (pc < end) {
+    const RuleInstr &instr = *pc++;
+    switch (instr.op) {
+    case RuleOp::Const:
+      acc = instr.u8 != 0;
+      break;
+    case RuleOp::Not:
+      acc = !acc;
+      break;
+    case RuleOp::JumpIfFalse:
+      if (!acc)
+        pc += instr.i16;
+      break;
+    case RuleOp::JumpIfTrue:
+      if (acc)
+        pc += instr.i16;
+      break;
+    case RuleOp::Decide: {
+      uint8_t decision = acc ? (instr.u8 & 0x0F) : (instr.u8 >> 4);
+      if (decision != RuleProgram::CONTINUE)
+        return (RuleDecision)decision;
+      break;
+    }
+    case RuleOp::CallCondition:
+      acc = conditions[instr.i16](ctx);
+      break;
+    case RuleOp::CallAction:
+      return actions[instr.i16](ctx);
+    case RuleOp::HoldFor:
+      acc = holdFor(instr, ctx, acc);
+      break;
+    case RuleOp::TimeWindow:
+      acc = timeWindow(instr, ctx);
+      break;
+    case RuleOp::Hysteresis:
+      return hysteresis(instr, ctx, acc);
+    case RuleOp::SolarHeater:
+      return solarHeater(instr, ctx, acc);
+    default:
+      acc = testOp(instr, ctx);
+      break;
+    }
+  }
+  return RuleDecision::Skip;
+}
+
+// True when cur lies in [start, end), wrapping past midnight when end <= start
+static bool inWindow(int cur, int start, int end) {
+  if (start < end)
+    return cur >= start && cur < end;
+  return cur >= start || cur < end;
+}
+
+// True when cur lies in [start, end] (both inclusive), overnight when end < start
+static bool inPeriod(int cur, int start, int end) {
+  if (cur < 0)
+    return false;
+  if (end < start)
+    return cur >= start || cur <= end;
+  return cur >= start && cur <= end;
+}
+
+bool SmartRuleSystem::testOp(const RuleInstr &instr, const RuleContext &ctx) {
+  switch (instr.op) {
+  case RuleOp::LightBelow:
+    return ctx.light < instr.f32;
+  case RuleOp::LightAbove:
+    return ctx.light > instr.f32;
+  case RuleOp::TemperatureAbove:
+    return ctx.hasBME280 && ctx.temperature > instr.f32;
+  case RuleOp::TemperatureBelow:
+    return ctx.hasBME280 && ctx.temperature < instr.f32;
+  case RuleOp::HumidityAbove:
+    return ctx.hasBME280 && ctx.humidity > instr.f32;
+  case RuleOp::HumidityBelow:
+    return ctx.hasBME280 && ctx.humidity < instr.f32;
+  case RuleOp::PressureAbove:
+    return ctx.hasBME280 && ctx.pressure > instr.f32;
+  case RuleOp::PressureBelow:
+    return ctx.hasBME280 && ctx.pressure < instr.f32;
+  case RuleOp::ExportAbove:
+    return ctx.hasP1 && ctx.exportPower > instr.f32;
+  case RuleOp::ExportBelow:
+    return ctx.hasP1 && ctx.exportPower < instr.f32;
+  case RuleOp::ImportAbove:
+    return ctx.hasP1 && ctx.importPower > instr.f32;
+
+  case RuleOp::PhonePresent:
+    return ctx.hasPhoneCheck && ctx.phonePresent;
+  case RuleOp::PhoneAbsent:
+    return ctx.hasPhoneCheck && !ctx.phonePresent;
+  case RuleOp::DayMask:
+    return (instr.u8 & ctx.dayMask) != 0;
+
+  case RuleOp::TimeBetween:
+    return inPeriod(ctx.minuteOfDay, instr.i16, instr.i32);
+  case RuleOp::TimeAfter: {
+    int cur = ctx.minuteOfDay;
+    if (cur < 0)
+      return false;
+    if (instr.i32 == 0) // No duration: after the target time until midnight
+      return cur >= instr.i16;
+    int endMinutes = instr.i16 + instr.i32;
+    if (endMinutes >= 1440) // Overnight window
+      endMinutes -= 1440;
+    if (instr.i16 <= endMinutes)
+      return cur >= instr.i16 && cur < endMinutes;
+    return cur >= instr.i16 || cur < endMinutes;
+  }
+  case RuleOp::PeriodEnding:
+    return ctx.minuteOfDay >= instr.i16 - 2 && ctx.minuteOfDay <= instr.i16;
+
+  case RuleOp::SunUp:
+    if (ctx.sunriseMinutes < 0)
+      return false; // Polar night
+    if (ctx.sunsetMinutes >= 1440)
+      return true; // Midnight sun
+    return ctx.minuteOfDay >= ctx.sunriseMinutes && ctx.minuteOfDay < ctx.sunsetMinutes;
+  case RuleOp::SunDown:
+    if (ctx.sunriseMinutes < 0)
+      return true; // Polar night
+    if (ctx.sunsetMinutes >= 1440)
+      return false; // Midnight sun
+    return ctx.minuteOfDay < ctx.sunriseMinutes || ctx.minuteOfDay >= ctx.sunsetMinutes;
+  case RuleOp::BeforeSunrise:
+    if (ctx.sunriseMinutes < 0)
+      return false; // No sunrise today
+    return inWindow(ctx.minuteOfDay, (ctx.sunriseMinutes - instr.i32 + 1440) % 1440, ctx.sunriseMinutes);
+  case RuleOp::AfterSunrise:
+    if (ctx.sunriseMinutes < 0)
+      return false;
+    return inWindow(ctx.minuteOfDay, ctx.sunriseMinutes, (ctx.sunriseMinutes + instr.i32) % 1440);
+  case RuleOp::BeforeSunset:
+    if (ctx.sunsetMinutes >= 1440)
+      return false; // No sunset today
+    return inWindow(ctx.minuteOfDay, (ctx.sunsetMinutes - instr.i32 + 1440) % 1440, ctx.sunsetMinutes);
+  case RuleOp::AfterSunset:
+    if (ctx.sunsetMinutes >= 1440)
+      return false;
+    return inWindow(ctx.minuteOfDay, ctx.sunsetMinutes, (ctx.sunsetMinutes + instr.i32) % 1440);
+
+  // Socket index was range checked when the rule was built
+  case RuleOp::SocketOn:
+    return ctx.socketOn[instr.u8];
+  case RuleOp::SocketOff:
+    return !ctx.socketOn[instr.u8];
+  case RuleOp::OnFor:
+    return ctx.socketOn[instr.u8] &&
+           (ctx.now - ctx.socketChangedAt[instr.u8]) / 60000 >= (unsigned long)instr.i32;
+  case RuleOp::OffFor:
+    return !ctx.socketOn[instr.u8] &&
+           (ctx.now - ctx.socketChangedAt[instr.u8]) / 60000 >= (unsigned long)instr.i32;
+
+  default:
+    return false;
+  }
+}
+
+// ============================================================================
+// STATEFUL RULE OPS
+// ============================================================================
+
+int SmartRuleSystem::allocateSlot(const char *builder, int32_t key0, int32_t key1) {
+  if (slotCount >= MAX_RULE_SLOTS) {
+    Serial.printf("ERROR: %s - rule state pool full (%d slots), rule ignored\n", builder, MAX_RULE_SLOTS);
+    return -1;
+  }
+  RuleSlot &slot = slots[slotCount];
+  slot = RuleSlot();
+  slot.builder = builder;
+  slot.key[0] = key0;
+  slot.key[1] = key1;
+  carrySlotState(slotCount, retiredSlots.data(), retiredSlots.size());
+  return slotCount++;
+}
+
+static bool sameKey(const char *builder, const int32_t *key, const char *otherBuilder, const int32_t *otherKey) {
+  return builder && otherBuilder && strcmp(builder, otherBuilder) == 0 && key[0] == otherKey[0] &&
+         key[1] == otherKey[1];
+}
+
+void SmartRuleSystem::carrySlotState(int index, const RuleSlot *from, int count) {
+  RuleSlot &slot = slots[index];
+  int nth = 0;
+  for (int i = 0; i < index; i++)
+    nth += sameKey(slot.builder, slot.key, slots[i].builder, slots[i].key);
+  for (int i = 0; i < count; i++) {
+    if (!sameKey(slot.builder, slot.key, from[i].builder, from[i].key) || nth-- > 0)
+      continue;
+    slot.active = from[i].active;
+    slot.since = from[i].since;
+    return;
+  }
+}
+
+// on/offConditionDelayed(): true once the condition has held for i32 ms,
+// then the timer starts over
+bool SmartRuleSystem::holdFor(const RuleInstr &instr, const RuleContext &ctx, bool condition) {
+  RuleSlot &state = slots[instr.u8];
+  if (!condition) {
+    state.active = false;
+    return false;
+  }
+  if (!state.active) {
+    state.since = ctx.now;
+    state.active = true;
+  }
+  if (ctx.now - state.since >= (unsigned long)instr.i32) {
+    state.active = false;
+    return true;
+  }
+  return false;
+}
+
+// timeWindowBetween(): open inside the window, and when it closes turn off
+// the sockets of rules registered with a timeWindow (one shot)
+bool SmartRuleSystem::timeWindow(const RuleInstr &instr, const RuleContext &ctx) {
+  RuleSlot &windowState = slots[instr.u8];
+  TimeOfDay start = TimeOfDay::fromMinutes(instr.i16);
+  TimeOfDay end = TimeOfDay::fromMinutes(instr.i32);
+  bool isInWindow = inPeriod(ctx.minuteOfDay, instr.i16, instr.i32);
+  char startStr[6], endStr[6];
+
+  // If we're in the time window and not already active
+  if (isInWindow && !windowState.active) {
+    windowState.since = calculateEndTime(end, ctx);
+    windowState.active = true;
+    Serial.printf("Time window activated: %s to %s\n", start.format(startStr), end.format(endStr));
+    return true;
+  }
+
+  // If we were active and just now went outside the window - do the ONE SHOT
+  // turn off
+  if (windowState.active &&
+      (!isInWindow || ctx.now > windowState.since)) {
+    Serial.printf("Time window ended: %s to %s - turning off devices\n",
+                  start.format(startStr), end.format(endStr));
+    // Do one-shot turn off using the state change from active to inactive
+    for (const auto &rule : rules) {
+      if (rule.timeWindow) {
+        int socketIndex = rule.socketNumber - 1;
+        if (socketIndex >= 0 && socketIndex < NUM_SOCKETS &&
+            ::sockets[socketIndex]) {
+          ::sockets[socketIndex]->setState(false);
+        }
+      }
+    }
+    windowState.active = false;
+    return false;
+  }
+
+  return windowState.active;
+}
+
+// delayedOnOff(): ON after the condition held i16 minutes, OFF after it
+// was false for i32 minutes, SKIP while waiting
+RuleDecision SmartRuleSystem::hysteresis(const RuleInstr &instr, const RuleContext &ctx, bool condition) {
+  RuleSlot &state = slots[instr.u8];
+
+  // Detect condition change
+  if (condition != state.active) {
+    state.since = ctx.now;
+    state.active = condition;
+  }
+
+  // Calculate elapsed time since condition change (in minutes)
+  unsigned long elapsedMinutes = (ctx.now - state.since) / 60000;
+
+  if (condition && elapsedMinutes >= (unsigned long)instr.i16) {
+    return RuleDecision::On;
+  } else if (!condition && elapsedMinutes >= (unsigned long)instr.i32) {
+    return RuleDecision::Off;
+  }
+
+  // During delay period, maintain previous state
+  return RuleDecision::Skip;
+}
+
+// solarHeaterControl(): ON above the export threshold, OFF above the import
+// threshold or when the extra condition fails, honouring min on/off times
+RuleDecision SmartRuleSystem::solarHeater(const RuleInstr &instr, const RuleContext &ctx, bool conditionMet) {
+  RuleSlot &heater = slots[instr.u8];
+  unsigned long currentTime = ctx.now;
+
+// Debug output
+#if DEBUG_RULES
+  Serial.println("\n----- Heater Rule Evaluation -----");
+  Serial.printf("Current state: %s\n", heater.active ? "ON" : "OFF");
+  Serial.printf("Extra condition met: %s\n", conditionMet ? "YES" : "NO");
+  Serial.printf("Export power: %.2f W (threshold: %.2f W)\n", ctx.hasP1 ? ctx.exportPower : -1, heater.exportThreshold);
+  Serial.printf("Time since last change: %lu ms\n", currentTime - heater.since);
+#endif
+
+  // First handle the case when we're ON
+  if (heater.active) {
+    // Check if we need to turn OFF because condition is no longer met
+    if (!conditionMet && (currentTime - heater.since >= heater.minOnTime)) {
+      heater.active = false;
+      heater.since = currentTime;
+      Serial.println("Solar Heater Control: Turning OFF - condition not met");
+      return RuleDecision::Off;
+    }
+
+    // Check if we're importing too much power (grid consumption)
+    if (ctx.hasP1 && ctx.importPower > heater.importThreshold &&
+        (currentTime - heater.since >= heater.minOnTime)) {
+      heater.active = false;
+      heater.since = currentTime;
+      Serial.println("Solar Heater Control: Turning OFF - import threshold exceeded");
+      return RuleDecision::Off;
+    }
+
+    // Otherwise stay ON
+    return RuleDecision::On;
+  }
+
+  // Now handle when we're OFF: only consider turning ON if the condition is met
+  // and we have enough export power AND minimum off time has elapsed
+  if (conditionMet && ctx.hasP1 && ctx.exportPower > heater.exportThreshold &&
+      (currentTime - heater.since >= heater.minOffTime)) {
+    heater.active = true;
+    heater.since = currentTime;
+    Serial.println("Solar Heater Control: Turning ON - export threshold met");
+    return RuleDecision::On;
+  }
+
+  // Stay OFF by default
+  return RuleDecision::Off;
+}
+
 void SmartRuleSystem::generateDailyRandoms() {
   TimeSync::TimeData t = timeSync.getTime();
 
@@ -108,89 +740,100 @@ int SmartRuleSystem::getDailyRandom24(int index) {
   return 0;
 }
 
-const char *SmartRuleSystem::addMinutesToTime(const char *baseTime, int minutesToAdd) {
-  static char timeBuffer[6];
-
-  int hour, minute;
-  sscanf(baseTime, "%d:%d", &hour, &minute);
-
-  minute += minutesToAdd;
-  hour += minute / 60;
-  minute = minute % 60;
-  hour = hour % 24;
-
+TimeOfDay SmartRuleSystem::addMinutesToTime(TimeOfDay baseTime, int minutesToAdd) {
+  TimeOfDay result = baseTime.addMinutes(minutesToAdd);
 #if DEBUG_RULES
-  snprintf(timeBuffer, sizeof(timeBuffer), "%02d:%02d", hour, minute);
+  char baseStr[6], resultStr[6];
+  Serial.printf("addMinutesToTime: %s + %d min = %s\n", baseTime.format(baseStr), minutesToAdd, result.format(resultStr));
 #endif
-  return timeBuffer;
+  return result;
 }
 
-const char *SmartRuleSystem::addHoursToTime(const char *baseTime, int hoursToAdd) {
-  static char timeBuffer[6];
-
-  int hour, minute;
-  sscanf(baseTime, "%d:%d", &hour, &minute);
-
-  hour = (hour + hoursToAdd) % 24;
-
-#if DEBUG_RULES
-  snprintf(timeBuffer, sizeof(timeBuffer), "%02d:%02d", hour, minute);
-#endif
-  return timeBuffer;
+TimeOfDay SmartRuleSystem::addHoursToTime(TimeOfDay baseTime, int hoursToAdd) {
+  return baseTime.addHours(hoursToAdd);
 }
 
 void SmartRuleSystem::update() {
+#if RULES_PROFILE
+  unsigned long passStart = micros();
+#endif
+  if (!retiredSlots.empty())
+    std::vector<RuleSlot>().swap(retiredSlots); // The rebuild is done
+
   // 1. Get current physical states
   for (int i = 0; i < NUM_SOCKETS; i++) {
     if (::sockets[i]) {
       sockets[i].physicalState = ::sockets[i]->getCurrentState();
-      sockets[i].virtualState = RuleDecision::Skip;
     }
   }
 
-  // 2. Evaluate all rules and store final decisions
-  for (const auto &rule : rules) {
-    int socketIndex = rule.socketNumber - 1;
-    if (socketIndex < 0 || socketIndex >= NUM_SOCKETS || !::sockets[socketIndex]) {
+  // One consistent view of time, sensors and sockets for the whole pass
+  RuleContext ctx;
+  captureContext(ctx);
+  uint16_t changed = lastContextValid ? changedInputs(lastContext, ctx) : (uint16_t)INPUT_ALL;
+  passCount++;
+
+  // 2. Per socket, walk its rules from the highest precedence (added last)
+  // down. The first non-SKIP decision wins, lower rules only still run
+  // when they are stateful.
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    if (!::sockets[i])
       continue;
-    }
 
-    // Get rule decision
-    RuleDecision decision = rule.evaluate();
+    const std::vector<uint16_t> &bucket = socketRules[i];
+    RuleDecision winner = RuleDecision::Skip;
+    int winningRule = -1;
 
-#if DEBUG_RULES
-    // allow logging of skipped rules too when debugging
-    if (decision == RuleDecision::Skip) {
-      Serial.printf("Socket %d: Rule '%s' evaluated to SKIP\n",
-                    rule.socketNumber,
-                    rule.name);
-    }
-#endif
+    for (int k = (int)bucket.size() - 1; k >= 0; k--) {
+      Rule &rule = rules[bucket[k]];
 
-    // Only store non-SKIP decisions (lets later rules override earlier ones)
-    if (decision != RuleDecision::Skip) {
+      if (winner != RuleDecision::Skip && !rule.stateful) {
+        if (rule.inputs & changed)
+          rule.decisionValid = false; // Inputs moved on without us
+        rulesShortCircuited++;
+        continue;
+      }
+
+      RuleDecision decision = decide(rule, ctx, changed);
 #if DEBUG_RULES
-      // Debug mode: log every evaluation
       Serial.printf("Socket %d: Rule '%s' evaluated to %s\n",
                     rule.socketNumber,
                     rule.name,
-                    decision == RuleDecision::On ? "ON" : "OFF");
-#else
-      // Normal mode: only log when state changes
-      if (sockets[socketIndex].virtualState != decision) {
-        Serial.printf("Socket %d: Rule '%s' -> %s\n",
-                      rule.socketNumber,
-                      rule.name,
-                      decision == RuleDecision::On ? "ON" : "OFF");
+                    decision == RuleDecision::On ? "ON" : decision == RuleDecision::Off ? "OFF"
+                                                                                        : "SKIP");
+#endif
+      if (winner == RuleDecision::Skip && decision != RuleDecision::Skip) {
+        winner = decision;
+        winningRule = bucket[k];
       }
+    }
+
+    // Only log when the deciding rule or its decision changes
+    if (winner != RuleDecision::Skip &&
+        (winningRule != sockets[i].winningRule || winner != sockets[i].virtualState)) {
+      Serial.printf("Socket %d: Rule '%s' -> %s\n",
+                    i + 1,
+                    rules[winningRule].name,
+                    winner == RuleDecision::On ? "ON" : "OFF");
+    }
+    sockets[i].virtualState = winner;
+    sockets[i].winningRule = winningRule;
+  }
+
+#if RULES_VERIFY_ORDER
+  verifyOrder(ctx);
 #endif
-      sockets[socketIndex].virtualState = decision;
 
-      // Track the last active rule that turns something ON
-      if (decision == RuleDecision::On) {
-        lastActiveRuleName = rule.name;
-        lastActiveRuleSocket = rule.socketNumber;
-      }
+  lastContext = ctx;
+  lastContextValid = true;
+
+  if (changed & INPUT_CLOCK) {
+    if (ctx.timeValid) {
+      nextClockMinute = nextTransitionMinute(ctx);
+      nextEventMillis = ctx.now + ((nextClockMinute - ctx.minuteOfDay) * 60UL - ctx.second) * 1000UL;
+    } else {
+      nextClockMinute = 0;
+      nextEventMillis = 0;
     }
   }
 
@@ -214,6 +857,13 @@ void SmartRuleSystem::update() {
           sockets[i].lastStateChange = millis();
           lastActiveRuleTime = millis();                 // Update time
           lastActiveRuleState = sockets[i].virtualState; // Update state
+          if (sockets[i].winningRule >= 0) {
+            lastActiveRuleName = rules[sockets[i].winningRule].name;
+            lastActiveRuleSocket = i + 1;
+#if RULES_PROFILE
+            rules[sockets[i].winningRule].stats.actuations++;
+#endif
+          }
 
           TimeSync::TimeData currentTime = timeSync.getTime();
           static char timeStr[12]; // Static buffer to store the formatted time
@@ -226,12 +876,25 @@ void SmartRuleSystem::update() {
     }
     yield();
   }
+
+#if RULES_PROFILE
+  // Whole pass, including the socket calls of step 3
+  unsigned long passElapsed = micros() - passStart;
+  passMicros[passSampleIndex] = passElapsed;
+  passSampleIndex = (passSampleIndex + 1) % PASS_SAMPLES;
+  if (passSampleCount < PASS_SAMPLES)
+    passSampleCount++;
+  passesTimed++;
+  passTotalMicros += passElapsed;
+  if (passElapsed > passMaxMicros)
+    passMaxMicros = passElapsed;
+#endif
 }
 
 void SmartRuleSystem::pollPhysicalStates() {
   for (int i = 0; i < NUM_SOCKETS; i++) {
     if (::sockets[i]) {
-      ::sockets[i]->readStateInfo(); // First actively read the current state
+      pollScheduler.expedite(i + 1); // Read soon, this pass sees the last known state
       sockets[i].physicalState = ::sockets[i]->getCurrentState();
       yield();
     }
@@ -258,6 +921,8 @@ void SmartRuleSystem::detectManualChanges() {
 void SmartRuleSystem::evaluateRules() {
   // Track applied rules per socket
   std::vector<RuleDecision> lastDecisions(NUM_SOCKETS, RuleDecision::Skip);
+  RuleContext ctx;
+  captureContext(ctx);
 
   // Evaluate each rule in order
   for (const auto &rule : rules) {
@@ -267,7 +932,7 @@ void SmartRuleSystem::evaluateRules() {
     }
 
     // Get rule decision
-    RuleDecision decision = rule.evaluate();
+    RuleDecision decision = execute(rule, ctx);
 
     Serial.printf("Socket %d: Rule evaluated to %s\n",
                   rule.socketNumber,
@@ -340,477 +1005,229 @@ void SmartRuleSystem::applyVirtualState() {
   }
 }
 
-std::function<RuleDecision()> SmartRuleSystem::delayedOnOff(const char *startTime, const char *endTime, int onDelayMinutes, int offDelayMinutes, std::function<bool()> condition) {
-
-  std::string stateKey = std::string(startTime) + "-" + std::string(endTime);
-
-  return [this, stateKey, startTime, endTime, onDelayMinutes, offDelayMinutes, condition]() {
-    // First check if we're in the time window
-    bool isInTimeRange = timeSync.isTimeBetween(startTime, endTime);
-    if (!isInTimeRange) {
-      return RuleDecision::Skip;
-    }
-
-    auto &state = this->delayedStates[stateKey];
-    bool currentCondition = condition();
-    unsigned long now = millis();
-
-    // Detect condition change
-    if (currentCondition != state.lastCondition) {
-      state.conditionChangeTime = now;
-      state.lastCondition = currentCondition;
-    }
-
-    // Calculate elapsed time since condition change (in minutes)
-    unsigned long elapsedMinutes = (now - state.conditionChangeTime) / 60000;
+RuleAction SmartRuleSystem::delayedOnOff(TimeOfDay startTime, TimeOfDay endTime, int onDelayMinutes, int offDelayMinutes, RuleCondition condition) {
+  int slot = allocateSlot("delayedOnOff", startTime.toMinutes() | endTime.toMinutes() << 16,
+                          onDelayMinutes | offDelayMinutes << 16);
+  if (slot < 0)
+    return RuleAction();
 
-    if (currentCondition && elapsedMinutes >= onDelayMinutes) {
-      // Condition has been true for onDelayMinutes
-      return RuleDecision::On;
-    } else if (!currentCondition && elapsedMinutes >= offDelayMinutes) {
-      // Condition has been false for offDelayMinutes
-      return RuleDecision::Off;
-    }
-
-    // During delay period, maintain previous state
-    return RuleDecision::Skip;
-  };
+  RuleProgram code;
+  // Outside the time window: SKIP
+  code.emit(RuleOp::TimeBetween, 0, startTime.toMinutes(), endTime.toMinutes());
+  code.emit(RuleOp::Decide, RuleProgram::decisions(RuleProgram::CONTINUE, (uint8_t)RuleDecision::Skip));
+  code.append(condition);
+  code.emit(RuleOp::Hysteresis, slot, onDelayMinutes, offDelayMinutes);
+  code.stateful = true;
+  return RuleAction(std::move(code));
 }
 
-std::function<bool()> SmartRuleSystem::timeWindowBetween(const char *start, const char *end) {
-  return [this, start, end]() {
-    std::string key = std::string(start) + "-" + std::string(end);
-    bool isInWindow = timeSync.isTimeBetween(start, end);
-    auto &windowState = this->activeTimeWindows[key];
-
-    // If we're in the time window and not already active
-    if (isInWindow && !windowState.isActive) {
-      int endHour, endMin;
-      sscanf(end, "%d:%d", &endHour, &endMin);
-      windowState.endTimeMillis = calculateEndTime(endHour, endMin);
-      windowState.isActive = true;
-      Serial.printf("Time window activated: %s to %s\n", start, end);
-      return true;
-    }
-
-    // If we were active and just now went outside the window - do the ONE SHOT
-    // turn off
-    if (windowState.isActive &&
-        (!isInWindow || millis() > windowState.endTimeMillis)) {
-      Serial.printf("Time window ended: %s to %s - turning off devices\n",
-                    start, end);
-      // Do one-shot turn off using the state change from active to inactive
-      for (const auto &rule : rules) {
-        if (rule.timeWindow) {
-          int socketIndex = rule.socketNumber - 1;
-          if (socketIndex >= 0 && socketIndex < NUM_SOCKETS &&
-              ::sockets[socketIndex]) {
-            ::sockets[socketIndex]->setState(false);
-          }
-        }
-      }
-      windowState.isActive = false;
-      return false;
-    }
-
-    return windowState.isActive;
-  };
+RuleCondition SmartRuleSystem::timeWindowBetween(TimeOfDay start, TimeOfDay end) {
+  int slot = allocateSlot("timeWindowBetween", start.toMinutes() | end.toMinutes() << 16);
+  if (slot < 0)
+    return RuleCondition::constant(false);
+  RuleCondition window = RuleCondition::op(RuleOp::TimeWindow, slot, start.toMinutes(), end.toMinutes());
+  window.stateful = true;
+  return window;
 }
 
-std::function<RuleDecision()> SmartRuleSystem::solarHeaterControl(float exportThreshold, float importThreshold, unsigned long minOnTime, unsigned long minOffTime, std::function<bool()> extraCondition) {
-
-  return [=]() {
-    static bool deviceIsOn = false;
-    static unsigned long lastStateChangeTime = 0;
-    unsigned long currentTime = millis();
-
-    // Evaluate condition once and store result
-    bool conditionMet = extraCondition();
-
-// Debug output
-#if DEBUG_RULES
-    Serial.println("\n----- Heater Rule Evaluation -----");
-    Serial.printf("Current state: %s\n", deviceIsOn ? "ON" : "OFF");
-    Serial.printf("Extra condition met: %s\n", conditionMet ? "YES" : "NO");
-    Serial.printf("Export power: %.2f W (threshold: %.2f W)\n", p1Meter ? p1Meter->getCurrentExport() : -1, exportThreshold);
-    Serial.printf("Time since last change: %lu ms\n", currentTime - lastStateChangeTime);
-#endif
-
-    // First handle the case when we're ON
-    if (deviceIsOn) {
-      // Check if we need to turn OFF because condition is no longer met
-      if (!conditionMet && (currentTime - lastStateChangeTime >= minOnTime)) {
-        deviceIsOn = false;
-        lastStateChangeTime = currentTime;
-        Serial.println("Solar Heater Control: Turning OFF - condition not met");
-        return RuleDecision::Off;
-      }
-
-      // Check if we're importing too much power (grid consumption)
-      if (p1Meter && p1Meter->getCurrentImport() > importThreshold &&
-          (currentTime - lastStateChangeTime >= minOnTime)) {
-        deviceIsOn = false;
-        lastStateChangeTime = currentTime;
-        Serial.println("Solar Heater Control: Turning OFF - import threshold exceeded");
-        return RuleDecision::Off;
-      }
-
-      // Otherwise stay ON
-      return RuleDecision::On;
-    }
-    // Now handle when we're OFF
-    else {
-      // Only consider turning ON if the condition is met
-      if (conditionMet) {
-        // Check if we have enough export power AND minimum off time has elapsed
-        if (p1Meter && p1Meter->getCurrentExport() > exportThreshold &&
-            (currentTime - lastStateChangeTime >= minOffTime)) {
-          deviceIsOn = true;
-          lastStateChangeTime = currentTime;
-          Serial.println("Solar Heater Control: Turning ON - export threshold met");
-          return RuleDecision::On;
-        }
-      }
+RuleAction SmartRuleSystem::solarHeaterControl(float exportThreshold, float importThreshold, unsigned long minOnTime, unsigned long minOffTime, RuleCondition extraCondition) {
+  int slot = allocateSlot("solarHeaterControl", lroundf(exportThreshold), lroundf(importThreshold));
+  if (slot < 0)
+    return RuleAction();
+  slots[slot].exportThreshold = exportThreshold;
+  slots[slot].importThreshold = importThreshold;
+  slots[slot].minOnTime = minOnTime;
+  slots[slot].minOffTime = minOffTime;
 
-      // Stay OFF by default
-      return RuleDecision::Off;
-    }
-  };
+  RuleProgram code;
+  code.append(extraCondition);
+  code.emit(RuleOp::SolarHeater, slot);
+  code.stateful = true;
+  return RuleAction(std::move(code));
 }
 
 //[private after function]
-std::function<bool()> SmartRuleSystem::after(const char *timeStr, int durationMins) {
-  return [timeStr, durationMins]() {
-    // Parse the input time string (HH:MM)
-    int targetHour, targetMinute;
-    sscanf(timeStr, "%d:%d", &targetHour, &targetMinute);
-    int targetMinutes = targetHour * 60 + targetMinute;
-
-    // Get the current time
-    TimeSync::TimeData currentTime = timeSync.getTime();
-    int currentMinutes = currentTime.hour * 60 + currentTime.minute;
-
-    // Calculate the end time if a duration is provided
-    int endMinutes = targetMinutes + durationMins;
-
-    // Handle overnight periods (e.g., 23:30 + 60 minutes = 00:30)
-    if (endMinutes >= 1440) { // 1440 minutes = 24 hours
-      endMinutes -= 1440;
-    }
-
-    // Check if the current time is after the target time
-    if (durationMins == 0) {
-      // No duration: return true if current time is after target time
-      return currentMinutes >= targetMinutes;
-    } else {
-      // With duration: return true if current time is within the window
-      if (targetMinutes <= endMinutes) {
-        // Normal case: window is within the same day
-        return currentMinutes >= targetMinutes && currentMinutes < endMinutes;
-      } else {
-        // Overnight case: window spans midnight
-        return currentMinutes >= targetMinutes || currentMinutes < endMinutes;
-      }
-    }
-  };
+RuleCondition SmartRuleSystem::after(TimeOfDay time, int durationMins) {
+  // durationMins == 0: true from the target time until midnight,
+  // otherwise true during the window (which may span midnight)
+  return RuleCondition::op(RuleOp::TimeAfter, 0, time.toMinutes(), durationMins);
 }
 
 // turns on a rule if a condition is met, but skips if not (does not turn off)
-std::function<RuleDecision()> SmartRuleSystem::period(const char *startTime, const char *endTime, std::function<bool()> condition) {
-  return [this, startTime, endTime, condition]() {
-    // Parse times
-    int startHour, startMinute, endHour, endMinute;
-    sscanf(startTime, "%d:%d", &startHour, &startMinute);
-    sscanf(endTime, "%d:%d", &endHour, &endMinute);
-
-    TimeSync::TimeData currentTime = timeSync.getTime();
-    int currentMinutes = currentTime.hour * 60 + currentTime.minute;
-    int startMinutes = startHour * 60 + startMinute;
-    int endMinutes = endHour * 60 + endMinute;
-
-    // Check if we're in the time range
-    bool isInTimeRange;
-    if (endMinutes < startMinutes) {
-      // Overnight period
-      isInTimeRange = currentMinutes >= startMinutes || currentMinutes <= endMinutes;
-    } else {
-      // Same day period
-      isInTimeRange = currentMinutes >= startMinutes && currentMinutes <= endMinutes;
-    }
-
-#if DEBUG_RULES
-    Serial.printf("Period %s-%s: %s\n", startTime, endTime,
-                  isInTimeRange ? "IN RANGE" : "outside");
-#endif
-
-    // If we're outside the time range, return SKIP (silent)
-    if (!isInTimeRange) {
-      return RuleDecision::Skip;
-    }
-
-    // Check if we're in the turn-off window (last 2 minutes)
-    int turnOffStartMinutes = endMinutes - 2;
-    bool isInTurnOffWindow = currentMinutes >= turnOffStartMinutes && currentMinutes <= endMinutes;
-
-    if (isInTurnOffWindow) {
-      // This matters - period ending, always log
-      Serial.printf("Period %s-%s ending -> OFF\n", startTime, endTime);
-      return RuleDecision::Off;
-    }
-
-    // We're in the active period, check condition
-    bool conditionMet = condition();
-
-#if DEBUG_RULES
-    Serial.printf("Period %s-%s active, condition: %s\n",
-                  startTime, endTime, conditionMet ? "MET" : "not met");
-#endif
-
-    return conditionMet ? RuleDecision::On : RuleDecision::Skip;
-  };
+RuleAction SmartRuleSystem::period(TimeOfDay startTime, TimeOfDay endTime, RuleCondition condition) {
+  int startMinutes = startTime.toMinutes();
+  int endMinutes = endTime.toMinutes();
+
+  RuleProgram code;
+  // Outside the time range: SKIP (silent)
+  code.emit(RuleOp::TimeBetween, 0, startMinutes, endMinutes);
+  code.emit(RuleOp::Decide, RuleProgram::decisions(RuleProgram::CONTINUE, (uint8_t)RuleDecision::Skip));
+  // Last 2 minutes of the period: OFF
+  code.emit(RuleOp::PeriodEnding, 0, endMinutes);
+  code.emit(RuleOp::Decide, RuleProgram::decisions((uint8_t)RuleDecision::Off, RuleProgram::CONTINUE));
+  // Active period: the condition decides between ON and SKIP
+  code.append(condition);
+  code.emit(RuleOp::Decide, RuleProgram::decisions(RuleDecision::On, RuleDecision::Skip));
+  return RuleAction(std::move(code));
 }
 
-std::function<RuleDecision()> SmartRuleSystem::boolPeriod(const char *startTime, const char *endTime, std::function<bool()> condition) {
-  return [=]() {
-    // Parse times
-    int startHour, startMinute, endHour, endMinute;
-    sscanf(startTime, "%d:%d", &startHour, &startMinute);
-    sscanf(endTime, "%d:%d", &endHour, &endMinute);
-
-    TimeSync::TimeData currentTime = timeSync.getTime();
-    int currentMinutes = currentTime.hour * 60 + currentTime.minute;
-    int startMinutes = startHour * 60 + startMinute;
-    int endMinutes = endHour * 60 + endMinute;
-
-    // Check if we're in the time range
-    bool isInTimeRange;
-    if (endMinutes < startMinutes) {
-      // Overnight period
-      isInTimeRange = currentMinutes >= startMinutes || currentMinutes <= endMinutes;
-    } else {
-      // Same day period
-      isInTimeRange = currentMinutes >= startMinutes && currentMinutes <= endMinutes;
-    }
-
-    Serial.printf("Period check: Current: %02d:%02d, Start: %s, End: %s, In Range: %s\n",
-                  currentTime.hour, currentTime.minute, startTime, endTime,
-                  isInTimeRange ? "true" : "false");
-
-    // Outside period -> SKIP (let other rules decide)
-    if (!isInTimeRange) {
-      Serial.println("Outside time period - returning SKIP");
-      return RuleDecision::Skip;
-    }
-
-    // Inside period, condition determines ON/OFF
-    bool conditionMet = condition();
-    Serial.printf("In period, condition: %s\n", conditionMet ? "true" : "false");
-
-    // The socket will handle the actual delays when state changes
-    return conditionMet ? RuleDecision::On : RuleDecision::Off;
-  };
+RuleAction SmartRuleSystem::boolPeriod(TimeOfDay startTime, TimeOfDay endTime, RuleCondition condition) {
+  RuleProgram code;
+  // Outside period -> SKIP (let other rules decide)
+  code.emit(RuleOp::TimeBetween, 0, startTime.toMinutes(), endTime.toMinutes());
+  code.emit(RuleOp::Decide, RuleProgram::decisions(RuleProgram::CONTINUE, (uint8_t)RuleDecision::Skip));
+  // Inside period, condition determines ON/OFF
+  code.append(condition);
+  code.emit(RuleOp::Decide, RuleProgram::decisions(RuleDecision::On, RuleDecision::Off));
+  return RuleAction(std::move(code));
 }
 
-std::function<RuleDecision()> SmartRuleSystem::onAfter(const char *timeStr, int durationMins, std::function<bool()> condition) {
-  return [this, timeStr, durationMins, condition]() {
-    bool isAfter = after(timeStr, durationMins)();
-    bool conditionMet = condition();
-
-    if (isAfter && conditionMet) {
-      // Only turn on if both after time and condition is met
-      return RuleDecision::On;
-    }
-    // In all other cases, skip
-    return RuleDecision::Skip;
-  };
+RuleAction SmartRuleSystem::during(TimeOfDay startTime, TimeOfDay endTime, RuleAction action, RuleDecision outside) {
+  RuleProgram code;
+  code.emit(RuleOp::TimeBetween, 0, startTime.toMinutes(), endTime.toMinutes());
+  code.emit(RuleOp::Decide, RuleProgram::decisions(RuleProgram::CONTINUE, (uint8_t)outside));
+  code.append(action);
+  return RuleAction(std::move(code));
 }
 
-std::function<RuleDecision()> SmartRuleSystem::offAfter(const char *timeStr, int durationMins, std::function<bool()> condition) {
-  return [this, timeStr, durationMins, condition]() {
-    bool isAfter = after(timeStr, durationMins)();
-    bool conditionMet = condition();
-
-    if (isAfter) {
-      // After the time, condition determines off/skip
-      return conditionMet ? RuleDecision::Off : RuleDecision::Skip;
-    }
-    // Before the time, don't influence the state
-    return RuleDecision::Skip;
-  };
+RuleAction SmartRuleSystem::onAfter(TimeOfDay time, int durationMins, RuleCondition condition) {
+  RuleProgram code;
+  // Only turn on if both after time and condition is met, skip otherwise
+  code.append(after(time, durationMins));
+  code.emit(RuleOp::Decide, RuleProgram::decisions(RuleProgram::CONTINUE, (uint8_t)RuleDecision::Skip));
+  code.append(condition);
+  code.emit(RuleOp::Decide, RuleProgram::decisions(RuleDecision::On, RuleDecision::Skip));
+  return RuleAction(std::move(code));
 }
 
-std::function<RuleDecision()> SmartRuleSystem::onCondition(std::function<bool()> condition) {
-  return [condition]() {
-    if (condition())
-      return RuleDecision::On;
-    return RuleDecision::Skip;
-  };
+RuleAction SmartRuleSystem::offAfter(TimeOfDay time, int durationMins, RuleCondition condition) {
+  RuleProgram code;
+  // Before the time, don't influence the state
+  code.append(after(time, durationMins));
+  code.emit(RuleOp::Decide, RuleProgram::decisions(RuleProgram::CONTINUE, (uint8_t)RuleDecision::Skip));
+  // After the time, condition determines off/skip
+  code.append(condition);
+  code.emit(RuleOp::Decide, RuleProgram::decisions(RuleDecision::Off, RuleDecision::Skip));
+  return RuleAction(std::move(code));
 }
 
-std::function<RuleDecision()> SmartRuleSystem::offCondition(std::function<bool()> condition) {
-  return [condition]() {
-    if (condition())
-      return RuleDecision::Off;
-    return RuleDecision::Skip;
-  };
+RuleAction SmartRuleSystem::stateful(RuleAction action) {
+  action.stateful = true;
+  return action;
 }
 
-std::function<bool()> SmartRuleSystem::lightBelow(float threshold) {
-  return [=]() { return sensors.getLightLevel() < threshold; };
+RuleAction SmartRuleSystem::onCondition(RuleCondition condition) {
+  RuleProgram code;
+  code.append(condition);
+  code.emit(RuleOp::Decide, RuleProgram::decisions(RuleDecision::On, RuleDecision::Skip));
+  return RuleAction(std::move(code));
 }
 
-struct DelayState {
-  unsigned long startTime = 0;
-  bool timing = false;
-};
-
-std::function<RuleDecision()> SmartRuleSystem::onConditionDelayed(std::function<bool()> condition, int delaySeconds) {
-
-  auto state = std::make_shared<DelayState>();
-
-  return [condition, delaySeconds, state]() {
-    bool conditionMet = condition();
-
-    if (conditionMet) {
-      if (!state->timing) {
-        state->startTime = millis();
-        state->timing = true;
-      }
-
-      if (millis() - state->startTime >= delaySeconds * 1000UL) {
-        state->timing = false;
-        return RuleDecision::On;
-      }
-    } else {
-      state->timing = false;
-    }
-
-    return RuleDecision::Skip;
-  };
+RuleAction SmartRuleSystem::offCondition(RuleCondition condition) {
+  RuleProgram code;
+  code.append(condition);
+  code.emit(RuleOp::Decide, RuleProgram::decisions(RuleDecision::Off, RuleDecision::Skip));
+  return RuleAction(std::move(code));
 }
 
-std::function<RuleDecision()> SmartRuleSystem::offConditionDelayed(std::function<bool()> condition, int delaySeconds) {
-
-  auto state = std::make_shared<DelayState>();
+RuleCondition SmartRuleSystem::lightBelow(float threshold) {
+  return RuleCondition::threshold(RuleOp::LightBelow, threshold);
+}
 
-  return [condition, delaySeconds, state]() {
-    bool conditionMet = condition();
+RuleAction SmartRuleSystem::onConditionDelayed(RuleCondition condition, int delaySeconds) {
+  int slot = allocateSlot("onConditionDelayed", delaySeconds);
+  if (slot < 0)
+    return RuleAction();
 
-    if (conditionMet) {
-      if (!state->timing) {
-        state->startTime = millis();
-        state->timing = true;
-      }
+  RuleProgram code;
+  code.append(condition);
+  code.emit(RuleOp::HoldFor, slot, 0, delaySeconds * 1000);
+  code.stateful = true;
+  code.emit(RuleOp::Decide, RuleProgram::decisions(RuleDecision::On, RuleDecision::Skip));
+  return RuleAction(std::move(code));
+}
 
-      if (millis() - state->startTime >= delaySeconds * 1000UL) {
-        state->timing = false;
-        return RuleDecision::Off;
-      }
-    } else {
-      state->timing = false;
-    }
+RuleAction SmartRuleSystem::offConditionDelayed(RuleCondition condition, int delaySeconds) {
+  int slot = allocateSlot("offConditionDelayed", delaySeconds);
+  if (slot < 0)
+    return RuleAction();
 
-    return RuleDecision::Skip;
-  };
+  RuleProgram code;
+  code.append(condition);
+  code.emit(RuleOp::HoldFor, slot, 0, delaySeconds * 1000);
+  code.stateful = true;
+  code.emit(RuleOp::Decide, RuleProgram::decisions(RuleDecision::Off, RuleDecision::Skip));
+  return RuleAction(std::move(code));
 }
 
-std::function<bool()> SmartRuleSystem::lightAbove(float threshold) {
-  return [=]() { return sensors.getLightLevel() > threshold; };
+RuleCondition SmartRuleSystem::lightAbove(float threshold) {
+  return RuleCondition::threshold(RuleOp::LightAbove, threshold);
 }
 
-std::function<bool()> SmartRuleSystem::phoneNotPresent() {
-  return []() { return phoneCheck && !phoneCheck->isDevicePresent(); };
+RuleCondition SmartRuleSystem::phoneNotPresent() {
+  return RuleCondition::op(RuleOp::PhoneAbsent);
 }
 
-std::function<bool()> SmartRuleSystem::phonePresent() {
-  return []() {
-    if (!phoneCheck)
-      return false;
-    return phoneCheck->isDevicePresent();
-  };
+RuleCondition SmartRuleSystem::phonePresent() {
+  return RuleCondition::op(RuleOp::PhonePresent);
 }
 
-std::function<bool()> SmartRuleSystem::isWorkday() {
-  return []() {
-    return timeSync.isWorkday();
-  };
+RuleCondition SmartRuleSystem::isWorkday() {
+  return RuleCondition::op(RuleOp::DayMask, WEEKDAYS);
 }
-std::function<bool()> SmartRuleSystem::isWeekend() {
-  return []() {
-    return timeSync.isWeekend();
-  };
+RuleCondition SmartRuleSystem::isWeekend() {
+  return RuleCondition::op(RuleOp::DayMask, WEEKEND);
 }
-std::function<bool()> SmartRuleSystem::isMonday() {
-  return []() {
-    return timeSync.isMonday();
-  };
+RuleCondition SmartRuleSystem::isMonday() {
+  return RuleCondition::op(RuleOp::DayMask, MONDAY);
 }
-std::function<bool()> SmartRuleSystem::isTuesday() {
-  return []() {
-    return timeSync.isTuesday();
-  };
+RuleCondition SmartRuleSystem::isTuesday() {
+  return RuleCondition::op(RuleOp::DayMask, TUESDAY);
 }
-std::function<bool()> SmartRuleSystem::isWednesday() {
-  return []() {
-    return timeSync.isWednesday();
-  };
+RuleCondition SmartRuleSystem::isWednesday() {
+  return RuleCondition::op(RuleOp::DayMask, WEDNESDAY);
 }
-std::function<bool()> SmartRuleSystem::isThursday() {
-  return []() {
-    return timeSync.isThursday();
-  };
+RuleCondition SmartRuleSystem::isThursday() {
+  return RuleCondition::op(RuleOp::DayMask, THURSDAY);
 }
-std::function<bool()> SmartRuleSystem::isFriday() {
-  return []() {
-    return timeSync.isFriday();
-  };
+RuleCondition SmartRuleSystem::isFriday() {
+  return RuleCondition::op(RuleOp::DayMask, FRIDAY);
 }
-std::function<bool()> SmartRuleSystem::isSaturday() {
-  return []() {
-    return timeSync.isSaturday();
-  };
+RuleCondition SmartRuleSystem::isSaturday() {
+  return RuleCondition::op(RuleOp::DayMask, SATURDAY);
 }
-std::function<bool()> SmartRuleSystem::isSunday() {
-  return []() {
-    return timeSync.isSunday();
-  };
+RuleCondition SmartRuleSystem::isSunday() {
+  return RuleCondition::op(RuleOp::DayMask, SUNDAY);
 }
 
 // power related rules
 
-std::function<bool()> SmartRuleSystem::powerSolarActive() {
-  return []() { return p1Meter && p1Meter->getCurrentExport() > 0; };
+RuleCondition SmartRuleSystem::powerSolarActive() {
+  return RuleCondition::threshold(RuleOp::ExportAbove, 0);
 }
-std::function<bool()> SmartRuleSystem::powerProducing() {
-  return []() { return p1Meter && p1Meter->getCurrentExport() > 0; };
+RuleCondition SmartRuleSystem::powerProducing() {
+  return RuleCondition::threshold(RuleOp::ExportAbove, 0);
 }
-std::function<bool()> SmartRuleSystem::powerConsuming() {
-  return []() { return p1Meter && p1Meter->getCurrentImport() > 0; };
+RuleCondition SmartRuleSystem::powerConsuming() {
+  return RuleCondition::threshold(RuleOp::ImportAbove, 0);
 }
-std::function<bool()> SmartRuleSystem::powerProductionBelow(float threshold) {
-  return [=]() { return p1Meter && p1Meter->getCurrentExport() < threshold; };
+RuleCondition SmartRuleSystem::powerProductionBelow(float threshold) {
+  return RuleCondition::threshold(RuleOp::ExportBelow, threshold);
 }
-std::function<bool()> SmartRuleSystem::powerProductionAbove(float threshold) {
-  return [=]() { return p1Meter && p1Meter->getCurrentExport() > threshold; };
+RuleCondition SmartRuleSystem::powerProductionAbove(float threshold) {
+  return RuleCondition::threshold(RuleOp::ExportAbove, threshold);
 }
 
-const char *SmartRuleSystem::rndTime(const char *time, int maxMinutes, int extraSeed) {
+TimeOfDay SmartRuleSystem::rndTime(TimeOfDay time, int maxMinutes, int extraSeed) {
   TimeSync::TimeData t = timeSync.getTime();
   srand(t.dayOfYear + t.weekNum + extraSeed);
   int addMinutes = rand() % maxMinutes;
 
-  int hour, minute;
-  sscanf(time, "%d:%d", &hour, &minute);
-
-  minute += addMinutes;
-  hour += minute / 60;
-  minute = minute % 60;
-  hour = hour % 24;
-
-  snprintf(timeBuffer, sizeof(timeBuffer), "%02d:%02d", hour, minute);
+  TimeOfDay result = time.addMinutes(addMinutes);
+  char resultStr[6], baseStr[6];
   Serial.printf("Generated random time: %s (base: %s, added: %d min)\n",
-                timeBuffer, time, addMinutes);
-  return timeBuffer;
+                result.format(resultStr), time.format(baseStr), addMinutes);
+  return result;
 }
 
 // ============================================================================
@@ -957,269 +1374,141 @@ const char *SmartRuleSystem::getSunsetTime() {
 // SUN-BASED CONDITIONS
 // ============================================================================
 
-std::function<bool()> SmartRuleSystem::sunUp() {
-  return []() {
-    calculateDailySunTimes();
-
-    if (sunriseMinutes < 0)
-      return false; // Polar night
-    if (sunsetMinutes >= 1440)
-      return true; // Midnight sun
-
-    TimeSync::TimeData t = timeSync.getTime();
-    int currentMinutes = t.hour * 60 + t.minute;
-
-    return currentMinutes >= sunriseMinutes && currentMinutes < sunsetMinutes;
-  };
+RuleCondition SmartRuleSystem::sunUp() {
+  return RuleCondition::op(RuleOp::SunUp);
 }
 
-std::function<bool()> SmartRuleSystem::sunDown() {
-  return []() {
-    calculateDailySunTimes();
-
-    if (sunriseMinutes < 0)
-      return true; // Polar night
-    if (sunsetMinutes >= 1440)
-      return false; // Midnight sun
-
-    TimeSync::TimeData t = timeSync.getTime();
-    int currentMinutes = t.hour * 60 + t.minute;
-
-    return currentMinutes < sunriseMinutes || currentMinutes >= sunsetMinutes;
-  };
+RuleCondition SmartRuleSystem::sunDown() {
+  return RuleCondition::op(RuleOp::SunDown);
 }
 
-std::function<bool()> SmartRuleSystem::beforeSunrise(int minutes) {
-  return [minutes]() {
-    calculateDailySunTimes();
-
-    if (sunriseMinutes < 0)
-      return false; // No sunrise today
-
-    TimeSync::TimeData t = timeSync.getTime();
-    int currentMinutes = t.hour * 60 + t.minute;
-
-    int windowStart = sunriseMinutes - minutes;
-    if (windowStart < 0)
-      windowStart += 1440;
-
-    if (windowStart < sunriseMinutes) {
-      return currentMinutes >= windowStart && currentMinutes < sunriseMinutes;
-    } else {
-      // Window spans midnight
-      return currentMinutes >= windowStart || currentMinutes < sunriseMinutes;
-    }
-  };
+RuleCondition SmartRuleSystem::beforeSunrise(int minutes) {
+  return RuleCondition::op(RuleOp::BeforeSunrise, 0, 0, minutes);
 }
 
-std::function<bool()> SmartRuleSystem::afterSunrise(int minutes) {
-  return [minutes]() {
-    calculateDailySunTimes();
-
-    if (sunriseMinutes < 0)
-      return false;
-
-    TimeSync::TimeData t = timeSync.getTime();
-    int currentMinutes = t.hour * 60 + t.minute;
-
-    int windowEnd = sunriseMinutes + minutes;
-    if (windowEnd >= 1440)
-      windowEnd -= 1440;
-
-    if (sunriseMinutes < windowEnd) {
-      return currentMinutes >= sunriseMinutes && currentMinutes < windowEnd;
-    } else {
-      return currentMinutes >= sunriseMinutes || currentMinutes < windowEnd;
-    }
-  };
+RuleCondition SmartRuleSystem::afterSunrise(int minutes) {
+  return RuleCondition::op(RuleOp::AfterSunrise, 0, 0, minutes);
 }
 
-std::function<bool()> SmartRuleSystem::beforeSunset(int minutes) {
-  return [minutes]() {
-    calculateDailySunTimes();
-
-    if (sunsetMinutes >= 1440)
-      return false; // No sunset today
-
-    TimeSync::TimeData t = timeSync.getTime();
-    int currentMinutes = t.hour * 60 + t.minute;
-
-    int windowStart = sunsetMinutes - minutes;
-    if (windowStart < 0)
-      windowStart += 1440;
-
-    if (windowStart < sunsetMinutes) {
-      return currentMinutes >= windowStart && currentMinutes < sunsetMinutes;
-    } else {
-      return currentMinutes >= windowStart || currentMinutes < sunsetMinutes;
-    }
-  };
+RuleCondition SmartRuleSystem::beforeSunset(int minutes) {
+  return RuleCondition::op(RuleOp::BeforeSunset, 0, 0, minutes);
 }
 
-std::function<bool()> SmartRuleSystem::afterSunset(int minutes) {
-  return [minutes]() {
-    calculateDailySunTimes();
-
-    if (sunsetMinutes >= 1440)
-      return false;
-
-    TimeSync::TimeData t = timeSync.getTime();
-    int currentMinutes = t.hour * 60 + t.minute;
-
-    int windowEnd = sunsetMinutes + minutes;
-    if (windowEnd >= 1440)
-      windowEnd -= 1440;
-
-    if (sunsetMinutes < windowEnd) {
-      return currentMinutes >= sunsetMinutes && currentMinutes < windowEnd;
-    } else {
-      return currentMinutes >= sunsetMinutes || currentMinutes < windowEnd;
-    }
-  };
+RuleCondition SmartRuleSystem::afterSunset(int minutes) {
+  return RuleCondition::op(RuleOp::AfterSunset, 0, 0, minutes);
 }
 
 // ============================================================================
 // TEMPERATURE CONDITIONS
 // ============================================================================
 
-std::function<bool()> SmartRuleSystem::temperatureAbove(float threshold) {
-  return [=]() {
-    if (!sensors.hasBME280())
-      return false;
-    return sensors.getTemperature() > threshold;
-  };
+RuleCondition SmartRuleSystem::temperatureAbove(float threshold) {
+  return RuleCondition::threshold(RuleOp::TemperatureAbove, threshold);
 }
 
-std::function<bool()> SmartRuleSystem::temperatureBelow(float threshold) {
-  return [=]() {
-    if (!sensors.hasBME280())
-      return false;
-    return sensors.getTemperature() < threshold;
-  };
+RuleCondition SmartRuleSystem::temperatureBelow(float threshold) {
+  return RuleCondition::threshold(RuleOp::TemperatureBelow, threshold);
 }
 
 // ============================================================================
 // HUMIDITY CONDITIONS
 // ============================================================================
 
-std::function<bool()> SmartRuleSystem::humidityAbove(float threshold) {
-  return [=]() {
-    if (!sensors.hasBME280())
-      return false;
-    return sensors.getHumidity() > threshold;
-  };
+RuleCondition SmartRuleSystem::humidityAbove(float threshold) {
+  return RuleCondition::threshold(RuleOp::HumidityAbove, threshold);
 }
 
-std::function<bool()> SmartRuleSystem::humidityBelow(float threshold) {
-  return [=]() {
-    if (!sensors.hasBME280())
-      return false;
-    return sensors.getHumidity() < threshold;
-  };
+RuleCondition SmartRuleSystem::humidityBelow(float threshold) {
+  return RuleCondition::threshold(RuleOp::HumidityBelow, threshold);
 }
 
 // ============================================================================
 // AIR PRESSURE CONDITIONS
 // ============================================================================
 
-std::function<bool()> SmartRuleSystem::pressureAbove(float threshold) {
-  return [=]() {
-    if (!sensors.hasBME280())
-      return false;
-    return sensors.getPressure() > threshold;
-  };
+RuleCondition SmartRuleSystem::pressureAbove(float threshold) {
+  return RuleCondition::threshold(RuleOp::PressureAbove, threshold);
 }
 
-std::function<bool()> SmartRuleSystem::pressureBelow(float threshold) {
-  return [=]() {
-    if (!sensors.hasBME280())
-      return false;
-    return sensors.getPressure() < threshold;
-  };
+RuleCondition SmartRuleSystem::pressureBelow(float threshold) {
+  return RuleCondition::threshold(RuleOp::PressureBelow, threshold);
 }
 
 // ============================================================================
 // SOCKET STATE CONDITIONS
 // ============================================================================
 
-std::function<bool()> SmartRuleSystem::socketIsOn(int socketNumber) {
-  return [this, socketNumber]() {
-    int idx = socketNumber - 1;
-    if (idx < 0 || idx >= NUM_SOCKETS)
-      return false;
-    return sockets[idx].physicalState;
-  };
+RuleCondition SmartRuleSystem::socketIsOn(int socketNumber) {
+  int idx = socketNumber - 1;
+  if (idx < 0 || idx >= NUM_SOCKETS)
+    return RuleCondition::constant(false);
+  return RuleCondition::op(RuleOp::SocketOn, idx);
 }
 
-std::function<bool()> SmartRuleSystem::socketIsOff(int socketNumber) {
-  return [this, socketNumber]() {
-    int idx = socketNumber - 1;
-    if (idx < 0 || idx >= NUM_SOCKETS)
-      return true;
-    return !sockets[idx].physicalState;
-  };
+RuleCondition SmartRuleSystem::socketIsOff(int socketNumber) {
+  int idx = socketNumber - 1;
+  if (idx < 0 || idx >= NUM_SOCKETS)
+    return RuleCondition::constant(true);
+  return RuleCondition::op(RuleOp::SocketOff, idx);
 }
 
 // ============================================================================
 // DURATION CONDITIONS
 // ============================================================================
 
-std::function<bool()> SmartRuleSystem::hasBeenOnFor(int socketNumber, unsigned long minutes) {
-  return [this, socketNumber, minutes]() {
-    int idx = socketNumber - 1;
-    if (idx < 0 || idx >= NUM_SOCKETS)
-      return false;
-
-    // Must be currently ON
-    if (!sockets[idx].physicalState)
-      return false;
-
-    unsigned long elapsedMs = millis() - sockets[idx].lastStateChange;
-    unsigned long elapsedMinutes = elapsedMs / 60000;
-
-    return elapsedMinutes >= minutes;
-  };
+RuleCondition SmartRuleSystem::hasBeenOnFor(int socketNumber, unsigned long minutes) {
+  int idx = socketNumber - 1;
+  if (idx < 0 || idx >= NUM_SOCKETS)
+    return RuleCondition::constant(false);
+  // Must be currently ON for at least the given minutes
+  return RuleCondition::op(RuleOp::OnFor, idx, 0, (int32_t)minutes);
 }
 
-std::function<bool()> SmartRuleSystem::hasBeenOffFor(int socketNumber, unsigned long minutes) {
-  return [this, socketNumber, minutes]() {
-    int idx = socketNumber - 1;
-    if (idx < 0 || idx >= NUM_SOCKETS)
-      return false;
-
-    // Must be currently OFF
-    if (sockets[idx].physicalState)
-      return false;
-
-    unsigned long elapsedMs = millis() - sockets[idx].lastStateChange;
-    unsigned long elapsedMinutes = elapsedMs / 60000;
-
-    return elapsedMinutes >= minutes;
-  };
+RuleCondition SmartRuleSystem::hasBeenOffFor(int socketNumber, unsigned long minutes) {
+  int idx = socketNumber - 1;
+  if (idx < 0 || idx >= NUM_SOCKETS)
+    return RuleCondition::constant(false);
+  // Must be currently OFF for at least the given minutes
+  return RuleCondition::op(RuleOp::OffFor, idx, 0, (int32_t)minutes);
 }
 
 // grouping logic
 
-std::function<bool()> SmartRuleSystem::allOf(std::vector<std::function<bool()>> conditions) {
-  return [=]() {
-    for (const auto &cond : conditions) {
-      if (!cond())
-        return false;
-    }
-    return true;
-  };
-}
-std::function<bool()> SmartRuleSystem::anyOf(std::vector<std::function<bool()>> conditions) {
-  return [=]() {
-    for (const auto &cond : conditions) {
-      if (cond())
-        return true;
-    }
-    return false;
-  };
+RuleCondition SmartRuleSystem::allOf(std::vector<RuleCondition> conditions) {
+  if (conditions.empty())
+    return RuleCondition::constant(true);
+
+  // Short-circuit: every false result jumps to the end with acc = false
+  RuleProgram code;
+  std::vector<size_t> exits;
+  for (size_t i = 0; i < conditions.size(); i++) {
+    code.append(conditions[i]);
+    if (i + 1 < conditions.size())
+      exits.push_back(code.emitJump(RuleOp::JumpIfFalse));
+  }
+  for (size_t at : exits)
+    code.patchJump(at);
+  return RuleCondition(std::move(code));
+}
+RuleCondition SmartRuleSystem::anyOf(std::vector<RuleCondition> conditions) {
+  if (conditions.empty())
+    return RuleCondition::constant(false);
+
+  // Short-circuit: every true result jumps to the end with acc = true
+  RuleProgram code;
+  std::vector<size_t> exits;
+  for (size_t i = 0; i < conditions.size(); i++) {
+    code.append(conditions[i]);
+    if (i + 1 < conditions.size())
+      exits.push_back(code.emitJump(RuleOp::JumpIfTrue));
+  }
+  for (size_t at : exits)
+    code.patchJump(at);
+  return RuleCondition(std::move(code));
 }
-std::function<bool()> SmartRuleSystem::notOf(std::function<bool()> condition) {
-  return [=]() { return !condition(); };
+RuleCondition SmartRuleSystem::notOf(RuleCondition condition) {
+  condition.emit(RuleOp::Not);
+  return condition;
 }
 
 bool SmartRuleSystem::getSocketState(int socketIndex) const {
@@ -1237,20 +1526,79 @@ bool SmartRuleSystem::decisionToPhysical(RuleDecision decision) {
 }
 
 // helper function to calculate end time in milliseconds
-unsigned long SmartRuleSystem::calculateEndTime(int hour, int minute) {
-  TimeSync::TimeData t = timeSync.getTime();
-  unsigned long now = millis();
-  int currentHour = t.hour;
-  int currentMinute = t.minute;
-
+unsigned long SmartRuleSystem::calculateEndTime(TimeOfDay end, const RuleContext &ctx) {
   // Calculate minutes remaining until end time
-  int minutesRemaining = (hour - currentHour) * 60 + (minute - currentMinute);
+  int minutesRemaining = end.toMinutes() - ctx.minuteOfDay;
   if (minutesRemaining < 0)
     minutesRemaining += 24 * 60; // Handle overnight
 
-  return now + (minutesRemaining * 60 * 1000UL);
+  return ctx.now + (minutesRemaining * 60 * 1000UL);
 }
+// lastActiveRuleName must not keep pointing into a name store that goes away
+static bool namedBy(const char *name, const std::vector<char> &names) {
+  return !names.empty() && name >= names.data() && name < names.data() + names.size();
+}
+
 void SmartRuleSystem::clearRules() {
   rules.clear();
+  program.clear();
+  conditionCalls.clear();
+  actionCalls.clear();
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    socketRules[i].clear();
+    sockets[i].winningRule = -1;
+  }
+  // Kept for the rebuild that follows; a second clear before it keeps the first
+  if (slotCount > 0)
+    retiredSlots.assign(slots, slots + slotCount);
+  slotCount = 0;
+  if (namedBy(lastActiveRuleName, ruleNames))
+    lastActiveRuleName = "none";
+  ruleNames.clear();
+  lastContextValid = false;
   Serial.println("All rules cleared");
+}
+
+void SmartRuleSystem::setRuleNames(std::vector<char> names) {
+  ruleNames = std::move(names);
+  const char *name = ruleNames.data();
+  for (auto &rule : rules) {
+    if (name >= ruleNames.data() + ruleNames.size())
+      break;
+    rule.name = name;
+    name += strlen(name) + 1;
+  }
+}
+
+void SmartRuleSystem::swapRules(SmartRuleSystem &other) {
+  std::swap(rules, other.rules);
+  std::swap(program, other.program);
+  std::swap(conditionCalls, other.conditionCalls);
+  std::swap(actionCalls, other.actionCalls);
+  std::swap(ruleNames, other.ruleNames);
+  for (int i = 0; i < MAX_RULE_SLOTS; i++)
+    std::swap(slots[i], other.slots[i]);
+  std::swap(slotCount, other.slotCount);
+  for (int i = 0; i < slotCount; i++)
+    carrySlotState(i, other.slots, other.slotCount);
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    std::swap(socketRules[i], other.socketRules[i]);
+    sockets[i].winningRule = -1;
+    other.sockets[i].winningRule = -1;
+  }
+  if (namedBy(lastActiveRuleName, other.ruleNames))
+    lastActiveRuleName = "none";
+  lastContextValid = false; // Full pass with the new rules
+  other.lastContextValid = false;
+}
+
+size_t SmartRuleSystem::getRulesetBytes() const {
+  size_t bytes = rules.capacity() * sizeof(Rule) +
+                 program.capacity() * sizeof(RuleInstr) +
+                 conditionCalls.capacity() * sizeof(ConditionCall) +
+                 actionCalls.capacity() * sizeof(ActionCall) +
+                 ruleNames.capacity();
+  for (int i = 0; i < NUM_SOCKETS; i++)
+    bytes += socketRules[i].capacity() * sizeof(uint16_t);
+  return bytes;
 }
\ No newline at end of file
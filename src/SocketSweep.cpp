@@ -0,0 +1,91 @@
+#define DEBUG_SOCKET_SWEEP 0
+
+#include "SocketSweep.h"
+#include "HomeSocketDevice.h"
+
+SocketSweep socketSweep;
+
+bool SocketSweep::start(HomeSocketDevice **sockets, uint8_t socketCount, uint8_t maxWidth, Callback done) {
+  if (active)
+    return false;
+  count = 0;
+  for (uint8_t i = 0; i < socketCount && i < NUM_SOCKETS; i++) {
+    devices[i] = sockets[i];
+    slots[i] = sockets[i] ? Slot::Waiting : Slot::Done;
+    count++;
+  }
+  width = maxWidth < 1 ? 1 : maxWidth > AsyncHttpClient::MAX_REQUESTS ? AsyncHttpClient::MAX_REQUESTS : maxWidth;
+  callback = done;
+  online = 0;
+  started = millis();
+  active = true;
+  poll();
+  return true;
+}
+
+void SocketSweep::poll() {
+  if (!active)
+    return;
+  unsigned long now = millis();
+
+  // Collect the reads that completed
+  uint8_t inFlight = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if (slots[i] != Slot::Reading)
+      continue;
+    if (devices[i]->isReadPending()) {
+      inFlight++;
+      continue;
+    }
+    slots[i] = Slot::Done;
+    bool ok = devices[i]->getHealth().lastOk();
+    online += ok;
+#if DEBUG_SOCKET_SWEEP
+    Serial.printf("Sweep > socket %d %s after %lu ms\n", i + 1, ok ? "read" : "failed", now - readStarted[i]);
+#endif
+    if (callback)
+      callback(i + 1, ok, now - readStarted[i]);
+  }
+
+  // Start the next ones while there is room
+  bool waiting = false;
+  for (uint8_t i = 0; i < count; i++) {
+    if (slots[i] != Slot::Waiting)
+      continue;
+    if (inFlight >= width) {
+      waiting = true;
+      break;
+    }
+    // A read the scheduler already started counts as this one
+    if (devices[i]->isReadPending() || devices[i]->getState()) {
+      slots[i] = Slot::Reading;
+      readStarted[i] = now;
+      inFlight++;
+    } else if (WiFi.status() != WL_CONNECTED || !devices[i]->isConnected()) {
+      slots[i] = Slot::Done; // Nothing to read over, its breaker is open or it is unreachable
+      if (callback)
+        callback(i + 1, false, 0);
+    } else {
+      waiting = true; // Client slots taken by others, next poll()
+      break;
+    }
+  }
+  if (inFlight > stats.maxInFlight)
+    stats.maxInFlight = inFlight;
+
+  if (inFlight == 0 && !waiting) {
+    active = false;
+    stats.sweeps++;
+    stats.lastSweepMs = now - started;
+    stats.lastOnline = online;
+  }
+}
+
+void SocketSweep::runUntilDone(unsigned long maxMs) {
+  unsigned long begin = millis();
+  while (active && millis() - begin < maxMs) {
+    httpClient.poll();
+    poll();
+    delay(1);
+  }
+}
@@ -181,7 +181,7 @@ String TimeSync::getCurrentTime() {
   return String(timeString);
 }
 
-bool TimeSync::isTimeBetween(const char *startTime, const char *endTime) {
+bool TimeSync::isTimeBetween(TimeOfDay startTime, TimeOfDay endTime) {
   struct tm timeinfo;
   if (!getLocalTime(&timeinfo)) {
     Serial.println("âš  Failed to get time for comparison");
@@ -190,36 +190,14 @@ bool TimeSync::isTimeBetween(const char *startTime, const char *endTime) {
   }
 
   int currentMinutes = timeinfo.tm_hour * 60 + timeinfo.tm_min;
-
-  // Parse start time (format "HH:MM")
-  int startHour, startMin;
-  sscanf(startTime, "%d:%d", &startHour, &startMin);
-  int startMinutes = startHour * 60 + startMin;
-
-  // Parse end time
-  int endHour, endMin;
-  sscanf(endTime, "%d:%d", &endHour, &endMin);
-  int endMinutes = endHour * 60 + endMin;
-
-  // Debug time information
-  // Serial.printf("Time check - Current: %02d:%02d (%d min), ", timeinfo.tm_hour,
-  //               timeinfo.tm_min, currentMinutes);
-  // Serial.printf("Start: %02d:%02d (%d min), ", startHour, startMin,
-  //               startMinutes);
-  // Serial.printf("End: %02d:%02d (%d min)\n", endHour, endMin, endMinutes);
+  int startMinutes = startTime.toMinutes();
+  int endMinutes = endTime.toMinutes();
 
   if (endMinutes < startMinutes) { // Handles overnight periods
-    bool isInRange =
-        currentMinutes >= startMinutes || currentMinutes <= endMinutes;
-    // Serial.printf("Overnight period check: %s\n", isInRange ? "true" : "false");
-
-    return isInRange;
+    return currentMinutes >= startMinutes || currentMinutes <= endMinutes;
   }
 
-  bool isInRange =
-      currentMinutes >= startMinutes && currentMinutes <= endMinutes;
-  //  Serial.printf("Same-day period check: %s\n", isInRange ? "true" : "false");
-  return isInRange;
+  return currentMinutes >= startMinutes && currentMinutes <= endMinutes;
 }
 
 int TimeSync::getCurrentMinutes() {
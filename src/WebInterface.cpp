@@ -2,12 +2,57 @@
 #include "WebInterface.h"
 #include "Constants.h"
 #include "GlobalVars.h"
+#include "PollScheduler.h"
 #include "PowerHistory.h"
+#include "RuleLoader.h"
+#include "SmartRuleSystem.h"
+#include "WebAssets.h"
+
+// Breaker, availability over the last requests (percent), latency (ms)
+// and what went wrong, for the switches and under "health"
+static void addHealth(JsonObject out, const DeviceHealth &health) {
+  const DeviceHealth::Counts &counts = health.getCounts();
+  out["breaker"] = health.getStateName();
+  out["avail"] = (int)(health.availability() * 100 + 0.5f);
+  out["lat_p50"] = health.latencyPercentile(50);
+  out["lat_p99"] = health.latencyPercentile(99);
+  out["ok"] = counts.ok;
+  out["timeouts"] = counts.timeouts;
+  out["errors"] = counts.connectErrors + counts.httpErrors;
+  out["parse_errors"] = counts.parseErrors;
+}
+
+// Today's import and export in kWh, false until yesterday's totals are known
+static bool dailyTotals(float &dailyImport, float &dailyExport) {
+  if (!p1Meter || config.yesterday <= 0 || config.yesterdayImport <= 0)
+    return false;
+  dailyImport = p1Meter->getTotalImport() - config.yesterdayImport;
+  dailyExport = p1Meter->getTotalExport() - config.yesterdayExport;
+  return dailyImport >= 0 && dailyImport < 100 && dailyExport >= 0 && dailyExport < 100;
+}
+
+// The rule that switched last and the ones before it
+static void addRuleHistory(JsonDocument &doc) {
+  doc["last_rule"] = lastActiveRuleName;
+  doc["last_rule_time"] = lastActiveRuleTimeStr;
+  JsonArray ruleHist = doc.createNestedArray("rule_history");
+  for (int i = 0; i < 4; i++) {
+    int idx = (ruleHistoryIndex + i) % 4;
+    if (ruleHistory[idx].name[0] != '\0') {
+      if (strcmp(ruleHistory[idx].name, lastActiveRuleName) != 0) {
+        JsonObject hist = ruleHist.createNestedObject();
+        hist["name"] = ruleHistory[idx].name;
+        hist["time"] = ruleHistory[idx].time;
+      }
+    }
+  }
+}
 
 void WebInterface::updateCache() {
   if (p1Meter) {
-    cached.import_power = p1Meter->getCurrentImport();
-    cached.export_power = p1Meter->getCurrentExport();
+    P1Sample sample = p1Meter->getSample(); // Import and export of the same measurement
+    cached.import_power = sample.importPower;
+    cached.export_power = sample.exportPower;
   }
   cached.temperature = sensors.getTemperature();
   cached.humidity = sensors.getHumidity();
@@ -20,135 +65,559 @@ void WebInterface::updateCache() {
   }
 }
 
-void WebInterface::begin() {
-  if (!SPIFFS.begin(true)) {
-    Serial.println("SPIFFS Mount Failed");
-    return;
+String WebInterface::dataJson() {
+  JsonDocument &doc = dataDoc;
+  doc.clear();
+
+  doc["import_power"] = cached.import_power;
+  doc["export_power"] = cached.export_power;
+
+  float dailyImport, dailyExport;
+  if (dailyTotals(dailyImport, dailyExport)) {
+    doc["daily_import"] = dailyImport;
+    doc["daily_export"] = dailyExport;
   }
 
-  WiFi.setTxPower(WIFI_POWER_19_5dBm);
+  doc["temperature"] = cached.temperature;
+  doc["humidity"] = cached.humidity;
+  doc["light"] = cached.light;
+  doc["phone_present"] = (phoneCheck && phoneCheck->isDevicePresent());
 
-  // Serve static files automatically from SPIFFS
-  // This replaces getContentType, serveFromCache, cacheFile, and serveFile
+  JsonArray switches = doc.createNestedArray("switches");
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    JsonObject sw = switches.createNestedObject();
+    sw["state"] = cached.socket_states[i];
+    sw["duration"] = cached.socket_durations[i] / 1000;
+    sw["online"] = cached.socket_online[i];
+    // Age the state reaches before it is read again, seconds
+    PollScheduler::Staleness staleness = pollScheduler.getStaleness(i + 1);
+    sw["stale_p50"] = staleness.p50 / 1000;
+    sw["stale_p90"] = staleness.p90 / 1000;
+    if (sockets[i]) {
+      sw["command"] = HomeSocketDevice::statusName(sockets[i]->getLatestCommand().status);
+      sw["reach"] = Reachability::stateName(sockets[i]->getReachability());
+      addHealth(sw.createNestedObject("health"), sockets[i]->getHealth());
+    }
+  }
 
-  server.serveStatic("/", SPIFFS, "/index.html", "public, max-age=604800");
+  addRuleHistory(doc);
+
+  // Earliest time a time-based rule can change its decision
+  char nextEvent[6] = "";
+  if (ruleSystem.getNextEventMillis() != 0)
+    ruleSystem.getNextEventTime().format(nextEvent);
+  doc["next_rule_event"] = nextEvent;
+
+  // Device connections: sockets open now and at most, leaks closed
+  const AsyncHttpClient::Stats &http = httpClient.getStats();
+  JsonObject connections = doc.createNestedObject("http");
+  connections["requests"] = http.started;
+  connections["reused"] = http.connectionsReused;
+  connections["open"] = http.openSockets;
+  connections["max_open"] = http.maxOpenSockets;
+  connections["leaks"] = http.leaksClosed;
+  doc["p1_source"] = !p1Meter ? "none" : p1Meter->isStreaming() ? "stream" : "poll";
+  JsonObject health = doc.createNestedObject("health");
+  if (p1Meter)
+    addHealth(health.createNestedObject("p1"), p1Meter->getHealth());
+
+  // Phones: presence and the round trips of their probes
+  JsonArray phones = doc.createNestedArray("phones");
+  for (uint8_t i = 0; phoneCheck && i < phoneCheck->getDeviceCount(); i++) {
+    const NetworkCheck::Device &device = phoneCheck->getDevice(i);
+    JsonObject phone = phones.createNestedObject();
+    phone["ip"] = device.ip.c_str();
+    phone["present"] = device.present;
+    phone["last_reply"] = device.lastReply ? (long)((millis() - device.lastReply) / 1000) : -1;
+    phone["avail"] = device.health.availability();
+    phone["lat_p50"] = device.health.latencyPercentile(50);
+  }
 
-  // API endpoint for getting data
-  server.on("/data", HTTP_GET, [this]() {
-    server.sendHeader("Access-Control-Allow-Origin", "*");
+  doc["ip"] = WiFi.localIP().toString();
+  doc["free_ram"] = ESP.getFreeHeap() / 1024;
+  doc["uptime"] = millis() / 1000;
 
-    // Using StaticJsonDocument on the stack is much safer than Dynamic
-    StaticJsonDocument<2048> doc;
+  String response;
+  serializeJson(doc, response);
+  return response;
+}
 
-    doc["import_power"] = cached.import_power;
-    doc["export_power"] = cached.export_power;
+// The answer for version, serialized only when the version moved on
+const String &WebInterface::cachedBody(CachedResponse &cache, const char *name, uint32_t version,
+                                       const std::function<String()> &build) {
+  if (!cache.valid || cache.version != version) {
+    cache.body = build();
+    cache.version = version;
+    cache.valid = true;
+    snprintf(cache.etag, sizeof(cache.etag), "\"%08lx-%s-%lu\"", (unsigned long)bootId, name,
+             (unsigned long)version);
+  }
+  return cache.body;
+}
 
-    if (p1Meter && config.yesterday > 0 && config.yesterdayImport > 0) {
-      float dailyImport = p1Meter->getTotalImport() - config.yesterdayImport;
-      float dailyExport = p1Meter->getTotalExport() - config.yesterdayExport;
-      if (dailyImport >= 0 && dailyImport < 100 && dailyExport >= 0 && dailyExport < 100) {
-        doc["daily_import"] = dailyImport;
-        doc["daily_export"] = dailyExport;
-      }
-    }
+// No-cache: the browser keeps the answer but asks each time, and gets a 304
+// while it is still current
+void WebInterface::sendCached(const HttpServer::Request &req, HttpServer::Response &res, CachedResponse &cache,
+                              const char *name, uint32_t version, const std::function<String()> &build) {
+  const String &body = cachedBody(cache, name, version, build);
+  res.addHeader("Cache-Control", "no-cache");
+  if (res.notModified(req, cache.etag))
+    return;
+  res.send(200, "application/json", body);
+}
 
-    doc["temperature"] = cached.temperature;
-    doc["humidity"] = cached.humidity;
-    doc["light"] = cached.light;
-    doc["phone_present"] = (phoneCheck && phoneCheck->isDevicePresent());
-
-    JsonArray switches = doc.createNestedArray("switches");
-    for (int i = 0; i < NUM_SOCKETS; i++) {
-      JsonObject sw = switches.createNestedObject();
-      sw["state"] = cached.socket_states[i];
-      sw["duration"] = cached.socket_durations[i] / 1000;
-      sw["online"] = cached.socket_online[i];
-    }
+void WebInterface::begin() {
+  bootId = random(0x7fffffff);
+  if (!SPIFFS.begin(true)) {
+    Serial.println("SPIFFS Mount Failed");
+    return;
+  }
 
-    doc["last_rule"] = lastActiveRuleName;
-    doc["last_rule_time"] = lastActiveRuleTimeStr;
-
-    JsonArray ruleHist = doc.createNestedArray("rule_history");
-    for (int i = 0; i < 4; i++) {
-      int idx = (ruleHistoryIndex + i) % 4;
-      if (ruleHistory[idx].name[0] != '\0') {
-        if (strcmp(ruleHistory[idx].name, lastActiveRuleName) != 0) {
-          JsonObject hist = ruleHist.createNestedObject();
-          hist["name"] = ruleHistory[idx].name;
-          hist["time"] = ruleHistory[idx].time;
-        }
-      }
-    }
+  WiFi.setTxPower(WIFI_POWER_19_5dBm);
 
-    doc["ip"] = WiFi.localIP().toString();
-    doc["free_ram"] = ESP.getFreeHeap() / 1024;
-    doc["uptime"] = millis() / 1000;
+  // The page, favicon and Chart.js, gzipped into flash at build time
+  // (scripts/embed_web.py). The page is asked for each time and answered 304
+  // while it is the same; what it links to carries its hash in ?v=, so a
+  // browser keeps that for good and a new firmware's page asks for new ones
+  for (const WebAsset &asset : WEB_ASSETS) {
+    HttpServer::Handler serve = [&asset](const HttpServer::Request &req, HttpServer::Response &res) {
+      bool pinned = req.arg("v") == asset.hash;
+      res.addHeader("Cache-Control", pinned ? "public, max-age=31536000, immutable" : "no-cache");
+      if (res.notModified(req, asset.etag))
+        return;
+      res.addHeader("Content-Encoding", "gzip");
+      res.sendStatic(200, asset.contentType, asset.data, asset.length);
+    };
+    server.on(asset.path, HttpServer::Method::Get, serve);
+    if (strcmp(asset.path, "/index.html") == 0)
+      server.on("/", HttpServer::Method::Get, serve);
+  }
 
-    String response;
-    serializeJson(doc, response);
-    server.send(200, "application/json", response);
+  // API endpoint for getting data
+  server.on("/data", HttpServer::Method::Get, [this](const HttpServer::Request &req, HttpServer::Response &res) {
+    res.addHeader("Access-Control-Allow-Origin", "*");
+    sendCached(req, res, dataCache, "data", dataVersion, [this]() { return dataJson(); });
   });
 
-  // History endpoints
-  server.on("/history/minute", HTTP_GET, [this]() {
-    server.send(200, "application/json", powerHistory.getMinuteDataJson());
+  // The same data pushed: a "data" event with all of it, then a "patch" with
+  // the fields that changed whenever some did, and a "heartbeat"
+  server.on("/events", HttpServer::Method::Get, [this](const HttpServer::Request &, HttpServer::Response &res) {
+    res.addHeader("Access-Control-Allow-Origin", "*");
+    res.startEvents("data", cachedBody(dataCache, "data", dataVersion, [this]() { return dataJson(); }));
   });
 
-  server.on("/history/hour", HTTP_GET, [this]() {
-    server.send(200, "application/json", powerHistory.getHourDataJson());
+  // History endpoints, serialized again only when their tier got a point
+  server.on("/history/minute", HttpServer::Method::Get, [this](const HttpServer::Request &req, HttpServer::Response &res) {
+    sendCached(req, res, historyCache[(int)PowerHistory::Tier::Minute], "minute",
+               powerHistory.getVersion(PowerHistory::Tier::Minute), []() { return powerHistory.getMinuteDataJson(); });
   });
 
-  server.on("/history/day", HTTP_GET, [this]() {
-    server.send(200, "application/json", powerHistory.getDayDataJson());
+  server.on("/history/hour", HttpServer::Method::Get, [this](const HttpServer::Request &req, HttpServer::Response &res) {
+    sendCached(req, res, historyCache[(int)PowerHistory::Tier::Hour], "hour",
+               powerHistory.getVersion(PowerHistory::Tier::Hour), []() { return powerHistory.getHourDataJson(); });
   });
 
-  server.on("/history/month", HTTP_GET, [this]() {
-    server.send(200, "application/json", powerHistory.getMonthDataJson());
+  server.on("/history/day", HttpServer::Method::Get, [this](const HttpServer::Request &req, HttpServer::Response &res) {
+    sendCached(req, res, historyCache[(int)PowerHistory::Tier::Day], "day",
+               powerHistory.getVersion(PowerHistory::Tier::Day), []() { return powerHistory.getDayDataJson(); });
   });
 
+  server.on("/history/month", HttpServer::Method::Get, [this](const HttpServer::Request &req, HttpServer::Response &res) {
+    sendCached(req, res, historyCache[(int)PowerHistory::Tier::Month], "month",
+               powerHistory.getVersion(PowerHistory::Tier::Month), []() { return powerHistory.getMonthDataJson(); });
+  });
+
+  // Only the points the page does not have yet, of one tier or all of them
+  server.on("/history", HttpServer::Method::Get,
+            [this](const HttpServer::Request &req, HttpServer::Response &res) { handleHistory(req, res); });
+
+#if RULES_PROFILE
+  // Rule profiler counters, ?reset=1 clears them after this response
+  server.on("/rules/stats", HttpServer::Method::Get,
+            [this](const HttpServer::Request &req, HttpServer::Response &res) { handleRuleStats(req, res); });
+#endif
+
+  // Replace the rule set: body is a complete rules.json, stored only when it loads
+  server.on("/rules", HttpServer::Method::Post,
+            [this](const HttpServer::Request &req, HttpServer::Response &res) { handleRulesUpload(req, res); });
+
   // API endpoints for controlling switches
   for (int i = 0; i < NUM_SOCKETS; i++) {
-    server.on("/switch/" + String(i + 1), HTTP_POST, [this, i]() { handleSwitch(i); });
+    String path = "/switch/" + String(i + 1);
+    server.on(path.c_str(), HttpServer::Method::Post,
+              [this, i](const HttpServer::Request &req, HttpServer::Response &res) { handleSwitch(i, req, res); });
+    // What became of a command: ?id= from the POST answer, the latest without
+    server.on(path.c_str(), HttpServer::Method::Get,
+              [this, i](const HttpServer::Request &req, HttpServer::Response &res) { handleSwitchStatus(i, req, res); });
+  }
+
+  if (server.begin(PORT))
+    Serial.println("Web server started");
+}
+
+#if RULES_PROFILE
+void WebInterface::handleRuleStats(const HttpServer::Request &req, HttpServer::Response &res) {
+  res.addHeader("Access-Control-Allow-Origin", "*");
+
+  size_t ruleCount = ruleSystem.getRuleCount();
+  DynamicJsonDocument doc(1024 + ruleCount * 384);
+
+  unsigned long passes = ruleSystem.getPassesTimed();
+  JsonObject pass = doc.createNestedObject("pass");
+  pass["count"] = passes;
+  pass["avg_us"] = passes ? ruleSystem.getPassTotalMicros() / passes : 0;
+  pass["max_us"] = ruleSystem.getPassMaxMicros();
+  unsigned long samples[SmartRuleSystem::PASS_SAMPLES];
+  int sampleCount = ruleSystem.getPassMicros(samples);
+  JsonArray recent = pass.createNestedArray("recent_us"); // Oldest first
+  for (int i = 0; i < sampleCount; i++)
+    recent.add(samples[i]);
+
+  doc["evaluated"] = ruleSystem.getRulesEvaluated();
+  doc["cached"] = ruleSystem.getRulesSkipped();
+  doc["short_circuited"] = ruleSystem.getRulesShortCircuited();
+
+  JsonArray rules = doc.createNestedArray("rules");
+  for (size_t i = 0; i < ruleCount; i++) {
+    const SmartRuleSystem::RuleStats &stats = ruleSystem.getRuleStats(i);
+    JsonObject rule = rules.createNestedObject();
+    rule["name"] = ruleSystem.getRuleName(i);
+    rule["socket"] = ruleSystem.getRuleSocket(i);
+    rule["evaluations"] = stats.evaluations;
+    rule["on"] = stats.decisionsOn;
+    rule["off"] = stats.decisionsOff;
+    rule["skip"] = stats.decisionsSkip;
+    rule["actuations"] = stats.actuations;
+    rule["total_us"] = stats.totalMicros;
+    rule["max_us"] = stats.maxMicros;
+    rule["avg_us"] = stats.evaluations ? (float)stats.totalMicros / stats.evaluations : 0.0f;
+  }
+
+  String response;
+  serializeJson(doc, response);
+  res.send(200, "application/json", response);
+
+  if (req.arg("reset") == "1")
+    ruleSystem.resetStats();
+}
+#endif
+
+// One /history answer, as asked; versions are the tiers' when it was
+struct HistoryQuery
+{
+  bool binary;
+  uint32_t boot;
+  int tierCount;
+  PowerHistory::Tier tiers[4];
+  uint32_t cursors[4];
+  uint32_t versions[4];
+};
+
+static void writeHistory(const HistoryQuery &query, const PowerHistory::Sink &out) {
+  if (query.binary) {
+    const uint8_t head[] = {'P', 'H', 1, (uint8_t)query.tierCount, (uint8_t)query.boot, (uint8_t)(query.boot >> 8),
+                            (uint8_t)(query.boot >> 16), (uint8_t)(query.boot >> 24)};
+    out(head, sizeof(head));
+  } else {
+    char head[24];
+    out((const uint8_t *)head, snprintf(head, sizeof(head), "{\"boot\":\"%lx\"", (unsigned long)query.boot));
+  }
+  for (int i = 0; i < query.tierCount; i++) {
+    if (query.binary) {
+      powerHistory.writeBinary(query.tiers[i], query.cursors[i], out);
+    } else {
+      out((const uint8_t *)",", 1);
+      powerHistory.writeJson(query.tiers[i], query.cursors[i], out);
+    }
+  }
+  if (!query.binary)
+    out((const uint8_t *)"}", 1);
+}
+
+// /history?tier=hour&since=<next>: the hour points added after the cursor
+// the last answer gave as "next"; tier=all&since=a,b,c,d answers all four
+// at once. The cursors count from boot: with boot= other than this one's,
+// or without it, every tier comes whole. format=bin packs it: "PH", 1, the
+// tier count (u8) and the boot id (u32), then what
+// PowerHistory::writeBinary() writes per tier; JSON otherwise
+void WebInterface::handleHistory(const HttpServer::Request &req, HttpServer::Response &res) {
+  HistoryQuery query = {};
+  String tier = req.arg("tier");
+  for (int t = 0; t < 4; t++) {
+    if (tier == "all" || tier == PowerHistory::tierName((PowerHistory::Tier)t)) {
+      query.tiers[query.tierCount] = (PowerHistory::Tier)t;
+      query.versions[query.tierCount++] = powerHistory.getVersion((PowerHistory::Tier)t);
+    }
+  }
+  if (query.tierCount == 0) {
+    res.send(400, "text/plain", "tier: minute, hour, day, month or all");
+    return;
+  }
+
+  bool sameBoot = req.hasArg("boot") && strtoul(req.arg("boot").c_str(), nullptr, 16) == bootId;
+  String sinceArg = req.arg("since");
+  const char *since = sinceArg.c_str();
+  for (int i = 0; i < query.tierCount; i++) {
+    char *end;
+    unsigned long cursor = strtoul(since, &end, 10);
+    query.cursors[i] = sameBoot && end != since ? cursor : UINT32_MAX; // Never answerable: everything
+    since = *end == ',' ? end + 1 : end;
+  }
+
+  query.binary = req.arg("format") == "bin";
+  query.boot = bootId;
+
+  // Streamed from the ring buffers, nothing rendered ahead: one walk counts
+  // the bytes, then each chunk the server sends walks the answer again and
+  // keeps its part (every tier whole is ~2.3 KB of JSON, ~0.6 KB packed, so
+  // three walks at most). A point added meanwhile would change the bytes
+  // under the Content-Length: the answer is cut short then, and the page
+  // asks with the same cursors a minute later
+  size_t length = 0;
+  writeHistory(query, [&length](const uint8_t *, size_t n) { length += n; });
+  res.addHeader("Access-Control-Allow-Origin", "*");
+  res.sendStream(200, query.binary ? "application/octet-stream" : "application/json", length,
+                 [query](uint8_t *buffer, size_t max, size_t offset) -> size_t {
+                   for (int i = 0; i < query.tierCount; i++) {
+                     if (powerHistory.getVersion(query.tiers[i]) != query.versions[i])
+                       return 0;
+                   }
+                   size_t at = 0, filled = 0;
+                   writeHistory(query, [&](const uint8_t *piece, size_t n) {
+                     if (at + n > offset && at < offset + max) {
+                       size_t from = at < offset ? offset - at : 0;
+                       size_t take = min(n - from, offset + max - (at + from));
+                       memcpy(buffer + (at + from - offset), piece + from, take);
+                       filled += take;
+                     }
+                     at += n;
+                   });
+                   return filled;
+                 });
+}
+
+void WebInterface::handleRulesUpload(const HttpServer::Request &req, HttpServer::Response &res) {
+  if (req.body().length() == 0) {
+    res.send(400, "text/plain", "Body not received");
+    return;
+  }
+
+  // Parse from SPIFFS like at boot; /rules.json is only replaced once the
+  // new set is running
+  File file = SPIFFS.open("/rules.json.new", "w");
+  if (!file) {
+    res.send(500, "text/plain", "Cannot write SPIFFS");
+    return;
+  }
+  file.print(req.body());
+  file.close();
+
+  RuleLoadReport report;
+  bool ok = loadRulesFile("/rules.json.new", report);
+  if (ok) {
+    SPIFFS.remove("/rules.json");
+    SPIFFS.rename("/rules.json.new", "/rules.json");
+  } else {
+    SPIFFS.remove("/rules.json.new");
   }
 
-  server.begin();
-  Serial.println("Web server started");
+  StaticJsonDocument<256> doc;
+  doc["success"] = ok;
+  if (ok) {
+    doc["rules"] = report.ruleCount;
+    doc["load_us"] = report.loadMicros;
+    doc["ruleset_bytes"] = report.rulesetBytes;
+    doc["heap_used"] = report.heapUsed;
+  } else {
+    doc["error"] = report.error;
+  }
+  String response;
+  serializeJson(doc, response);
+  res.send(ok ? 200 : 400, "application/json", response);
 }
 
 void WebInterface::update() {
   unsigned long now = millis();
-  server.handleClient();
+  server.poll();
+
+  // The cache, /data's version and the streams follow the sources only when
+  // something the page shows changed
+  if (now - lastLook >= CHANGE_INTERVAL) {
+    lastLook = now;
+    refresh(now);
+    pushChanges(now);
+  }
+}
 
-  // Periodic Cache Update
-  static unsigned long lastCacheUpdate = 0;
-  if (now - lastCacheUpdate >= 1000) {
-    updateCache();
-    lastCacheUpdate = now;
+bool WebInterface::Shown::operator==(const Shown &other) const {
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    if (socketStates[i] != other.socketStates[i] || socketOnline[i] != other.socketOnline[i] ||
+        socketCommands[i] != other.socketCommands[i])
+      return false;
   }
+  return importPower == other.importPower && exportPower == other.exportPower &&
+         dailyImport == other.dailyImport && dailyExport == other.dailyExport &&
+         temperature == other.temperature && humidity == other.humidity && light == other.light &&
+         phonePresent == other.phonePresent && lastRule == other.lastRule &&
+         strcmp(lastRuleTime, other.lastRuleTime) == 0 && ruleHistoryIndex == other.ruleHistoryIndex;
 }
-void WebInterface::handleSwitch(int switchNumber) {
-  if (!server.hasArg("plain")) {
-    server.send(400, "text/plain", "Body not received");
+
+// Straight from the sources, so nothing is copied or serialized when nothing changed
+WebInterface::Shown WebInterface::measure() {
+  Shown current;
+  if (p1Meter) {
+    P1Sample sample = p1Meter->getSample();
+    current.importPower = lround(sample.importPower);
+    current.exportPower = lround(sample.exportPower);
+  }
+  float dailyImport, dailyExport;
+  if (dailyTotals(dailyImport, dailyExport)) {
+    current.dailyImport = lround(dailyImport * 10);
+    current.dailyExport = lround(dailyExport * 10);
+  }
+  current.temperature = lround(sensors.getTemperature() * 10);
+  current.humidity = lround(sensors.getHumidity());
+  current.light = lround(sensors.getLightLevel());
+  current.phonePresent = phoneCheck && phoneCheck->isDevicePresent();
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    current.socketStates[i] = sockets[i] ? sockets[i]->getCurrentState() : false;
+    current.socketOnline[i] = sockets[i] ? sockets[i]->isConnected() : false;
+    current.socketCommands[i] = sockets[i] ? (uint8_t)sockets[i]->getLatestCommand().status : 0;
+  }
+  current.lastRule = lastActiveRuleName;
+  strncpy(current.lastRuleTime, lastActiveRuleTimeStr, sizeof(current.lastRuleTime) - 1);
+  current.ruleHistoryIndex = ruleHistoryIndex;
+  return current;
+}
+
+// New /data version when the page would show something else, or the slow
+// details are DATA_REFRESH old
+void WebInterface::refresh(unsigned long now, bool force) {
+  Shown current = measure();
+  if (!force && current == shown && now - lastDataChange < DATA_REFRESH)
+    return;
+  updateCache();
+  shown = current;
+  lastDataChange = now;
+  dataVersion++;
+}
+
+void WebInterface::pushChanges(unsigned long now) {
+  if (server.getEventClientCount() == 0)
+    return;
+
+  if (now - lastSnapshot >= SNAPSHOT_INTERVAL) {
+    lastSnapshot = now;
+    server.sendEvent("data", cachedBody(dataCache, "data", dataVersion, [this]() { return dataJson(); }));
+    pushed = shown;
+    return;
+  }
+
+  const Shown &current = shown;
+  JsonDocument &patch = patchDoc;
+  patch.clear();
+  if (current.importPower != pushed.importPower || current.exportPower != pushed.exportPower) {
+    patch["import_power"] = cached.import_power;
+    patch["export_power"] = cached.export_power;
+  }
+  if (current.dailyImport != pushed.dailyImport || current.dailyExport != pushed.dailyExport) {
+    float dailyImport, dailyExport;
+    if (dailyTotals(dailyImport, dailyExport)) {
+      patch["daily_import"] = dailyImport;
+      patch["daily_export"] = dailyExport;
+    }
+  }
+  if (current.temperature != pushed.temperature)
+    patch["temperature"] = cached.temperature;
+  if (current.humidity != pushed.humidity)
+    patch["humidity"] = cached.humidity;
+  if (current.light != pushed.light)
+    patch["light"] = cached.light;
+  if (current.phonePresent != pushed.phonePresent)
+    patch["phone_present"] = current.phonePresent;
+
+  // Switches by index, with only the fields that changed
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    if (current.socketStates[i] == pushed.socketStates[i] && current.socketOnline[i] == pushed.socketOnline[i] &&
+        current.socketCommands[i] == pushed.socketCommands[i])
+      continue;
+    JsonObject switches = patch["switches"];
+    if (switches.isNull())
+      switches = patch.createNestedObject("switches");
+    JsonObject sw = switches.createNestedObject(String(i));
+    sw["state"] = current.socketStates[i];
+    sw["online"] = current.socketOnline[i];
+    sw["duration"] = cached.socket_durations[i] / 1000;
+    if (sockets[i])
+      sw["command"] = HomeSocketDevice::statusName(sockets[i]->getLatestCommand().status);
+  }
+
+  if (current.lastRule != pushed.lastRule || strcmp(current.lastRuleTime, pushed.lastRuleTime) != 0 ||
+      current.ruleHistoryIndex != pushed.ruleHistoryIndex)
+    addRuleHistory(patch);
+
+  if (patch.size() > 0) {
+    String json;
+    serializeJson(patch, json);
+    server.sendEvent("patch", json);
+    pushed = shown;
+  }
+
+  if (now - lastHeartbeat >= HEARTBEAT_INTERVAL) {
+    lastHeartbeat = now;
+    char heartbeat[64];
+    snprintf(heartbeat, sizeof(heartbeat), "{\"uptime\":%lu,\"free_ram\":%lu}", millis() / 1000,
+             (unsigned long)(ESP.getFreeHeap() / 1024));
+    server.sendEvent("heartbeat", heartbeat);
+  }
+}
+
+void WebInterface::handleSwitch(int switchNumber, const HttpServer::Request &req, HttpServer::Response &res) {
+  if (req.body().length() == 0) {
+    res.send(400, "text/plain", "Body not received");
     return;
   }
 
   StaticJsonDocument<128> doc;
-  deserializeJson(doc, server.arg("plain"));
+  deserializeJson(doc, req.body());
   bool state = doc["state"];
 
+  uint32_t id = 0;
   if (sockets[switchNumber] != nullptr) {
-    sockets[switchNumber]->setState(state);
+    // Queued, the socket is switched after this answer
+    id = sockets[switchNumber]->setState(state);
     lastStateChangeTime[switchNumber] = millis();
 
     // *** ADD THESE 3 LINES: ***
     cached.socket_states[switchNumber] = state; // Update cache immediately
     cached.socket_durations[switchNumber] = 0;  // Reset duration
 
-    // Force cache update to refresh all other sockets too
-    updateCache(); // Get fresh states for everything
+    // Fresh states for everything, and a new /data version for the duration
+    refresh(millis(), true);
   }
 
-  server.send(200, "application/json", "{\"success\":true}");
+  char response[96];
+  snprintf(response, sizeof(response), "{\"success\":%s,\"command\":%lu,\"status\":\"%s\"}",
+           id ? "true" : "false", (unsigned long)id,
+           id ? HomeSocketDevice::statusName(sockets[switchNumber]->getCommand(id).status) : "failed");
+  res.send(200, "application/json", response);
+}
+
+void WebInterface::handleSwitchStatus(int switchNumber, const HttpServer::Request &req, HttpServer::Response &res) {
+  res.addHeader("Access-Control-Allow-Origin", "*");
+  if (sockets[switchNumber] == nullptr) {
+    res.send(404, "application/json", "{\"error\":\"no socket\"}");
+    return;
+  }
+  HomeSocketDevice *socket = sockets[switchNumber];
+  HomeSocketDevice::Command command =
+      req.hasArg("id") ? socket->getCommand(strtoul(req.arg("id").c_str(), nullptr, 10)) : socket->getLatestCommand();
+
+  char response[128];
+  snprintf(response, sizeof(response), "{\"command\":%lu,\"status\":\"%s\",\"state\":%s,\"current\":%s}",
+           (unsigned long)command.id, HomeSocketDevice::statusName(command.status), command.state ? "true" : "false",
+           socket->getCurrentState() ? "true" : "false");
+  res.send(200, "application/json", response);
 }
 /*
 void WebInterface::handleSwitch(int switchNumber) {
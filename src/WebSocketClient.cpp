@@ -0,0 +1,287 @@
+#define DEBUG_WEB_SOCKET 0
+
+#include "WebSocketClient.h"
+#include <errno.h>
+
+#if defined(ESP32)
+#include <lwip/sockets.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // lwIP never raises SIGPIPE
+#endif
+
+enum : uint8_t {
+  OP_CONTINUATION = 0x0,
+  OP_TEXT = 0x1,
+  OP_BINARY = 0x2,
+  OP_CLOSE = 0x8,
+  OP_PING = 0x9,
+  OP_PONG = 0xA
+};
+
+// Splits "ws://a.b.c.d[:port]/path" into address, port and path
+static bool parseWsUrl(const char *url, sockaddr_in &addr, const char *&path, char *host, size_t hostSize) {
+  if (strncmp(url, "ws://", 5) != 0)
+    return false;
+  const char *start = url + 5;
+  path = strchr(start, '/');
+  size_t hostLength = path ? path - start : strlen(start);
+  if (!path)
+    path = "/";
+  if (hostLength == 0 || hostLength >= hostSize)
+    return false;
+  memcpy(host, start, hostLength);
+  host[hostLength] = '\0';
+
+  char address[24];
+  strncpy(address, host, sizeof(address) - 1);
+  address[sizeof(address) - 1] = '\0';
+  int port = 80;
+  char *colon = strchr(address, ':');
+  if (colon) {
+    *colon = '\0';
+    port = atoi(colon + 1);
+    if (port <= 0 || port > 65535)
+      return false;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  return inet_pton(AF_INET, address, &addr.sin_addr) == 1;
+}
+
+// Sec-WebSocket-Key: 16 bytes, base64. Only has to differ per connection,
+// we don't check the Accept hash the server derives from it.
+static void makeKey(char *out) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  uint32_t seed = micros() * 2654435761u;
+  for (int i = 0; i < 21; i++) {
+    seed = seed * 1103515245u + 12345u;
+    out[i] = alphabet[(seed >> 16) & 63];
+  }
+  out[21] = 'A'; // Last 6 bits of 16 bytes are padding
+  out[22] = '=';
+  out[23] = '=';
+  out[24] = '\0';
+}
+
+bool WebSocketClient::connect(const String &url) {
+  close();
+
+  sockaddr_in addr;
+  const char *path;
+  char host[24];
+  if (!parseWsUrl(url.c_str(), addr, path, host, sizeof(host)))
+    return false;
+
+  char key[25];
+  makeKey(key);
+  int length = snprintf(request, sizeof(request),
+                        "GET %s HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                        "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n",
+                        path, host, key);
+  if (length <= 0 || length >= (int)sizeof(request))
+    return false;
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return false;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  if (::connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+
+  requestLength = length;
+  sent = 0;
+  received = 0;
+  started = millis();
+  state = State::Connecting;
+  return true;
+}
+
+void WebSocketClient::close() {
+  if (fd >= 0) {
+    if (state == State::Open)
+      sendFrame(OP_CLOSE, nullptr, 0); // Best effort, we don't wait for the answer
+    ::close(fd);
+  }
+  fd = -1;
+  state = State::Closed;
+}
+
+bool WebSocketClient::sendText(const char *text) {
+  if (state != State::Open)
+    return false;
+  return sendFrame(OP_TEXT, (const uint8_t *)text, strlen(text));
+}
+
+// Client frames are always masked. Small frames go out in one send(); on a
+// healthy connection the socket buffer has room for them.
+bool WebSocketClient::sendFrame(uint8_t opcode, const uint8_t *payload, size_t length) {
+  uint8_t frame[8 + 256];
+  if (length > 256)
+    return false;
+  size_t header = 0;
+  frame[header++] = 0x80 | opcode; // FIN
+  if (length < 126) {
+    frame[header++] = 0x80 | length;
+  } else {
+    frame[header++] = 0x80 | 126;
+    frame[header++] = length >> 8;
+    frame[header++] = length & 0xFF;
+  }
+  uint32_t mask = micros() * 2654435761u;
+  uint8_t *maskKey = frame + header;
+  memcpy(maskKey, &mask, 4);
+  header += 4;
+  for (size_t i = 0; i < length; i++)
+    frame[header + i] = payload[i] ^ maskKey[i & 3];
+
+  ssize_t n = send(fd, frame, header + length, MSG_DONTWAIT | MSG_NOSIGNAL);
+  return n == (ssize_t)(header + length);
+}
+
+void WebSocketClient::poll() {
+  if (state == State::Closed)
+    return;
+
+  if (state != State::Open && millis() - started >= CONNECT_TIMEOUT) {
+    if (DEBUG_WEB_SOCKET)
+      Serial.printf("WS > No upgrade within %lu ms\n", CONNECT_TIMEOUT);
+    close();
+    return;
+  }
+
+  if (state == State::Connecting) {
+    // Writable means the handshake finished, SO_ERROR tells how
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(fd, &writable);
+    timeval noWait = {0, 0};
+    if (select(fd + 1, nullptr, &writable, nullptr, &noWait) <= 0)
+      return;
+    int error = 0;
+    socklen_t length = sizeof(error);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+    if (error != 0) {
+      close();
+      return;
+    }
+    ssize_t n = send(fd, request + sent, requestLength - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        close();
+      return;
+    }
+    sent += n;
+    if (sent < requestLength)
+      return;
+    state = State::Upgrading;
+  }
+
+  // Drain whatever arrived
+  while (state == State::Upgrading || state == State::Open) {
+    if (received >= BUFFER_SIZE) {
+      if (DEBUG_WEB_SOCKET)
+        Serial.println("WS > Message larger than the buffer");
+      close();
+      return;
+    }
+    ssize_t n = recv(fd, buffer + received, BUFFER_SIZE - received, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+    if (n <= 0) {
+      close(); // Closed or reset by the device
+      return;
+    }
+    received += n;
+    bool ok = state == State::Upgrading ? readUpgrade() : readFrames();
+    if (!ok) {
+      close();
+      return;
+    }
+  }
+}
+
+// Waits for the whole 101 answer; frames right behind it stay in the buffer
+bool WebSocketClient::readUpgrade() {
+  buffer[received] = '\0';
+  const char *answer = (const char *)buffer;
+  const char *headerEnd = strstr(answer, "\r\n\r\n");
+  if (!headerEnd)
+    return true;
+  if (strncmp(answer, "HTTP/1.1 101", 12) != 0) {
+    if (DEBUG_WEB_SOCKET)
+      Serial.printf("WS > Upgrade refused: %.*s\n", (int)(strchr(answer, '\r') - answer), answer);
+    return false;
+  }
+  size_t used = headerEnd + 4 - answer;
+  memmove(buffer, buffer + used, received - used);
+  received -= used;
+  state = State::Open;
+  return readFrames();
+}
+
+// Handles every complete frame in the buffer and keeps a partial one
+bool WebSocketClient::readFrames() {
+  while (received >= 2) {
+    uint8_t opcode = buffer[0] & 0x0F;
+    bool fin = buffer[0] & 0x80;
+    bool masked = buffer[1] & 0x80;
+    size_t length = buffer[1] & 0x7F;
+    size_t header = 2;
+    if (length == 126) {
+      if (received < 4)
+        return true;
+      length = (buffer[2] << 8) | buffer[3];
+      header = 4;
+    } else if (length == 127) {
+      return false; // Never fits the buffer
+    }
+    if (masked)
+      header += 4;
+    if (header + length > BUFFER_SIZE)
+      return false;
+    if (received < header + length)
+      return true;
+
+    uint8_t *payload = buffer + header;
+    if (masked)
+      for (size_t i = 0; i < length; i++)
+        payload[i] ^= buffer[header - 4 + (i & 3)];
+
+    if (!fin || opcode == OP_CONTINUATION)
+      return false; // Fragmented messages are not expected from the devices
+    if (opcode == OP_CLOSE)
+      return false;
+    if (opcode == OP_PING) {
+      sendFrame(OP_PONG, payload, length);
+    } else if (opcode == OP_TEXT) {
+      uint8_t after = payload[length];
+      payload[length] = '\0'; // Terminated for the callback, restored below
+      messages++;
+      if (messageCallback)
+        messageCallback((const char *)payload, length);
+      if (state != State::Open)
+        return true; // Closed from the callback
+      payload[length] = after;
+    }
+    // Binary frames and pongs are skipped
+
+    size_t used = header + length;
+    memmove(buffer, buffer + used, received - used);
+    received -= used;
+  }
+  return true;
+}
@@ -1,5 +1,6 @@
 #include "main.h"
 #include "PowerHistory.h"
+#include "RuleLoader.h"
 
 // Global variable definitions
 TimingControl timing;
@@ -55,6 +56,8 @@ bool loadConfiguration() {
   config.wifi_ssid = doc["wifi_ssid"].as<String>();
   config.wifi_password = doc["wifi_password"].as<String>();
   config.p1_ip = doc["p1_ip"].as<String>();
+  config.p1_stream = doc["p1_stream"] | "";
+  config.p1_token = doc["p1_token"] | "";
 
   for (int i = 0; i < NUM_SOCKETS; i++) {
     String key = "socket_" + String(i + 1);
@@ -70,11 +73,29 @@ bool loadConfiguration() {
   config.min_on_time = doc["min_on_time"] | 300UL;
   config.min_off_time = doc["min_off_time"] | 300UL;
   config.max_on_time = doc["max_on_time"] | 1800UL;
-  config.phone_ip = doc["phone_ip"].as<String>();
+  // Phones: the "phone_ips" list, or the single "phone_ip" of older configs
+  int phones = 0;
+  for (JsonVariant ip : doc["phone_ips"].as<JsonArray>()) {
+    if (phones < NetworkCheck::MAX_DEVICES) {
+      config.phone_ips[phones++] = ip.as<String>();
+    }
+  }
+  if (phones == 0) {
+    config.phone_ips[0] = doc["phone_ip"] | "";
+  }
 
   return true;
 }
 
+// /rules.json replaces setupRules() when it is on SPIFFS and loads
+void buildRules() {
+  RuleLoadReport report;
+  if (SPIFFS.exists("/rules.json") && loadRulesFile("/rules.json", report))
+    return;
+  ruleSystem.clearRules();
+  setupRules();
+}
+
 void connectWiFi() {
   Serial.println("Connecting to WiFi...");
   WiFi.begin(config.wifi_ssid.c_str(), config.wifi_password.c_str());
@@ -155,85 +176,6 @@ void updateDisplay() {
   );
 }
 
-void setupRules() {
-  auto &rs = ruleSystem;
-
-  static char morningEndTime[6];
-  static char eveningEndTime[6];
-  static char weekendEndTime[6];
-  static char nightOffTime[6];
-
-  snprintf(morningEndTime, 6, "%s", rs.addMinutesToTime("07:45", rs.getDailyRandom60(0) % 36));
-  snprintf(eveningEndTime, 6, "%s", rs.addMinutesToTime("23:00", rs.getDailyRandom(0) % 24));
-  snprintf(weekendEndTime, 6, "%s", rs.addMinutesToTime("23:00", rs.getDailyRandom60(1) % 54));
-  snprintf(nightOffTime, 6, "%s", rs.addMinutesToTime("23:55", rs.getDailyRandom(1) % 5));
-
-  // Morning rule (weekdays) - varies end time by 0-35 minutes after 07:45
-  rs.addRule(1, "Good morning",
-             rs.period("07:10", "07:44", // Ends at 07:44 to ensure off by 07:45
-                       rs.allOf({rs.lightBelow(5), rs.isWorkday()})));
-
-  // Morning OFF rule - EXACTLY at 07:45 as departure reminder
-  rs.addRule(1, "Leave for car",
-             rs.offAfter("07:45", 2,       // 2 minute window to ensure it turns off
-                         rs.isWorkday())); // Only on workdays
-
-  // Evening rule (weekdays)
-  rs.addRule(1, "Evening",
-             rs.period("17:15", eveningEndTime, // Changed to period()
-                       rs.allOf({rs.lightBelow(5), rs.isWorkday()})));
-
-  rs.addRule(1, "Good night",
-             rs.offAfter(eveningEndTime, 2, // 2 minute window to ensure it turns off
-                         rs.isWorkday()));  // Only on workdays
-
-  // Weekend rule with phone presence
-  rs.addRule(1, "Weekend",
-             rs.period("19:00", weekendEndTime, // Changed to period()
-                       rs.allOf({rs.lightBelow(5), rs.phoneNotPresent(), rs.isWeekend()})));
-
-  // Add explicit weekend off rule
-  rs.addRule(1, "Weekend night",
-             rs.offAfter(weekendEndTime, 2, // Turns OFF at calculated end time
-                         rs.isWeekend()));
-
-  // Late night off rule
-  rs.addRule(1, "Night off",
-             rs.offAfter(nightOffTime, 5));
-  // Smart solar heater rule that maintains different ON/OFF thresholds
-  // this one is quite complex and uses the P1Meter object
-  rs.addRule(3, "Solar Heater",
-             [&]() { // Replace the entire rule evaluation with a new lambda
-               // First check time window - exit early if outside window
-               if (!timeSync.isTimeBetween("07:00", "19:00")) {
-                 return RuleDecision::Off; // Exit immediately outside time window
-               }
-
-               // Check rate limiting
-               unsigned long now = millis();
-               if (now - lastHeaterCheck < HEATER_CHECK_INTERVAL) {
-                 return RuleDecision::Skip; // Exit if too soon
-               }
-               lastHeaterCheck = now;
-
-               // Only do heater control if we passed time window and rate limit
-               return rs.solarHeaterControl(
-                   1020,  // Export threshold
-                   5,     // Import threshold
-                   60000, // Minimum ON time
-                   30000, // Minimum OFF time
-                   []() { // Phone presence check
-                     return phoneCheck && !phoneCheck->isDevicePresent();
-                   })();
-             });
-
-  rs.addRule(4, "TV ambient on",
-             rs.onCondition(rs.allOf({rs.phonePresent(), rs.after("18:00"), rs.lightAbove(11)})));
-
-  rs.addRule(4, "TV ambient off",
-             rs.offConditionDelayed(rs.lightBelow(5), 120));
-}
-
 void setup() {
   // Initialize WiFi and disable persistent settings
   WiFi.persistent(false);
@@ -337,6 +279,7 @@ void setup() {
         config.socket_ip[i] != "null") {
       Serial.printf(">>> ABOUT TO CREATE SOCKET %d <<<\n", i + 1);
       sockets[i] = new HomeSocketDevice(config.socket_ip[i].c_str(), i + 1); // Pass socket number
+      pollScheduler.add(sockets[i], i + 1, i * 250); // The discovery read below moves it on
       socketsInitialized++;
       Serial.printf("Socket %d initialized at: %s\n", i + 1,
                     config.socket_ip[i].c_str());
@@ -349,6 +292,9 @@ void setup() {
   bool p1OK = false;
   if (config.p1_ip != "" && config.p1_ip != "0" && config.p1_ip != "null") {
     p1Meter = new HomeP1Device(config.p1_ip.c_str());
+    if (config.p1_stream != "") {
+      p1Meter->enableStream(config.p1_stream, config.p1_token);
+    }
     p1OK = true;
     Serial.println("P1 meter initialized at: " + config.p1_ip);
   } else {
@@ -373,35 +319,36 @@ void setup() {
   Serial.println("Waiting for network to stabilize...");
   delay(3000); // 3 seconds for WiFi/ARP to settle
 
-  // Now do an initial poll of all sockets with proper spacing
+  // Read all sockets at once, as many in parallel as the client allows;
+  // an offline one costs its timeout once instead of once per socket
   Serial.println("Discovering sockets...");
-  for (int i = 0; i < NUM_SOCKETS; i++) {
-    if (sockets[i]) {
-      Serial.printf("Polling socket %d...\n", i + 1);
-      sockets[i]->readStateInfo(); // Force immediate read
-      delay(3000);                 // 500ms between each socket to avoid overwhelming network
-      yield();
-    }
-  }
+  socketSweep.start(sockets, NUM_SOCKETS, AsyncHttpClient::MAX_REQUESTS, [](int number, bool ok, unsigned long elapsedMs) {
+    Serial.printf("Socket %d %s (%lu ms)\n", number, ok ? "found" : "not answering", elapsedMs);
+  });
+  socketSweep.runUntilDone(5000);
+  Serial.printf("Discovery took %lu ms, %d sockets online\n", socketSweep.getStats().lastSweepMs,
+                socketSweep.getStats().lastOnline);
   // Set up rules
-  setupRules();
+  buildRules();
   if (displayOK) {
     display.showStartupProgress("Rules Loaded", true);
     delay(200);
   }
 
-  for (int i = 0; i < NUM_SOCKETS; i++) {
-    // Stagger by 250ms - all 8 sockets checked within 2 seconds of boot
-    timing.lastSocketUpdates[i] = millis() - timing.SOCKET_INTERVAL + (i * 250);
-  }
-
   // Initialize phone presence check (if configured)
   bool phoneOK = false;
-  if (config.phone_ip != "" && config.phone_ip != "0" &&
-      config.phone_ip != "null") {
-    phoneCheck = new NetworkCheck(config.phone_ip.c_str());
-    phoneOK = true;
-    Serial.println("Phone check initialized at: " + config.phone_ip);
+  for (int i = 0; i < NetworkCheck::MAX_DEVICES; i++) {
+    const String &ip = config.phone_ips[i];
+    if (ip == "" || ip == "0" || ip == "null") {
+      continue;
+    }
+    if (!phoneCheck) {
+      phoneCheck = new NetworkCheck();
+    }
+    if (phoneCheck->addDevice(ip.c_str())) {
+      phoneOK = true;
+      Serial.println("Phone check initialized at: " + ip);
+    }
   }
 
   if (displayOK) {
@@ -437,29 +384,41 @@ void reconnectWiFi() {
 static int yesterday;
 static uint16_t operationOrder = 0;
 static unsigned long lastRuleCheck = 0;
-static int currentSocketIndex = 0;
-static unsigned long lastWiFiFlush = 0;
+static unsigned long lastOperationStep = 0;
 
 void loop() {
   unsigned long currentMillis = millis();
 
-  if (millis() - lastWiFiFlush > 3600000) { // Every hour
-    Serial.println("Flushing WiFi to clear socket pool...");
-    WiFi.disconnect();
-    delay(1000);
-    WiFi.begin(config.wifi_ssid.c_str(), config.wifi_password.c_str());
-    while (WiFi.status() != WL_CONNECTED && millis() - lastWiFiFlush < 3610000) {
-      delay(500);
+  // Network requests advance on every pass, without waiting on them
+  httpClient.poll();
+  if (p1Meter) {
+    p1Meter->updateStream(); // Pushed measurements arrive between the steps
+  }
+  reachability.poll();  // Echo probes of sockets that stopped answering
+  pollScheduler.poll(); // Socket state reads that are due
+  if (phoneCheck) {
+    phoneCheck->poll(); // Presence probes out, replies in
+  }
+  socketSweep.poll();
+  for (int i = 0; i < NUM_SOCKETS; i++) {
+    if (sockets[i]) {
+      sockets[i]->dispatch(); // Switch commands waiting for their connection
     }
-    lastWiFiFlush = millis();
-    Serial.println("WiFi reconnected, sockets flushed");
   }
 
-  // Use static counter to sequence for ALL operations
+  // Use static counter to sequence for ALL operations, one step per 200ms
 
-  File file;
+  // Between steps the pass waits for web requests and answers them as they
+  // come in, at most 60 ms so the pollers above keep their pace; the wait
+  // also gives lower priority tasks the core
+  if (currentMillis - lastOperationStep < 200) {
+    webServer.update();
+    webServer.serveFor(min(200UL - (currentMillis - lastOperationStep), 60UL));
+    return;
+  }
+  lastOperationStep = currentMillis;
 
-  delay(200);
+  File file;
 
   switch (operationOrder) {
   case 0:
@@ -556,12 +515,10 @@ void loop() {
   case 30: // P1 meter (Network)
     if (p1Meter &&
         (currentMillis - timing.lastP1Update >= timing.P1_INTERVAL)) {
-      p1Meter->update();
-      Serial.printf("****** P1 meter update - Import: %.2f W, Export: %.2f W\n", p1Meter->getCurrentImport(), p1Meter->getCurrentExport()); // it reporst zero here as well ??
+      p1Meter->update(); // Only reads when no measurements are pushed
+      Serial.printf("****** P1 meter update (%s) - Import: %.2f W, Export: %.2f W\n", p1Meter->isStreaming() ? "stream" : "poll", p1Meter->getCurrentImport(), p1Meter->getCurrentExport()); // it reporst zero here as well ??
       timing.lastP1Update = currentMillis;
-      delay(20);
       yield();
-      delay(20);
     }
     operationOrder = 40;
     break;
@@ -587,27 +544,18 @@ void loop() {
     //   operationOrder = 70;
     //   break;
 
-  case 40: // Optimized Socket updates (Truly Non-blocking)
-    if (sockets[currentSocketIndex]) {
-      unsigned long now = millis();
-      // Check if THIS specific socket is due for a refresh
-      if (now - timing.lastSocketUpdates[currentSocketIndex] >= timing.SOCKET_INTERVAL) {
-        // Perform the network request for ONE socket only
-        sockets[currentSocketIndex]->readStateInfo();
-        timing.lastSocketUpdates[currentSocketIndex] = now;
-        yield();
-      }
-    }
-
-    // Increment index for the NEXT time the state machine hits case 40
-    currentSocketIndex++;
-    if (currentSocketIndex >= NUM_SOCKETS) {
-      currentSocketIndex = 0;
+  case 40: { // Socket updates: pollScheduler at the top of loop() reads them,
+             // all of them together after WiFi came back and every few minutes
+    static bool wifiWasDown = false;
+    bool wifiUp = WiFi.status() == WL_CONNECTED;
+    if (wifiUp && (wifiWasDown || currentMillis - timing.lastSocketUpdate >= timing.SOCKET_SWEEP_INTERVAL) &&
+        socketSweep.start(sockets, NUM_SOCKETS, SocketSweep::LOOP_WIDTH)) {
+      timing.lastSocketUpdate = currentMillis;
     }
-
-    // ALWAYS move to the next state (70) so the rest of the loop runs
+    wifiWasDown = !wifiUp;
     operationOrder = 70;
     break;
+  }
 
   case 70: // Max on time check (no I2C or network)
     // checkMaxOnTime();
@@ -621,7 +569,9 @@ void loop() {
     break;
 
   case 90:
-    if (phoneCheck && (currentMillis - timing.lastPhoneCheck >= timing.PHONE_CHECK_INTERVAL)) {
+    // Phone presence: phoneCheck->poll() at the top of loop() probes
+    // without waiting; here only the change is logged
+    if (phoneCheck) {
       static bool lastPhoneState = false;
       bool currentPhoneState = phoneCheck->isDevicePresent();
 
@@ -630,14 +580,8 @@ void loop() {
         Serial.println(currentPhoneState ? "Phone arrived" : "Phone left");
         lastPhoneState = currentPhoneState;
       }
-
-      timing.lastPhoneCheck = currentMillis;
-      operationOrder = 95;
-      yield();
-      delay(20);
-    } else {
-      operationOrder = 95;
     }
+    operationOrder = 95;
     break;
 
   case 95: // Power history updates
@@ -724,8 +668,7 @@ void loop() {
       }
 
       Serial.println("NEW DAY DETECTED - Updating rules with fresh random numbers");
-      ruleSystem.clearRules(); // Clear existing rules
-      setupRules();            // Setup rules with new daily randoms
+      buildRules(); // Rebuild with new daily randoms
     }
 
     // Only check for day change - remove the exact midnight check
@@ -772,8 +715,8 @@ void loop() {
     break;
   }
   webServer.update();
-  // add some time to let internal processes run.
-  delay(30);
+  // Idle time that lets internal processes run, spent answering web
+  // requests as they come in
+  webServer.serveFor(60);
   yield();
-  vTaskDelay(30);
 }